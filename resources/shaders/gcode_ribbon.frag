@@ -0,0 +1,18 @@
+#version 330 core
+in float rAcross;
+flat in vec3 rSide;
+flat in vec3 rFacing;
+flat in vec3 rColor;
+out vec4 FragColor;
+
+const vec3 kLightDir = normalize(vec3(0.5, 0.5, 1.0));
+
+void main() {
+    // Shade the flat quad as the round bead it stands for: the normal turns
+    // from the viewer towards the sides across the width.
+    float t = clamp(rAcross, -1.0, 1.0);
+    vec3 n = normalize(rSide * t + rFacing * sqrt(1.0 - t * t));
+    float diffuse = max(dot(n, kLightDir), 0.0);
+    float rim = 0.25 * max(dot(n, rFacing), 0.0);
+    FragColor = vec4(rColor * (0.35 + 0.5 * diffuse + rim), 1.0);
+}
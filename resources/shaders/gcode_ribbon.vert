@@ -0,0 +1,139 @@
+#version 330 core
+// One instance per toolpath segment; attributes advance once per instance (see GCodeArena::DrawRibbons).
+layout(location = 0) in vec3 aPosA;       // segment start, quantized inside its layer box
+layout(location = 1) in uvec2 aFeatureA;
+layout(location = 2) in vec3 aPosB;       // segment end
+layout(location = 3) in uvec2 aFeatureB;  // x: feature | run start bit, y: cross-section code
+layout(location = 4) in uvec4 aSettingsB; // the segment's speed, fan, temperature and tool codes
+out float rAcross;                        // -1..1 across the visible width of the bead
+flat out vec3 rSide;
+flat out vec3 rFacing;
+flat out vec3 rColor;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPos;                   // in G-code space, once per frame
+uniform samplerBuffer layerTable;         // per layer: (origin, first vertex), (step, height), (seconds); see GCodeArena
+uniform int layerCount;
+uniform int instanceBase;                 // page vertex of instance 0's start
+uniform vec3 featureColors[16];           // palette, indexed by GCodeFeature
+uniform int visibleFeatures;              // bit i set: feature i is drawn
+uniform float travelWidth;                // width of moves without extrusion, mm
+uniform int colorMode;                    // GCodeModel::ColorMode; 0 colours by feature
+uniform vec2 colorRange;                  // values at the two ends of the colour ramp
+uniform vec3 toolColors[4];               // ColorMode::Tool, indexed by extruder
+uniform float maxArea;                    // GCodePacking::kMaxArea
+uniform float maxSpeed;                   // GCodePacking::kMaxSpeed
+uniform float temperatureStep;            // GCodePacking::kTemperatureStep
+
+const uint kRunStart = 0x80u;
+const float kPi = 3.14159265;
+
+// Same search as gcode_shader.vert, keyed by the segment's end vertex.
+int FindLayer(float id) {
+    int lo = 0;
+    int hi = layerCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (texelFetch(layerTable, 3 * mid).w <= id)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Low to high: blue, cyan, green, yellow, red.
+vec3 Ramp(float value) {
+    const vec3 stops[5] = vec3[5](vec3(0.15, 0.25, 0.85), vec3(0.10, 0.70, 0.90), vec3(0.25, 0.80, 0.30),
+                                  vec3(0.95, 0.85, 0.25), vec3(0.90, 0.20, 0.15));
+    float t = 4.0 * clamp((value - colorRange.x) / max(colorRange.y - colorRange.x, 1e-6), 0.0, 1.0);
+    int i = min(int(t), 3);
+    return mix(stops[i], stops[i + 1], t - float(i));
+}
+
+// Colour of the segment ending at a vertex: its feature's, or a print setting
+// (x speed, y fan, z temperature, w tool; see GCodePackedVertex) on the ramp.
+// Moves without extrusion keep their feature colour.
+vec3 SegmentColor(uint feature, float area, uvec4 settings, float layerSeconds) {
+    if (colorMode == 0 || area <= 0.0)
+        return featureColors[feature];
+    float code = float(settings.x) / 255.0;
+    float speed = code * code * maxSpeed;
+    if (colorMode == 1)
+        return Ramp(speed);
+    if (colorMode == 2)
+        return Ramp(area * speed);
+    if (colorMode == 3)
+        return Ramp(float(settings.y) * (100.0 / 255.0));
+    if (colorMode == 4)
+        return Ramp(float(settings.z) * temperatureStep);
+    if (colorMode == 5)
+        return toolColors[min(settings.w, 3u)];
+    return Ramp(layerSeconds);
+}
+
+void main() {
+    uint feature = aFeatureB.x & 0x7Fu;
+    rAcross = 0.0;
+    rSide = vec3(0.0);
+    rFacing = vec3(0.0);
+    rColor = vec3(0.0);
+    // The end vertex starting a run means there is no segment here; neither is
+    // there one for a hidden feature. Either way, collapse outside the clip volume.
+    if ((aFeatureB.x & kRunStart) != 0u || ((visibleFeatures >> int(feature)) & 1) == 0) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    int layer = FindLayer(float(instanceBase + gl_InstanceID + 1));
+    vec4 box0 = texelFetch(layerTable, 3 * layer);
+    vec4 box1 = texelFetch(layerTable, 3 * layer + 1);
+    vec3 a = box0.xyz + aPosA * box1.xyz;
+    vec3 b = box0.xyz + aPosB * box1.xyz;
+
+    // Bead shape: a rectangle with semicircular sides (the Slic3r flow model),
+    // so area = (w - h) * h + pi * h^2 / 4. Travel moves have no area.
+    float code = float(aFeatureB.y) / 255.0;
+    float area = code * code * maxArea;
+    float h = box1.w;
+    float w;
+    vec3 up = vec3(0.0, 0.0, 1.0);
+    if (area > 0.0) {
+        w = max(area / h + h * (1.0 - kPi / 4.0), h);
+        // Toolpaths are at the nozzle tip, the top of the bead.
+        a -= up * (0.5 * h);
+        b -= up * (0.5 * h);
+    } else {
+        w = travelWidth;
+        h = travelWidth;
+    }
+
+    vec3 d = b - a;
+    float len = length(d);
+    vec3 dir = len > 1e-6 ? d / len : vec3(1.0, 0.0, 0.0);
+    vec3 toEye = cameraPos - 0.5 * (a + b);
+    vec3 side = cross(dir, toEye);
+    side = length(side) > 1e-6 ? normalize(side) : normalize(cross(dir, abs(dir.z) < 0.9 ? up : vec3(1.0, 0.0, 0.0)));
+    vec3 facing = normalize(cross(side, dir));
+    if (dot(facing, toEye) < 0.0)
+        facing = -facing;
+
+    // Half the extent of the elliptical cross-section seen along `side`.
+    vec3 across = abs(dir.z) < 0.9 ? normalize(cross(up, dir)) : vec3(1.0, 0.0, 0.0);
+    float halfExtent = 0.5 * length(vec2(w * dot(side, across), h * dot(side, up)));
+
+    // Corners 0..3 of the strip: start/end by gl_VertexID >> 1, side by its low bit.
+    // Ends are extended by half the width so consecutive segments join without gaps.
+    bool atEnd = (gl_VertexID & 2) != 0;
+    float s = (gl_VertexID & 1) != 0 ? 1.0 : -1.0;
+    vec3 p = atEnd ? b + dir * (0.5 * w) : a - dir * (0.5 * w);
+    p += side * (s * halfExtent);
+
+    rAcross = s;
+    rSide = side;
+    rFacing = facing;
+    rColor = SegmentColor(feature, area, aSettingsB, texelFetch(layerTable, 3 * layer + 2).x);
+    gl_Position = projection * view * model * vec4(p, 1.0);
+}
@@ -1,7 +1,11 @@
 #version 330 core
-in vec3 vColor;
+flat in vec3 vColor;
+flat in int vVisible;
 out vec4 FragColor;
 
 void main() {
+    // Hidden features are still drawn, so toggling them needs no re-upload.
+    if (vVisible == 0)
+        discard;
     FragColor = vec4(vColor, 1.0);
 }
@@ -1,13 +1,80 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aColor;
-out vec3 vColor;
+layout(location = 0) in vec3 aPos;        // quantized position inside the layer box
+layout(location = 1) in uvec2 aFeature;   // x: feature (palette index) | run start bit, y: cross-section
+layout(location = 2) in uvec4 aSettings;  // speed, fan, temperature, tool codes
+flat out vec3 vColor;
+flat out int vVisible;
+out vec3 vWorldPos;                       // for gcode_shader.geom
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform samplerBuffer layerTable;         // per layer: (origin, first vertex), (step, height), (seconds); see GCodeArena
+uniform int layerCount;
+uniform vec3 featureColors[16];          // palette, indexed by GCodeFeature
+uniform int visibleFeatures;              // bit i set: feature i is drawn
+uniform int colorMode;                    // GCodeModel::ColorMode; 0 colours by feature
+uniform vec2 colorRange;                  // values at the two ends of the colour ramp
+uniform vec3 toolColors[4];               // ColorMode::Tool, indexed by extruder
+uniform float maxArea;                    // GCodePacking::kMaxArea
+uniform float maxSpeed;                   // GCodePacking::kMaxSpeed
+uniform float temperatureStep;            // GCodePacking::kTemperatureStep
+
+// The arena page holds many layers back to back; find the one this vertex
+// belongs to (the last whose first vertex is <= gl_VertexID).
+int FindLayer(float id) {
+    int lo = 0;
+    int hi = layerCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (texelFetch(layerTable, 3 * mid).w <= id)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Low to high: blue, cyan, green, yellow, red.
+vec3 Ramp(float value) {
+    const vec3 stops[5] = vec3[5](vec3(0.15, 0.25, 0.85), vec3(0.10, 0.70, 0.90), vec3(0.25, 0.80, 0.30),
+                                  vec3(0.95, 0.85, 0.25), vec3(0.90, 0.20, 0.15));
+    float t = 4.0 * clamp((value - colorRange.x) / max(colorRange.y - colorRange.x, 1e-6), 0.0, 1.0);
+    int i = min(int(t), 3);
+    return mix(stops[i], stops[i + 1], t - float(i));
+}
+
+// Colour of the segment ending at a vertex: its feature's, or a print setting
+// (x speed, y fan, z temperature, w tool; see GCodePackedVertex) on the ramp.
+// Moves without extrusion keep their feature colour.
+vec3 SegmentColor(uint feature, float area, uvec4 settings, float layerSeconds) {
+    if (colorMode == 0 || area <= 0.0)
+        return featureColors[feature];
+    float code = float(settings.x) / 255.0;
+    float speed = code * code * maxSpeed;
+    if (colorMode == 1)
+        return Ramp(speed);
+    if (colorMode == 2)
+        return Ramp(area * speed);
+    if (colorMode == 3)
+        return Ramp(float(settings.y) * (100.0 / 255.0));
+    if (colorMode == 4)
+        return Ramp(float(settings.z) * temperatureStep);
+    if (colorMode == 5)
+        return toolColors[min(settings.w, 3u)];
+    return Ramp(layerSeconds);
+}
 
 void main() {
-    vColor = aColor;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    // Each line of a strip takes its colour from its last vertex (the provoking
+    // vertex), which carries the feature and settings of that segment.
+    int layer = FindLayer(float(gl_VertexID));
+    uint feature = aFeature.x & 0x7Fu;
+    float code = float(aFeature.y) / 255.0;
+    vColor = SegmentColor(feature, code * code * maxArea, aSettings, texelFetch(layerTable, 3 * layer + 2).x);
+    vVisible = (visibleFeatures >> int(feature)) & 1;
+    vec3 pos = texelFetch(layerTable, 3 * layer).xyz + aPos * texelFetch(layerTable, 3 * layer + 1).xyz;
+    vec4 world = model * vec4(pos, 1.0);
+    vWorldPos = world.xyz;
+    gl_Position = projection * view * world;
 }
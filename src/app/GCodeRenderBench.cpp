@@ -0,0 +1,159 @@
+#include "GCodeRenderBench.h"
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "FrameBuffer.h"
+#include "GCodeModel.h"
+#include "Shader.h"
+
+namespace {
+
+constexpr int kWidth = 1920;
+constexpr int kHeight = 1080;
+constexpr float kBeadWidth = 0.45f;   // lineWidth of the geometry shader path, mm
+
+struct BenchPath {
+    const char* name;
+    GCodeModel::DrawStyle style;
+    std::unique_ptr<Shader> shader;
+};
+
+struct Timing {
+    double gpuMedianMs = 0.0;
+    double gpuMeanMs = 0.0;
+    double cpuMeanMs = 0.0;
+};
+
+// Orbit around the print, or with `closeUp` around a point a quarter of the way
+// across it, from a tenth of the distance. `cull` passes the view so tiles
+// outside it are skipped; `lod` also lets distant tiles use coarser levels.
+Timing Measure(GCodeModel& model, BenchPath& path, int frames, bool closeUp = false, bool cull = false,
+               bool lod = false) {
+    const glm::vec3 extent = model.GetBoundsMax() - model.GetBoundsMin();
+    const glm::vec3 center = closeUp ? model.GetBoundsMin() + extent * 0.25f : model.GetCenter();
+    const float radius = std::max(glm::length(extent), 1.0f) * (closeUp ? 0.1f : 1.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), float(kWidth) / kHeight,
+                                                  radius * 0.01f, radius * 10.0f);
+    model.SetDrawStyle(path.style);
+    model.SetLodEnabled(lod);
+
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    std::vector<double> gpu;
+    double cpuTotal = 0.0;
+    // One untimed frame first, so shader compilation and driver warm-up are not measured.
+    for (int frame = -1; frame < frames; ++frame) {
+        const float angle = 6.2831853f * std::max(frame, 0) / std::max(frames, 1);
+        const glm::vec3 eye = center + glm::vec3(std::cos(angle), std::sin(angle), 0.6f) * radius;
+        const glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 0.0f, 1.0f));
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        const auto start = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        path.shader->use();
+        path.shader->setMat4("model", glm::mat4(1.0f));
+        path.shader->setMat4("view", view);
+        path.shader->setMat4("projection", projection);
+        path.shader->setVec3("cameraPos", eye);
+        path.shader->setFloat("lineWidth", kBeadWidth);
+        GCodeModel::View camera;
+        camera.frustum = Frustum(projection * view);
+        camera.eye = eye;
+        camera.pixelScale = 0.5f * kHeight * projection[1][1];
+        model.DrawUpToLayer(-1, *path.shader, cull || lod ? &camera : nullptr);
+        glEndQuery(GL_TIME_ELAPSED);
+        const auto end = std::chrono::steady_clock::now();
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        if (frame >= 0) {
+            gpu.push_back(ns * 1e-6);
+            cpuTotal += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+    }
+    glDeleteQueries(1, &query);
+
+    Timing t;
+    if (gpu.empty())
+        return t;
+    for (double ms : gpu)
+        t.gpuMeanMs += ms;
+    t.gpuMeanMs /= gpu.size();
+    std::nth_element(gpu.begin(), gpu.begin() + gpu.size() / 2, gpu.end());
+    t.gpuMedianMs = gpu[gpu.size() / 2];
+    t.cpuMeanMs = cpuTotal / frames;
+    return t;
+}
+
+} // namespace
+
+int RunGCodeRenderBench(const std::string& path, int frames) {
+    if (!glfwInit())
+        throw std::runtime_error("Failed to init GLFW");
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "RendRipper bench", nullptr, nullptr);
+    if (!window) {
+        glfwTerminate();
+        throw std::runtime_error("No GLFW window");
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress))) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        throw std::runtime_error("No GLAD");
+    }
+
+    {
+        GCodeModel model(path, GCodeModel::LoadMode::Blocking);
+        FrameBuffer target;
+        target.Init(kWidth, kHeight);
+        target.Bind();
+        glViewport(0, 0, kWidth, kHeight);
+        glEnable(GL_DEPTH_TEST);
+
+        BenchPath paths[] = {
+            {"lines", GCodeModel::DrawStyle::Lines,
+             std::make_unique<Shader>("../../resources/shaders/gcode_shader.vert",
+                                      "../../resources/shaders/gcode_shader.frag")},
+            {"geometry shader", GCodeModel::DrawStyle::Lines,
+             std::make_unique<Shader>("../../resources/shaders/gcode_shader.vert",
+                                      "../../resources/shaders/gcode_ribbon.frag",
+                                      "../../resources/shaders/gcode_shader.geom")},
+            {"instanced ribbons", GCodeModel::DrawStyle::Ribbons,
+             std::make_unique<Shader>("../../resources/shaders/gcode_ribbon.vert",
+                                      "../../resources/shaders/gcode_ribbon.frag")},
+        };
+        std::cout << path << ": " << model.GetLayerCount() << " layers, " << kWidth << "x" << kHeight
+                  << ", " << frames << " frames\n";
+        for (BenchPath& p : paths) {
+            Timing t = Measure(model, p, frames);
+            std::cout << "  " << p.name << ": GPU median " << t.gpuMedianMs << " ms, mean " << t.gpuMeanMs
+                      << " ms; CPU submit " << t.cpuMeanMs << " ms" << std::endl;
+        }
+        for (bool cull : {false, true}) {
+            Timing t = Measure(model, paths[2], frames, true, cull);
+            std::cout << "  close-up ribbons" << (cull ? ", culled" : "") << ": GPU median " << t.gpuMedianMs
+                      << " ms, mean " << t.gpuMeanMs << " ms; CPU submit " << t.cpuMeanMs << " ms" << std::endl;
+        }
+        for (BenchPath* p : {&paths[0], &paths[2]}) {
+            Timing t = Measure(model, *p, frames, false, true, true);
+            std::cout << "  " << p->name << ", level of detail: GPU median " << t.gpuMedianMs << " ms, mean "
+                      << t.gpuMeanMs << " ms; CPU submit " << t.cpuMeanMs << " ms" << std::endl;
+        }
+        target.Unbind();
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+
+// Usage: RendRipper --gcode-render-bench <file.gcode> [frames]
+// Loads the file into a hidden window and times every G-code draw path with
+// GL_TIME_ELAPSED queries while orbiting the print: line strips, quads
+// expanded by gcode_shader.geom, and the instanced ribbons GCodeModel uses,
+// then ribbons from close up with and without tile culling, and lines and
+// ribbons with level of detail.
+int RunGCodeRenderBench(const std::string& path, int frames);
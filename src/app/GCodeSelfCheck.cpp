@@ -0,0 +1,296 @@
+#include "GCodeSelfCheck.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "GCodeParser.h"
+#include "GCodeSource.h"
+#include "GCodeVisitor.h"
+
+namespace {
+
+// Everything ParseBuffer returns.
+struct ParseOutput {
+    std::vector<std::vector<GCodePathVertex>> layers;
+    std::vector<float> layerZs;
+    std::vector<GCodeEstimate> estimates;
+    GCodeParseStats stats;
+};
+
+ParseOutput ParseWith(const GCodeParser& parser, std::string_view text) {
+    ParseOutput out;
+    out.stats = parser.ParseBuffer(text.data(), text.data() + text.size(), out.layers, out.layerZs, &out.estimates);
+    return out;
+}
+
+// The same through GCodeStreamingParse, fed `piece` more bytes at a time as if
+// the text were still being decoded, so pieces end mid-line and mid-layer.
+ParseOutput StreamWith(const GCodeParser& parser, std::string_view text, size_t piece) {
+    ParseOutput out;
+    GCodeStreamingParse stream(parser, [&](float z, std::vector<GCodePathVertex>&& path, const GCodeEstimate& e) {
+        out.layers.push_back(std::move(path));
+        out.layerZs.push_back(z);
+        out.estimates.push_back(e);
+        return true;
+    });
+    for (size_t end = piece; end < text.size(); end += piece)
+        stream.Feed(text.data(), text.data() + end);
+    out.stats = stream.Finish(text.data(), text.data() + text.size());
+    return out;
+}
+
+bool SameVertex(const GCodePathVertex& a, const GCodePathVertex& b) {
+    return a.pos == b.pos && a.feature == b.feature && a.flags == b.flags && a.fan == b.fan && a.tool == b.tool &&
+           a.area == b.area && a.move == b.move && a.speed == b.speed && a.temperature == b.temperature;
+}
+
+bool SameEstimate(const GCodeEstimate& a, const GCodeEstimate& b) {
+    return a.seconds == b.seconds && a.filament == b.filament && a.grams == b.grams && a.moveTimes == b.moveTimes &&
+           a.moveLines == b.moveLines;
+}
+
+// The first difference between two parses, or an empty string if they are the same.
+std::string Difference(const ParseOutput& expected, const ParseOutput& actual) {
+    std::ostringstream out;
+    if (actual.layers.size() != expected.layers.size() || actual.layerZs.size() != expected.layerZs.size() ||
+        actual.estimates.size() != expected.estimates.size()) {
+        out << actual.layers.size() << " layers instead of " << expected.layers.size();
+        return out.str();
+    }
+    for (size_t layer = 0; layer < expected.layers.size(); ++layer) {
+        const std::vector<GCodePathVertex>& a = expected.layers[layer];
+        const std::vector<GCodePathVertex>& b = actual.layers[layer];
+        if (actual.layerZs[layer] != expected.layerZs[layer]) {
+            out << "layer " << layer << " at Z " << actual.layerZs[layer] << " instead of " << expected.layerZs[layer];
+            return out.str();
+        }
+        if (b.size() != a.size()) {
+            out << "layer " << layer << " has " << b.size() << " vertices instead of " << a.size();
+            return out.str();
+        }
+        const auto [ia, ib] = std::mismatch(a.begin(), a.end(), b.begin(), SameVertex);
+        if (ia != a.end()) {
+            out << "layer " << layer << " differs at vertex " << (ia - a.begin());
+            return out.str();
+        }
+        if (!SameEstimate(expected.estimates[layer], actual.estimates[layer])) {
+            out << "layer " << layer << " has a different estimate";
+            return out.str();
+        }
+    }
+    if (actual.stats.lines != expected.stats.lines || actual.stats.moves != expected.stats.moves) {
+        out << actual.stats.lines << " lines and " << actual.stats.moves << " moves instead of "
+            << expected.stats.lines << " and " << expected.stats.moves;
+        return out.str();
+    }
+    return {};
+}
+
+// Counts what a visitor is told, and checks every line reaches it once, in order.
+class CountingVisitor : public IGCodeVisitor {
+public:
+    size_t commands = 0, layers = 0, moves = 0, settings = 0;
+    bool inOrder = true;
+
+    void OnCommand(const GCodeCommand&, size_t line) override {
+        inOrder = inOrder && (commands == 0 || line > lastLine_);
+        lastLine_ = line;
+        ++commands;
+    }
+    void OnLayer(size_t, size_t) override { ++layers; }
+    void OnMove(const GCodeMoveEvent&) override { ++moves; }
+    void OnTool(int) override { ++settings; }
+    void OnTemperature(float) override { ++settings; }
+    void OnFan(float) override { ++settings; }
+
+    bool SameCounts(const CountingVisitor& other) const {
+        return commands == other.commands && layers == other.layers && moves == other.moves &&
+               settings == other.settings;
+    }
+
+private:
+    size_t lastLine_ = 0;
+};
+
+// Several visitors on one Visit must cost one read and one tokenizer pass: the
+// parse covers the buffer once and decodes exactly the lines a serial
+// ParseBuffer decodes, whether one visitor listens or six, and every visitor is
+// told what a lone visitor is told. The collector's layers must be ParseBuffer's.
+std::string VisitDifference(const GCodeParser& parser, std::string_view text, const ParseOutput& serial) {
+    CountingVisitor alone;
+    const GCodeParseStats aloneStats = parser.Visit(text.data(), text.data() + text.size(), {&alone});
+
+    constexpr size_t kCounters = 5;
+    CountingVisitor counters[kCounters];
+    GCodeLayerCollector collector;
+    std::vector<IGCodeVisitor*> visitors = {&collector};
+    for (CountingVisitor& counter : counters)
+        visitors.push_back(&counter);
+    ParseOutput visited;
+    visited.stats = parser.Visit(text.data(), text.data() + text.size(), visitors);
+
+    std::ostringstream out;
+    if (visited.stats.bytes != text.size() || visited.stats.lines != serial.stats.lines) {
+        out << "read " << visited.stats.bytes << " bytes in " << visited.stats.lines << " lines instead of "
+            << text.size() << " in " << serial.stats.lines;
+        return out.str();
+    }
+    if (aloneStats.decoded != serial.stats.decoded || visited.stats.decoded != serial.stats.decoded) {
+        out << "decoded " << aloneStats.decoded << " lines for one visitor and " << visited.stats.decoded << " for "
+            << visitors.size() << " instead of " << serial.stats.decoded;
+        return out.str();
+    }
+    for (const CountingVisitor& counter : counters) {
+        if (!counter.inOrder || !counter.SameCounts(alone)) {
+            out << "a visitor among " << visitors.size() << " was told " << counter.commands << " commands, "
+                << counter.moves << " moves instead of " << alone.commands << ", " << alone.moves;
+            return out.str();
+        }
+    }
+    visited.layers = std::move(collector.layers);
+    visited.layerZs = std::move(collector.layerZs);
+    visited.estimates = std::move(collector.estimates);
+    return Difference(serial, visited);
+}
+
+// What the synthetic fixtures vary.
+struct Fixture {
+    const char* name;
+    bool markers;   // ";LAYER:" markers, or layers told by Z alone
+    bool relative;  // stretches of G91 and M83 moves
+    bool crlf;
+    bool finalNewline;
+};
+
+// A small print in the style of a slicer's output: a start block, then layers
+// of square walls closed by an arc and a zig-zag infill after a retraction,
+// with a fan and a temperature change on the way. With `relative`, layers 4-6,
+// 14-16 and so on are walls alone in G91 and M83, and G92 restores absolute E
+// after each stretch.
+std::string SyntheticGCode(const Fixture& fixture) {
+    constexpr int kLayers = 40;
+    std::ostringstream out;
+    out << ";FLAVOR:Marlin\n;Generated for the G-code self-check\nG28\nG90\nM82\nM104 S200\nG92 E0\n";
+    double e = 0.0;
+    auto extrude = [&](double x, double y, double length) {
+        e += length * 0.033;
+        out << "G1 X" << x << " Y" << y << " E" << e << "\n";
+    };
+    for (int layer = 0; layer < kLayers; ++layer) {
+        const double z = 0.2 + 0.2 * layer;
+        if (fixture.markers)
+            out << ";LAYER:" << layer << "\n";
+        if (layer == 2)
+            out << "M106 S255\n";
+        if (layer == 5)
+            out << "M104 S210\n";
+        const double side = 20.0 + (layer % 3);
+        if (fixture.relative && layer % 10 >= 4 && layer % 10 < 7) {
+            // Walls from wherever the last layer ended, every move and E relative.
+            if (layer % 10 == 4)
+                out << "G91\nM83\n";
+            out << "G0 F9000 Z0.2\n;TYPE:WALL-OUTER\nG1 F1800\n";
+            const double de = side * 0.033;
+            out << "G1 X" << side << " E" << de << "\nG1 Y" << side << " E" << de << "\n";
+            out << "G1 X" << -side << " E" << de << "\nG1 Y" << -side << " E" << de << "\n";
+            out << "G1 E-0.8 F2400\nG0 F9000 X2 Y2\nG1 E0.8 F2400\n";
+            if (layer % 10 == 6) {
+                out << "G90\nM82\nG92 E0\n";
+                e = 0.0;
+            }
+            continue;
+        }
+        out << "G0 F9000 X10 Y10 Z" << z << "\n;TYPE:WALL-OUTER\nG1 F1800\n";
+        extrude(10.0 + side, 10.0, side);
+        extrude(10.0 + side, 10.0 + side, side);
+        extrude(10.0, 10.0 + side, side);
+        extrude(10.0, 10.0, side);
+        out << "G2 X14 Y10 I2 J0 E" << (e += 0.2) << "\n";
+        out << ";TYPE:FILL\nG1 E" << (e - 0.8) << " F2400\nG0 F9000 X12 Y12\nG1 E" << e << " F2400\nG1 F3000\n";
+        for (int row = 0; row < 8; ++row) {
+            const double y = 12.0 + row * (side - 4.0) / 8.0;
+            extrude(row % 2 ? 12.0 : 6.0 + side, y, side - 6.0);
+            extrude(row % 2 ? 12.0 : 6.0 + side, y + (side - 4.0) / 8.0, (side - 4.0) / 8.0);
+        }
+    }
+    out << "M107\nM104 S0\nG1 Z" << 0.2 * kLayers + 5.0 << "\n;End of print";
+    if (fixture.finalNewline)
+        out << "\n";
+    std::string text = out.str();
+    if (fixture.crlf) {
+        std::string crlf;
+        crlf.reserve(text.size() + text.size() / 16);
+        for (const char c : text) {
+            if (c == '\n')
+                crlf += '\r';
+            crlf += c;
+        }
+        text = std::move(crlf);
+    }
+    return text;
+}
+
+// Every check on one text: ParseBuffer in chunks, GCodeStreamingParse in
+// pieces, and Visit, each against a serial ParseBuffer.
+bool CheckText(const std::string& name, std::string_view text, unsigned threads) {
+    GCodeParser parser;
+    parser.SetMachineLimits(GCodeMachineLimits::FromDefinition(A1MINI_PRINTER_SETTINGS_FILE));
+
+    parser.SetThreadCount(1);
+    const ParseOutput serial = ParseWith(parser, text);
+    std::cout << name << ": " << serial.layers.size() << " layers, " << serial.stats.vertices << " vertices\n";
+
+    // Chunks as small as the counts ask for, so even a small file is split that many ways.
+    std::vector<unsigned> chunkCounts = {2, 3, 8, 64, threads ? threads : std::thread::hardware_concurrency()};
+    std::sort(chunkCounts.begin(), chunkCounts.end());
+    chunkCounts.erase(std::unique(chunkCounts.begin(), chunkCounts.end()), chunkCounts.end());
+    bool ok = true;
+    for (unsigned chunks : chunkCounts) {
+        if (chunks < 2)
+            continue;
+        parser.SetThreadCount(chunks);
+        parser.SetMinChunkBytes(std::max<size_t>(text.size() / chunks, 1));
+        const std::string difference = Difference(serial, ParseWith(parser, text));
+        std::cout << "ParseBuffer in " << chunks << " chunks: " << (difference.empty() ? "same" : difference) << "\n";
+        ok = ok && difference.empty();
+    }
+    parser.SetThreadCount(1);
+    // Pieces of a prime number of bytes, and markers and flavor told early.
+    constexpr size_t kPieceBytes = 4099;
+    parser.SetMinChunkBytes(kPieceBytes);
+    std::string difference = Difference(serial, StreamWith(parser, text, kPieceBytes));
+    std::cout << "Streaming parse in " << kPieceBytes << "-byte pieces: " << (difference.empty() ? "same" : difference)
+              << "\n";
+    ok = ok && difference.empty();
+    difference = VisitDifference(parser, text, serial);
+    std::cout << "Visit with one and with six visitors: " << (difference.empty() ? "same" : difference) << "\n";
+    return ok && difference.empty();
+}
+
+}  // namespace
+
+int RunGCodeSelfCheck(const std::string& path, unsigned threads) {
+    const GCodeSource file(path);
+    const bool ok = CheckText(path, std::string_view(file.data(), file.size()), threads);
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+int RunGCodeSelfCheck(unsigned threads) {
+    const Fixture fixtures[] = {
+        {"markers", true, false, false, true},
+        {"no markers", false, false, false, true},
+        {"markers, G91/M83 stretches, CRLF", true, true, true, true},
+        {"no markers, G91/M83 stretches, no final newline", false, true, false, false},
+        {"no markers, CRLF, no final newline", false, false, true, false},
+    };
+    bool ok = true;
+    for (const Fixture& fixture : fixtures) {
+        const std::string text = SyntheticGCode(fixture);
+        ok = CheckText(fixture.name, text, threads) && ok;
+    }
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+// Usage: RendRipper --gcode-selfcheck <file.gcode> [threads]
+// Parses the file serially and in parallel chunks (2, 3, 8, 64 and `threads`
+// chunks, hardware_concurrency() by default) and checks that every parse
+// yields the same layers, vertices and estimates. Then visits it with several
+// visitors at once (see IGCodeVisitor) and checks that they share one pass and
+// that GCodeLayerCollector gets ParseBuffer's layers. Prints the first
+// difference and returns 1 if there is one, 0 if all parses agree.
+int RunGCodeSelfCheck(const std::string& path, unsigned threads);
+
+// Usage: RendRipper --gcode-selfcheck
+// The same checks, and GCodeStreamingParse fed in small pieces, on G-code
+// generated in-process: with and without ";LAYER:" markers, with G91/M83
+// stretches, CRLF line ends and no final newline. Small chunks and pieces cut
+// it mid-layer. ctest runs this (see CMakeLists.txt).
+int RunGCodeSelfCheck(unsigned threads);
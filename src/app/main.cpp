@@ -1,8 +1,125 @@
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include "Application.h"
+#include "GCodeBinary.h"
+#include "GCodeParser.h"
+#include "GCodePostProcessor.h"
+#include "GCodeRenderBench.h"
+#include "GCodeSelfCheck.h"
+#include "GCodeShifter.h"
 
-int main() {
+// Usage: RendRipper --gcode-throughput <file.gcode> [passes] [simplify-tolerance-mm]
+// The file may also be gzipped G-code or binary G-code (see GCodeSource).
+// Parses the file without opening a window and prints the parser throughput,
+// the print time estimated for the A1 mini and what estimating it costs.
+static int RunGCodeThroughput(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " --gcode-throughput <file.gcode> [passes] [simplify-tolerance-mm]"
+                  << std::endl;
+        return -1;
+    }
+    int passes = argc > 3 ? std::stoi(argv[3]) : 3;
+    GCodeParser parser;
+    parser.SetMachineLimits(GCodeMachineLimits::FromDefinition(A1MINI_PRINTER_SETTINGS_FILE));
+    if (argc > 4)
+        parser.SetSimplifyTolerance(std::stof(argv[4]));
+    GCodeParseStats s = parser.MeasureThroughput(argv[2], passes);
+    std::cout << argv[2] << ": " << s.bytes / (1024.0 * 1024.0) << " MB, "
+              << s.lines << " lines, " << s.moves << " moves, " << s.vertices << " vertices ("
+              << s.removedVertices << " removed by simplification)\n"
+              << "estimated print time " << s.estimate.seconds << " s, "
+              << s.estimate.filament / 1000.0 << " m of filament\n"
+              << "best of " << passes << ": " << s.seconds << " s, "
+              << s.MegabytesPerSecond() << " MB/s\n"
+              << "without the print time: " << s.untimedSeconds << " s, so estimating it adds "
+              << 100.0 * (s.seconds / s.untimedSeconds - 1.0) << "%" << std::endl;
+    return 0;
+}
+
+// Usage: RendRipper --gcode-postprocess <in.gcode> <out.gcode> [arc-tolerance-mm]
+// Fits arcs and drops redundant words as after slicing (see GCodePostProcessor);
+// <out> may be <in>. Prints the reduction in size and command count.
+static int RunGCodePostProcess(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " --gcode-postprocess <in.gcode> <out.gcode> [arc-tolerance-mm]"
+                  << std::endl;
+        return -1;
+    }
+    GCodePostOptions options;
+    if (argc > 4)
+        options.arcTolerance = std::stof(argv[4]);
+    GCodePostStats s = GCodePostProcessor(options).ProcessFile(argv[2], argv[3]);
+    std::cout << argv[2] << ": " << s.bytesIn / (1024.0 * 1024.0) << " MB -> " << s.bytesOut / (1024.0 * 1024.0)
+              << " MB (" << 100.0 * s.SizeReduction() << "% smaller)\n"
+              << s.commandsIn << " -> " << s.commandsOut << " commands (" << 100.0 * s.CommandReduction()
+              << "% fewer), " << s.arcs << " arcs replacing " << s.movesInArcs << " moves\n"
+              << "in " << s.seconds << " s" << std::endl;
+    return 0;
+}
+
+// Usage: RendRipper --gcode-binary <in.gcode> <out.bgcode> [none|deflate|heatshrink11|heatshrink12] [plain]
+// Converts G-code to binary G-code (see GCodeBinaryWriter), MeatPacked unless
+// "plain", checking that every block decodes back to its text.
+static int RunGCodeBinary(int argc, char** argv) {
+    static const char* const compressions[] = {"none", "deflate", "heatshrink11", "heatshrink12"};
+    GCodeBinaryOptions options;
+    bool usage = argc < 4;
+    if (argc > 4) {
+        const auto it = std::find(std::begin(compressions), std::end(compressions), std::string(argv[4]));
+        usage = usage || it == std::end(compressions);
+        options.compression = static_cast<GCodeBinary::Compression>(it - std::begin(compressions));
+    }
+    if (argc > 5) {
+        usage = usage || std::string(argv[5]) != "plain";
+        options.encoding = GCodeBinary::Encoding::None;
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0]
+                  << " --gcode-binary <in.gcode> <out.bgcode> [none|deflate|heatshrink11|heatshrink12] [plain]"
+                  << std::endl;
+        return -1;
+    }
+    GCodeBinaryStats s = GCodeBinaryWriter(options).WriteFile(argv[2], argv[3]);
+    std::cout << argv[2] << ": " << s.bytesIn / (1024.0 * 1024.0) << " MB -> " << s.bytesOut / (1024.0 * 1024.0)
+              << " MB (" << 100.0 * s.SizeReduction() << "% smaller) in " << s.blocks << " blocks, "
+              << s.seconds << " s" << std::endl;
+    return 0;
+}
+
+// Usage: RendRipper --gcode-shift <in.gcode> <out.gcode> <dx-mm> <dy-mm> [bed-width-mm bed-depth-mm]
+// Moves a Cura print across the bed as re-slicing it moved would (see
+// GCodeShifter); the bed defaults to the A1 mini's 180 x 180 mm. <out> may be <in>.
+static int RunGCodeShift(int argc, char** argv) {
+    if (argc != 6 && argc != 8) {
+        std::cerr << "Usage: " << argv[0]
+                  << " --gcode-shift <in.gcode> <out.gcode> <dx-mm> <dy-mm> [bed-width-mm bed-depth-mm]" << std::endl;
+        return -1;
+    }
+    const glm::dvec2 offset(std::stod(argv[4]), std::stod(argv[5]));
+    const glm::dvec2 bed = argc == 8 ? glm::dvec2(std::stod(argv[6]), std::stod(argv[7])) : glm::dvec2(180.0);
+    GCodeShiftStats s = GCodeShifter(offset, glm::dvec2(0.0), bed).ShiftFile(argv[2], argv[3]);
+    std::cout << argv[2] << ": " << s.moves << " moves shifted, " << s.bytes / (1024.0 * 1024.0) << " MB in "
+              << s.seconds << " s" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
     try {
+        if (argc > 1 && std::string(argv[1]) == "--gcode-throughput")
+            return RunGCodeThroughput(argc, argv);
+        if (argc > 1 && std::string(argv[1]) == "--gcode-postprocess")
+            return RunGCodePostProcess(argc, argv);
+        if (argc > 1 && std::string(argv[1]) == "--gcode-binary")
+            return RunGCodeBinary(argc, argv);
+        if (argc > 1 && std::string(argv[1]) == "--gcode-shift")
+            return RunGCodeShift(argc, argv);
+        if (argc > 2 && std::string(argv[1]) == "--gcode-selfcheck")
+            return RunGCodeSelfCheck(argv[2], argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 0);
+        if (argc > 1 && std::string(argv[1]) == "--gcode-selfcheck")
+            return RunGCodeSelfCheck(0);
+        if (argc > 2 && std::string(argv[1]) == "--gcode-render-bench")
+            return RunGCodeRenderBench(argv[2], argc > 3 ? std::stoi(argv[3]) : 120);
         Application app(1280, 720, "3D Slicer");
         app.Run();
     } catch (const std::exception& ex) {
@@ -10,4 +127,4 @@ int main() {
         return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
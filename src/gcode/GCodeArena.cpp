@@ -0,0 +1,586 @@
+#include "GCodeArena.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstddef>
+
+GCodeArena::~GCodeArena()
+{
+    for (Page &p: pages_)
+        {
+        glDeleteVertexArrays(1, &p.vao);
+        glDeleteVertexArrays(1, &p.ribbonVao);
+        glDeleteBuffers(1, &p.vbo);
+        glDeleteTextures(1, &p.tableTexture);
+        glDeleteBuffers(1, &p.tableBuffer);
+        }
+}
+
+size_t GCodeArena::VertexCount() const
+{
+    size_t total = 0;
+    for (const Page &p: pages_)
+        total += p.used;
+    return total;
+}
+
+size_t GCodeArena::ResidentBytes() const
+{
+    size_t total = 0;
+    for (const Page &p: pages_)
+        total += p.resident ? p.capacity * sizeof(GCodePackedVertex) : 0;
+    return total;
+}
+
+size_t GCodeArena::CompressedBytes() const
+{
+    size_t total = 0;
+    for (const Page &p: pages_)
+        {
+        for (const Slot &slot: p.slots)
+            total += slot.compressed.size();
+        }
+    return total;
+}
+
+GCodeArena::Page &GCodeArena::pageFor(size_t count)
+{
+    // An evicted page is not filled up; the space left in it stays unused.
+    for (Page &p: pages_)
+        {
+        if (p.resident && p.capacity - p.used >= count)
+            return p;
+        }
+
+    Page &p = pages_.emplace_back();
+    p.capacity = std::max(kPageVertices, count);
+    createBuffers(p);
+    glGenBuffers(1, &p.tableBuffer);
+    glGenTextures(1, &p.tableTexture);
+    return p;
+}
+
+// Create the vertex buffer of `p`, empty, and the vertex arrays reading it.
+void GCodeArena::createBuffers(Page &p)
+{
+    glGenVertexArrays(1, &p.vao);
+    glGenBuffers(1, &p.vbo);
+    glBindVertexArray(p.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+    glBufferData(GL_ARRAY_BUFFER, p.capacity * sizeof(GCodePackedVertex), nullptr, GL_STATIC_DRAW);
+    // Quantized position (converted to float unnormalized), then feature and
+    // cross-section, then the print settings, as integers.
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(GCodePackedVertex), (void *) 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 2, GL_UNSIGNED_BYTE, sizeof(GCodePackedVertex),
+                           (void *) offsetof(GCodePackedVertex, feature));
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 4, GL_UNSIGNED_BYTE, sizeof(GCodePackedVertex),
+                           (void *) offsetof(GCodePackedVertex, speed));
+
+    // Ribbons: attributes 0/1 are the segment's start, 2/3 its end and 4 the
+    // end's print settings, advancing once per instance. DrawRibbons sets the
+    // offsets before each draw.
+    glGenVertexArrays(1, &p.ribbonVao);
+    glBindVertexArray(p.ribbonVao);
+    for (GLuint loc = 0; loc < 5; ++loc)
+        {
+        glEnableVertexAttribArray(loc);
+        glVertexAttribDivisor(loc, 1);
+        }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    p.resident = true;
+    p.lastUse = std::chrono::steady_clock::now();
+}
+
+// Compress the layer just added to `p`, or note that the page must stay.
+void GCodeArena::keepCopy(Page &p, const GCodePackedVertex *vertices, size_t count)
+{
+    if (keepCompressed_)
+        p.slots.back().compressed = GCodePacking::Compress(vertices, count);
+    else
+        p.pinned = true;
+}
+
+void GCodeArena::AddLayer(int layer, const GCodePackedVertex *vertices, size_t count, const GCodePackedLayer &packed)
+{
+    if (count == 0)
+        return;
+    Page &p = pageFor(count);
+    const size_t first = p.used;
+    glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(GCodePackedVertex), count * sizeof(GCodePackedVertex), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    p.used += count;
+
+    // A layer packed without tiles is one tile.
+    const size_t runs = packed.runFirst.size();
+    std::vector<Tile> tiles;
+    if (packed.tiles.empty())
+        {
+        Tile t;
+        t.runs = static_cast<int>(runs);
+        t.first = first;
+        t.count = count;
+        t.boundsMin = packed.origin - kCullMargin;
+        t.boundsMax = packed.origin + packed.step * 65535.0f + kCullMargin;
+        tiles.push_back(t);
+        }
+    for (const GCodePackedTile &pt: packed.tiles)
+        {
+        if (pt.runs == 0)
+            continue;
+        const size_t lastRun = pt.firstRun + pt.runs - 1;
+        Tile t;
+        t.firstRun = static_cast<int>(pt.firstRun);
+        t.runs = static_cast<int>(pt.runs);
+        t.first = first + static_cast<size_t>(packed.runFirst[pt.firstRun]);
+        t.count = static_cast<size_t>(packed.runFirst[lastRun] + packed.runCount[lastRun]) -
+                  static_cast<size_t>(packed.runFirst[pt.firstRun]);
+        t.cellX = pt.cellX;
+        t.cellY = pt.cellY;
+        t.boundsMin = pt.boundsMin - kCullMargin;
+        t.boundsMax = pt.boundsMax + kCullMargin;
+        tiles.push_back(t);
+        }
+    addEntry(p, layer, first, count, glm::vec4(packed.origin, static_cast<float>(first)),
+             glm::vec4(packed.step, packed.height), packed.seconds, packed.runFirst.data(), packed.runCount.data(), runs,
+             tiles);
+    keepCopy(p, vertices, count);
+}
+
+bool GCodeArena::CopyLayer(int layer, const GCodeArena &source, int sourceLayer, float seconds)
+{
+    for (const Page &from: source.pages_)
+        {
+        auto pos = std::lower_bound(from.layers.begin(), from.layers.end(), sourceLayer);
+        if (pos == from.layers.end() || *pos != sourceLayer)
+            continue;
+        const size_t k = static_cast<size_t>(pos - from.layers.begin());
+        const size_t slot = static_cast<size_t>(std::find_if(from.slots.begin(), from.slots.end(), [&](const Slot &s)
+            {
+            return s.layer == sourceLayer;
+            }) - from.slots.begin());
+        const Slot &copied = from.slots[slot];
+        const size_t count = copied.count;
+        Page &p = pageFor(count);
+        const size_t first = p.used;
+        if (from.resident)
+            {
+            glBindBuffer(GL_COPY_READ_BUFFER, from.vbo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, p.vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                                static_cast<GLintptr>(copied.first * sizeof(GCodePackedVertex)),
+                                static_cast<GLintptr>(first * sizeof(GCodePackedVertex)),
+                                static_cast<GLsizeiptr>(count * sizeof(GCodePackedVertex)));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            }
+        else
+            {
+            // Evicted there, so it has a compressed copy to upload from.
+            expanded_.resize(count);
+            GCodePacking::Expand(copied.compressed, count, expanded_.data());
+            glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(first * sizeof(GCodePackedVertex)),
+                            static_cast<GLsizeiptr>(count * sizeof(GCodePackedVertex)), expanded_.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+        p.used += count;
+
+        // Run and tile tables move with the vertices, from one page offset to the other.
+        const size_t runBegin = k == 0 ? 0 : static_cast<size_t>(from.runEnd[k - 1]);
+        const size_t runs = static_cast<size_t>(from.runEnd[k]) - runBegin;
+        std::vector<int32_t> runFirst(runs);
+        for (size_t r = 0; r < runs; ++r)
+            runFirst[r] = from.runFirst[runBegin + r] - static_cast<int>(from.slots[slot].first);
+        std::vector<Tile> tiles(from.tiles.begin() + (k == 0 ? 0 : from.tileEnd[k - 1]),
+                                from.tiles.begin() + from.tileEnd[k]);
+        for (Tile &t: tiles)
+            t.first = t.first - copied.first + first;
+        const glm::vec4 *texels = &from.table[slot * kLayerTexels];
+        addEntry(p, layer, first, count, glm::vec4(glm::vec3(texels[0]), static_cast<float>(first)), texels[1],
+                 seconds, runFirst.data(), from.runCount.data() + runBegin, runs, tiles);
+        if (keepCompressed_ && !copied.compressed.empty())
+            p.slots.back().compressed = copied.compressed;
+        else
+            p.pinned = true;
+        return true;
+        }
+    return false;
+}
+
+// The page holding `layer`, with the layer's position `k` in its run and tile
+// tables and its slot; null if no page holds it.
+const GCodeArena::Page *GCodeArena::find(int layer, size_t &k, size_t &slot) const
+{
+    for (const Page &p: pages_)
+        {
+        auto pos = std::lower_bound(p.layers.begin(), p.layers.end(), layer);
+        if (pos == p.layers.end() || *pos != layer)
+            continue;
+        k = static_cast<size_t>(pos - p.layers.begin());
+        slot = static_cast<size_t>(std::find_if(p.slots.begin(), p.slots.end(), [&](const Slot &s)
+            {
+            return s.layer == layer;
+            }) - p.slots.begin());
+        return &p;
+        }
+    return nullptr;
+}
+
+// Fill the quantization and runs of `layer` into `out` and return its page and
+// slot; null if no page holds it.
+const GCodeArena::Page *GCodeArena::readFrame(int layer, GCodePackedLayer &out, const Slot *&slot) const
+{
+    size_t k = 0, index = 0;
+    const Page *p = find(layer, k, index);
+    if (!p)
+        return nullptr;
+    slot = &p->slots[index];
+    const glm::vec4 *texels = &p->table[index * kLayerTexels];
+    out.origin = glm::vec3(texels[0]);
+    out.step = glm::vec3(texels[1]);
+    out.height = texels[1].w;
+    const size_t runBegin = k == 0 ? 0 : static_cast<size_t>(p->runEnd[k - 1]);
+    const size_t runEnd = static_cast<size_t>(p->runEnd[k]);
+    out.runFirst.assign(p->runFirst.begin() + runBegin, p->runFirst.begin() + runEnd);
+    out.runCount.assign(p->runCount.begin() + runBegin, p->runCount.begin() + runEnd);
+    for (int32_t &first: out.runFirst)
+        first -= static_cast<int32_t>(slot->first);
+    return p;
+}
+
+bool GCodeArena::ReadLayer(int layer, GCodePackedLayer &out) const
+{
+    const Slot *s = nullptr;
+    const Page *p = readFrame(layer, out, s);
+    if (!p)
+        return false;
+    out.vertices.resize(s->count);
+    if (!s->compressed.empty())
+        {
+        GCodePacking::Expand(s->compressed, s->count, out.vertices.data());
+        return true;
+        }
+    // Without a copy the page is pinned, so it is on the GPU.
+    glBindBuffer(GL_ARRAY_BUFFER, p->vbo);
+    glGetBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(s->first * sizeof(GCodePackedVertex)),
+                       static_cast<GLsizeiptr>(s->count * sizeof(GCodePackedVertex)), out.vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+bool GCodeArena::ReadCompressedLayer(int layer, GCodePackedLayer &out, std::vector<uint8_t> &compressed,
+                                     size_t &count) const
+{
+    const Slot *s = nullptr;
+    if (!readFrame(layer, out, s) || s->compressed.empty())
+        return false;
+    compressed = s->compressed;
+    count = s->count;
+    return true;
+}
+
+bool GCodeArena::Near(int layer, const glm::vec2 &point, float radius) const
+{
+    size_t k = 0, slot = 0;
+    const Page *p = find(layer, k, slot);
+    if (!p)
+        return false;
+    for (int t = k == 0 ? 0 : p->tileEnd[k - 1]; t < p->tileEnd[k]; ++t)
+        {
+        const Tile &tile = p->tiles[static_cast<size_t>(t)];
+        if (point.x >= tile.boundsMin.x - radius && point.x <= tile.boundsMax.x + radius &&
+            point.y >= tile.boundsMin.y - radius && point.y <= tile.boundsMax.y + radius)
+            return true;
+        }
+    return false;
+}
+
+// Record a layer whose `count` vertices were just stored at `first` in `p`:
+// its layer table entry, runs (relative to the layer) and tiles.
+void GCodeArena::addEntry(Page &p, int layer, size_t first, size_t count, const glm::vec4 &origin,
+                          const glm::vec4 &step, float seconds, const int32_t *runFirst, const int32_t *runCount,
+                          size_t runs, const std::vector<Tile> &tiles)
+{
+    // Layer table (see kLayerTexels). The first vertex is exact as a float: shared
+    // pages hold 2^21 vertices, and an oversized layer is alone in its page.
+    p.table.push_back(origin);
+    p.table.push_back(step);
+    p.table.emplace_back(seconds, 0.0f, 0.0f, 0.0f);
+    p.slots.push_back({layer, first, count, {}});
+    p.lastUse = std::chrono::steady_clock::now();
+    const size_t entries = p.table.size() / kLayerTexels;
+    glBindBuffer(GL_TEXTURE_BUFFER, p.tableBuffer);
+    if (entries > p.tableCapacity)
+        {
+        p.tableCapacity = std::max<size_t>(64, p.tableCapacity * 2);
+        glBufferData(GL_TEXTURE_BUFFER, p.tableCapacity * kLayerTexels * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, p.table.size() * sizeof(glm::vec4), p.table.data());
+        glBindTexture(GL_TEXTURE_BUFFER, p.tableTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, p.tableBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+    else
+        {
+        glBufferSubData(GL_TEXTURE_BUFFER, (p.table.size() - kLayerTexels) * sizeof(glm::vec4),
+                        kLayerTexels * sizeof(glm::vec4), &p.table[p.table.size() - kLayerTexels]);
+        }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // Keep the run tables in layer order. Layers normally arrive in order, so
+    // this is an append; a layer loaded ahead of the others is inserted.
+    auto pos = std::lower_bound(p.layers.begin(), p.layers.end(), layer);
+    const size_t k = static_cast<size_t>(pos - p.layers.begin());
+    const size_t runAt = k == 0 ? 0 : static_cast<size_t>(p.runEnd[k - 1]);
+    p.layers.insert(pos, layer);
+    p.runEnd.insert(p.runEnd.begin() + static_cast<std::ptrdiff_t>(k), static_cast<int>(runAt + runs));
+    for (size_t j = k + 1; j < p.runEnd.size(); ++j)
+        p.runEnd[j] += static_cast<int>(runs);
+    p.runFirst.insert(p.runFirst.begin() + static_cast<std::ptrdiff_t>(runAt), runFirst, runFirst + runs);
+    p.runCount.insert(p.runCount.begin() + static_cast<std::ptrdiff_t>(runAt), runCount, runCount + runs);
+    for (size_t r = runAt; r < runAt + runs; ++r)
+        p.runFirst[r] += static_cast<int>(first);
+
+    // Tiles, likewise in layer order.
+    const size_t tileAt = k == 0 ? 0 : static_cast<size_t>(p.tileEnd[k - 1]);
+    p.tiles.insert(p.tiles.begin() + static_cast<std::ptrdiff_t>(tileAt), tiles.begin(), tiles.end());
+    p.tileEnd.insert(p.tileEnd.begin() + static_cast<std::ptrdiff_t>(k), static_cast<int>(tileAt + tiles.size()));
+    for (size_t j = k + 1; j < p.tileEnd.size(); ++j)
+        p.tileEnd[j] += static_cast<int>(tiles.size());
+}
+
+void GCodeArena::Draw(int first, int last, Shader &shader, const Frustum *frustum, const TileFilter *filter,
+                      const TileClip *clip) const
+{
+    const auto now = std::chrono::steady_clock::now();
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("layerTable", 0);
+    for (const Page &p: pages_)
+        {
+        auto from = std::lower_bound(p.layers.begin(), p.layers.end(), first);
+        auto to = std::upper_bound(from, p.layers.end(), last);
+        if (from == to)
+            continue;
+        const size_t k0 = static_cast<size_t>(from - p.layers.begin());
+        const size_t k1 = static_cast<size_t>(to - p.layers.begin());
+        const int runBegin = k0 == 0 ? 0 : p.runEnd[k0 - 1];
+        const int runEnd = p.runEnd[k1 - 1];
+        if (runEnd == runBegin)
+            continue;
+        if (!p.resident)
+            {
+            // Evicted: have it restored if anything in it is in view.
+            if (anyVisible(p, k0, k1, frustum, filter))
+                {
+                p.wanted = true;
+                p.lastUse = now;
+                }
+            continue;
+            }
+
+        // Without culling, or with every tile in view, the layer range is one
+        // slice of the run tables; otherwise gather the runs of visible tiles,
+        // cut short where a clip ends them.
+        const int *runFirst = p.runFirst.data() + runBegin;
+        const int *runCount = p.runCount.data() + runBegin;
+        int runs = runEnd - runBegin;
+        if (frustum || filter || clip)
+            {
+            drawFirst_.clear();
+            drawCount_.clear();
+            bool culled = clip != nullptr;
+            for (size_t k = k0; k < k1; ++k)
+                {
+                const int layerRuns = k == 0 ? 0 : p.runEnd[k - 1];
+                for (int t = k == 0 ? 0 : p.tileEnd[k - 1]; t < p.tileEnd[k]; ++t)
+                    {
+                    const Tile &tile = p.tiles[static_cast<size_t>(t)];
+                    if (!visible(p.layers[k], tile, frustum, filter))
+                        {
+                        culled = true;
+                        continue;
+                        }
+                    const size_t r = static_cast<size_t>(layerRuns + tile.firstRun);
+                    if (!clip)
+                        {
+                        drawFirst_.insert(drawFirst_.end(), p.runFirst.begin() + r, p.runFirst.begin() + r + tile.runs);
+                        drawCount_.insert(drawCount_.end(), p.runCount.begin() + r, p.runCount.begin() + r + tile.runs);
+                        continue;
+                        }
+                    const size_t layerFirst = static_cast<size_t>(p.runFirst[static_cast<size_t>(layerRuns)]);
+                    const size_t end = tile.first + (*clip)(p.layers[k], tile.first - layerFirst, tile.count);
+                    for (size_t i = r; i < r + static_cast<size_t>(tile.runs); ++i)
+                        {
+                        const size_t from = static_cast<size_t>(p.runFirst[i]);
+                        if (from + 2 > end)
+                            break;
+                        drawFirst_.push_back(p.runFirst[i]);
+                        drawCount_.push_back(static_cast<int>(std::min(static_cast<size_t>(p.runCount[i]), end - from)));
+                        }
+                    }
+                }
+            if (culled)
+                {
+                if (drawFirst_.empty())
+                    continue;
+                runFirst = drawFirst_.data();
+                runCount = drawCount_.data();
+                runs = static_cast<int>(drawFirst_.size());
+                }
+            }
+
+        p.lastUse = now;
+        shader.setInt("layerCount", static_cast<int>(p.table.size() / kLayerTexels));
+        glBindTexture(GL_TEXTURE_BUFFER, p.tableTexture);
+        glBindVertexArray(p.vao);
+        glMultiDrawArrays(GL_LINE_STRIP, runFirst, runCount, runs);
+        }
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void GCodeArena::DrawRibbons(int first, int last, Shader &shader, const Frustum *frustum,
+                             const TileFilter *filter, const TileClip *clip) const
+{
+    const auto now = std::chrono::steady_clock::now();
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("layerTable", 0);
+    for (const Page &p: pages_)
+        {
+        // Vertex ranges to draw, in storage order, merged where they touch. The
+        // run start flag of each piece's first vertex keeps segments from
+        // bridging two layers or tiles.
+        spans_.clear();
+        auto add = [&](size_t from, size_t count)
+            {
+            if (!spans_.empty() && spans_.back().second == from)
+                spans_.back().second += count;
+            else
+                spans_.emplace_back(from, from + count);
+            };
+        for (const Slot &slot: p.slots)
+            {
+            if (slot.layer < first || slot.layer > last)
+                continue;
+            if (!frustum && !filter && !clip)
+                {
+                add(slot.first, slot.count);
+                continue;
+                }
+            const size_t k = static_cast<size_t>(std::lower_bound(p.layers.begin(), p.layers.end(), slot.layer) -
+                                                 p.layers.begin());
+            for (int t = k == 0 ? 0 : p.tileEnd[k - 1]; t < p.tileEnd[k]; ++t)
+                {
+                const Tile &tile = p.tiles[static_cast<size_t>(t)];
+                if (!visible(slot.layer, tile, frustum, filter))
+                    continue;
+                const size_t count = clip ? (*clip)(slot.layer, tile.first - slot.first, tile.count) : tile.count;
+                if (count > 0)
+                    add(tile.first, count);
+                }
+            }
+        if (spans_.empty())
+            continue;
+        p.lastUse = now;
+        if (!p.resident)
+            {
+            p.wanted = true;
+            continue;
+            }
+
+        bool bound = false;
+        for (const auto &[begin, end]: spans_)
+            {
+            if (end - begin < 2)
+                continue;
+            if (!bound)
+                {
+                shader.setInt("layerCount", static_cast<int>(p.table.size() / kLayerTexels));
+                glBindTexture(GL_TEXTURE_BUFFER, p.tableTexture);
+                glBindVertexArray(p.ribbonVao);
+                glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+                bound = true;
+                }
+            const size_t stride = sizeof(GCodePackedVertex);
+            const size_t at = begin * stride;
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, stride, (void *) at);
+            glVertexAttribIPointer(1, 2, GL_UNSIGNED_BYTE, stride, (void *) (at + offsetof(GCodePackedVertex, feature)));
+            glVertexAttribPointer(2, 3, GL_UNSIGNED_SHORT, GL_FALSE, stride, (void *) (at + stride));
+            glVertexAttribIPointer(3, 2, GL_UNSIGNED_BYTE, stride,
+                                   (void *) (at + stride + offsetof(GCodePackedVertex, feature)));
+            glVertexAttribIPointer(4, 4, GL_UNSIGNED_BYTE, stride,
+                                   (void *) (at + stride + offsetof(GCodePackedVertex, speed)));
+            shader.setInt("instanceBase", static_cast<int>(begin));
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(end - begin - 1));
+            }
+        }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+bool GCodeArena::anyVisible(const Page &p, size_t k0, size_t k1, const Frustum *frustum,
+                            const TileFilter *filter) const
+{
+    for (size_t k = k0; k < k1; ++k)
+        {
+        for (int t = k == 0 ? 0 : p.tileEnd[k - 1]; t < p.tileEnd[k]; ++t)
+            {
+            if (visible(p.layers[k], p.tiles[static_cast<size_t>(t)], frustum, filter))
+                return true;
+            }
+        }
+    return false;
+}
+
+std::chrono::steady_clock::time_point GCodeArena::OldestEvictable() const
+{
+    auto oldest = std::chrono::steady_clock::time_point::max();
+    for (const Page &p: pages_)
+        {
+        if (p.resident && !p.pinned)
+            oldest = std::min(oldest, p.lastUse);
+        }
+    return oldest;
+}
+
+void GCodeArena::EvictOldest()
+{
+    Page *oldest = nullptr;
+    for (Page &p: pages_)
+        {
+        if (p.resident && !p.pinned && (!oldest || p.lastUse < oldest->lastUse))
+            oldest = &p;
+        }
+    if (!oldest)
+        return;
+    glDeleteVertexArrays(1, &oldest->vao);
+    glDeleteVertexArrays(1, &oldest->ribbonVao);
+    glDeleteBuffers(1, &oldest->vbo);
+    oldest->vao = oldest->ribbonVao = oldest->vbo = 0;
+    oldest->resident = false;
+    oldest->wanted = false;
+}
+
+bool GCodeArena::RestoreWanted()
+{
+    for (Page &p: pages_)
+        {
+        if (!p.wanted)
+            continue;
+        createBuffers(p);
+        expanded_.resize(p.used);
+        for (const Slot &slot: p.slots)
+            GCodePacking::Expand(slot.compressed, slot.count, expanded_.data() + slot.first);
+        glBindBuffer(GL_ARRAY_BUFFER, p.vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(p.used * sizeof(GCodePackedVertex)),
+                        expanded_.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        p.wanted = false;
+        return true;
+        }
+    return false;
+}
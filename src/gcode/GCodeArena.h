@@ -0,0 +1,201 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Frustum.h"
+#include "GCodePacking.h"
+#include "Shader.h"
+
+/// GPU storage for the packed toolpaths of a whole print.
+///
+/// Layers are appended to a few large vertex buffers ("pages") instead of one
+/// VAO/VBO per layer. Each page keeps its layers' run tables sorted by layer
+/// index, so any range of layers is one contiguous slice of the page's run
+/// arrays and is drawn with a single glMultiDrawArrays per page.
+///
+/// Layers keep their own quantization (GCodePackedLayer::origin/step). The
+/// page's layer table lives in a texture buffer; gcode_shader.vert finds the
+/// layer of a vertex by binary search on gl_VertexID, which keeps vertices at
+/// 12 bytes and works on a GL 3.3 context without gl_DrawID. The table also
+/// holds each layer's print time for the layer time colour mode.
+///
+/// The same buffers feed the ribbon renderer (DrawRibbons): one instance per
+/// segment, reading the segment's two end vertices as instanced attributes.
+/// GL 3.3 has no base instance, so the attributes are re-pointed at the first
+/// vertex of each contiguous span and gcode_ribbon.vert is told the offset.
+///
+/// Both draws can be given a frustum; tiles (GCodePackedTile) entirely outside
+/// it are skipped, so a close-up submits only what is near the view. A tile
+/// filter can further pick tiles by layer and grid cell (see GCodeLod), and a
+/// tile clip can draw only the start of each tile (see GCodeModel::DrawUpToMove).
+///
+/// To bound VRAM use, an arena can keep a compressed copy of its layers in RAM
+/// (SetKeepCompressed). Whole pages can then be evicted, least recently drawn
+/// first, and are restored from those copies after a draw found them missing.
+/// Only the vertex buffer goes; run, tile and layer tables stay.
+class GCodeArena
+{
+public:
+    /// Default page size in vertices (16 MB). Larger layers get a page of their own.
+    static constexpr size_t kPageVertices = size_t(1) << 21;
+
+    /// Tile bounds are grown by this much (mm) before culling, since they
+    /// cover toolpath centre lines and ribbons are drawn around them.
+    static constexpr float kCullMargin = 1.0f;
+
+    /// Called as (layer, cell x, cell y) for each tile that passed culling;
+    /// the tile is drawn if it returns true.
+    using TileFilter = std::function<bool(int, int, int)>;
+
+    /// Called as (layer, first, count) for each tile that is drawn, with the
+    /// tile's vertices counted from the start of its layer in packed order
+    /// (as in GCodePackedLayer::vertices); only the first vertices of the tile,
+    /// as many as it returns, are drawn.
+    using TileClip = std::function<size_t(int, size_t, size_t)>;
+
+    GCodeArena() = default;
+    ~GCodeArena();
+
+    GCodeArena(const GCodeArena &) = delete;
+    GCodeArena &operator=(const GCodeArena &) = delete;
+
+    /// Upload layer `layer`. `vertices` may point into a mapped file; `packed`
+    /// supplies the quantization, run table and tiles. Empty layers are ignored.
+    void AddLayer(int layer, const GCodePackedVertex *vertices, size_t count, const GCodePackedLayer &packed);
+
+    /// Add layer `layer` as a copy of layer `sourceLayer` of another arena,
+    /// e.g. one of the previous slice whose layer is identical. The vertices
+    /// are copied from buffer to buffer on the GPU (or uploaded from the
+    /// compressed copy if that page is evicted) and the run and tile tables
+    /// are taken over; only the layer time is new. Returns false if `source`
+    /// does not hold `sourceLayer`.
+    bool CopyLayer(int layer, const GCodeArena &source, int sourceLayer, float seconds);
+
+    /// The packed vertices, quantization and runs of layer `layer`, as they were
+    /// added (tiles are left out), for code that needs them on the CPU, e.g. a
+    /// picking grid. Expanded from the compressed copy, or read back from the GPU
+    /// without one. Returns false if the arena does not hold the layer.
+    bool ReadLayer(int layer, GCodePackedLayer &out) const;
+
+    /// ReadLayer without expanding the vertices: a copy of the layer's compressed
+    /// vertices and their `count`, for GCodePacking::Expand on another thread.
+    /// Returns false if the arena does not hold the layer or keeps no copy of it.
+    bool ReadCompressedLayer(int layer, GCodePackedLayer &out, std::vector<uint8_t> &compressed,
+                             size_t &count) const;
+
+    /// Whether the bounds of some tile of layer `layer` (grown by kCullMargin)
+    /// come within `radius` of `point` in XY: a cheap test before ReadLayer.
+    bool Near(int layer, const glm::vec2 &point, float radius) const;
+
+    /// Draw layers first..last inclusive; the shader must be bound.
+    /// Issues one draw call per page that holds any of them. With a `frustum`
+    /// (in toolpath space) tiles outside it are left out.
+    void Draw(int first, int last, Shader &shader, const Frustum *frustum = nullptr,
+              const TileFilter *filter = nullptr, const TileClip *clip = nullptr) const;
+
+    /// Draw layers first..last inclusive as instanced ribbons (gcode_ribbon.vert).
+    /// Issues one instanced draw per storage-contiguous span of those layers
+    /// (or of their tiles inside `frustum`), normally one per page.
+    void DrawRibbons(int first, int last, Shader &shader, const Frustum *frustum = nullptr,
+                     const TileFilter *filter = nullptr, const TileClip *clip = nullptr) const;
+
+    size_t PageCount() const { return pages_.size(); }
+    size_t VertexCount() const;
+
+    /// Keep a GCodePacking::Compress copy of each layer added from now on, which
+    /// lets their pages be evicted. A page holding any layer without one stays
+    /// on the GPU.
+    void SetKeepCompressed(bool keep) { keepCompressed_ = keep; }
+
+    /// Bytes of vertex buffers on the GPU, and of compressed layers in RAM.
+    size_t ResidentBytes() const;
+    size_t CompressedBytes() const;
+
+    /// When the least recently drawn page that can be evicted was last drawn
+    /// (or written to); time_point::max() if there is none.
+    std::chrono::steady_clock::time_point OldestEvictable() const;
+
+    /// Free the vertex buffer of that page. Its layers draw nothing until a
+    /// draw asks for them and RestoreWanted brings them back.
+    void EvictOldest();
+
+    /// Re-upload one evicted page that a draw since its eviction would have
+    /// drawn from. Returns false if there is none.
+    bool RestoreWanted();
+
+private:
+    struct Tile
+    {
+        int firstRun = 0;                 // relative to the layer's first run
+        int runs = 0;
+        size_t first = 0;                 // vertex range in the page
+        size_t count = 0;
+        int cellX = 0;
+        int cellY = 0;
+        glm::vec3 boundsMin{0.0f};        // grown by kCullMargin
+        glm::vec3 boundsMax{0.0f};
+    };
+
+    struct Slot
+    {
+        int layer = 0;
+        size_t first = 0;                 // first vertex in the page
+        size_t count = 0;
+        std::vector<uint8_t> compressed;  // GCodePacking::Compress, if kept
+    };
+
+    struct Page
+    {
+        unsigned int vao = 0;
+        unsigned int ribbonVao = 0;       // per-instance segment ends, see DrawRibbons
+        unsigned int vbo = 0;
+        unsigned int tableBuffer = 0;     // GL_TEXTURE_BUFFER of layer entries
+        unsigned int tableTexture = 0;
+        size_t used = 0;
+        size_t capacity = 0;
+        size_t tableCapacity = 0;         // in layer entries
+        std::vector<glm::vec4> table;     // kLayerTexels per layer, in upload order
+        std::vector<Slot> slots;          // likewise; storage order
+        std::vector<int> layers;          // layer indices in this page, ascending
+        std::vector<int> runEnd;          // runs of layers[0..k] inclusive
+        std::vector<int> runFirst;        // run tables ordered like `layers`,
+        std::vector<int> runCount;        // relative to the page's first vertex
+        std::vector<int> tileEnd;         // tiles of layers[0..k] inclusive
+        std::vector<Tile> tiles;          // ordered like `layers`
+        bool resident = true;             // vbo, vao and ribbonVao exist
+        bool pinned = false;              // some layer has no compressed copy
+        mutable bool wanted = false;      // evicted, and a draw needed it
+        mutable std::chrono::steady_clock::time_point lastUse;
+    };
+
+    // Layer table texels: (origin, first vertex), (step, height), (seconds, 0, 0, 0).
+    static constexpr size_t kLayerTexels = 3;
+
+    Page &pageFor(size_t count);
+    const Page *find(int layer, size_t &k, size_t &slot) const;
+    const Page *readFrame(int layer, GCodePackedLayer &out, const Slot *&slot) const;
+    void createBuffers(Page &p);
+    void keepCopy(Page &p, const GCodePackedVertex *vertices, size_t count);
+    bool anyVisible(const Page &p, size_t k0, size_t k1, const Frustum *frustum, const TileFilter *filter) const;
+    void addEntry(Page &p, int layer, size_t first, size_t count, const glm::vec4 &origin, const glm::vec4 &step,
+                  float seconds, const int32_t *runFirst, const int32_t *runCount, size_t runs,
+                  const std::vector<Tile> &tiles);
+    static bool visible(int layer, const Tile &tile, const Frustum *frustum, const TileFilter *filter)
+    {
+        return (!frustum || frustum->Intersects(tile.boundsMin, tile.boundsMax)) &&
+               (!filter || (*filter)(layer, tile.cellX, tile.cellY));
+    }
+
+    // Per-draw scratch space for the culled run tables and ribbon spans.
+    mutable std::vector<int> drawFirst_;
+    mutable std::vector<int> drawCount_;
+    mutable std::vector<std::pair<size_t, size_t> > spans_;
+    std::vector<GCodePackedVertex> expanded_;      // scratch for RestoreWanted and CopyLayer
+
+    bool keepCompressed_ = false;
+
+    std::vector<Page> pages_;
+};
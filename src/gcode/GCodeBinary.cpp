@@ -0,0 +1,630 @@
+#include "GCodeBinary.h"
+#include "GCodeOutput.h"
+#include "GCodeSource.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <exception>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <zlib.h>
+
+using GCodeBinary::Block;
+using GCodeBinary::BlockType;
+using GCodeBinary::Compression;
+using GCodeBinary::Encoding;
+
+namespace
+{
+    // Heatshrink lengths are 4 bits, 1..16 bytes. A back-reference costs 17
+    // bits with a 12-bit window, so it only pays from three bytes on.
+    constexpr int kCountBits = 4;
+    constexpr size_t kMinMatch = 3;
+    constexpr size_t kMaxMatch = size_t(1) << kCountBits;
+
+    // Match finding hashes three bytes and follows at most this many earlier
+    // positions with the same hash.
+    constexpr int kHashBits = 13;
+    constexpr int kMaxChain = 32;
+
+    // Blocks encoded at a time, per thread; with kMaxGCodeBlock this bounds
+    // the text and output held by the writer.
+    constexpr size_t kBlocksPerThread = 4;
+
+    uint32_t ReadLE(const unsigned char *p, size_t bytes)
+    {
+        uint32_t v = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            v |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return v;
+    }
+
+    void PutLE(std::string &out, uint32_t v, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; ++i)
+            out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+
+    uint32_t Crc32(const unsigned char *begin, const unsigned char *end)
+    {
+        return static_cast<uint32_t>(crc32(0, begin, static_cast<uInt>(end - begin)));
+    }
+
+    // Read the block at `p`, checking its CRC if `checked`, and step past it.
+    Block ReadBlock(const unsigned char *&p, const unsigned char *end, bool checked)
+    {
+        auto corrupt = [](const char *why) { return std::runtime_error(std::string("Corrupt binary G-code: ") + why); };
+        if (end - p < 8)
+            throw corrupt("truncated block header");
+        const unsigned char *header = p;
+        Block b;
+        b.type = static_cast<BlockType>(ReadLE(p, 2));
+        b.compression = static_cast<Compression>(ReadLE(p + 2, 2));
+        b.size = ReadLE(p + 4, 4);
+        b.stored = b.size;
+        p += 8;
+        if (b.compression != Compression::None)
+            {
+            if (end - p < 4)
+                throw corrupt("truncated block header");
+            b.stored = ReadLE(p, 4);
+            p += 4;
+            }
+        const size_t params = b.type == BlockType::Thumbnail ? 6 : 2;
+        if (static_cast<size_t>(end - p) < params + b.stored + (checked ? 4 : 0))
+            throw corrupt("truncated block");
+        b.encoding = static_cast<Encoding>(ReadLE(p, 2));
+        b.data = p + params;
+        p = b.data + b.stored;
+        if (checked)
+            {
+            if (Crc32(header, p) != ReadLE(p, 4))
+                throw corrupt("block checksum mismatch");
+            p += 4;
+            }
+        return b;
+    }
+
+    // Heatshrink is LZSS with a bit-packed stream: a 1 bit and a literal byte,
+    // or a 0 bit, a back-reference offset and a length, each stored minus one.
+    void Unheatshrink(const Block &b, int windowBits, std::string &out)
+    {
+        const unsigned char *p = b.data;
+        const unsigned char *end = b.data + b.stored;
+        uint64_t bits = 0;
+        int available = 0;
+        auto read = [&](int count, uint32_t &value)
+            {
+            while (available < count)
+                {
+                if (p == end)
+                    return false;
+                bits = (bits << 8) | *p++;
+                available += 8;
+                }
+            available -= count;
+            value = static_cast<uint32_t>(bits >> available) & ((1u << count) - 1);
+            return true;
+            };
+
+        out.reserve(b.size);
+        uint32_t tag = 0, literal = 0, index = 0, count = 0;
+        // The last byte is padded with zero bits, too few for another token.
+        while (out.size() < b.size && read(1, tag))
+            {
+            if (tag)
+                {
+                if (!read(8, literal))
+                    break;
+                out.push_back(static_cast<char>(literal));
+                continue;
+                }
+            if (!read(windowBits, index) || !read(kCountBits, count))
+                break;
+            if (index + 1 > out.size())
+                throw std::runtime_error("Corrupt binary G-code: heatshrink reference before the block start");
+            const size_t from = out.size() - index - 1;
+            for (size_t i = 0; i <= count; ++i)
+                out.push_back(out[from + i]);
+            }
+        if (out.size() != b.size)
+            throw std::runtime_error("Corrupt binary G-code: block decompresses to the wrong size");
+    }
+
+    // The stream Unheatshrink reads, matched greedily: at each byte the
+    // longest earlier match within the window, or a literal if none pays.
+    std::string Heatshrink(std::string_view data, int windowBits)
+    {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(data.data());
+        const size_t size = data.size();
+        const size_t window = size_t(1) << windowBits;
+
+        std::string out;
+        out.reserve(size);
+        uint64_t bits = 0;
+        int pending = 0;
+        auto write = [&](uint32_t value, int count)
+            {
+            bits = (bits << count) | value;
+            pending += count;
+            while (pending >= 8)
+                {
+                pending -= 8;
+                out.push_back(static_cast<char>(bits >> pending));
+                }
+            };
+
+        // head[hash] is the last position whose three bytes hash there,
+        // previous[i] the one before i with the same hash.
+        std::vector<int32_t> head(size_t(1) << kHashBits, -1);
+        std::vector<int32_t> previous(size, -1);
+        auto hash = [&](size_t i)
+            {
+            const uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8 | in[i + 2];
+            return (v * 2654435761u) >> (32 - kHashBits);
+            };
+        auto insert = [&](size_t i)
+            {
+            if (i + kMinMatch > size)
+                return;
+            const uint32_t h = hash(i);
+            previous[i] = head[h];
+            head[h] = static_cast<int32_t>(i);
+            };
+
+        for (size_t i = 0; i < size;)
+            {
+            size_t best = 0;
+            size_t offset = 0;
+            if (i + kMinMatch <= size)
+                {
+                const size_t limit = std::min(kMaxMatch, size - i);
+                int chain = kMaxChain;
+                for (int32_t j = head[hash(i)]; j >= 0 && chain-- > 0; j = previous[j])
+                    {
+                    if (i - j > window)
+                        break;
+                    // A match may run on into the bytes it repeats.
+                    size_t length = 0;
+                    while (length < limit && in[j + length] == in[i + length])
+                        ++length;
+                    if (length > best)
+                        {
+                        best = length;
+                        offset = i - j;
+                        if (length == limit)
+                            break;
+                        }
+                    }
+                }
+            if (best >= kMinMatch)
+                {
+                write(0, 1);
+                write(static_cast<uint32_t>(offset - 1), windowBits);
+                write(static_cast<uint32_t>(best - 1), kCountBits);
+                for (size_t k = 0; k < best; ++k)
+                    insert(i + k);
+                i += best;
+                }
+            else
+                {
+                write(1, 1);
+                write(in[i], 8);
+                insert(i);
+                ++i;
+                }
+            }
+        if (pending > 0)
+            out.push_back(static_cast<char>(bits << (8 - pending)));
+        return out;
+    }
+
+    std::string Deflate(std::string_view data)
+    {
+        uLongf size = compressBound(static_cast<uLong>(data.size()));
+        std::string out(size, '\0');
+        if (compress2(reinterpret_cast<Bytef *>(out.data()), &size, reinterpret_cast<const Bytef *>(data.data()),
+                      static_cast<uLong>(data.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+            throw std::runtime_error("Binary G-code: deflate failed");
+        out.resize(size);
+        return out;
+    }
+
+    // MeatPack packs the 15 most common G-code characters two to a byte, low
+    // nibble first; 0xF says that character follows as a whole byte instead.
+    // 0xFF 0xFF and a command byte switch packing and the space-free mode, in
+    // which nibble 11 stands for 'E' and the spaces between words are left out.
+    constexpr char kMeatPackChars[] = "0123456789. \nGX";
+    constexpr unsigned kWholeNibble = 0xF;
+    constexpr unsigned char kSignal = 0xFF;
+    constexpr unsigned char kEnablePacking = 0xFB;
+
+    class MeatPackDecoder
+    {
+    public:
+        /// Append the text of `packed` to `out`.
+        void Decode(std::string_view packed, std::string &out)
+        {
+            // A byte yields at most two characters and the spaces before them,
+            // and a held character; the buffer grows when less than that is left.
+            constexpr size_t kMaxPerByte = 5;
+            const size_t start = out.size();
+            out.resize(start + packed.size() * 2 + kMaxPerByte);
+            out_ = out.data() + start;
+            const char *limit = out.data() + out.size() - kMaxPerByte;
+            for (const char ch: packed)
+                {
+                if (out_ > limit)
+                    {
+                    const size_t used = static_cast<size_t>(out_ - out.data());
+                    out.resize(out.size() * 2);
+                    out_ = out.data() + used;
+                    limit = out.data() + out.size() - kMaxPerByte;
+                    }
+                const unsigned char c = static_cast<unsigned char>(ch);
+                // Most bytes are two packed characters, the first not a newline.
+                const unsigned low = c & 0x0F;
+                const unsigned high = c >> 4;
+                if (packing_ && whole_ == 0 && signals_ == 0 && !command_ && low != 0x0C && low != kWholeNibble &&
+                    high != kWholeNibble)
+                    {
+                    put(character(low));
+                    put(character(high));
+                    continue;
+                    }
+                receive(c);
+                }
+            out.resize(static_cast<size_t>(out_ - out.data()));
+        }
+
+    private:
+        void receive(unsigned char c)
+        {
+            if (c == kSignal && !command_)
+                {
+                command_ = signals_ == 1;
+                signals_ = command_ ? 0 : 1;
+                return;
+                }
+            if (command_)
+                {
+                command_ = false;
+                run(c);
+                return;
+                }
+            if (signals_)
+                {
+                // A lone 0xFF was data after all.
+                signals_ = 0;
+                unpack(kSignal);
+                }
+            unpack(c);
+        }
+
+        void run(unsigned char command)
+        {
+            switch (command)
+                {
+                case kEnablePacking: packing_ = true; break;
+                case 0xFA: packing_ = false; break;
+                case 0xF9: packing_ = false; break;     // reset
+                case 0xF7: noSpaces_ = true; break;
+                case 0xF6: noSpaces_ = false; break;
+                default: break;
+                }
+        }
+
+        char character(unsigned nibble) const
+        {
+            return nibble == 11 && noSpaces_ ? 'E' : kMeatPackChars[nibble];
+        }
+
+        void unpack(unsigned char c)
+        {
+            if (!packing_)
+                {
+                put(static_cast<char>(c));
+                return;
+                }
+            if (whole_ > 0)
+                {
+                put(static_cast<char>(c));
+                if (held_)
+                    put(held_);
+                held_ = 0;
+                --whole_;
+                return;
+                }
+            const bool lowWhole = (c & 0x0F) == kWholeNibble;
+            const bool highWhole = (c >> 4) == kWholeNibble;
+            if (lowWhole)
+                {
+                // The whole byte comes first, then the packed character.
+                whole_ = highWhole ? 2 : 1;
+                if (!highWhole)
+                    held_ = character(c >> 4);
+                return;
+                }
+            const char first = character(c & 0x0F);
+            put(first);
+            // A newline ends the pair; its high nibble is padding.
+            if (first == '\n')
+                return;
+            if (highWhole)
+                whole_ = 1;
+            else
+                put(character(c >> 4));
+        }
+
+        // The tokenizer splits words at spaces, so they go back in where the
+        // space-free mode left them out: before a letter that follows a value.
+        void put(char c)
+        {
+            if (c == ';')
+                comment_ = true;
+            else if (c == '\n')
+                comment_ = false;
+            else if (noSpaces_ && c >= 'A' && c <= 'Z' && !comment_ && valueEnd_)
+                *out_++ = ' ';
+            valueEnd_ = (c >= '0' && c <= '9') || c == '.';
+            *out_++ = c;
+        }
+
+        char *out_ = nullptr;
+        bool packing_ = false;
+        bool noSpaces_ = false;
+        bool command_ = false;
+        int signals_ = 0;
+        int whole_ = 0;         // whole bytes still to come
+        char held_ = 0;         // packed character to put after the next whole byte
+        bool comment_ = false;
+        bool valueEnd_ = false; // the last character put ends a number
+    };
+
+    // MeatPackDecoder gives back exactly the text MeatPack packed when that
+    // ends a line (a pair cannot be padded otherwise) and holds no 0xFF byte,
+    // two of which in a row would read as a command.
+    bool CanMeatPack(std::string_view text)
+    {
+        return !text.empty() && text.back() == '\n' && text.find(static_cast<char>(kSignal)) == std::string_view::npos;
+    }
+
+    // Packed without the space-free mode, which would lose the spacing of the
+    // text. Every line starts a pair.
+    std::string MeatPack(std::string_view text)
+    {
+        static const std::array<unsigned char, 256> nibbles = []
+            {
+            std::array<unsigned char, 256> n;
+            n.fill(kWholeNibble);
+            for (unsigned i = 0; i < kWholeNibble; ++i)
+                n[static_cast<unsigned char>(kMeatPackChars[i])] = static_cast<unsigned char>(i);
+            return n;
+            }();
+
+        std::string out;
+        out.reserve(text.size() * 3 / 4 + 3);
+        out.push_back(static_cast<char>(kSignal));
+        out.push_back(static_cast<char>(kSignal));
+        out.push_back(static_cast<char>(kEnablePacking));
+        for (size_t i = 0; i < text.size();)
+            {
+            const unsigned char a = static_cast<unsigned char>(text[i]);
+            if (a == '\n')
+                {
+                out.push_back(static_cast<char>(nibbles['\n']));
+                ++i;
+                continue;
+                }
+            // The text ends with a newline, so a character that is not one has another after it.
+            const unsigned char b = static_cast<unsigned char>(text[i + 1]);
+            out.push_back(static_cast<char>(nibbles[a] | nibbles[b] << 4));
+            if (nibbles[a] == kWholeNibble)
+                out.push_back(static_cast<char>(a));
+            if (nibbles[b] == kWholeNibble)
+                out.push_back(static_cast<char>(b));
+            i += 2;
+            }
+        return out;
+    }
+}
+
+std::vector<Block> GCodeBinary::ReadBlocks(const unsigned char *begin, const unsigned char *end)
+{
+    if (end - begin < 10)
+        throw std::runtime_error("Corrupt binary G-code: truncated file header");
+    if (ReadLE(begin + 4, 4) != kVersion)
+        throw std::runtime_error("Unsupported binary G-code version " + std::to_string(ReadLE(begin + 4, 4)));
+    const bool checked = ReadLE(begin + 8, 2) == 1;
+
+    std::vector<Block> blocks;
+    for (const unsigned char *p = begin + 10; p < end;)
+        blocks.push_back(ReadBlock(p, end, checked));
+    return blocks;
+}
+
+std::string GCodeBinary::Decompress(const Block &b)
+{
+    std::string out;
+    switch (b.compression)
+        {
+        case Compression::None:
+            out.assign(reinterpret_cast<const char *>(b.data), b.stored);
+            break;
+        case Compression::Deflate:
+            {
+            out.resize(b.size);
+            uLongf size = b.size;
+            if (uncompress(reinterpret_cast<Bytef *>(out.data()), &size, b.data, b.stored) != Z_OK || size != b.size)
+                throw std::runtime_error("Corrupt binary G-code: bad deflate block");
+            break;
+            }
+        case Compression::Heatshrink11:
+            Unheatshrink(b, 11, out);
+            break;
+        case Compression::Heatshrink12:
+            Unheatshrink(b, 12, out);
+            break;
+        default:
+            throw std::runtime_error("Unsupported binary G-code compression " +
+                                     std::to_string(static_cast<int>(b.compression)));
+        }
+    return out;
+}
+
+std::string GCodeBinary::DecodeGCode(const Block &b)
+{
+    std::string raw = Decompress(b);
+    if (b.encoding == Encoding::None)
+        return raw;
+    if (b.encoding != Encoding::MeatPack && b.encoding != Encoding::MeatPackComments)
+        throw std::runtime_error("Unsupported binary G-code encoding " + std::to_string(static_cast<int>(b.encoding)));
+    std::string text;
+    MeatPackDecoder().Decode(raw, text);
+    return text;
+}
+
+std::string GCodeBinary::FileHeader()
+{
+    std::string header(kMagic, sizeof(kMagic));
+    PutLE(header, kVersion, 4);
+    PutLE(header, 1, 2);    // CRC32 block checksums
+    return header;
+}
+
+std::string GCodeBinary::EncodeBlock(BlockType type, std::string_view data, Compression compression,
+                                     Encoding encoding)
+{
+    std::string packed;
+    if (type == BlockType::GCode && encoding != Encoding::None && CanMeatPack(data))
+        {
+        packed = MeatPack(data);
+        data = packed;
+        }
+    else
+        encoding = Encoding::None;
+
+    std::string compressed;
+    switch (compression)
+        {
+        case Compression::Deflate: compressed = Deflate(data); break;
+        case Compression::Heatshrink11: compressed = Heatshrink(data, 11); break;
+        case Compression::Heatshrink12: compressed = Heatshrink(data, 12); break;
+        default: compression = Compression::None; break;
+        }
+    if (compressed.size() >= data.size())
+        compression = Compression::None;
+    const std::string_view stored = compression == Compression::None ? data : std::string_view(compressed);
+
+    std::string block;
+    block.reserve(stored.size() + 18);
+    PutLE(block, static_cast<uint32_t>(type), 2);
+    PutLE(block, static_cast<uint32_t>(compression), 2);
+    PutLE(block, static_cast<uint32_t>(data.size()), 4);
+    if (compression != Compression::None)
+        PutLE(block, static_cast<uint32_t>(stored.size()), 4);
+    PutLE(block, static_cast<uint32_t>(encoding), 2);
+    block.append(stored);
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(block.data());
+    PutLE(block, Crc32(bytes, bytes + block.size()), 4);
+    return block;
+}
+
+std::string GCodeBinaryWriter::encodeGCode(std::string_view text) const
+{
+    std::string block = GCodeBinary::EncodeBlock(BlockType::GCode, text, options_.compression, options_.encoding);
+    if (options_.verify)
+        {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(block.data());
+        const unsigned char *end = p + block.size();
+        const Block b = ReadBlock(p, end, true);
+        if (p != end || GCodeBinary::DecodeGCode(b) != text)
+            throw std::runtime_error("Binary G-code block does not decode to the text it was made from");
+        }
+    return block;
+}
+
+GCodeBinaryStats GCodeBinaryWriter::Write(const char *begin, const char *end, std::ostream &out) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    GCodeBinaryStats stats;
+    stats.bytesIn = static_cast<size_t>(end - begin);
+    auto put = [&](const std::string &bytes)
+        {
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        stats.bytesOut += bytes.size();
+        };
+
+    put(GCodeBinary::FileHeader());
+    for (BlockType type: {BlockType::PrinterMetadata, BlockType::PrintMetadata, BlockType::SlicerMetadata})
+        put(GCodeBinary::EncodeBlock(type, {}, Compression::None));
+
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string_view> texts;
+    std::vector<std::string> blocks;
+    std::vector<std::exception_ptr> errors(threads);
+    for (const char *p = begin; p < end;)
+        {
+        // The next batch of blocks, each cut after the last line end that fits.
+        texts.clear();
+        while (p < end && texts.size() < threads * kBlocksPerThread)
+            {
+            std::string_view text(p, std::min<size_t>(end - p, GCodeBinary::kMaxGCodeBlock));
+            if (p + text.size() < end)
+                {
+                const size_t nl = text.rfind('\n');
+                if (nl != std::string_view::npos)
+                    text = text.substr(0, nl + 1);
+                }
+            texts.push_back(text);
+            p += text.size();
+            }
+
+        blocks.assign(texts.size(), std::string());
+        const size_t shares = std::min(threads, texts.size());
+        auto encode = [&](size_t share)
+            {
+            try
+                {
+                for (size_t i = texts.size() * share / shares; i < texts.size() * (share + 1) / shares; ++i)
+                    blocks[i] = encodeGCode(texts[i]);
+                }
+            catch (...)
+                {
+                errors[share] = std::current_exception();
+                }
+            };
+        if (shares == 1)
+            encode(0);
+        else
+            {
+            std::vector<std::thread> workers;
+            workers.reserve(shares);
+            for (size_t i = 0; i < shares; ++i)
+                workers.emplace_back(encode, i);
+            for (auto &w: workers)
+                w.join();
+            }
+        for (const std::exception_ptr &e: errors)
+            {
+            if (e)
+                std::rethrow_exception(e);
+            }
+        for (const std::string &b: blocks)
+            put(b);
+        stats.blocks += blocks.size();
+        }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+GCodeBinaryStats GCodeBinaryWriter::WriteFile(const std::string &inPath, const std::string &outPath) const
+{
+    GCodeBinaryStats stats;
+    RewriteGCodeFile(inPath, outPath, [&](const GCodeSource &source, std::ostream &out)
+        {
+        stats = Write(source.data(), source.data() + source.size(), out);
+        });
+    return stats;
+}
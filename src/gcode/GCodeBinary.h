@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Prusa binary G-code (".bgcode"): a 10-byte file header, then blocks, each a
+/// header, its parameters, its data (compressed or not) and a CRC32 of all
+/// three. Printer, print and slicer metadata come first as INI text; the
+/// G-code follows in blocks of at most kMaxGCodeBlock bytes before compression,
+/// which is what printers buffer.
+namespace GCodeBinary
+{
+    constexpr char kMagic[4] = {'G', 'C', 'D', 'E'};
+    constexpr uint32_t kVersion = 1;
+    constexpr size_t kMaxGCodeBlock = size_t(1) << 16;
+
+    enum class BlockType : uint16_t
+    {
+        FileMetadata = 0,
+        GCode = 1,
+        SlicerMetadata = 2,
+        PrinterMetadata = 3,
+        PrintMetadata = 4,
+        Thumbnail = 5
+    };
+
+    enum class Compression : uint16_t
+    {
+        None = 0,
+        Deflate = 1,
+        Heatshrink11 = 2,   // heatshrink with an 11-bit window, 4-bit lookahead
+        Heatshrink12 = 3    // 12-bit window, 4-bit lookahead
+    };
+
+    /// Encodings of a G-code block; metadata blocks are always INI text.
+    /// MeatPack drops comments (the decoder keeps any it finds), MeatPackComments
+    /// keeps them; both are written the same way here.
+    enum class Encoding : uint16_t
+    {
+        None = 0,
+        MeatPack = 1,
+        MeatPackComments = 2
+    };
+
+    /// One block of a binary G-code file, as laid out on disk.
+    struct Block
+    {
+        BlockType type = BlockType::GCode;
+        Compression compression = Compression::None;
+        Encoding encoding = Encoding::None;
+        uint32_t size = 0;                  // decompressed bytes
+        const unsigned char *data = nullptr;
+        uint32_t stored = 0;                // bytes at `data`
+    };
+
+    /// Split a binary G-code file into its blocks, checking each one's CRC if
+    /// the file has them. Throws std::runtime_error if the file is truncated,
+    /// corrupt or of another version.
+    std::vector<Block> ReadBlocks(const unsigned char *begin, const unsigned char *end);
+
+    /// Data of a block, decompressed; the text of a G-code block, decoded.
+    /// Both throw std::runtime_error on corrupt data.
+    std::string Decompress(const Block &block);
+    std::string DecodeGCode(const Block &block);
+
+    /// The file header of a file with CRC32 block checksums.
+    std::string FileHeader();
+
+    /// A whole block, header to checksum, holding `data`: INI text for the
+    /// metadata types, G-code text for GCode blocks. G-code is MeatPacked when
+    /// `encoding` asks for it and that round-trips (the block ends a line);
+    /// data is stored uncompressed when compressing it does not make it smaller.
+    std::string EncodeBlock(BlockType type, std::string_view data, Compression compression,
+                            Encoding encoding = Encoding::None);
+}
+
+/// How GCodeBinaryWriter encodes a file. The defaults are what Prusa printers
+/// read fastest.
+struct GCodeBinaryOptions
+{
+    GCodeBinary::Compression compression = GCodeBinary::Compression::Heatshrink12;
+    GCodeBinary::Encoding encoding = GCodeBinary::Encoding::MeatPackComments;
+
+    /// Decode every block again and compare it with its text before writing it.
+    bool verify = true;
+};
+
+/// What a conversion did.
+struct GCodeBinaryStats
+{
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    size_t blocks = 0;          // G-code blocks written
+    double seconds = 0.0;
+
+    /// Share of the bytes removed, 0..1.
+    double SizeReduction() const { return bytesIn ? 1.0 - static_cast<double>(bytesOut) / bytesIn : 0.0; }
+};
+
+/// Converts G-code text to binary G-code, streaming: the text is cut into
+/// blocks at line ends, a few blocks per thread are encoded at a time and
+/// written in order, so memory does not grow with the file.
+///
+/// The text goes into the G-code blocks whole, comments included, so the file
+/// decodes (GCodeSource) to exactly the bytes it was made from. The metadata
+/// blocks the format requires are written empty: CuraEngine's settings are
+/// comments in the G-code, and metadata blocks decode to comments of their own.
+class GCodeBinaryWriter
+{
+public:
+    explicit GCodeBinaryWriter(const GCodeBinaryOptions &options = {}) : options_(options) {}
+
+    /// Write the text [begin, end) to `out` as a binary G-code file. Throws
+    /// std::runtime_error if verification finds a block that does not decode
+    /// to its text.
+    GCodeBinaryStats Write(const char *begin, const char *end, std::ostream &out) const;
+
+    /// Convert the file at `inPath` (plain, gzipped or binary G-code) to a
+    /// binary G-code file at `outPath`, which may be the same path: the output
+    /// then goes to a temporary file that replaces the input once complete.
+    /// Throws std::runtime_error if either file cannot be opened or written.
+    GCodeBinaryStats WriteFile(const std::string &inPath, const std::string &outPath) const;
+
+private:
+    std::string encodeGCode(std::string_view text) const;
+
+    GCodeBinaryOptions options_;
+};
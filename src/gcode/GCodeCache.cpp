@@ -0,0 +1,378 @@
+#include "GCodeCache.h"
+#include "GCodeHash.h"
+#include "GCodeSource.h"
+#include "MappedFile.h"
+#include <cfloat>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+namespace
+{
+    constexpr char kMagic[8] = {'R', 'R', 'G', 'C', 'A', 'C', 'H', 'E'};
+    // Bump whenever CacheHeader, LayerEntry, GCodePackedVertex or the parser's
+    // layer split change.
+    constexpr uint32_t kVersion = 12;
+    constexpr uint64_t kDataOffset = 128;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexStride;
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        uint64_t sourceHash;
+        uint64_t layerCount;
+        uint64_t vertexTotal;
+        uint64_t runTotal;
+        uint64_t tileTotal;
+        uint64_t moveTimeTotal;
+        uint64_t payloadHash;
+        float boundsMin[3];
+        float boundsMax[3];
+        float simplifyTolerance;    // GCodeParser settings the toolpaths and estimates were produced with
+        uint64_t machineHash;
+    };
+    static_assert(sizeof(CacheHeader) <= kDataOffset);
+
+    struct LayerEntry
+    {
+        uint64_t firstVertex;
+        uint64_t vertexCount;
+        uint64_t firstRun;
+        uint64_t runCount;
+        uint64_t firstTile;
+        uint64_t tileCount;
+        uint64_t firstMoveTime;
+        uint64_t moveTimeCount;
+        float z;
+        float origin[3];
+        float step[3];
+        float boundsMin[3];
+        float boundsMax[3];
+        float height;
+        double seconds;
+        double filament;
+        double grams;
+    };
+    static_assert(sizeof(LayerEntry) == 144);
+
+    glm::vec3 ToVec(const float (&v)[3])
+    {
+        return glm::vec3(v[0], v[1], v[2]);
+    }
+
+    void FromVec(float (&out)[3], const glm::vec3 &v)
+    {
+        for (int k = 0; k < 3; ++k)
+            out[k] = v[k];
+    }
+
+    uint64_t HashMachine(const GCodeMachineLimits &machine)
+    {
+        static_assert(sizeof(GCodeMachineLimits) == 12 * sizeof(float));
+        return GCodeHash::Bytes(&machine, sizeof(machine));
+    }
+}
+
+struct GCodeCacheWriter::Entry : LayerEntry
+{
+};
+
+GCodeSourceKey GCodeSourceKey::Of(const std::string &path, const GCodeSource &contents, bool withHash)
+{
+    GCodeSourceKey key;
+    key.size = contents.size();
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (!ec)
+        key.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    if (withHash)
+        key.hash = GCodeHash::Bytes(contents.data(), contents.size());
+    return key;
+}
+
+GCodeCache::GCodeCache() = default;
+
+GCodeCache::~GCodeCache() = default;
+
+std::string GCodeCache::SidecarPath(const std::string &gcodePath)
+{
+    return gcodePath + ".rrcache";
+}
+
+bool GCodeCache::Open(const std::string &gcodePath, const GCodeSource &source, float simplifyTolerance,
+                      const GCodeMachineLimits &machine)
+{
+    file_.reset();
+    layerCount_ = 0;
+    table_ = nullptr;
+
+    std::string path = SidecarPath(gcodePath);
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return false;
+    std::unique_ptr<MappedFile> file;
+    try
+        {
+        file = std::make_unique<MappedFile>(path);
+        }
+    catch (const std::exception &e)
+        {
+        std::cerr << "Warning: cannot read G-code cache " << path << ": " << e.what() << std::endl;
+        return false;
+        }
+
+    auto reject = [&](const char *why)
+        {
+        std::cerr << "G-code cache " << path << " ignored: " << why << std::endl;
+        return false;
+        };
+
+    if (file->size() < kDataOffset)
+        return reject("truncated header");
+    CacheHeader h;
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0)
+        return reject("bad magic");
+    if (h.version != kVersion || h.vertexStride != sizeof(GCodePackedVertex))
+        return reject("format version mismatch");
+    if (h.simplifyTolerance != simplifyTolerance)
+        return reject("parsed with a different simplification tolerance");
+    if (h.machineHash != HashMachine(machine))
+        return reject("estimated for different machine limits");
+    GCodeSourceKey key = GCodeSourceKey::Of(gcodePath, source, false);
+    if (h.sourceSize != key.size || h.sourceMtime != key.mtime)
+        return reject("source file changed");
+    if (h.sourceHash != GCodeSourceKey::Of(gcodePath, source).hash)
+        return reject("source file changed");
+
+    uint64_t available = file->size() - kDataOffset;
+    if (h.vertexTotal > available / sizeof(GCodePackedVertex))
+        return reject("bad layer table");
+    available -= h.vertexTotal * sizeof(GCodePackedVertex);
+    if (h.runTotal > available / (2 * sizeof(int32_t)))
+        return reject("bad layer table");
+    available -= h.runTotal * 2 * sizeof(int32_t);
+    if (h.tileTotal > available / sizeof(GCodePackedTile))
+        return reject("bad layer table");
+    available -= h.tileTotal * sizeof(GCodePackedTile);
+    if (h.vertexTotal > available / sizeof(uint32_t))
+        return reject("bad layer table");
+    available -= h.vertexTotal * sizeof(uint32_t);
+    if (h.moveTimeTotal > available / sizeof(float))
+        return reject("bad layer table");
+    available -= h.moveTimeTotal * sizeof(float);
+    if (h.layerCount > available / sizeof(LayerEntry) || h.layerCount * sizeof(LayerEntry) != available)
+        return reject("bad layer table");
+
+    const char *vertexData = file->data() + kDataOffset;
+    const int32_t *runFirst = reinterpret_cast<const int32_t *>(vertexData + h.vertexTotal * sizeof(GCodePackedVertex));
+    const int32_t *runCount = runFirst + h.runTotal;
+    const GCodePackedTile *tiles = reinterpret_cast<const GCodePackedTile *>(runCount + h.runTotal);
+    const uint32_t *moves = reinterpret_cast<const uint32_t *>(tiles + h.tileTotal);
+    const float *moveTimes = reinterpret_cast<const float *>(moves + h.vertexTotal);
+    const LayerEntry *entries = reinterpret_cast<const LayerEntry *>(moveTimes + h.moveTimeTotal);
+    uint64_t payloadHash = 0;
+    for (uint64_t i = 0; i < h.layerCount; ++i)
+        {
+        const LayerEntry &e = entries[i];
+        if (e.firstVertex > h.vertexTotal || e.vertexCount > h.vertexTotal - e.firstVertex ||
+            e.firstRun > h.runTotal || e.runCount > h.runTotal - e.firstRun ||
+            e.firstTile > h.tileTotal || e.tileCount > h.tileTotal - e.firstTile ||
+            e.firstMoveTime > h.moveTimeTotal || e.moveTimeCount > h.moveTimeTotal - e.firstMoveTime)
+            return reject("layer range out of bounds");
+        for (uint64_t t = e.firstTile; t < e.firstTile + e.tileCount; ++t)
+            {
+            if (tiles[t].firstRun > e.runCount || tiles[t].runs > e.runCount - tiles[t].firstRun)
+                return reject("tile out of bounds");
+            }
+        for (uint64_t r = e.firstRun; r < e.firstRun + e.runCount; ++r)
+            {
+            if (runFirst[r] < 0 || runCount[r] < 0 ||
+                static_cast<uint64_t>(runFirst[r]) + static_cast<uint64_t>(runCount[r]) > e.vertexCount)
+                return reject("run out of bounds");
+            }
+        payloadHash = GCodeHash::Combine(payloadHash,
+                                         GCodeHash::Bytes(vertexData + e.firstVertex * sizeof(GCodePackedVertex),
+                                                          e.vertexCount * sizeof(GCodePackedVertex)));
+        }
+    payloadHash = GCodeHash::Combine(payloadHash, GCodeHash::Bytes(runFirst, h.runTotal * 2 * sizeof(int32_t)));
+    payloadHash = GCodeHash::Combine(payloadHash, GCodeHash::Bytes(tiles, h.tileTotal * sizeof(GCodePackedTile)));
+    payloadHash = GCodeHash::Combine(payloadHash, GCodeHash::Bytes(moves, h.vertexTotal * sizeof(uint32_t)));
+    payloadHash = GCodeHash::Combine(payloadHash, GCodeHash::Bytes(moveTimes, h.moveTimeTotal * sizeof(float)));
+    payloadHash = GCodeHash::Combine(payloadHash, GCodeHash::Bytes(entries, h.layerCount * sizeof(LayerEntry)));
+    if (payloadHash != h.payloadHash)
+        return reject("checksum mismatch");
+
+    file_ = std::move(file);
+    layerCount_ = static_cast<size_t>(h.layerCount);
+    table_ = entries;
+    runFirst_ = runFirst;
+    runCount_ = runCount;
+    tiles_ = tiles;
+    moves_ = moves;
+    moveTimes_ = moveTimes;
+    boundsMin_ = ToVec(h.boundsMin);
+    boundsMax_ = ToVec(h.boundsMax);
+    return true;
+}
+
+GCodeCachedLayer GCodeCache::Layer(size_t index) const
+{
+    GCodeCachedLayer layer;
+    if (index >= layerCount_)
+        return layer;
+    const LayerEntry &e = static_cast<const LayerEntry *>(table_)[index];
+    layer.z = e.z;
+    layer.height = e.height;
+    layer.origin = ToVec(e.origin);
+    layer.step = ToVec(e.step);
+    layer.boundsMin = ToVec(e.boundsMin);
+    layer.boundsMax = ToVec(e.boundsMax);
+    layer.vertices = reinterpret_cast<const GCodePackedVertex *>(
+        file_->data() + kDataOffset + e.firstVertex * sizeof(GCodePackedVertex));
+    layer.vertexCount = static_cast<size_t>(e.vertexCount);
+    layer.runFirst = runFirst_ + e.firstRun;
+    layer.runCount = runCount_ + e.firstRun;
+    layer.runs = static_cast<size_t>(e.runCount);
+    layer.tiles = tiles_ + e.firstTile;
+    layer.tileCount = static_cast<size_t>(e.tileCount);
+    layer.moves = moves_ + e.firstVertex;
+    layer.estimate.seconds = e.seconds;
+    layer.estimate.filament = e.filament;
+    layer.estimate.grams = e.grams;
+    layer.estimate.moveTimes.assign(moveTimes_ + e.firstMoveTime, moveTimes_ + e.firstMoveTime + e.moveTimeCount);
+    return layer;
+}
+
+GCodeCacheWriter::GCodeCacheWriter(const std::string &gcodePath, float simplifyTolerance,
+                                   const GCodeMachineLimits &machine)
+    : finalPath_(GCodeCache::SidecarPath(gcodePath)),
+      tempPath_(finalPath_ + ".tmp"),
+      simplifyTolerance_(simplifyTolerance),
+      machineHash_(HashMachine(machine)),
+      boundsMin_(FLT_MAX),
+      boundsMax_(-FLT_MAX)
+{
+    out_.open(tempPath_, std::ios::binary | std::ios::trunc);
+    if (!out_.is_open())
+        {
+        std::cerr << "Warning: cannot write G-code cache " << tempPath_ << std::endl;
+        return;
+        }
+    char zeros[kDataOffset] = {};
+    out_.write(zeros, sizeof(zeros));
+}
+
+GCodeCacheWriter::~GCodeCacheWriter()
+{
+    if (out_.is_open())
+        {
+        out_.close();
+        std::error_code ec;
+        std::filesystem::remove(tempPath_, ec);
+        }
+}
+
+void GCodeCacheWriter::AddLayer(const GCodePackedLayer &layer, const GCodeEstimate &estimate)
+{
+    if (!out_.is_open())
+        return;
+    Entry e{};
+    e.firstVertex = vertexCount_;
+    e.vertexCount = layer.vertices.size();
+    e.firstRun = runFirst_.size();
+    e.runCount = layer.runFirst.size();
+    e.firstTile = tiles_.size();
+    e.tileCount = layer.tiles.size();
+    e.firstMoveTime = moveTimes_.size();
+    e.moveTimeCount = estimate.moveTimes.size();
+    e.z = layer.z;
+    e.height = layer.height;
+    e.seconds = estimate.seconds;
+    e.filament = estimate.filament;
+    e.grams = estimate.grams;
+    FromVec(e.origin, layer.origin);
+    FromVec(e.step, layer.step);
+    FromVec(e.boundsMin, layer.boundsMin);
+    FromVec(e.boundsMax, layer.boundsMax);
+    const size_t bytes = layer.vertices.size() * sizeof(GCodePackedVertex);
+    out_.write(reinterpret_cast<const char *>(layer.vertices.data()), static_cast<std::streamsize>(bytes));
+    payloadHash_ = GCodeHash::Combine(payloadHash_, GCodeHash::Bytes(layer.vertices.data(), bytes));
+    vertexCount_ += layer.vertices.size();
+    runFirst_.insert(runFirst_.end(), layer.runFirst.begin(), layer.runFirst.end());
+    runCount_.insert(runCount_.end(), layer.runCount.begin(), layer.runCount.end());
+    tiles_.insert(tiles_.end(), layer.tiles.begin(), layer.tiles.end());
+    moves_.insert(moves_.end(), layer.moves.begin(), layer.moves.end());
+    moves_.resize(vertexCount_);    // layers packed without move numbers count as none done
+    moveTimes_.insert(moveTimes_.end(), estimate.moveTimes.begin(), estimate.moveTimes.end());
+    entries_.push_back(e);
+    if (layer.HasExtrusions())
+        {
+        boundsMin_ = glm::min(boundsMin_, layer.boundsMin);
+        boundsMax_ = glm::max(boundsMax_, layer.boundsMax);
+        }
+}
+
+bool GCodeCacheWriter::Finish(const GCodeSourceKey &key)
+{
+    if (!out_.is_open())
+        return false;
+
+    // Run starts and lengths are written back to back so they hash as one block.
+    std::vector<int32_t> runs(runFirst_);
+    runs.insert(runs.end(), runCount_.begin(), runCount_.end());
+    out_.write(reinterpret_cast<const char *>(runs.data()), static_cast<std::streamsize>(runs.size() * sizeof(int32_t)));
+    const size_t tileBytes = tiles_.size() * sizeof(GCodePackedTile);
+    out_.write(reinterpret_cast<const char *>(tiles_.data()), static_cast<std::streamsize>(tileBytes));
+    const size_t moveBytes = moves_.size() * sizeof(uint32_t);
+    out_.write(reinterpret_cast<const char *>(moves_.data()), static_cast<std::streamsize>(moveBytes));
+    const size_t moveTimeBytes = moveTimes_.size() * sizeof(float);
+    out_.write(reinterpret_cast<const char *>(moveTimes_.data()), static_cast<std::streamsize>(moveTimeBytes));
+    std::vector<LayerEntry> table(entries_.begin(), entries_.end());
+    const size_t tableBytes = table.size() * sizeof(LayerEntry);
+    out_.write(reinterpret_cast<const char *>(table.data()), static_cast<std::streamsize>(tableBytes));
+
+    CacheHeader h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.vertexStride = sizeof(GCodePackedVertex);
+    h.sourceSize = key.size;
+    h.sourceMtime = key.mtime;
+    h.sourceHash = key.hash;
+    h.layerCount = table.size();
+    h.vertexTotal = vertexCount_;
+    h.runTotal = runFirst_.size();
+    h.tileTotal = tiles_.size();
+    h.moveTimeTotal = moveTimes_.size();
+    h.payloadHash = GCodeHash::Combine(payloadHash_, GCodeHash::Bytes(runs.data(), runs.size() * sizeof(int32_t)));
+    h.payloadHash = GCodeHash::Combine(h.payloadHash, GCodeHash::Bytes(tiles_.data(), tileBytes));
+    h.payloadHash = GCodeHash::Combine(h.payloadHash, GCodeHash::Bytes(moves_.data(), moveBytes));
+    h.payloadHash = GCodeHash::Combine(h.payloadHash, GCodeHash::Bytes(moveTimes_.data(), moveTimeBytes));
+    h.payloadHash = GCodeHash::Combine(h.payloadHash, GCodeHash::Bytes(table.data(), tableBytes));
+    FromVec(h.boundsMin, boundsMin_);
+    FromVec(h.boundsMax, boundsMax_);
+    h.simplifyTolerance = simplifyTolerance_;
+    h.machineHash = machineHash_;
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    out_.close();
+    std::error_code ec;
+    if (!out_)
+        {
+        std::filesystem::remove(tempPath_, ec);
+        return false;
+        }
+
+    std::filesystem::rename(tempPath_, finalPath_, ec);
+    if (ec)
+        {
+        std::cerr << "Warning: cannot move G-code cache into place: " << ec.message() << std::endl;
+        std::filesystem::remove(tempPath_, ec);
+        return false;
+        }
+    return true;
+}
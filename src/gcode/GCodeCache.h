@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GCodeEstimator.h"
+#include "GCodePacking.h"
+
+class MappedFile;
+class GCodeSource;
+
+/// Identity of a G-code file as seen by the toolpath cache.
+struct GCodeSourceKey
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+
+    /// Build the key for `path`, hashing its already decoded `contents` unless `withHash` is false.
+    static GCodeSourceKey Of(const std::string &path, const GCodeSource &contents, bool withHash = true);
+
+    bool operator==(const GCodeSourceKey &) const = default;
+};
+
+/// One layer as stored in a cache file. The pointers lead into the mapped
+/// sidecar; `vertices` can be passed straight to glBufferData.
+struct GCodeCachedLayer
+{
+    float z = 0.0f;
+    float height = 0.0f;
+    glm::vec3 origin{0.0f};
+    glm::vec3 step{0.0f};
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    const GCodePackedVertex *vertices = nullptr;
+    size_t vertexCount = 0;
+    const int32_t *runFirst = nullptr;
+    const int32_t *runCount = nullptr;
+    size_t runs = 0;
+    const GCodePackedTile *tiles = nullptr;
+    size_t tileCount = 0;
+    const uint32_t *moves = nullptr;        // per vertex, see GCodePackedLayer::moves
+    GCodeEstimate estimate;
+};
+
+/// Read side of the binary toolpath sidecar ("<file>.gcode.rrcache").
+///
+/// Layout: a fixed header (magic, version, vertex stride, source key, bounds,
+/// payload hash, parser settings), the packed vertices of every layer back to back, the run
+/// starts and run lengths of every layer, the tiles of every layer, the move number of
+/// every vertex, the move times of every layer, then a table with one entry per layer
+/// (Z, thickness, quantization, vertex, run, tile and move time ranges, bounds, print
+/// time estimate).
+class GCodeCache
+{
+public:
+    GCodeCache();
+    ~GCodeCache();
+
+    static std::string SidecarPath(const std::string &gcodePath);
+
+    /// Map the sidecar of `gcodePath`, whose contents are `source`. Returns false
+    /// if it is missing, stale, was produced with another simplification
+    /// tolerance or machine, or fails validation. Size and mtime are checked
+    /// before the source is hashed, so an obviously stale cache costs nothing.
+    bool Open(const std::string &gcodePath, const GCodeSource &source, float simplifyTolerance,
+              const GCodeMachineLimits &machine);
+
+    size_t LayerCount() const { return layerCount_; }
+    GCodeCachedLayer Layer(size_t index) const;
+
+    const glm::vec3 &GetBoundsMin() const { return boundsMin_; }
+    const glm::vec3 &GetBoundsMax() const { return boundsMax_; }
+
+private:
+    std::unique_ptr<MappedFile> file_;
+    size_t layerCount_ = 0;
+    const void *table_ = nullptr;
+    const int32_t *runFirst_ = nullptr;
+    const int32_t *runCount_ = nullptr;
+    const GCodePackedTile *tiles_ = nullptr;
+    const uint32_t *moves_ = nullptr;
+    const float *moveTimes_ = nullptr;
+    glm::vec3 boundsMin_{0.0f};
+    glm::vec3 boundsMax_{0.0f};
+};
+
+/// Write side of the sidecar. Layers are appended as they are parsed, so the
+/// cache can be produced during a streaming load without keeping a copy.
+/// The file is written under a temporary name and renamed by Finish().
+class GCodeCacheWriter
+{
+public:
+    GCodeCacheWriter(const std::string &gcodePath, float simplifyTolerance, const GCodeMachineLimits &machine);
+    ~GCodeCacheWriter();
+
+    GCodeCacheWriter(const GCodeCacheWriter &) = delete;
+    GCodeCacheWriter &operator=(const GCodeCacheWriter &) = delete;
+
+    bool IsOpen() const { return out_.is_open(); }
+
+    void AddLayer(const GCodePackedLayer &layer, const GCodeEstimate &estimate);
+
+    /// Write the layer table and a header stamped with `key`, then move the file into place.
+    bool Finish(const GCodeSourceKey &key);
+
+private:
+    struct Entry;
+
+    std::string finalPath_;
+    std::string tempPath_;
+    float simplifyTolerance_ = 0.0f;
+    uint64_t machineHash_ = 0;
+    std::ofstream out_;
+    std::vector<Entry> entries_;
+    std::vector<int32_t> runFirst_;
+    std::vector<int32_t> runCount_;
+    std::vector<GCodePackedTile> tiles_;
+    std::vector<uint32_t> moves_;
+    std::vector<float> moveTimes_;
+    uint64_t vertexCount_ = 0;
+    uint64_t payloadHash_ = 0;
+    glm::vec3 boundsMin_;
+    glm::vec3 boundsMax_;
+};
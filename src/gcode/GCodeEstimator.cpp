@@ -0,0 +1,358 @@
+#include "GCodeEstimator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace
+{
+    // A setting's entry anywhere below `node`; fdmprinter.def.json nests them in categories.
+    const json *FindSetting(const json &node, const std::string &key)
+    {
+        if (!node.is_object())
+            return nullptr;
+        auto it = node.find(key);
+        if (it != node.end() && it->is_object())
+            return &*it;
+        for (const auto &child: node)
+            {
+            if (const json *found = FindSetting(child, key))
+                return found;
+            }
+        return nullptr;
+    }
+
+    // "value" if it is a plain number (or a string holding one), else "default_value".
+    bool NumberOf(const json &setting, float &out)
+    {
+        for (const char *field: {"value", "default_value"})
+            {
+            auto it = setting.find(field);
+            if (it == setting.end())
+                continue;
+            if (it->is_number())
+                {
+                out = it->get<float>();
+                return true;
+                }
+            if (it->is_string())
+                {
+                const std::string text = it->get<std::string>();
+                char *end = nullptr;
+                const float value = std::strtof(text.c_str(), &end);
+                if (!text.empty() && end == text.c_str() + text.size())
+                    {
+                    out = value;
+                    return true;
+                    }
+                }
+            }
+        return false;
+    }
+
+    // Highest speed at which a move along `unit` can change by `change` per mm of
+    // travel on each axis, given the inverse per-axis jerk. Branch-free: which axis
+    // binds depends on the direction, and branch prediction cannot guess that.
+    float JerkLimit(const float change[4], const glm::vec3 &perJerk)
+    {
+        const float ratio = std::max({change[0] * perJerk.x, change[1] * perJerk.x,
+                                      change[2] * perJerk.y, change[3] * perJerk.z});
+        return 1.0f / ratio;    // +inf when nothing changes
+    }
+
+    // Highest speed at which the move can start or end at rest.
+    float SafeSpeed(const glm::vec4 &unit, const glm::vec3 &perJerk, float speed)
+    {
+        const float change[4] = {std::abs(unit.x), std::abs(unit.y), std::abs(unit.z), std::abs(unit.w)};
+        return std::min(speed, JerkLimit(change, perJerk));
+    }
+
+    // Duration of a move of `length` that enters at `entry`, cruises at up to `speed`
+    // and leaves at `exit`, accelerating and braking at `acceleration`. Takes the
+    // reciprocals of speed and acceleration as well, which the block already has.
+    float TrapezoidTime(float entry, float exit, float speed, float perSpeed, float acceleration,
+                        float perAcceleration, float length)
+    {
+        const float accelerating = (speed * speed - entry * entry) * 0.5f * perAcceleration;
+        const float braking = (speed * speed - exit * exit) * 0.5f * perAcceleration;
+        if (accelerating + braking <= length)
+            return (2.0f * speed - entry - exit) * perAcceleration + (length - accelerating - braking) * perSpeed;
+        // Triangle: the move never reaches its nominal speed.
+        const float peak = std::max({std::sqrt((2.0f * acceleration * length + entry * entry + exit * exit) * 0.5f),
+                                     entry, exit});
+        return (2.0f * peak - entry - exit) * perAcceleration;
+    }
+}
+
+GCodeMachineLimits GCodeMachineLimits::FromDefinition(const std::string &path)
+{
+    GCodeMachineLimits limits;
+    std::vector<json> chain;
+    std::filesystem::path file(path);
+    try
+        {
+        // Most derived first; inheritance is short, but guard against cycles.
+        while (chain.size() < 16)
+            {
+            std::ifstream in(file);
+            if (!in.is_open())
+                {
+                std::cerr << "Warning: cannot open printer definition " << file.string() << std::endl;
+                break;
+                }
+            json def;
+            in >> def;
+            chain.push_back(std::move(def));
+            auto parent = chain.back().find("inherits");
+            if (parent == chain.back().end() || !parent->is_string())
+                break;
+            file = file.parent_path() / (parent->get<std::string>() + ".def.json");
+            }
+        }
+    catch (const std::exception &e)
+        {
+        std::cerr << "Warning: JSON parse error in printer definition " << file.string() << ": " << e.what() << std::endl;
+        }
+
+    auto read = [&](const std::string &key, float &out)
+        {
+        for (const json &def: chain)
+            {
+            auto overrides = def.find("overrides");
+            if (overrides != def.end() && overrides->contains(key) && NumberOf((*overrides)[key], out))
+                return;
+            auto settings = def.find("settings");
+            const json *setting = settings != def.end() ? FindSetting(*settings, key) : nullptr;
+            if (setting && NumberOf(*setting, out))
+                return;
+            }
+        };
+    const char *axes[4] = {"x", "y", "z", "e"};
+    for (int i = 0; i < 4; ++i)
+        {
+        read(std::string("machine_max_feedrate_") + axes[i], limits.maxFeedrate[i]);
+        read(std::string("machine_max_acceleration_") + axes[i], limits.maxAcceleration[i]);
+        }
+    read("machine_acceleration", limits.acceleration);
+    read("machine_max_jerk_xy", limits.jerkXY);
+    read("machine_max_jerk_z", limits.jerkZ);
+    read("machine_max_jerk_e", limits.jerkE);
+    return limits;
+}
+
+void GCodeTimeEstimator::SetLimits(const GCodeMachineLimits &limits)
+{
+    for (int i = 0; i < 4; ++i)
+        {
+        motion_.perAxisFeedrate[i] = 1.0f / limits.maxFeedrate[i];
+        motion_.perAxisAcceleration[i] = 1.0f / limits.maxAcceleration[i];
+        }
+    motionIndex_ = kNoMotion;
+}
+
+void GCodeTimeEstimator::AddMove(const glm::vec4 &delta, float feedrate, float acceleration, const glm::vec3 &jerk)
+{
+    // Retractions and other E-only moves are timed along the filament; a move
+    // with neither length is dropped, as is one that cannot be timed.
+    const float length2 = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+    if (!(length2 > 0.0f || (length2 == 0.0f && std::abs(delta.w) > 0.0f)) || !(feedrate > 0.0f) ||
+        !(acceleration > 0.0f))
+        return;
+    if (!timed_)
+        {
+        ++untimed_;
+        return;
+        }
+    if (motionIndex_ == kNoMotion || acceleration != motion_.acceleration || jerk != motion_.jerk)
+        {
+        motion_.acceleration = acceleration;
+        motion_.jerk = jerk;
+        motionIndex_ = static_cast<uint32_t>(motions_.size());
+        motions_.push_back(motion_);
+        }
+    moves_.push_back({delta, feedrate, motionIndex_});
+}
+
+void GCodeTimeEstimator::AddDwell(float seconds)
+{
+    if (!(seconds > 0.0f))
+        return;
+    if (!timed_)
+        {
+        ++untimed_;
+        return;
+        }
+    moves_.push_back({glm::vec4(seconds, 0.0f, 0.0f, 0.0f), 0.0f, kDwell});
+}
+
+void GCodeTimeEstimator::Append(GCodeTimeEstimator &&other)
+{
+    const uint32_t offset = static_cast<uint32_t>(motions_.size());
+    motions_.insert(motions_.end(), other.motions_.begin(), other.motions_.end());
+    const size_t first = moves_.size();
+    if (moves_.empty())
+        moves_.swap(other.moves_);
+    else
+        moves_.insert(moves_.end(), other.moves_.begin(), other.moves_.end());
+    for (size_t i = first; offset > 0 && i < moves_.size(); ++i)
+        {
+        if (moves_[i].motion != kDwell)
+            moves_[i].motion += offset;
+        }
+    untimed_ += std::exchange(other.untimed_, 0);
+    other.moves_.clear();
+    other.motions_.clear();
+    other.motionIndex_ = kNoMotion;
+    // The last entry is other's; the next move here looks up its own.
+    motionIndex_ = kNoMotion;
+}
+
+double GCodeTimeEstimator::Flush(std::vector<float> *moveTimes)
+{
+    makeBlocks();
+    double start = 0.0;
+    if (moveTimes)
+        {
+        if (moveTimes->empty())
+            moveTimes->push_back(0.0f);
+        start = moveTimes->back();
+        moveTimes->reserve(moveTimes->size() + blocks_.size() + untimed_);
+        }
+    double seconds = 0.0;
+    size_t first = 0;
+    for (size_t i = 0; i <= blocks_.size(); ++i)
+        {
+        if (i < blocks_.size() && blocks_[i].dwell <= 0.0f)
+            continue;
+        seconds += plan(first, i, start + seconds, moveTimes);
+        if (i < blocks_.size())
+            {
+            seconds += blocks_[i].dwell;
+            if (moveTimes)
+                moveTimes->push_back(static_cast<float>(start + seconds));
+            }
+        first = i + 1;
+        }
+    if (moveTimes)
+        moveTimes->insert(moveTimes->end(), untimed_, static_cast<float>(start + seconds));
+    untimed_ = 0;
+    moves_.clear();
+    motions_.clear();
+    motionIndex_ = kNoMotion;
+    return seconds;
+}
+
+// Work out a block for every queued move: its direction, and its feedrate and
+// acceleration lowered to what every axis allows. Feedrate, acceleration and
+// jerk change rarely, so their reciprocals are only recomputed when they do,
+// and working with reciprocals needs no division per axis.
+void GCodeTimeEstimator::makeBlocks()
+{
+    blocks_.resize(moves_.size());
+    float feedrate = 0.0f;
+    float perFeedrate = 0.0f;
+    uint32_t motion = kNoMotion;
+    const Motion *m = nullptr;
+    float perAcceleration = 0.0f;
+    glm::vec3 perJerk{0.0f};
+    for (size_t i = 0; i < moves_.size(); ++i)
+        {
+        const Move &move = moves_[i];
+        Block &b = blocks_[i];
+        if (move.motion == kDwell)
+            {
+            b = Block();
+            b.dwell = move.delta.x;
+            continue;
+            }
+        if (move.motion != motion)
+            {
+            motion = move.motion;
+            m = &motions_[motion];
+            perAcceleration = 1.0f / m->acceleration;
+            // A zero jerk (M205 X0) would stop at every corner; keep it finite.
+            perJerk = 1.0f / glm::max(m->jerk, glm::vec3(1e-3f));
+            }
+        if (move.feedrate != feedrate)
+            {
+            feedrate = move.feedrate;
+            perFeedrate = 1.0f / feedrate;
+            }
+        const glm::vec4 &delta = move.delta;
+        float length = std::sqrt(delta.x * delta.x + delta.y * delta.y + delta.z * delta.z);
+        if (length <= 0.0f)
+            length = std::abs(delta.w);
+        const float perLength = 1.0f / length;
+        b.unit = glm::vec4(delta.x * perLength, delta.y * perLength, delta.z * perLength, delta.w * perLength);
+        b.perJerk = perJerk;
+        b.length = length;
+        b.perSpeed = perFeedrate;
+        b.perAcceleration = perAcceleration;
+        for (int k = 0; k < 4; ++k)
+            {
+            const float share = std::abs(b.unit[k]);
+            b.perSpeed = std::max(b.perSpeed, share * m->perAxisFeedrate[k]);
+            b.perAcceleration = std::max(b.perAcceleration, share * m->perAxisAcceleration[k]);
+            }
+        b.speed = b.perSpeed == perFeedrate ? feedrate : 1.0f / b.perSpeed;
+        b.acceleration = 1.0f / b.perAcceleration;
+        b.dwell = 0.0f;
+        }
+}
+
+// Plan blocks [first, last), which start and end at rest, and append when each
+// ends to `moveTimes`, counting from `start`. Both passes work on squared
+// junction speeds, so the chain from one junction to the next has no square
+// root in it.
+double GCodeTimeEstimator::plan(size_t first, size_t last, double start, std::vector<float> *moveTimes)
+{
+    if (first >= last)
+        return 0.0;
+    const size_t n = last - first;
+    const Block *b = blocks_.data() + first;
+    speeds_.resize(n + 1);
+    float *v2 = speeds_.data();
+
+    // Backward: every junction no faster than the jerk allows and than the
+    // following block can brake from.
+    const float exit = SafeSpeed(b[n - 1].unit, b[n - 1].perJerk, b[n - 1].speed);
+    v2[n] = exit * exit;
+    for (size_t k = n; k-- > 0;)
+        {
+        float limit;
+        if (k == 0)
+            limit = SafeSpeed(b[k].unit, b[k].perJerk, b[k].speed);
+        else
+            {
+            // Each axis may change speed by at most its jerk across the corner.
+            const glm::vec4 &u = b[k].unit;
+            const glm::vec4 &w = b[k - 1].unit;
+            const float change[4] = {std::abs(u.x - w.x), std::abs(u.y - w.y), std::abs(u.z - w.z),
+                                     std::abs(u.w - w.w)};
+            limit = std::min({b[k - 1].speed, b[k].speed, JerkLimit(change, b[k].perJerk)});
+            }
+        v2[k] = std::min(limit * limit, v2[k + 1] + 2.0f * b[k].acceleration * b[k].length);
+        }
+
+    // Forward: no faster than the block before can accelerate to. Each block's
+    // speeds are final once its exit is, so it is timed in the same pass.
+    double seconds = 0.0;
+    float entry = std::sqrt(v2[0]);
+    for (size_t k = 0; k < n; ++k)
+        {
+        v2[k + 1] = std::min(v2[k + 1], v2[k] + 2.0f * b[k].acceleration * b[k].length);
+        const float exitSpeed = std::sqrt(v2[k + 1]);
+        seconds += TrapezoidTime(entry, exitSpeed, b[k].speed, b[k].perSpeed, b[k].acceleration,
+                                 b[k].perAcceleration, b[k].length);
+        if (moveTimes)
+            moveTimes->push_back(static_cast<float>(start + seconds));
+        entry = exitSpeed;
+        }
+    return seconds;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+/// Motion limits of a printer, named after Cura's machine settings. The
+/// defaults are those of fdmprinter.def.json.
+struct GCodeMachineLimits
+{
+    glm::vec4 maxFeedrate{299792458000.0f};                         // machine_max_feedrate_x/y/z/e, mm/s
+    glm::vec4 maxAcceleration{9000.0f, 9000.0f, 100.0f, 10000.0f};  // machine_max_acceleration_x/y/z/e, mm/s^2
+    float acceleration = 4000.0f;   // machine_acceleration, until the file sets one with M204
+    float jerkXY = 20.0f;           // machine_max_jerk_xy/z/e, mm/s, until the file sets them with M205
+    float jerkZ = 0.4f;
+    float jerkE = 5.0f;
+
+    /// Read the limits from a Cura machine definition such as bambulab_a1mini.def.json,
+    /// following its "inherits" chain through the same directory. Settings that are
+    /// not found keep their defaults; a file that cannot be read is reported on std::cerr.
+    static GCodeMachineLimits FromDefinition(const std::string &path);
+};
+
+/// Print time and filament use of one layer or of a whole print.
+struct GCodeEstimate
+{
+    double seconds = 0.0;
+    double filament = 0.0;      // mm of filament fed, retractions netted out
+    double grams = 0.0;
+    // Per layer: seconds from the start of the layer until its first k moves are
+    // done, pauses counting as moves; moveTimes[0] is 0. Empty for a whole print.
+    std::vector<float> moveTimes;
+    // Per layer, with GCodeParser::SetRecordMoveLines: the line of each of its
+    // moves in turn, counted from the start of the parsed range.
+    std::vector<uint32_t> moveLines;
+
+    /// Adds seconds, filament and grams; the move times stay as they are.
+    GCodeEstimate &operator+=(const GCodeEstimate &other)
+    {
+        seconds += other.seconds;
+        filament += other.filament;
+        grams += other.grams;
+        return *this;
+    }
+};
+
+/// Print-time estimator: a trapezoidal motion planner in the manner of Marlin's.
+/// Moves are queued with the feedrate, acceleration and jerk in force when they
+/// were read, and Flush() plans the queue as one sequence that starts and ends at
+/// rest. Queuing only records a move; Flush() works out the blocks of the whole
+/// queue in one pass before planning it, which keeps the parser's loop lean.
+/// Junction speeds are limited by per-axis jerk, and a backward and a forward
+/// pass make every speed change reachable at the move's acceleration. Unlike
+/// firmware, the whole queue is looked ahead.
+class GCodeTimeEstimator
+{
+public:
+    /// Per-axis feedrate and acceleration limits for the moves queued from now on.
+    /// Without a call, no axis is limited.
+    void SetLimits(const GCodeMachineLimits &limits);
+
+    /// Time the moves queued from now on (the default). Untimed moves are only
+    /// counted: they take no time, so Flush() gives each the time of the one before.
+    void SetTimed(bool timed) { timed_ = timed; }
+
+    /// Queue a move by `delta` (X, Y, Z, E in mm) at `feedrate` mm/s. The feedrate
+    /// and `acceleration` are lowered to what each axis allows (see SetLimits);
+    /// `jerk` holds the XY, Z and E jerk.
+    void AddMove(const glm::vec4 &delta, float feedrate, float acceleration, const glm::vec3 &jerk);
+
+    /// Queue a pause (G4). The printer comes to rest before it.
+    void AddDwell(float seconds);
+
+    /// Append the moves queued in `other`, e.g. the rest of a layer that was read by
+    /// another thread. The result plans exactly as if they had been queued here.
+    void Append(GCodeTimeEstimator &&other);
+
+    /// Plan everything queued, empty the queue and return its duration in seconds.
+    /// With `moveTimes`, also append when each queued move ends, counting from the
+    /// last entry already there (a 0 is put in an empty table first).
+    double Flush(std::vector<float> *moveTimes = nullptr);
+
+    bool Empty() const { return moves_.empty() && untimed_ == 0; }
+
+    /// Number of moves and pauses queued.
+    size_t Size() const { return moves_.size() + untimed_; }
+
+private:
+    static constexpr uint32_t kDwell = ~uint32_t(0);
+    static constexpr uint32_t kNoMotion = ~uint32_t(0);
+
+    // Limits, acceleration and jerk a run of queued moves shares; they change rarely.
+    struct Motion
+    {
+        glm::vec4 perAxisFeedrate{0.0f};
+        glm::vec4 perAxisAcceleration{0.0f};
+        float acceleration = 0.0f;
+        glm::vec3 jerk{-1.0f};
+    };
+
+    // A move as queued, or a pause of delta.x seconds.
+    struct Move
+    {
+        glm::vec4 delta{0.0f};
+        float feedrate = 0.0f;
+        uint32_t motion = kDwell;   // index into motions_
+    };
+
+    struct Block
+    {
+        glm::vec4 unit{0.0f};       // direction; X, Y, Z and E per mm of travel
+        glm::vec3 perJerk{0.0f};    // 1 / jerk of XY, Z and E
+        float length = 0.0f;
+        float speed = 0.0f;         // nominal speed after the axis limits, mm/s
+        float perSpeed = 0.0f;
+        float acceleration = 0.0f;
+        float perAcceleration = 0.0f;
+        float dwell = 0.0f;         // > 0 for a pause, which has no length
+    };
+
+    void makeBlocks();
+    double plan(size_t first, size_t last, double start, std::vector<float> *moveTimes);
+
+    std::vector<Move> moves_;
+    std::vector<Motion> motions_;
+    Motion motion_;                     // in force for the next move
+    uint32_t motionIndex_ = kNoMotion;  // of motion_ in motions_, if it is there
+    bool timed_ = true;
+    size_t untimed_ = 0;                // moves and pauses queued untimed, after moves_
+    std::vector<Block> blocks_;     // scratch for Flush(): the queued moves, worked out
+    std::vector<float> speeds_;     // scratch for plan(): squared speed at each junction
+};
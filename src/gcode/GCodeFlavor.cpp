@@ -0,0 +1,93 @@
+#include "GCodeFlavor.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace
+{
+    // Slicers name themselves in the header and list their settings in a block
+    // at the top (Bambu Studio) or the bottom (PrusaSlicer, OrcaSlicer).
+    constexpr size_t kDetectBytes = size_t(128) << 10;
+
+    struct FlavorSign
+    {
+        std::string_view text;
+        GCodeFlavor flavor;
+    };
+
+    // In order of precedence: OrcaSlicer writes "gcode_flavor = marlin" for
+    // Bambu printers, and Cura's ";FLAVOR:" names the firmware it targets.
+    constexpr FlavorSign kFlavorSigns[] = {
+        {"BambuStudio", GCodeFlavor::Bambu},
+        {"printer_model = Bambu Lab", GCodeFlavor::Bambu},
+        {"gcode_flavor = klipper", GCodeFlavor::Klipper},
+        {"gcode_flavor = marlin", GCodeFlavor::Marlin},
+        {";FLAVOR:", GCodeFlavor::Cura},
+        {"Cura_SteamEngine", GCodeFlavor::Cura},
+    };
+
+    GCodeAction ModeSwitchOf(const GCodeCommand &cmd)
+    {
+        if (cmd.letter == 'G' && (cmd.number == 90 || cmd.number == 91))
+            return cmd.number == 90 ? GCodeAction::Absolute : GCodeAction::Relative;
+        if (cmd.letter == 'M' && (cmd.number == 82 || cmd.number == 83))
+            return cmd.number == 82 ? GCodeAction::AbsoluteE : GCodeAction::RelativeE;
+        return GCodeAction::None;
+    }
+}
+
+const char *GCodeFlavorName(GCodeFlavor flavor)
+{
+    switch (flavor)
+        {
+        case GCodeFlavor::Auto: return "Auto";
+        case GCodeFlavor::Cura: return "Cura";
+        case GCodeFlavor::Marlin: return "Marlin";
+        case GCodeFlavor::Klipper: return "Klipper";
+        case GCodeFlavor::Bambu: return "Bambu";
+        }
+    return "";
+}
+
+GCodeFlavor DetectGCodeFlavor(const char *begin, const char *end)
+{
+    const size_t size = static_cast<size_t>(end - begin);
+    const std::string_view head(begin, std::min(size, kDetectBytes));
+    const std::string_view tail = size > kDetectBytes ? std::string_view(end - kDetectBytes, kDetectBytes)
+                                                      : std::string_view();
+    for (const FlavorSign &sign: kFlavorSigns)
+        {
+        if (head.find(sign.text) != std::string_view::npos || tail.find(sign.text) != std::string_view::npos)
+            return sign.flavor;
+        }
+    return GCodeFlavor::Cura;
+}
+
+void FindGCodeModeSwitches(const char *begin, const char *end, std::vector<GCodeModeSwitch> &out)
+{
+    const size_t first = out.size();
+    const std::string_view text(begin, static_cast<size_t>(end - begin));
+    GCodeCommand cmd;
+    for (const std::string_view needle: {std::string_view("G9"), std::string_view("M8")})
+        {
+        for (size_t pos = text.find(needle); pos != std::string_view::npos; pos = text.find(needle, pos + 2))
+            {
+            // Only a command word counts, not "G9" inside a comment.
+            size_t lineBegin = pos;
+            while (lineBegin > 0 && (text[lineBegin - 1] == ' ' || text[lineBegin - 1] == '\t'))
+                --lineBegin;
+            if (lineBegin > 0 && text[lineBegin - 1] != '\n')
+                continue;
+            const char *eol = static_cast<const char *>(std::memchr(begin + pos, '\n', text.size() - pos));
+            std::string_view line(begin + lineBegin, static_cast<size_t>((eol ? eol : end) - (begin + lineBegin)));
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            GCodeTokenizer::Decode(line, cmd);
+            const GCodeAction action = ModeSwitchOf(cmd);
+            if (action != GCodeAction::None)
+                out.push_back({lineBegin, action});
+            }
+        }
+    std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end(),
+              [](const GCodeModeSwitch &a, const GCodeModeSwitch &b) { return a.offset < b.offset; });
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "GCodeTokenizer.h"
+
+/// Which firmware dialect a file is written for. The dialects agree on G0/G1,
+/// but not on what G91 does to E, which arc forms they accept, or which
+/// optional commands (jerk, firmware retraction) exist at all.
+enum class GCodeFlavor : uint8_t
+{
+    Auto,       // decide from the file (see DetectGCodeFlavor)
+    Cura,       // Cura's output, and files that name no firmware
+    Marlin,
+    Klipper,
+    Bambu       // Bambu Lab firmware, as Bambu Studio and OrcaSlicer write for it
+};
+
+/// Display name of a flavor, e.g. "Klipper".
+const char *GCodeFlavorName(GCodeFlavor flavor);
+
+/// Guess the flavor from what slicers write at the top of a file and in the
+/// settings block at its end: Bambu Studio's name or a Bambu Lab printer model,
+/// "gcode_flavor = klipper" or "= marlin", Cura's ";FLAVOR:" header. Anything
+/// else is read as Cura writes it.
+GCodeFlavor DetectGCodeFlavor(const char *begin, const char *end);
+
+/// What a command does, as far as the parser is concerned.
+enum class GCodeAction : uint8_t
+{
+    None,           // nothing the toolpath or the estimate depends on
+    Move,           // G0, G1
+    ArcClockwise,   // G2
+    ArcCounterClockwise,    // G3
+    Dwell,          // G4
+    Retract,        // G10, firmware retraction
+    Unretract,      // G11
+    Absolute,       // G90
+    Relative,       // G91
+    SetPosition,    // G92
+    AbsoluteE,      // M82
+    RelativeE,      // M83
+    Temperature,    // M104, M109
+    Fan,            // M106
+    FanOff,         // M107
+    Acceleration,   // M204
+    Jerk,           // M205
+    Tool            // T<n>
+};
+
+struct GCodeCommandSpec
+{
+    char letter;
+    int number;
+    GCodeAction action;
+};
+
+/// Flavor policies. Each lists the commands it has beyond kCommon and how it
+/// reads the ones whose meaning differs; GCodeDispatch turns the lists into
+/// lookup tables at compile time, and code templated on a policy tests its
+/// constants with `if constexpr`, so a flavor pays nothing for what it lacks.
+namespace GCodeFlavors
+{
+    constexpr GCodeCommandSpec kCommon[] = {
+        {'G', 0, GCodeAction::Move},
+        {'G', 1, GCodeAction::Move},
+        {'G', 4, GCodeAction::Dwell},
+        {'G', 90, GCodeAction::Absolute},
+        {'G', 91, GCodeAction::Relative},
+        {'G', 92, GCodeAction::SetPosition},
+        {'M', 82, GCodeAction::AbsoluteE},
+        {'M', 83, GCodeAction::RelativeE},
+        {'M', 104, GCodeAction::Temperature},
+        {'M', 106, GCodeAction::Fan},
+        {'M', 107, GCodeAction::FanOff},
+        {'M', 109, GCodeAction::Temperature},
+        {'M', 204, GCodeAction::Acceleration},
+    };
+
+    /// Marlin 2: G90 and G91 switch E along with X, Y and Z, until the next
+    /// M82 or M83. Arcs take a centre (I, J) or a radius (R).
+    struct Marlin
+    {
+        static constexpr GCodeCommandSpec kCommands[] = {
+            {'G', 2, GCodeAction::ArcClockwise},
+            {'G', 3, GCodeAction::ArcCounterClockwise},
+            {'G', 10, GCodeAction::Retract},
+            {'G', 11, GCodeAction::Unretract},
+            {'M', 205, GCodeAction::Jerk},
+        };
+        static constexpr bool kPositioningSetsE = true;
+        static constexpr bool kArcRadius = true;
+        static constexpr bool kBareSetPositionZeroes = false;
+    };
+
+    /// Marlin as Cura drives it. Cura writes no arcs itself; post-processors
+    /// such as ArcWelder add them, always with I and J.
+    struct Cura
+    {
+        static constexpr GCodeCommandSpec kCommands[] = {
+            {'G', 2, GCodeAction::ArcClockwise},
+            {'G', 3, GCodeAction::ArcCounterClockwise},
+            {'G', 10, GCodeAction::Retract},
+            {'G', 11, GCodeAction::Unretract},
+            {'M', 205, GCodeAction::Jerk},
+        };
+        static constexpr bool kPositioningSetsE = true;
+        static constexpr bool kArcRadius = false;
+        static constexpr bool kBareSetPositionZeroes = false;
+    };
+
+    /// E is relative while either G91 or M83 is in force, so M83 outlives G90.
+    /// Arcs need I and J, there is no M205 (square corner velocity is set by
+    /// an extended command instead), and a G92 without words zeroes every axis.
+    struct Klipper
+    {
+        static constexpr GCodeCommandSpec kCommands[] = {
+            {'G', 2, GCodeAction::ArcClockwise},
+            {'G', 3, GCodeAction::ArcCounterClockwise},
+            {'G', 10, GCodeAction::Retract},
+            {'G', 11, GCodeAction::Unretract},
+        };
+        static constexpr bool kPositioningSetsE = false;
+        static constexpr bool kArcRadius = false;
+        static constexpr bool kBareSetPositionZeroes = true;
+    };
+
+    /// Relative E works as on Klipper; Bambu's start G-code wraps absolute
+    /// moves in G90 without repeating its M83. Arcs come with I and J, and
+    /// there is no firmware retraction.
+    struct Bambu
+    {
+        static constexpr GCodeCommandSpec kCommands[] = {
+            {'G', 2, GCodeAction::ArcClockwise},
+            {'G', 3, GCodeAction::ArcCounterClockwise},
+            {'M', 205, GCodeAction::Jerk},
+        };
+        static constexpr bool kPositioningSetsE = false;
+        static constexpr bool kArcRadius = false;
+        static constexpr bool kBareSetPositionZeroes = false;
+    };
+}
+
+/// Constant-time command lookup for one flavor: a table per command letter,
+/// indexed by the command number.
+template <typename Flavor>
+class GCodeDispatch
+{
+public:
+    static constexpr int kNumbers = 256;
+
+    static GCodeAction Of(const GCodeCommand &cmd)
+    {
+        if (cmd.letter == 'T')
+            return cmd.number >= 0 ? GCodeAction::Tool : GCodeAction::None;
+        if (cmd.number < 0 || cmd.number >= kNumbers)
+            return GCodeAction::None;
+        if (cmd.letter == 'G')
+            return kG[static_cast<size_t>(cmd.number)];
+        if (cmd.letter == 'M')
+            return kM[static_cast<size_t>(cmd.number)];
+        return GCodeAction::None;
+    }
+
+private:
+    using Table = std::array<GCodeAction, kNumbers>;
+
+    static constexpr Table build(char letter)
+    {
+        Table table{};
+        for (const GCodeCommandSpec &c: GCodeFlavors::kCommon)
+            {
+            if (c.letter == letter)
+                table[static_cast<size_t>(c.number)] = c.action;
+            }
+        for (const GCodeCommandSpec &c: Flavor::kCommands)
+            {
+            if (c.letter == letter)
+                table[static_cast<size_t>(c.number)] = c.action;
+            }
+        return table;
+    }
+
+    static constexpr Table kG = build('G');
+    static constexpr Table kM = build('M');
+};
+
+/// Call `fn` with the policy of `flavor` (Cura for Auto), so the code it
+/// runs is compiled for that flavor alone.
+template <typename Fn>
+decltype(auto) WithGCodeFlavor(GCodeFlavor flavor, Fn &&fn)
+{
+    switch (flavor)
+        {
+        case GCodeFlavor::Marlin: return fn(GCodeFlavors::Marlin{});
+        case GCodeFlavor::Klipper: return fn(GCodeFlavors::Klipper{});
+        case GCodeFlavor::Bambu: return fn(GCodeFlavors::Bambu{});
+        default: return fn(GCodeFlavors::Cura{});
+        }
+}
+
+/// Whether coordinates are absolute or relative to the current position.
+struct GCodeModes
+{
+    bool relative = false;      // G91 in force
+    bool relativeE = false;     // M83 in force, or on Marlin G91
+
+    /// Follow G90, G91, M82 or M83; returns false for other actions.
+    template <typename Flavor>
+    bool Apply(GCodeAction action)
+    {
+        switch (action)
+            {
+            case GCodeAction::Absolute:
+            case GCodeAction::Relative:
+                relative = action == GCodeAction::Relative;
+                if constexpr (Flavor::kPositioningSetsE)
+                    relativeE = relative;
+                return true;
+            case GCodeAction::AbsoluteE:
+            case GCodeAction::RelativeE:
+                relativeE = action == GCodeAction::RelativeE;
+                return true;
+            default:
+                return false;
+            }
+    }
+
+    template <typename Flavor>
+    bool RelativeE() const
+    {
+        if constexpr (Flavor::kPositioningSetsE)
+            return relativeE;
+        else
+            return relative || relativeE;
+    }
+};
+
+/// A G90, G91, M82 or M83 line, at `offset` bytes into the buffer searched.
+struct GCodeModeSwitch
+{
+    size_t offset = 0;
+    GCodeAction action = GCodeAction::None;
+};
+
+/// Append the mode switches in [begin, end) to `out`, in file order. They are
+/// rare, so this searches for "G9" and "M8" rather than decoding every line.
+void FindGCodeModeSwitches(const char *begin, const char *end, std::vector<GCodeModeSwitch> &out);
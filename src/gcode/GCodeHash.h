@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// Fast non-cryptographic 64-bit hashing, for the toolpath cache's checksums
+/// and for recognising layers that did not change between two slices.
+namespace GCodeHash
+{
+    inline uint64_t Mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+    /// Hash `size` bytes, a word at a time.
+    inline uint64_t Bytes(const void *data, size_t size, uint64_t seed = 0)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(data);
+        uint64_t h = Mix(seed ^ size);
+        while (size >= 8)
+            {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            h = (h ^ Mix(w)) * 0x9e3779b97f4a7c15ull;
+            p += 8;
+            size -= 8;
+            }
+        uint64_t tail = 0;
+        if (size)
+            std::memcpy(&tail, p, size);
+        return Mix(h ^ tail);
+    }
+
+    /// Fold `v` into the running hash `h`; the order matters.
+    inline uint64_t Combine(uint64_t h, uint64_t v)
+    {
+        return Mix(h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+    }
+}
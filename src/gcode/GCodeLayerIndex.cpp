@@ -0,0 +1,186 @@
+#include "GCodeLayerIndex.h"
+#include "GCodeTokenizer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    std::string_view LineAt(const char *lineBegin, const char *end)
+    {
+        const char *nl = static_cast<const char *>(std::memchr(lineBegin, '\n', static_cast<size_t>(end - lineBegin)));
+        std::string_view line(lineBegin, static_cast<size_t>((nl ? nl : end) - lineBegin));
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        return line;
+    }
+
+    // Byte ranges of a buffer where G91 is in force, in file order.
+    using Stretches = std::vector<std::pair<size_t, size_t> >;
+
+    Stretches RelativeStretches(const std::vector<GCodeModeSwitch> &switches, size_t size)
+    {
+        Stretches stretches;
+        for (const GCodeModeSwitch &s: switches)
+            {
+            if (s.action == GCodeAction::Relative && (stretches.empty() || stretches.back().second != size))
+                stretches.emplace_back(s.offset, size);
+            else if (s.action == GCodeAction::Absolute && !stretches.empty() && stretches.back().second == size)
+                stretches.back().second = s.offset;
+            }
+        return stretches;
+    }
+
+    bool Inside(const Stretches &stretches, size_t offset)
+    {
+        auto it = std::upper_bound(stretches.begin(), stretches.end(), offset,
+                                   [](size_t off, const std::pair<size_t, size_t> &s) { return off < s.first; });
+        return it != stretches.begin() && offset < std::prev(it)->second;
+    }
+
+    // Last Z word on a move in [begin, pos); this is the parser's current Z at `pos`.
+    // Moves in the `relative` stretches (offsets from `begin`) step from the Z
+    // before them, so the walk goes on to the last absolute Z word, or to the
+    // start of the buffer, where the parser starts at 0.
+    bool ZBefore(const char *begin, const char *pos, float &z, const Stretches &relative = {})
+    {
+        GCodeCommand cmd;
+        std::vector<float> steps;
+        auto sum = [&](float from)
+            {
+            z = from;
+            for (auto it = steps.rbegin(); it != steps.rend(); ++it)
+                z += *it;
+            return true;
+            };
+        const char *lineEnd = pos;
+        while (lineEnd > begin)
+            {
+            --lineEnd;
+            const char *lineBegin = lineEnd;
+            while (lineBegin > begin && lineBegin[-1] != '\n')
+                --lineBegin;
+            std::string_view line(lineBegin, static_cast<size_t>(lineEnd - lineBegin));
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            GCodeTokenizer::Decode(line, cmd);
+            if (cmd.IsMove() && cmd.Has(GCodeCommand::HasZ))
+                {
+                if (!Inside(relative, static_cast<size_t>(lineBegin - begin)))
+                    return sum(cmd.z);
+                steps.push_back(cmd.z);
+                }
+            lineEnd = lineBegin;
+            }
+        return !steps.empty() && sum(0.0f);
+    }
+}
+
+const char *GCodeLayerIndex::FindMarker(const char *begin, const char *end)
+{
+    std::string_view text(begin, static_cast<size_t>(end - begin));
+    size_t pos = 0;
+    while ((pos = text.find(";LAYER:", pos)) != std::string_view::npos)
+        {
+        if ((pos == 0 || text[pos - 1] == '\n') && IsMarker(LineAt(begin + pos, end)))
+            return begin + pos;
+        pos += 7;
+        }
+    return end;
+}
+
+void GCodeLayerIndex::Build(const char *begin, const char *end)
+{
+    marks_.clear();
+    modeSwitches_.clear();
+    size_ = static_cast<size_t>(end - begin);
+    FindGCodeModeSwitches(begin, end, modeSwitches_);
+    const Stretches relative = RelativeStretches(modeSwitches_, size_);
+
+    const char *marker = FindMarker(begin, end);
+    if (marker != end)
+        {
+        source_ = Source::Markers;
+        GCodeCommand cmd;
+        size_t line = 0;
+        const char *previous = begin;
+        float z = 0.0f;
+        while (marker != end)
+            {
+            line += static_cast<size_t>(std::count(previous, marker, '\n'));
+            const char *next = FindMarker(marker + 1, end);
+
+            // The layer's Z is the first Z word before the next marker. A layer
+            // without one keeps the last Z seen before its marker. Relative Z
+            // needs the Z before it, which may be anywhere back to the file start.
+            bool found = false;
+            GCodeLineScanner scanner(marker, next);
+            std::string_view text;
+            scanner.Next(text);
+            for (const char *lineBegin = scanner.Position(); !found && scanner.Next(text);
+                 lineBegin = scanner.Position())
+                {
+                GCodeTokenizer::Decode(text, cmd);
+                if (cmd.IsMove() && cmd.Has(GCodeCommand::HasZ))
+                    {
+                    z = cmd.z;
+                    if (Inside(relative, static_cast<size_t>(lineBegin - begin)))
+                        {
+                        float before = 0.0f;
+                        ZBefore(begin, lineBegin, before, relative);
+                        z = before + cmd.z;
+                        }
+                    found = true;
+                    }
+                }
+            if (!found && relative.empty())
+                ZBefore(previous, marker, z);
+            else if (!found)
+                ZBefore(begin, marker, z, relative);
+            marks_.push_back({static_cast<size_t>(marker - begin), line, z});
+            previous = marker;
+            marker = next;
+            }
+        return;
+        }
+
+    source_ = Source::ZChanges;
+    GCodeLineScanner scanner(begin, end);
+    GCodeCommand cmd;
+    std::string_view text;
+    float currentZ = 0.0f;
+    size_t line = 0;
+    const char *lineBegin = begin;
+    bool relativeZ = false;
+    while (scanner.Next(text))
+        {
+        GCodeTokenizer::Decode(text, cmd);
+        if (cmd.letter == 'G' && (cmd.number == 90 || cmd.number == 91))
+            relativeZ = cmd.number == 91;
+        const float z = relativeZ ? currentZ + cmd.z : cmd.z;
+        if (cmd.IsMove() && cmd.Has(GCodeCommand::HasZ) && z != currentZ)
+            {
+            currentZ = z;
+            marks_.push_back({static_cast<size_t>(lineBegin - begin), line, currentZ});
+            }
+        ++line;
+        lineBegin = scanner.Position();
+        }
+}
+
+std::pair<size_t, size_t> GCodeLayerIndex::ByteRange(size_t first, size_t last) const
+{
+    if (first >= marks_.size() || first > last)
+        return {0, 0};
+    size_t from = first == 0 ? 0 : marks_[first].offset;
+    size_t to = last + 1 < marks_.size() ? marks_[last + 1].offset : size_;
+    return {from, to};
+}
+
+int GCodeLayerIndex::LayerAtOffset(size_t offset) const
+{
+    if (marks_.empty())
+        return -1;
+    auto it = std::upper_bound(marks_.begin(), marks_.end(), offset,
+                               [](size_t off, const GCodeLayerMark &m) { return off < m.offset; });
+    return it == marks_.begin() ? 0 : static_cast<int>(it - marks_.begin()) - 1;
+}
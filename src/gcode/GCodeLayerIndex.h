@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "GCodeFlavor.h"
+
+/// Where one layer starts in a G-code buffer.
+struct GCodeLayerMark
+{
+    size_t offset = 0;   // byte offset of the line that starts the layer
+    size_t line = 0;     // 0-based line number of that line
+    float z = 0.0f;      // layer height, as GCodeParser reports it
+};
+
+/// Lightweight index of the layers in a G-code buffer, built without parsing geometry.
+///
+/// Layers start at the ";LAYER:<n>" comments CuraEngine writes. Files without
+/// those markers fall back to the parser's old rule: every move with a new Z
+/// starts a layer. A layer's Z is the first Z word after its marker (the Z that
+/// was current at the marker if it has none), so z-hops do not create layers.
+/// Z words under G91 count from the Z before them, as the parser reads them.
+///
+/// Layer k covers [Offset(k), Offset(k + 1)); anything before the first layer,
+/// such as the start G-code and the prime line, belongs to layer 0. This is the
+/// same split GCodeParser uses, so GCodeParser::ParseLayerRange can parse any
+/// range of layers on its own.
+class GCodeLayerIndex
+{
+public:
+    enum class Source
+    {
+        Markers,    // ";LAYER:" comments
+        ZChanges    // no markers found; a new Z starts a layer
+    };
+
+    /// Index [begin, end). Marker files cost little more than a memchr pass;
+    /// the Z-change fallback has to decode every line.
+    void Build(const char *begin, const char *end);
+
+    size_t Count() const { return marks_.size(); }
+    bool Empty() const { return marks_.empty(); }
+    const GCodeLayerMark &operator[](size_t layer) const { return marks_[layer]; }
+    const std::vector<GCodeLayerMark> &Marks() const { return marks_; }
+    Source GetSource() const { return source_; }
+
+    /// Byte range [first, second) covering layers first..last inclusive.
+    std::pair<size_t, size_t> ByteRange(size_t first, size_t last) const;
+
+    /// Layer containing the given byte offset, or -1 if the index is empty.
+    int LayerAtOffset(size_t offset) const;
+
+    /// The G90, G91, M82 and M83 lines of the buffer, in file order, so a parse
+    /// that starts partway through knows which coordinates are relative there.
+    const std::vector<GCodeModeSwitch> &ModeSwitches() const { return modeSwitches_; }
+
+    /// True if `line` (without its newline) is a Cura layer marker.
+    static bool IsMarker(std::string_view line)
+    {
+        return line.size() > 7 && line.compare(0, 7, ";LAYER:") == 0;
+    }
+
+    /// First marker line in [begin, end), or `end` if there is none.
+    static const char *FindMarker(const char *begin, const char *end);
+
+private:
+    std::vector<GCodeLayerMark> marks_;
+    std::vector<GCodeModeSwitch> modeSwitches_;
+    size_t size_ = 0;
+    Source source_ = Source::Markers;
+};
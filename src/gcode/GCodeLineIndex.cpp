@@ -0,0 +1,99 @@
+#include "GCodeLineIndex.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    // Shares smaller than this are not worth a thread.
+    constexpr size_t kMinShareBytes = size_t(4) << 20;
+
+    const char *NextNewline(const char *pos, const char *end)
+    {
+        return static_cast<const char *>(std::memchr(pos, '\n', static_cast<size_t>(end - pos)));
+    }
+
+    const char *NextLine(const char *pos, const char *end)
+    {
+        const char *nl = NextNewline(pos, end);
+        return nl ? nl + 1 : end;
+    }
+}
+
+void GCodeLineIndex::Build(const char *begin, const char *end, unsigned threads)
+{
+    size_ = static_cast<size_t>(end - begin);
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    const size_t shares = std::clamp<size_t>(size_ / kMinShareBytes, 1, threads);
+    std::vector<const char *> bounds(shares + 1);
+    for (size_t i = 0; i <= shares; ++i)
+        bounds[i] = begin + size_ / shares * i;
+    bounds[shares] = end;
+    auto forEachShare = [&](auto &&fn)
+        {
+        if (shares == 1)
+            {
+            fn(0);
+            return;
+            }
+        std::vector<std::thread> workers;
+        workers.reserve(shares);
+        for (size_t i = 0; i < shares; ++i)
+            workers.emplace_back(fn, i);
+        for (auto &w: workers)
+            w.join();
+        };
+
+    // Newlines per share, then the number of the first newline in each.
+    std::vector<size_t> newlines(shares + 1, 0);
+    forEachShare([&](size_t i)
+        {
+        size_t n = 0;
+        for (const char *p = bounds[i]; (p = NextNewline(p, bounds[i + 1])) != nullptr; ++p)
+            ++n;
+        newlines[i + 1] = n;
+        });
+    for (size_t i = 0; i < shares; ++i)
+        newlines[i + 1] += newlines[i];
+    count_ = newlines[shares] + (size_ > 0 && end[-1] != '\n' ? 1 : 0);
+
+    // Line k * kStride starts after newline k * kStride - 1 (counting from 0).
+    checkpoints_.assign((count_ + kStride - 1) / kStride, 0);
+    forEachShare([&](size_t i)
+        {
+        size_t line = newlines[i];
+        for (const char *p = bounds[i]; (p = NextNewline(p, bounds[i + 1])) != nullptr; ++p)
+            {
+            ++line;
+            if (line % kStride == 0 && line / kStride < checkpoints_.size())
+                checkpoints_[line / kStride] = static_cast<size_t>(p + 1 - begin);
+            }
+        });
+}
+
+size_t GCodeLineIndex::Offset(const char *begin, size_t line) const
+{
+    if (line >= count_)
+        return size_;
+    const char *end = begin + size_;
+    const char *p = begin + checkpoints_[line / kStride];
+    for (size_t skip = line % kStride; skip > 0; --skip)
+        p = NextLine(p, end);
+    return static_cast<size_t>(p - begin);
+}
+
+std::string_view GCodeLineIndex::Line(const char *begin, size_t line) const
+{
+    if (line >= count_)
+        return {};
+    const char *end = begin + size_;
+    const char *first = begin + Offset(begin, line);
+    const char *last = NextLine(first, end);
+    std::string_view text(first, static_cast<size_t>(last - first));
+    if (!text.empty() && text.back() == '\n')
+        text.remove_suffix(1);
+    if (!text.empty() && text.back() == '\r')
+        text.remove_suffix(1);
+    return text;
+}
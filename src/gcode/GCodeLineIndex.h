@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+/// Line index of a G-code buffer, for showing any of its lines without reading
+/// the ones before.
+///
+/// Only every kStride-th line start is stored, so fifty million lines take
+/// about 6 MB; a line is found from the checkpoint before it by skipping at
+/// most kStride - 1 newlines. Lines end at '\n', and a '\r' before it is not
+/// part of the line. A buffer that does not end in a newline still counts its
+/// last line.
+class GCodeLineIndex
+{
+public:
+    static constexpr size_t kStride = 64;
+
+    /// Index [begin, end) with `threads` threads (0 selects
+    /// std::thread::hardware_concurrency()): each counts the newlines of its
+    /// share with memchr, then records the checkpoints in it, numbered from the
+    /// counts of the shares before.
+    void Build(const char *begin, const char *end, unsigned threads = 0);
+
+    size_t Count() const { return count_; }
+
+    /// Byte offset of line `line` in the buffer `begin` that was indexed; the
+    /// buffer size for `line` >= Count().
+    size_t Offset(const char *begin, size_t line) const;
+
+    /// Line `line` of the buffer `begin` that was indexed, without its line end;
+    /// empty for `line` >= Count().
+    std::string_view Line(const char *begin, size_t line) const;
+
+private:
+    std::vector<size_t> checkpoints_;   // offset of lines 0, kStride, 2 * kStride, ...
+    size_t count_ = 0;
+    size_t size_ = 0;
+};
@@ -0,0 +1,88 @@
+#include "GCodeLod.h"
+#include "GCodeParser.h"
+
+namespace
+{
+    // Chord tolerance per level, mm; about a quarter pixel at the level's closest distance.
+    constexpr float kTolerance[GCodeLod::kLevels] = {0.0f, 0.1f, 0.4f};
+
+    bool Keep(GCodeFeature feature, int level)
+    {
+        if (IsTravel(feature))
+            return false;
+        if (level < 2)
+            return true;
+        switch (feature)
+            {
+            case GCodeFeature::WallOuter:
+            case GCodeFeature::Support:
+            case GCodeFeature::SupportInterface:
+            case GCodeFeature::Skirt:
+            case GCodeFeature::PrimeTower:
+                return true;
+            default:
+                return false;
+            }
+    }
+
+    // Print settings of a packed vertex, decoded as Pack will encode them again.
+    void CopySettings(const GCodePackedVertex &from, GCodePathVertex &to)
+    {
+        to.speed = GCodePacking::DecodeSpeed(from.speed);
+        to.fan = from.fan;
+        to.temperature = GCodePacking::DecodeTemperature(from.temperature);
+        to.tool = from.tool;
+    }
+}
+
+GCodePackedLayer GCodeLod::Build(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, int level)
+{
+    // Unpack the kept segments into a path, starting a new run wherever a
+    // dropped segment leaves a gap.
+    std::vector<GCodePathVertex> path;
+    for (size_t r = 0; r < layer.runFirst.size(); ++r)
+        {
+        const GCodePackedVertex *run = vertices + layer.runFirst[r];
+        bool open = false;
+        for (int32_t j = 1; j < layer.runCount[r]; ++j)
+            {
+            const auto feature = static_cast<GCodeFeature>(run[j].feature & ~GCodePacking::kRunStartBit);
+            if (!Keep(feature, level))
+                {
+                open = false;
+                continue;
+                }
+            if (!open)
+                {
+                GCodePathVertex start;
+                start.pos = GCodePacking::Unpack(layer, run[j - 1]);
+                start.feature = feature;
+                start.flags = GCodePathVertex::RunStart;
+                CopySettings(run[j], start);
+                path.push_back(start);
+                open = true;
+                }
+            GCodePathVertex v;
+            v.pos = GCodePacking::Unpack(layer, run[j]);
+            v.feature = feature;
+            v.area = GCodePacking::DecodeArea(run[j].area);
+            CopySettings(run[j], v);
+            path.push_back(v);
+            }
+        }
+    GCodeParser::Simplify(path, kTolerance[level]);
+    GCodePackedLayer coarse = GCodePacking::Pack(layer.z, layer.height, path);
+    // Playback draws the partial layer at full detail (see GCodeModel::DrawUpToMove).
+    std::vector<uint32_t>().swap(coarse.moves);
+    return coarse;
+}
+
+int GCodeLod::Select(int previous, float pixelsPerMm)
+{
+    int level = previous;
+    while (level > 0 && pixelsPerMm > kPixelsPerMm[level - 1] * (1.0f + kHysteresis))
+        --level;
+    while (level < kLevels - 1 && pixelsPerMm < kPixelsPerMm[level] * (1.0f - kHysteresis))
+        ++level;
+    return level;
+}
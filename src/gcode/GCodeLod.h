@@ -0,0 +1,29 @@
+#pragma once
+#include "GCodePacking.h"
+
+/// Coarser versions of packed layers, for views where a tile covers few pixels.
+///
+/// Level 0 is the layer itself. Level 1 drops travel moves and simplifies the
+/// extrusions with a chord tolerance well under a pixel at that distance.
+/// Level 2 keeps only what faces outward (outer walls, skirt, support, prime
+/// tower) at a coarser tolerance; from far away the inside of a print is hidden
+/// by its walls anyway. Levels are built from packed layers, so layers read
+/// from the toolpath cache get them too.
+namespace GCodeLod
+{
+    constexpr int kLevels = 3;
+
+    /// A tile moves from level l to l + 1 when it gets smaller than
+    /// kPixelsPerMm[l] pixels per mm on screen, give or take kHysteresis.
+    constexpr float kPixelsPerMm[kLevels - 1] = {4.0f, 1.0f};
+    constexpr float kHysteresis = 0.2f;
+
+    /// Build level `level` (1 .. kLevels - 1) of `layer`, whose packed vertices
+    /// are `vertices` (its own, or mapped from the cache).
+    GCodePackedLayer Build(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, int level);
+
+    /// Level for a tile seen at `pixelsPerMm`, given its level last frame.
+    /// Leaving a level takes a margin of kHysteresis past its threshold, so
+    /// tiles do not flicker between levels while the camera moves slowly.
+    int Select(int previous, float pixelsPerMm);
+}
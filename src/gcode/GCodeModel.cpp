@@ -6,74 +6,774 @@
 #include <cfloat>   // for FLT_MAX
 #include <algorithm>
 #include <cmath>
+#include <filesystem>
 #include "GCodeParser.h"
-#include "GCodeUploader.h"
+#include "GCodeArena.h"
+#include "GCodeCache.h"
+#include "GCodeLayerIndex.h"
+#include "GCodeLod.h"
+#include "GCodePacking.h"
+#include "GCodeSource.h"
+#include <limits>
+#include <iterator>
+#include <map>
 
-GCodeModel::GCodeModel(const std::string &gcodePath)
+namespace
 {
+    std::vector<GCodePackedLayer> BuildLod(const GCodePackedLayer &packed, const GCodePackedVertex *vertices)
+    {
+        std::vector<GCodePackedLayer> levels;
+        for (int level = 1; level < GCodeLod::kLevels; ++level)
+            levels.push_back(GCodeLod::Build(packed, vertices, level));
+        return levels;
+    }
+}
+
+GCodeModel::GCodeModel(const std::string &gcodePath, LoadMode mode, const GCodeMachineLimits &machine,
+                       std::shared_ptr<const GCodeModel> previous)
+    : path_(gcodePath), machine_(machine)
+{
+    // Picking reads the full-detail layers back from their compressed copies.
+    arenas_[0].SetKeepCompressed(true);
+    source_ = sourcePromise_.get_future().share();
+
+    // A model that is still loading is changing on the GL thread; don't look at it.
+    if (previous && !previous->IsLoading())
+        {
+        for (size_t i = 0; i < previous->layerHashes_.size(); ++i)
+            {
+            if (previous->layerUploaded_[i] && previous->lodReady_[i] && previous->layerVertexCounts_[i] > 0)
+                reusable_.emplace(previous->layerHashes_[i], static_cast<int>(i));
+            }
+        if (!reusable_.empty())
+            previous_ = std::move(previous);
+        }
+
+    loading_ = true;
+    parsing_ = true;
+    if (mode == LoadMode::Progressive)
+        {
+        // The file is opened, and a compressed one decoded, on the loader too;
+        // a file that cannot be read loads as an empty model.
+        loader_ = std::thread([this]
+            {
+            try
+                {
+                loadLayers(true);
+                }
+            catch (const std::exception &e)
+                {
+                std::cerr << "Warning: " << e.what() << std::endl;
+                setSource(nullptr);
+                parsing_ = false;
+                }
+            });
+        return;
+        }
+
+    loadLayers(false);
+    PumpUploads(std::numeric_limits<double>::infinity());
+    layerZs_.shrink_to_fit();
+}
+
+GCodeModel::~GCodeModel()
+{
+    cancel_ = true;
+    if (loader_.joinable())
+        loader_.join();
+    {
+        std::lock_guard lk(gridMutex_);
+        gridStop_ = true;
+    }
+    gridWake_.notify_one();
+    if (gridWorker_.joinable())
+        gridWorker_.join();
+}
+
+// Fill pending_ with every layer of the file: straight from the sidecar cache
+// when it is valid, otherwise by parsing the source and writing a fresh cache.
+// Runs on loader_ in progressive mode, inline otherwise. Checking the cache
+// takes the whole text; without one, a progressive load parses a compressed
+// file as it is decoded, so its first layers show before the rest is.
+void GCodeModel::loadLayers(bool streaming)
+{
+    std::error_code ec;
+    if (streaming && !std::filesystem::exists(GCodeCache::SidecarPath(path_), ec))
+        {
+        parseLayers(nullptr, true);
+        return;
+        }
+    auto source = std::make_shared<const GCodeSource>(path_);
+    setSource(source);
+    if (!loadCachedLayers(*source))
+        parseLayers(std::move(source), streaming);
+}
+
+// Hand the text to GetSource(), once, and read the print time it reports.
+void GCodeModel::setSource(std::shared_ptr<const GCodeSource> source)
+{
+    if (sourceSet_)
+        return;
+    sourceSet_ = true;
+    if (source)
+        reportedSeconds_ = GCodeParser::ReportedPrintTime(source->data(), source->data() + source->size());
+    sourcePromise_.set_value(std::move(source));
+}
+
+// Queue every layer from the sidecar cache, if it is valid for `source`.
+bool GCodeModel::loadCachedLayers(const GCodeSource &source)
+{
+    auto cache = std::make_unique<GCodeCache>();
+    if (cache->Open(path_, source, kSimplifyTolerance, machine_))
+        {
+        std::vector<bool> reused(cache->LayerCount());
+        {
+            std::lock_guard lk(pendingMutex_);
+            pendingLayerZs_.clear();
+            for (size_t i = 0; i < cache->LayerCount(); ++i)
+                {
+                GCodeCachedLayer c = cache->Layer(i);
+                PendingLayer layer;
+                layer.index = i;
+                layer.packed.z = c.z;
+                layer.packed.height = c.height;
+                layer.packed.origin = c.origin;
+                layer.packed.step = c.step;
+                layer.packed.boundsMin = c.boundsMin;
+                layer.packed.boundsMax = c.boundsMax;
+                layer.packed.runFirst.assign(c.runFirst, c.runFirst + c.runs);
+                layer.packed.runCount.assign(c.runCount, c.runCount + c.runs);
+                layer.packed.tiles.assign(c.tiles, c.tiles + c.tileCount);
+                layer.moves = GCodePacking::CompressMoves(c.moves, c.vertexCount);
+                GCodePacking::GrowSettingsRange(c.vertices, c.vertexCount, layer.packed.settingsMin,
+                                                layer.packed.settingsMax);
+                layer.mapped = c.vertices;
+                layer.mappedCount = c.vertexCount;
+                layer.estimate = c.estimate;
+                hashLayer(layer, c.vertices, c.vertexCount);
+                reused[i] = layer.reuse >= 0;
+                pending_.push_back(std::move(layer));
+                pendingLayerZs_.push_back(c.z);
+                }
+            layerTablePending_ = true;
+            cache_ = std::move(cache);
+        }
+        // Every layer is queued at full detail; coarser levels follow, except
+        // for layers that come with them from the previous model.
+        for (size_t i = 0; i < cache_->LayerCount() && !cancel_.load(); ++i)
+            {
+            if (reused[i])
+                continue;
+            GCodeCachedLayer c = cache_->Layer(i);
+            GCodePackedLayer packed;
+            packed.z = c.z;
+            packed.height = c.height;
+            packed.origin = c.origin;
+            packed.step = c.step;
+            packed.runFirst.assign(c.runFirst, c.runFirst + c.runs);
+            packed.runCount.assign(c.runCount, c.runCount + c.runs);
+            PendingLayer layer;
+            layer.index = i;
+            layer.lod = BuildLod(packed, c.vertices);
+            layer.lodOnly = true;
+            std::lock_guard lk(pendingMutex_);
+            pending_.push_back(std::move(layer));
+            }
+        parsing_ = false;
+        return true;
+        }
+    return false;
+}
+
+// Parse `source` into pending_ and write the sidecar cache. Without a source,
+// open the file and parse it as it is decoded (see GCodeStreamingParse).
+void GCodeModel::parseLayers(std::shared_ptr<const GCodeSource> source, bool streaming)
+{
+    auto publishIndex = [&](const GCodeLayerIndex &index)
+        {
+        std::lock_guard lk(pendingMutex_);
+        pendingIndex_ = index;
+        pendingLayerZs_.clear();
+        for (const auto &mark: index.Marks())
+            pendingLayerZs_.push_back(mark.z);
+        layerTablePending_ = true;
+        };
+
+    // Layers can arrive out of order when RequestLayers() jumps ahead; the cache
+    // is written in order, so early arrivals wait in `unwritten`.
+    GCodeLayerIndex index;
+    GCodeCacheWriter writer(path_, kSimplifyTolerance, machine_);
+    std::vector<bool> delivered;
+    std::map<size_t, PendingLayer> unwritten;
+    size_t nextWrite = 0;
+    float lastZ = 0.0f;
+    auto deliver = [&](size_t i, float z, std::vector<GCodePathVertex> &&path, const GCodeEstimate &estimate)
+        {
+        if (i >= delivered.size())
+            delivered.resize(i + 1);
+        if (delivered[i])
+            return;
+        delivered[i] = true;
+
+        // Layer thickness sets the ribbon height. Without an index the layers
+        // stream in order, so the previous one is the last delivered.
+        const float below = i == 0 ? 0.0f : i - 1 < index.Count() ? index[i - 1].z : lastZ;
+        float height = z - below;
+        if (!(height > 0.0f))
+            height = kDefaultLayerHeight;
+        lastZ = z;
+
+        PendingLayer layer;
+        layer.index = i;
+        layer.packed = GCodePacking::Pack(z, height, path);
+        layer.estimate = estimate;
+        if (i == nextWrite)
+            {
+            writer.AddLayer(layer.packed, layer.estimate);
+            for (auto it = unwritten.find(++nextWrite); it != unwritten.end(); it = unwritten.find(++nextWrite))
+                {
+                writer.AddLayer(it->second.packed, it->second.estimate);
+                unwritten.erase(it);
+                }
+            }
+        else if (writer.IsOpen())
+            {
+            unwritten.emplace(i, layer);
+            }
+        hashLayer(layer, layer.packed.vertices.data(), layer.packed.vertices.size());
+        if (layer.reuse < 0)
+            layer.lod = BuildLod(layer.packed, layer.packed.vertices.data());
+        layer.moves = GCodePacking::CompressMoves(layer.packed.moves.data(), layer.packed.moves.size());
+        std::vector<uint32_t>().swap(layer.packed.moves);
+        std::lock_guard lk(pendingMutex_);
+        pending_.push_back(std::move(layer));
+        };
+
     GCodeParser parser;
-    parser.Parse(gcodePath, layers_, layerZs_);
-    if (!layers_.empty())
+    parser.SetSimplifyTolerance(kSimplifyTolerance);
+    parser.SetMachineLimits(machine_);
+
+    // Only the text decoded so far is there to index; the index comes last,
+    // as for a file without markers below. A plain file is never fed.
+    bool decoding = false;
+    if (!source)
+        {
+        size_t i = 0;
+        GCodeStreamingParse stream(parser, [&](float z, std::vector<GCodePathVertex> &&path,
+                                               const GCodeEstimate &estimate)
+            {
+            deliver(i++, z, std::move(path), estimate);
+            return !cancel_.load();
+            });
+        source = std::make_shared<const GCodeSource>(path_, [&](const char *begin, const char *end)
+            {
+            decoding = true;
+            return stream.Feed(begin, end) && !cancel_.load();
+            });
+        setSource(source);
+        if (decoding)
+            stream.Finish(source->data(), source->data() + source->size());
+        }
+    const char *begin = source->data();
+    const char *end = begin + source->size();
+
+    // Indexing a file without ";LAYER:" markers means decoding all of it, so a
+    // progressive load streams such files front to back and indexes them last.
+    const bool markers = !decoding && GCodeLayerIndex::FindMarker(begin, end) != end;
+    if (markers || !streaming)
+        {
+        index.Build(begin, end);
+        publishIndex(index);
+        delivered.resize(index.Count());
+        }
+    parser.SetFlavor(DetectGCodeFlavor(begin, end));    // once, not for every range parsed below
+    if (decoding)
+        {
+        if (!cancel_.load())
+            {
+            index.Build(begin, end);
+            publishIndex(index);
+            }
+        }
+    else if (!streaming)
         {
-        computeBounds();
-        GCodeUploader uploader;
-        uploader.Upload(layers_, layerVAOs_, layerVBOs_);
-        layerVertexCounts_.reserve(layers_.size());
-        for (const auto &layer: layers_)
+        std::vector<std::vector<GCodePathVertex> > layers;
+        std::vector<float> layerZs;
+        std::vector<GCodeEstimate> estimates;
+        parser.ParseBuffer(begin, end, layers, layerZs, &estimates);
+        for (size_t i = 0; i < layers.size(); ++i)
+            deliver(i, layerZs[i], std::move(layers[i]), estimates[i]);
+        }
+    else if (!markers)
+        {
+        size_t i = 0;
+        parser.ParseBufferStreaming(begin, end, [&](float z, std::vector<GCodePathVertex> &&path,
+                                                    const GCodeEstimate &estimate)
             {
-            layerVertexCounts_.push_back(layer.size());
+            deliver(i++, z, std::move(path), estimate);
+            return !cancel_.load();
+            });
+        if (!cancel_.load())
+            {
+            index.Build(begin, end);
+            publishIndex(index);
             }
-        std::vector<std::vector<ColoredVertex> >().swap(layers_);
-        layerZs_.shrink_to_fit();
-        ready_ = true;
         }
     else
         {
-        std::cerr << "Warning: GCodeModel loaded no extruding moves from " << gcodePath << std::endl;
+        // Parse front to back, but break off whenever the viewer asks for a
+        // specific range, parse that, then resume at the first missing layer.
+        size_t next = 0;
+        while (!cancel_.load())
+            {
+            size_t first = 0, last = 0;
+            bool priority = false;
+            {
+                std::lock_guard lk(pendingMutex_);
+                if (requestPending_.load())
+                    {
+                    first = static_cast<size_t>(requestFirst_);
+                    last = std::min(static_cast<size_t>(requestLast_), index.Count() - 1);
+                    requestPending_ = false;
+                    priority = true;
+                    }
+            }
+            if (priority)
+                {
+                if (first >= index.Count())
+                    continue;
+                while (first <= last && delivered[first])
+                    ++first;
+                if (first > last)
+                    continue;
+                }
+            else
+                {
+                while (next < index.Count() && delivered[next])
+                    ++next;
+                if (next == index.Count())
+                    break;
+                first = next;
+                last = index.Count() - 1;
+                }
+
+            size_t layer = first;
+            parser.ParseLayerRange(begin, end, index, first, last,
+                                   [&](float z, std::vector<GCodePathVertex> &&path, const GCodeEstimate &estimate)
+                {
+                deliver(layer++, z, std::move(path), estimate);
+                return !cancel_.load() && (priority || !requestPending_.load());
+                });
+            }
         }
+    if (!cancel_.load() && nextWrite == delivered.size())
+        writer.Finish(GCodeSourceKey::Of(path_, *source));
+    parsing_ = false;
 }
 
-GCodeModel::~GCodeModel()
+bool GCodeModel::IsLoading() const
+{
+    return loading_;
+}
+
+void GCodeModel::RequestLayers(int first, int last)
+{
+    if (!loading_ || first < 0 || last < first)
+        return;
+    if (first == requestedFirst_ && last == requestedLast_)
+        return;
+    requestedFirst_ = first;
+    requestedLast_ = last;
+
+    bool missing = false;
+    for (int i = first; i <= last && !missing; ++i)
+        missing = i >= GetLayerCount() || !layerUploaded_[i];
+    if (!missing)
+        return;
+    std::lock_guard lk(pendingMutex_);
+    requestFirst_ = first;
+    requestLast_ = last;
+    requestPending_ = true;
+}
+
+void GCodeModel::SetVramBudget(size_t bytes)
 {
-    // Delete all VAOs and VBOs
-    for (unsigned int vao: layerVAOs_)
+    vramBudget_ = bytes;
+    for (size_t level = 1; level < arenas_.size(); ++level)
+        arenas_[level].SetKeepCompressed(bytes > 0);
+}
+
+size_t GCodeModel::GetResidentBytes() const
+{
+    size_t total = 0;
+    for (const GCodeArena &arena: arenas_)
+        total += arena.ResidentBytes();
+    return total;
+}
+
+size_t GCodeModel::GetCompressedBytes() const
+{
+    size_t total = 0;
+    for (const GCodeArena &arena: arenas_)
+        total += arena.CompressedBytes();
+    for (const std::vector<uint8_t> &moves: layerMoves_)
+        total += moves.capacity();
+    return total;
+}
+
+// Bring back the evicted pages that draws asked for, within the frame's upload
+// time but at least one.
+void GCodeModel::restorePages(std::chrono::steady_clock::time_point start, double budgetMs)
+{
+    for (GCodeArena &arena: arenas_)
         {
-        if (vao)
-            glDeleteVertexArrays(1, &vao);
+        while (arena.RestoreWanted())
+            {
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs)
+                return;
+            }
         }
-    for (unsigned int vbo: layerVBOs_)
+}
+
+// Evict the least recently drawn pages of any level until the budget is kept,
+// leaving those the last frame drew.
+void GCodeModel::evictPages()
+{
+    size_t resident = GetResidentBytes();
+    while (resident > vramBudget_)
         {
-        if (vbo)
-            glDeleteBuffers(1, &vbo);
+        GCodeArena *oldest = nullptr;
+        auto when = lastPump_;
+        for (GCodeArena &arena: arenas_)
+            {
+            const auto t = arena.OldestEvictable();
+            if (t < when)
+                {
+                oldest = &arena;
+                when = t;
+                }
+            }
+        if (!oldest)
+            break;
+        oldest->EvictOldest();
+        resident = GetResidentBytes();
         }
 }
 
-void GCodeModel::computeBounds()
+bool GCodeModel::PumpUploads(double budgetMs)
 {
-    // Compute center_ and radius_ over all layers
-    glm::vec3 mn(FLT_MAX), mx(-FLT_MAX);
-    for (const auto &layerVerts: layers_)
+    auto start = std::chrono::steady_clock::now();
+    if (vramBudget_ > 0)
+        restorePages(start, budgetMs);
+    if (!loading_)
         {
-        for (const auto &v: layerVerts)
+        if (vramBudget_ > 0)
             {
-            mn = glm::min(mn, v.pos);
-            mx = glm::max(mx, v.pos);
+            evictPages();
+            lastPump_ = start;
             }
+        return false;
         }
-    if (layers_.empty())
+
+    bool added = false;
+    {
+        std::lock_guard lk(pendingMutex_);
+        if (layerTablePending_)
+            {
+            index_ = std::move(pendingIndex_);
+            resizeLayers(std::max(layerZs_.size(), pendingLayerZs_.size()));
+            std::copy(pendingLayerZs_.begin(), pendingLayerZs_.end(), layerZs_.begin());
+            layerTablePending_ = false;
+            added = true;
+            }
+    }
+
+    for (;;)
+        {
+        PendingLayer layer;
         {
-        center_ = glm::vec3(0.0f);
-        radius_ = 0.0f;
+            std::lock_guard lk(pendingMutex_);
+            if (pending_.empty())
+                break;
+            // Layers the viewer asked for go first.
+            auto it = pending_.begin();
+            if (requestedFirst_ >= 0)
+                {
+                auto wanted = std::find_if(pending_.begin(), pending_.end(), [&](const PendingLayer &p)
+                    {
+                    return static_cast<int>(p.index) >= requestedFirst_ && static_cast<int>(p.index) <= requestedLast_;
+                    });
+                if (wanted != pending_.end())
+                    it = wanted;
+                }
+            layer = std::move(*it);
+            pending_.erase(it);
+        }
+        if (layer.index >= layerUploaded_.size())
+            resizeLayers(layer.index + 1);
+        // The arenas keep the layer time for ColorMode::LayerTime. A level of
+        // detail that comes on its own follows its layer, which is uploaded by now.
+        const float seconds = static_cast<float>(layer.lodOnly ? layerEstimates_[layer.index].seconds
+                                                               : layer.estimate.seconds);
+        // A layer the previous model already has is copied on the GPU, every level at once.
+        for (size_t level = 1; layer.reuse >= 0 && level < arenas_.size(); ++level)
+            arenas_[level].CopyLayer(static_cast<int>(layer.index), previous_->arenas_[level], layer.reuse, seconds);
+        if (layer.reuse >= 0)
+            lodReady_[layer.index] = true;
+        for (size_t level = 1; level <= layer.lod.size(); ++level)
+            {
+            GCodePackedLayer &lod = layer.lod[level - 1];
+            lod.seconds = seconds;
+            arenas_[level].AddLayer(static_cast<int>(layer.index), lod.vertices.data(), lod.vertices.size(), lod);
+            growCells(lod);
+            }
+        lodReady_[layer.index] = lodReady_[layer.index] || !layer.lod.empty();
+        if (layer.lodOnly)
+            {
+            added = true;
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs)
+                break;
+            continue;
+            }
+        GCodePackedLayer &packed = layer.packed;
+        const GCodePackedVertex *data = layer.mapped ? layer.mapped : packed.vertices.data();
+        const size_t count = layer.mapped ? layer.mappedCount : packed.vertices.size();
+        packed.seconds = seconds;
+        if (layer.reuse >= 0)
+            arenas_[0].CopyLayer(static_cast<int>(layer.index), previous_->arenas_[0], layer.reuse, seconds);
+        else
+            arenas_[0].AddLayer(static_cast<int>(layer.index), data, count, packed);
+        growCells(packed);
+        layerHashes_[layer.index] = layer.hash;
+        layerVertexCounts_[layer.index] = count;
+        layerZs_[layer.index] = packed.z;
+        layerUploaded_[layer.index] = true;
+        layerMoves_[layer.index] = std::move(layer.moves);
+        if (expandedLayer_ == static_cast<int>(layer.index))
+            expandedLayer_ = -1;
+        layerEstimates_[layer.index] = std::move(layer.estimate);
+        printEstimate_ += layerEstimates_[layer.index];
+        if (packed.HasExtrusions())
+            growBounds(packed.boundsMin, packed.boundsMax);
+        settingsMin_ = glm::min(settingsMin_, packed.settingsMin);
+        settingsMax_ = glm::max(settingsMax_, packed.settingsMax);
+        if (count > 0)
+            ready_ = true;
+        added = true;
+        if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs)
+            break;
+        }
+
+    if (added)
+        {
+        layerStartTimes_.assign(1, 0.0);
+        for (const GCodeEstimate &e: layerEstimates_)
+            layerStartTimes_.push_back(layerStartTimes_.back() + e.seconds);
+        }
+
+    if (vramBudget_ > 0)
+        {
+        evictPages();
+        lastPump_ = start;
+        }
+
+    if (!parsing_.load())
+        {
+        std::lock_guard lk(pendingMutex_);
+        if (pending_.empty() && !layerTablePending_)
+            finishLoading();
+        }
+    return added;
+}
+
+void GCodeModel::resizeLayers(size_t count)
+{
+    layerVertexCounts_.resize(count, 0);
+    layerUploaded_.resize(count, false);
+    layerEstimates_.resize(count);
+    layerMoves_.resize(count);
+    layerHashes_.resize(count, 0);
+    lodReady_.resize(count, false);
+    layerZs_.resize(count, layerZs_.empty() ? 0.0f : layerZs_.back());
+    const glm::ivec2 cells = cellMax_ - cellMin_ + 1;
+    lodState_.resize(count * static_cast<size_t>(std::max(cells.x, 0) * std::max(cells.y, 0)), 0);
+}
+
+// Hash a layer about to be queued and look for the same layer in the previous
+// model. Runs on the loader thread; reusable_ does not change while it runs.
+void GCodeModel::hashLayer(PendingLayer &layer, const GCodePackedVertex *vertices, size_t count) const
+{
+    layer.hash = GCodePacking::Hash(layer.packed, vertices, count);
+    auto it = reusable_.find(layer.hash);
+    if (it != reusable_.end() && previous_->layerVertexCounts_[static_cast<size_t>(it->second)] == count)
+        layer.reuse = it->second;
+}
+
+// Widen the level-of-detail grid to the tiles of `packed`. This only happens
+// while loading, so simply start every cell over at full detail.
+void GCodeModel::growCells(const GCodePackedLayer &packed)
+{
+    glm::ivec2 mn = cellMin_, mx = cellMax_;
+    for (const GCodePackedTile &t: packed.tiles)
+        {
+        const glm::ivec2 cell(t.cellX, t.cellY);
+        if (mn.x > mx.x)
+            mn = mx = cell;
+        mn = glm::min(mn, cell);
+        mx = glm::max(mx, cell);
+        }
+    if (mn == cellMin_ && mx == cellMax_)
         return;
+    cellMin_ = mn;
+    cellMax_ = mx;
+    const glm::ivec2 cells = cellMax_ - cellMin_ + 1;
+    lodState_.assign(layerZs_.size() * static_cast<size_t>(cells.x * cells.y), 0);
+}
+
+// Called once every queued layer is on the GPU.
+void GCodeModel::finishLoading()
+{
+    if (loader_.joinable())
+        loader_.join();
+    cache_.reset();
+    source_ = {};
+    sourcePromise_ = {};
+    loading_ = false;
+    if (!ready_)
+        std::cerr << "Warning: GCodeModel loaded no moves from " << path_ << std::endl;
+    previous_.reset();
+}
+
+void GCodeModel::growBounds(const glm::vec3 &mn, const glm::vec3 &mx)
+{
+    boundsMin_ = glm::min(boundsMin_, mn);
+    boundsMax_ = glm::max(boundsMax_, mx);
+    center_ = (boundsMin_ + boundsMax_) * 0.5f;
+    radius_ = glm::length(boundsMax_ - center_) * 0.5f;
+}
+
+void GCodeModel::SetFeatureVisible(GCodeFeature feature, bool visible)
+{
+    const uint32_t bit = 1u << static_cast<unsigned>(feature);
+    visibleFeatures_ = visible ? visibleFeatures_ | bit : visibleFeatures_ & ~bit;
+}
+
+glm::vec2 GCodeModel::GetColorRange(ColorMode mode) const
+{
+    glm::vec2 range(0.0f);
+    switch (mode)
+        {
+        case ColorMode::Speed:
+        case ColorMode::Flow:
+        case ColorMode::Fan:
+        case ColorMode::Temperature:
+            {
+            // GCodePacking::GrowSettingsRange keeps them in this order.
+            const int i = static_cast<int>(mode) - static_cast<int>(ColorMode::Speed);
+            if (settingsMin_[i] <= settingsMax_[i])
+                range = glm::vec2(settingsMin_[i], settingsMax_[i]);
+            break;
+            }
+        case ColorMode::LayerTime:
+            {
+            range = glm::vec2(FLT_MAX, 0.0f);
+            for (size_t i = 0; i < layerEstimates_.size(); ++i)
+                {
+                if (!layerUploaded_[i])
+                    continue;
+                const float seconds = static_cast<float>(layerEstimates_[i].seconds);
+                range = glm::vec2(std::min(range.x, seconds), std::max(range.y, seconds));
+                }
+            if (range.x > range.y)
+                range = glm::vec2(0.0f);
+            break;
+            }
+        default:
+            break;
+        }
+    // A fan that never changes speed would leave no ramp; show it against 0..100%.
+    if (mode == ColorMode::Fan && range.x == range.y)
+        range = glm::vec2(0.0f, 100.0f);
+    return range;
+}
+
+// Palette and visibility mask for GCodeFeature values and the colour mode, read
+// by gcode_shader.vert and gcode_ribbon.vert, plus the bead parameters only the
+// latter uses.
+void GCodeModel::setFeatureUniforms(Shader &shader) const
+{
+    uint64_t &sent = paletteSent_[shader.ID];
+    if (sent != paletteVersion_)
+        {
+        shader.setVec3Array("featureColors", featureColors_.data(), static_cast<int>(featureColors_.size()));
+        shader.setVec3Array("toolColors", toolColors_.data(), static_cast<int>(toolColors_.size()));
+        shader.setInt("colorMode", static_cast<int>(colorMode_));
+        shader.setFloat("maxArea", GCodePacking::kMaxArea);
+        shader.setFloat("maxSpeed", GCodePacking::kMaxSpeed);
+        shader.setFloat("temperatureStep", GCodePacking::kTemperatureStep);
+        sent = paletteVersion_;
+        }
+    // The range grows while layers load, and features are hidden without a palette change.
+    shader.setInt("visibleFeatures", static_cast<int>(visibleFeatures_));
+    shader.setVec2("colorRange", GetColorRange(colorMode_));
+    if (drawStyle_ == DrawStyle::Ribbons)
+        shader.setFloat("travelWidth", kTravelWidth);
+}
+
+// Level of detail of one tile cell this frame, from its closest point to the eye.
+int GCodeModel::lodLevel(const View &view, int layer, int cellX, int cellY, int maxLevel) const
+{
+    if (!lodReady_[layer] || cellX < cellMin_.x || cellY < cellMin_.y || cellX > cellMax_.x || cellY > cellMax_.y)
+        return 0;
+    const float size = GCodePacking::kTileSize;
+    const float z = layerZs_[layer];
+    const glm::vec3 mn(cellX * size, cellY * size, z);
+    const glm::vec3 mx(mn.x + size, mn.y + size, z);
+    const float distance = glm::length(view.eye - glm::clamp(view.eye, mn, mx));
+    const size_t columns = static_cast<size_t>(cellMax_.x - cellMin_.x + 1);
+    const size_t rows = static_cast<size_t>(cellMax_.y - cellMin_.y + 1);
+    uint8_t &state = lodState_[(static_cast<size_t>(layer) * rows + static_cast<size_t>(cellY - cellMin_.y)) * columns +
+                               static_cast<size_t>(cellX - cellMin_.x)];
+    state = static_cast<uint8_t>(GCodeLod::Select(state, view.pixelScale / std::max(distance, 1.0f)));
+    return std::min<int>(state, maxLevel);
+}
+
+void GCodeModel::drawLayers(int first, int last, Shader &shader, const View *view) const
+{
+    shader.use();
+    // We assume the caller already set “view”, “projection” and, for ribbons, “cameraPos”.
+    setFeatureUniforms(shader);
+    const Frustum *frustum = view ? &view->frustum : nullptr;
+    auto draw = [&](const GCodeArena &arena, const GCodeArena::TileFilter *filter)
+        {
+        if (drawStyle_ == DrawStyle::Ribbons)
+            arena.DrawRibbons(first, last, shader, frustum, filter);
+        else
+            arena.Draw(first, last, shader, frustum, filter);
+        };
+    if (!lodEnabled_ || !view || view->pixelScale <= 0.0f)
+        {
+        draw(arenas_[0], nullptr);
+        return;
+        }
+
+    // The coarsest level is mostly outer walls; with those hidden it would show
+    // nothing, so stop one short. The top layer is seen whole from above and
+    // never goes past level 1 either.
+    const int maxLevel = IsFeatureVisible(GCodeFeature::WallOuter) ? GCodeLod::kLevels - 1 : GCodeLod::kLevels - 2;
+    const int topLevel = std::min(maxLevel, 1);
+    for (int level = 0; level < GCodeLod::kLevels; ++level)
+        {
+        const GCodeArena::TileFilter filter = [&, level](int layer, int cellX, int cellY)
+            {
+            return lodLevel(*view, layer, cellX, cellY, layer == last ? topLevel : maxLevel) == level;
+            };
+        draw(arenas_[level], &filter);
         }
-    boundsMin_ = mn;
-    boundsMax_ = mx;
-    center_ = (mn + mx) * 0.5f;
-    radius_ = glm::length(mx - center_) * 0.5f;
 }
 
 // Draw a single layer index. Returns false if invalid index or not ready.
-bool GCodeModel::DrawLayer(int layerIndex, Shader &lineShader) const
+bool GCodeModel::DrawLayer(int layerIndex, Shader &shader, const View *view) const
 {
     if (!ready_)
         return false;
@@ -82,25 +782,12 @@ bool GCodeModel::DrawLayer(int layerIndex, Shader &lineShader) const
     if (layerVertexCounts_[layerIndex] == 0)
         return false;
 
-    lineShader.use();
-    // We assume the caller already set “view” and “projection” uniforms.
-    // If your shader has a uniform “lineColor”, you can set it here. E.g.:
-    if (lineShader.hasUniform("lineColor"))
-        {
-        lineShader.setVec3("lineColor", glm::vec3(1.0f, 0.0f, 0.0f)); // default red for toolpaths
-        }
-    // Or pick a gradient color based on layerIndex, etc.
-
-    glBindVertexArray(layerVAOs_[layerIndex]);
-    glLineWidth(2.0f);
-    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(layerVertexCounts_[layerIndex]));
-    glLineWidth(1.0f);
-    glBindVertexArray(0);
+    drawLayers(layerIndex, layerIndex, shader, view);
     return true;
 }
 
 // Draw layers 0..maxLayerIndex inclusive. If maxLayerIndex < 0, draw all layers.
-void GCodeModel::DrawUpToLayer(int maxLayerIndex, Shader &lineShader) const
+void GCodeModel::DrawUpToLayer(int maxLayerIndex, Shader &shader, const View *view) const
 {
     if (!ready_)
         return;
@@ -110,21 +797,230 @@ void GCodeModel::DrawUpToLayer(int maxLayerIndex, Shader &lineShader) const
                   ? layerCount - 1
                   : std::clamp(maxLayerIndex, 0, layerCount - 1);
 
-    lineShader.use();
-    if (lineShader.hasUniform("lineColor"))
+    drawLayers(0, end, shader, view);
+}
+
+// Draw the layers below `position` whole and its own layer up to the moves done.
+// Each tile of a layer is a contiguous slice in print order, so the moves done
+// are a prefix of every tile, found with a binary search over its move numbers.
+void GCodeModel::DrawUpToMove(const PlaybackPosition &position, Shader &shader, const View *view) const
+{
+    if (!ready_ || position.layer < 0 || position.layer >= GetLayerCount())
+        return;
+    const int layer = position.layer;
+    if (layer > 0)
+        drawLayers(0, layer - 1, shader, view);
+    const std::vector<uint32_t> &moves = movesOf(layer);
+    if (moves.empty())
+        return;
+
+    shader.use();
+    setFeatureUniforms(shader);
+    const Frustum *frustum = view ? &view->frustum : nullptr;
+    const GCodeArena::TileClip clip = [&](int, size_t first, size_t count)
+        {
+        if (first >= moves.size())
+            return size_t(0);
+        const auto begin = moves.begin() + static_cast<std::ptrdiff_t>(first);
+        const auto end = begin + static_cast<std::ptrdiff_t>(std::min(count, moves.size() - first));
+        return static_cast<size_t>(std::upper_bound(begin, end, position.moves) - begin);
+        };
+    if (drawStyle_ == DrawStyle::Ribbons)
+        arenas_[0].DrawRibbons(layer, layer, shader, frustum, nullptr, &clip);
+    else
+        arenas_[0].Draw(layer, layer, shader, frustum, nullptr, &clip);
+}
+
+// The move numbers of `layer`, expanded; the last layer asked for is kept, since
+// playback asks for the same one every frame.
+const std::vector<uint32_t> &GCodeModel::movesOf(int layer) const
+{
+    if (layer != expandedLayer_)
+        {
+        const size_t count = layerMoves_[layer].empty() ? 0 : layerVertexCounts_[layer];
+        expandedMoves_.resize(count);
+        GCodePacking::ExpandMoves(layerMoves_[layer], count, expandedMoves_.data());
+        expandedLayer_ = layer;
+        }
+    return expandedMoves_;
+}
+
+// The picking grid of `layer` from the cache, or null if it is not built yet.
+// A grid the worker finished since the last call is adopted first, and the
+// cache then drops the grids used least recently beyond kPickGridBytes.
+const GCodePickGrid *GCodeModel::gridOf(int layer) const
+{
+    {
+        std::lock_guard lk(gridMutex_);
+        if (builtGrid_)
+            {
+            pickGrids_.push_front(std::move(*builtGrid_));
+            builtGrid_.reset();
+            gridRequested_ = -1;
+            size_t bytes = 0;
+            auto kept = pickGrids_.begin();
+            while (kept != pickGrids_.end() &&
+                   (kept == pickGrids_.begin() || bytes + kept->grid.MemoryBytes() <= kPickGridBytes))
+                bytes += (kept++)->grid.MemoryBytes();
+            pickGrids_.erase(kept, pickGrids_.end());
+            }
+    }
+    auto it = std::find_if(pickGrids_.begin(), pickGrids_.end(), [&](const CachedGrid &g)
+        {
+        return g.layer == layer;
+        });
+    if (it == pickGrids_.end())
+        return nullptr;
+    pickGrids_.splice(pickGrids_.begin(), pickGrids_, it);
+    return &pickGrids_.front().grid;
+}
+
+// Hand `layer` to gridWorker_ unless a grid is already being built. Only the
+// compressed vertices are copied here; expanding them is left to the worker.
+// False if the arena does not hold the layer, so there is nothing to wait for.
+bool GCodeModel::requestGrid(int layer) const
+{
+    if (gridRequested_ >= 0)
+        return true;
+    GridJob job;
+    job.layer = layer;
+    if (!arenas_[0].ReadCompressedLayer(layer, job.packed, job.compressed, job.count))
+        return false;
+    {
+        std::lock_guard lk(gridMutex_);
+        gridJob_ = std::move(job);
+    }
+    gridRequested_ = layer;
+    if (!gridWorker_.joinable())
+        gridWorker_ = std::thread(&GCodeModel::buildGrids, this);
+    gridWake_.notify_one();
+    return true;
+}
+
+// Body of gridWorker_: build each requested grid and leave it in builtGrid_.
+void GCodeModel::buildGrids() const
+{
+    std::unique_lock lk(gridMutex_);
+    for (;;)
         {
-        // For example, draw all printed lines in a dimmer red:
-        lineShader.setVec3("lineColor", glm::vec3(1.0f, 0.3f, 0.3f));
+        gridWake_.wait(lk, [&] { return gridStop_ || gridJob_; });
+        if (gridStop_)
+            return;
+        GridJob job = std::move(*gridJob_);
+        gridJob_.reset();
+        lk.unlock();
+
+        job.packed.vertices.resize(job.count);
+        GCodePacking::Expand(job.compressed, job.count, job.packed.vertices.data());
+        CachedGrid built;
+        built.layer = job.layer;
+        built.grid.Build(job.packed, job.packed.vertices.data(), job.count);
+
+        lk.lock();
+        builtGrid_ = std::move(built);
         }
+}
+
+uint32_t GCodeModel::GetLayerMoveCount(int layer) const
+{
+    if (layer < 0 || layer >= GetLayerCount() || layerEstimates_[layer].moveTimes.empty())
+        return 0;
+    return static_cast<uint32_t>(layerEstimates_[layer].moveTimes.size() - 1);
+}
+
+double GCodeModel::GetPrintTimeAt(const PlaybackPosition &position) const
+{
+    if (position.layer < 0 || static_cast<size_t>(position.layer) + 1 >= layerStartTimes_.size())
+        return 0.0;
+    const std::vector<float> &times = layerEstimates_[position.layer].moveTimes;
+    const double within = times.empty() ? 0.0 : times[std::min<size_t>(position.moves, times.size() - 1)];
+    return layerStartTimes_[position.layer] + within;
+}
 
-    for (int i = 0; i <= end; ++i)
+GCodeModel::PlaybackPosition GCodeModel::LocatePrintTime(double seconds) const
+{
+    PlaybackPosition position;
+    if (layerStartTimes_.size() < 2)
+        return position;
+    // The last layer that starts by `seconds`, then the last of its moves done by then.
+    const auto layerEnd = layerStartTimes_.end() - 1;
+    const auto start = std::upper_bound(layerStartTimes_.begin(), layerEnd, seconds);
+    position.layer = static_cast<int>(std::max<std::ptrdiff_t>(start - layerStartTimes_.begin() - 1, 0));
+    const std::vector<float> &times = layerEstimates_[position.layer].moveTimes;
+    if (times.empty())
+        return position;
+    const float within = static_cast<float>(seconds - layerStartTimes_[position.layer]);
+    const auto done = std::upper_bound(times.begin(), times.end(), within);
+    position.moves = static_cast<uint32_t>(std::max<std::ptrdiff_t>(done - times.begin() - 1, 0));
+    return position;
+}
+
+bool GCodeModel::Pick(const View &view, const glm::vec3 &direction, float pixels, const PlaybackPosition &upTo,
+                      PickResult &out) const
+{
+    const int layers = GetLayerCount();
+    const int last = upTo.layer < 0 ? layers - 1 : std::min(upTo.layer, layers - 1);
+    if (last < 0 || direction.z == 0.0f || !(view.pixelScale > 0.0f))
+        return false;
+    const glm::vec3 dir = glm::normalize(direction);
+
+    // Looking down, the ray meets the top layer first; looking up, the bottom one.
+    const int first = dir.z < 0.0f ? last : 0;
+    const int step = dir.z < 0.0f ? -1 : 1;
+    // Bytes of the grids this walk used: a walk needing more than the cache
+    // holds would only evict its own grids, so it stops there instead.
+    size_t walked = 0;
+    for (int layer = first; layer >= 0 && layer <= last; layer += step)
         {
-        if (layerVertexCounts_[i] == 0)
+        const float t = (layerZs_[layer] - view.eye.z) / dir.z;
+        if (t <= 0.0f)
+            continue;
+        const glm::vec3 at = view.eye + t * dir;
+        const float radius = pixels * t / view.pixelScale;
+        if (!arenas_[0].Near(layer, glm::vec2(at), radius))
             continue;
-        glBindVertexArray(layerVAOs_[i]);
-        glLineWidth(2.0f);
-        glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(layerVertexCounts_[i]));
-        glLineWidth(1.0f);
+        const GCodePickGrid *cached = gridOf(layer);
+        if (!cached)
+            {
+            // Layers further along the ray wait until this one's grid is built.
+            const size_t estimate = pickGrids_.empty() ? 0 : pickGrids_.front().grid.MemoryBytes();
+            if (walked > 0 && walked + estimate > kPickGridBytes)
+                return false;
+            if (requestGrid(layer))
+                return false;
+            continue;
+            }
+        const GCodePickGrid &grid = *cached;
+        walked += grid.MemoryBytes();
+        // Only the layer being played back needs its move numbers to filter by.
+        const bool partial = layer == upTo.layer && upTo.moves != UINT32_MAX;
+        const std::vector<uint32_t> *moves = partial ? &movesOf(layer) : nullptr;
+        const GCodePickGrid::Filter shown = [&](uint32_t vertex, const GCodePackedVertex &v)
+            {
+            const auto feature = static_cast<GCodeFeature>(v.feature & ~GCodePacking::kRunStartBit);
+            return IsFeatureVisible(feature) &&
+                   (!moves || (vertex < moves->size() ? (*moves)[vertex] : 0) <= upTo.moves);
+            };
+        GCodePickGrid::Hit hit;
+        if (!grid.Nearest(glm::vec2(at), radius, shown, hit))
+            continue;
+
+        const GCodePackedVertex &v = grid.Vertex(hit.vertex);
+        const float diameter = GCodeParser::kDefaultFilamentDiameter;
+        const std::vector<uint32_t> &hitMoves = movesOf(layer);
+        out.layer = layer;
+        out.move = hit.vertex < hitMoves.size() ? hitMoves[hit.vertex] : 0;
+        out.from = hit.from;
+        out.to = hit.to;
+        out.feature = static_cast<GCodeFeature>(v.feature & ~GCodePacking::kRunStartBit);
+        out.speed = GCodePacking::DecodeSpeed(v.speed);
+        out.area = IsTravel(out.feature) ? 0.0f : GCodePacking::DecodeArea(v.area);
+        out.volume = out.area * glm::length(hit.to - hit.from);
+        out.filament = out.volume / (0.25f * 3.14159265f * diameter * diameter);
+        out.fan = v.fan * (100.0f / 255.0f);
+        out.temperature = GCodePacking::DecodeTemperature(v.temperature);
+        out.tool = v.tool;
+        return true;
         }
-    glBindVertexArray(0);
+    return false;
 }
@@ -1,73 +1,450 @@
 // GCodeModel.h
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
-#include <fstream>
-#include <sstream>
-#include <regex>
+#include <cfloat>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <chrono>
 #include <glm/glm.hpp>
 #include "Shader.h"
-#include "GCodeParser.h" // for GCodeColoredVertex
+#include "GCodeParser.h"
+#include "GCodeLayerIndex.h"
+#include "GCodePacking.h"
+#include "GCodeArena.h"
+#include "GCodeLod.h"
+#include "GCodePickGrid.h"
 
-/// GCodeModel now groups extruding moves by “layer” (unique Z values).
-/// Each layer is one sequence of GL_LINES. You can draw a single layer or all layers up to some index.
+class GCodeSource;
+class GCodeCache;
+
+/// GCodeModel groups extrusions and travel moves by layer (see GCodeLayerIndex).
+/// Each layer is a set of runs of packed vertices (see GCodePacking.h), coloured by
+/// feature. They are drawn as instanced ribbons as wide and tall as the extruded
+/// bead (gcode_ribbon.vert), or as plain line strips (gcode_shader.vert). You can
+/// draw a single layer or all layers up to some index; either is a single draw
+/// per arena page (see GCodeArena). Layers are split into XY tiles so a
+/// close-up view only submits the tiles it can see, and tiles far from the
+/// camera are drawn from coarser copies built in the background (see GCodeLod).
+/// For playback, the toolpaths can also be drawn up to a moment of the print.
+/// Instead of by feature, segments can be coloured by a print setting or by
+/// layer time (see ColorMode).
 class GCodeModel
 {
 public:
-    /// Constructor: parse the .gcode file immediately.
-    explicit GCodeModel(const std::string &gcodePath);
+    enum class LoadMode
+    {
+        Blocking,    // parse and upload everything inside the constructor
+        Progressive  // parse on a background thread; PumpUploads() uploads finished layers
+    };
+
+    /// What the camera sees, in G-code coordinates; used to cull tiles and
+    /// choose their level of detail.
+    struct View
+    {
+        Frustum frustum;
+        glm::vec3 eye{0.0f};
+        float pixelScale = 0.0f;     // pixels per mm at 1 mm distance; 0 keeps full detail
+    };
+
+    enum class DrawStyle
+    {
+        Ribbons,     // gcode_ribbon.vert/.frag, instanced
+        Lines        // gcode_shader.vert/.frag, line strips
+    };
+
+    /// What the toolpaths are coloured by. Every mode but Feature shows a value
+    /// on a ramp from blue (low) to red (high) over GetColorRange(), except Tool,
+    /// which has a colour per extruder. Moves without extrusion keep their
+    /// feature colour in every mode.
+    enum class ColorMode
+    {
+        Feature,
+        Speed,          // feedrate, mm/s
+        Flow,           // volumetric flow, mm^3/s
+        Fan,            // part cooling fan, percent
+        Temperature,    // nozzle temperature set, degrees C
+        Tool,           // extruder (T0..T3)
+        LayerTime,      // estimated seconds to print the segment's layer
+        Count
+    };
+
+    /// Constructor: load the .gcode file immediately (Blocking) or start a
+    /// background load (Progressive). Either way a valid "<file>.rrcache"
+    /// sidecar is used instead of parsing, and a missing or stale one is rebuilt.
+    /// Print time is estimated for `machine` (see GCodeMachineLimits::FromDefinition).
+    /// `previous` is the model this one replaces, e.g. the print before a
+    /// re-slice. If it has finished loading, layers whose packed toolpaths hash
+    /// the same as one of its layers (GCodePacking::Hash) are copied from its
+    /// GPU buffers instead of uploaded, and their levels of detail are not
+    /// rebuilt. It is let go once loading finishes.
+    /// Throws if the file cannot be opened.
+    explicit GCodeModel(const std::string &gcodePath, LoadMode mode = LoadMode::Blocking,
+                        const GCodeMachineLimits &machine = {},
+                        std::shared_ptr<const GCodeModel> previous = nullptr);
 
     ~GCodeModel();
 
-    /// Draw *only* layer 'layerIndex' (0-based).
+    GCodeModel(const GCodeModel &) = delete;
+    GCodeModel &operator=(const GCodeModel &) = delete;
+
+    /// Upload layers finished by the background parser until `budgetMs` has elapsed,
+    /// and keep to the VRAM budget (see SetVramBudget). Must be called on the GL
+    /// thread, typically once per frame.
+    /// Returns true if any layer was added, i.e. layer count and bounds changed.
+    bool PumpUploads(double budgetMs);
+
+    /// Cap on the GPU memory of the toolpath vertex buffers, in bytes; 0, the
+    /// default, keeps every layer on the GPU. Full-detail layers always keep a
+    /// compressed copy in RAM (GCodePacking::Compress, less than half their
+    /// size), which picking reads; with a cap, coarser levels uploaded from then
+    /// on keep one too. PumpUploads then evicts the arena pages drawn least
+    /// recently to get under the cap, and restores evicted pages a draw needed;
+    /// until then, those draw nothing. Pages drawn in the last frame are never
+    /// evicted, so a view that needs more than the cap exceeds it.
+    void SetVramBudget(size_t bytes);
+    size_t GetVramBudget() const { return vramBudget_; }
+
+    /// Bytes of toolpath vertex buffers on the GPU, and of compressed copies in RAM:
+    /// of the layers that can be evicted, and of the move numbers of every layer.
+    size_t GetResidentBytes() const;
+    size_t GetCompressedBytes() const;
+
+    /// True until every layer has been parsed (or read from the cache) and uploaded.
+    bool IsLoading() const;
+
+    /// The text of the file while it loads, for a text panel to share instead of
+    /// reading, and for a compressed file decoding, it again. It is read on the
+    /// loader thread, so it is ready once the file is decoded, and holds null if
+    /// the file could not be read. Not valid once the model has loaded.
+    std::shared_future<std::shared_ptr<const GCodeSource> > GetSource() const { return source_; }
+
+    /// Ask a progressive load to parse and upload layers first..last before the
+    /// rest, e.g. when the layer slider jumps ahead of the loader. Only the
+    /// requested byte range of the file is parsed. Cheap to call every frame.
+    void RequestLayers(int first, int last);
+
+    /// Draw *only* layer 'layerIndex' (0-based) with a shader for the current DrawStyle.
+    /// With a `view`, tiles outside it are skipped and distant ones drawn coarser.
     /// Returns false if layerIndex is invalid.
-    bool DrawLayer(int layerIndex, Shader &lineShader) const;
+    bool DrawLayer(int layerIndex, Shader &shader, const View *view = nullptr) const;
 
     /// Draw all layers from 0..maxLayerIndex inclusive.
     /// If maxLayerIndex < 0, draws all layers.
-    void DrawUpToLayer(int maxLayerIndex, Shader &lineShader) const;
+    void DrawUpToLayer(int maxLayerIndex, Shader &shader, const View *view = nullptr) const;
+
+    /// A point in the print: layer `layer` with its first `moves` moves done.
+    /// Moves are counted as in GCodeEstimate::moveTimes.
+    struct PlaybackPosition
+    {
+        int layer = 0;
+        uint32_t moves = 0;
+    };
+
+    /// Draw layers 0..layer-1 and the segments of layer `layer` printed in its
+    /// first `moves` moves. Every tile of that layer holds its segments in print
+    /// order, so each is cut with a binary search and drawn as one range.
+    void DrawUpToMove(const PlaybackPosition &position, Shader &shader, const View *view = nullptr) const;
+
+    /// Number of moves of `layer` (0 until it is uploaded).
+    uint32_t GetLayerMoveCount(int layer) const;
+
+    /// Seconds into the print at `position`, and the inverse: where the print
+    /// is after `seconds`. Layers not uploaded yet count as taking no time.
+    double GetPrintTimeAt(const PlaybackPosition &position) const;
+    PlaybackPosition LocatePrintTime(double seconds) const;
+
+    /// A segment found by Pick, and what it was printed with.
+    struct PickResult
+    {
+        int layer = 0;
+        uint32_t move = 0;          // the move ending the segment, as in GCodePathVertex::move
+        glm::vec3 from{0.0f};
+        glm::vec3 to{0.0f};
+        GCodeFeature feature = GCodeFeature::Other;
+        float speed = 0.0f;         // mm/s
+        float area = 0.0f;          // cross-section, mm^2; 0 for travel
+        float volume = 0.0f;        // mm^3 extruded
+        float filament = 0.0f;      // mm of filament fed for it
+        float fan = 0.0f;           // percent
+        float temperature = 0.0f;   // degrees C
+        int tool = 0;
+    };
+
+    /// The shown segment under the ray from `view.eye` along `direction`, in
+    /// G-code coordinates, if one is within `pixels` of it on screen (as
+    /// view.pixelScale has it). `upTo` is what is drawn: layers below upTo.layer
+    /// whole and its first upTo.moves moves, as DrawUpToMove draws them; pass a
+    /// moves of UINT32_MAX for DrawUpToLayer. Each layer's plane is tried in the
+    /// order the ray meets them. Layers whose tiles are not near the ray are
+    /// skipped; otherwise the nearest segment is looked up in the layer's grid
+    /// (see GCodePickGrid). Grids are built in the background from the
+    /// full-detail arena's compressed copy, one layer at a time: the walk stops
+    /// at the first near layer without one and reports no hit until it is built,
+    /// so callers pick again on a later frame. Only the grids of the layers looked
+    /// at last are kept.
+    /// Values are those of the packed vertices, so within a few percent.
+    bool Pick(const View &view, const glm::vec3 &direction, float pixels, const PlaybackPosition &upTo,
+              PickResult &out) const;
 
-    /// Number of layers parsed
+    /// Ribbons by default; the caller binds the matching shader.
+    void SetDrawStyle(DrawStyle style) { drawStyle_ = style; }
+    DrawStyle GetDrawStyle() const { return drawStyle_; }
+
+    /// Level of detail is on by default; off, every tile is drawn in full.
+    void SetLodEnabled(bool enabled) { lodEnabled_ = enabled; }
+    bool IsLodEnabled() const { return lodEnabled_; }
+
+    /// Number of layers in the file, known as soon as the layer index is built.
+    /// During a progressive load, layers that are not uploaded yet draw nothing.
     int GetLayerCount() const { return static_cast<int>(layerVertexCounts_.size()); }
 
+    /// Byte offsets and line numbers of the layers; empty if they came from the toolpath cache.
+    const GCodeLayerIndex &GetLayerIndex() const { return index_; }
+
     /// Returns the Z-height (in mm) of each layer index.
     /// That is, layerZs_[i] = the Z coordinate that was first encountered for layer i.
     const std::vector<float> &GetLayerHeights() const { return layerZs_; }
 
-    /// Accessors for overall bounds and center
+    /// Estimated print time and filament per layer, and for the layers uploaded so far.
+    const std::vector<GCodeEstimate> &GetLayerEstimates() const { return layerEstimates_; }
+    const GCodeEstimate &GetPrintEstimate() const { return printEstimate_; }
+
+    /// Print time the slicer wrote in the file (Cura's ";TIME:"), or a negative value.
+    double GetReportedPrintTime() const { return reportedSeconds_; }
+
+    /// Show or hide one feature (see GCodeFeature). Applies from the next draw;
+    /// nothing is parsed or uploaded again. Travel moves are hidden by default.
+    void SetFeatureVisible(GCodeFeature feature, bool visible);
+    bool IsFeatureVisible(GCodeFeature feature) const
+    {
+        return (visibleFeatures_ >> static_cast<unsigned>(feature)) & 1u;
+    }
+
+    /// Colour mode; applies from the next draw, as it is only a shader uniform.
+    void SetColorMode(ColorMode mode)
+    {
+        if (mode != colorMode_)
+            ++paletteVersion_;
+        colorMode_ = mode;
+    }
+    ColorMode GetColorMode() const { return colorMode_; }
+
+    /// Values at the blue and red ends of the ramp for `mode`: the range seen
+    /// in the layers uploaded so far. Not meaningful for Feature and Tool.
+    glm::vec2 GetColorRange(ColorMode mode) const;
+
+    /// Palette entry for one feature; also takes effect on the next draw.
+    void SetFeatureColor(GCodeFeature feature, const glm::vec3 &color)
+    {
+        glm::vec3 &entry = featureColors_[static_cast<size_t>(feature)];
+        if (entry != color)
+            ++paletteVersion_;
+        entry = color;
+    }
+    const glm::vec3 &GetFeatureColor(GCodeFeature feature) const
+    {
+        return featureColors_[static_cast<size_t>(feature)];
+    }
+
+    /// Accessors for overall bounds and center (extrusions only)
     const glm::vec3 &GetBoundsMin() const { return boundsMin_; }
     const glm::vec3 &GetBoundsMax() const { return boundsMax_; }
     const glm::vec3 &GetCenter() const { return center_; }
 
 private:
-    void computeBounds();
+    void growBounds(const glm::vec3 &mn, const glm::vec3 &mx);
+    void loadLayers(bool streaming);
+    void setSource(std::shared_ptr<const GCodeSource> source);
+    bool loadCachedLayers(const GCodeSource &source);
+    void parseLayers(std::shared_ptr<const GCodeSource> source, bool streaming);
+    void finishLoading();
+    void resizeLayers(size_t count);
+    void setFeatureUniforms(Shader &shader) const;
+    void drawLayers(int first, int last, Shader &shader, const View *view) const;
+    int lodLevel(const View &view, int layer, int cellX, int cellY, int maxLevel) const;
+    void growCells(const GCodePackedLayer &packed);
+    const std::vector<uint32_t> &movesOf(int layer) const;
+    const GCodePickGrid *gridOf(int layer) const;
+    bool requestGrid(int layer) const;
+    void buildGrids() const;
+    struct PendingLayer;
+    void hashLayer(PendingLayer &layer, const GCodePackedVertex *vertices, size_t count) const;
+    void restorePages(std::chrono::steady_clock::time_point start, double budgetMs);
+    void evictPages();
 
-    static constexpr glm::vec3 kModelColor = glm::vec3(0.8f, 0.8f, 0.8f);
-    static constexpr glm::vec3 kInfillColor = glm::vec3(0.9f, 0.4f, 0.1f);
-    static constexpr glm::vec3 kSupportColor = glm::vec3(0.1f, 0.5f, 0.9f);
+    // Chord tolerance for GCodeParser::Simplify, in mm: well below a line width,
+    // so merged micro-segments of curved walls and gyroid infill look the same.
+    static constexpr float kSimplifyTolerance = 0.005f;
 
-    // lineVertices_ is no longer used directly; we bucket segments into layers_.
-    // We keep bounds of ALL points (regardless of layer) so that a “layer slider” scaled correctly if needed.
-    glm::vec3 center_;
-    float radius_;
-    glm::vec3 boundsMin_;
-    glm::vec3 boundsMax_;
+    // Thickness assumed for a layer that does not sit above the previous one.
+    static constexpr float kDefaultLayerHeight = 0.2f;
 
-    using ColoredVertex = GCodeColoredVertex;
+    // Picking grids are kept for the layers looked at last, up to this many
+    // bytes: a few dozen layers of a typical print.
+    static constexpr size_t kPickGridBytes = size_t(32) << 20;
+
+    // Ribbon width of travel moves, in mm.
+    static constexpr float kTravelWidth = 0.1f;
+
+    static constexpr size_t kFeatureCount = static_cast<size_t>(GCodeFeature::Count);
+
+    // Indexed by GCodeFeature; gcode_shader.vert has room for 16 entries.
+    static constexpr size_t kToolCount = 4;     // colours in gcode_shader.vert's toolColors
+
+    std::array<glm::vec3, kFeatureCount> featureColors_{{
+        {0.80f, 0.80f, 0.80f},  // Other
+        {0.90f, 0.25f, 0.20f},  // WallOuter
+        {0.35f, 0.80f, 0.30f},  // WallInner
+        {0.95f, 0.85f, 0.30f},  // Skin
+        {0.90f, 0.40f, 0.10f},  // Infill
+        {0.10f, 0.50f, 0.90f},  // Support
+        {0.45f, 0.75f, 1.00f},  // SupportInterface
+        {0.30f, 0.85f, 0.85f},  // Skirt
+        {0.70f, 0.70f, 0.90f},  // PrimeTower
+        {0.25f, 0.35f, 0.75f},  // Travel
+        {0.65f, 0.30f, 0.90f},  // Retract
+    }};
+    static_assert(kFeatureCount <= 16);
+    std::array<glm::vec3, kToolCount> toolColors_{{
+        {0.95f, 0.95f, 0.95f},
+        {0.20f, 0.20f, 0.20f},
+        {0.90f, 0.25f, 0.20f},
+        {0.15f, 0.45f, 0.90f},
+    }};
+    ColorMode colorMode_ = ColorMode::Feature;
+    DrawStyle drawStyle_ = DrawStyle::Ribbons;
+    bool lodEnabled_ = true;
+    uint32_t visibleFeatures_ = ((1u << kFeatureCount) - 1u) &
+                                ~(1u << static_cast<unsigned>(GCodeFeature::Travel)) &
+                                ~(1u << static_cast<unsigned>(GCodeFeature::Retract));
+    // Bumped by every palette or colour mode change. A shader program keeps its
+    // uniforms, so setFeatureUniforms sends those to a program again only when
+    // the version it last sent it (by Shader::ID) is out of date.
+    uint64_t paletteVersion_ = 1;
+    mutable std::unordered_map<unsigned int, uint64_t> paletteSent_;
+
+    // Bounds of every layer uploaded so far, travels included, grown as each
+    // one reaches the arenas; the camera frames the print from them.
+    glm::vec3 center_{0.0f};
+    float radius_{0.0f};
+    glm::vec3 boundsMin_{FLT_MAX};
+    glm::vec3 boundsMax_{-FLT_MAX};
 
-    // Each layer is now a flat list of ColoredVertex pairs forming line segments
-    // layers_[i] = vertices for layer i, in consecutive pairs.
-    std::vector<std::vector<ColoredVertex> > layers_;
     std::vector<size_t> layerVertexCounts_;
     std::vector<float> layerZs_;
+    std::vector<bool> layerUploaded_;
+    std::vector<GCodeEstimate> layerEstimates_;
+    std::vector<double> layerStartTimes_;   // seconds before each layer, plus the total
+    glm::vec4 settingsMin_{FLT_MAX};        // GCodePackedLayer::settingsMin/Max over uploaded layers
+    glm::vec4 settingsMax_{-FLT_MAX};
+    GCodeEstimate printEstimate_;
+    std::atomic<double> reportedSeconds_{-1.0};     // set by the loader
+    GCodeLayerIndex index_;
+
+    // Move number of each vertex of the uploaded layers, as in GCodePackedLayer::moves,
+    // compressed (GCodePacking::CompressMoves). movesOf expands the one layer
+    // playback or picking needs into expandedMoves_.
+    std::vector<std::vector<uint8_t> > layerMoves_;
+    mutable int expandedLayer_ = -1;
+    mutable std::vector<uint32_t> expandedMoves_;
+
+    // Picking grids of the layers Pick looked at last, most recent first (see gridOf).
+    struct CachedGrid
+    {
+        int layer = 0;
+        GCodePickGrid grid;
+    };
+    mutable std::list<CachedGrid> pickGrids_;
+    // Grids are built on gridWorker_, started by the first request: gridJob_ is
+    // the layer to build next, builtGrid_ the result gridOf adopts. Both, and
+    // gridStop_, are guarded by gridMutex_; gridRequested_ is the layer in flight.
+    struct GridJob
+    {
+        int layer = 0;
+        GCodePackedLayer packed;                // runs of the layer; vertices filled on the worker
+        std::vector<uint8_t> compressed;        // GCodePacking::Compress
+        size_t count = 0;
+    };
+    mutable std::thread gridWorker_;
+    mutable std::mutex gridMutex_;
+    mutable std::condition_variable gridWake_;
+    mutable std::optional<GridJob> gridJob_;
+    mutable std::optional<CachedGrid> builtGrid_;
+    mutable int gridRequested_ = -1;
+    bool gridStop_ = false;
+    std::vector<uint64_t> layerHashes_;     // GCodePacking::Hash of the uploaded layers
+
+    // The model this one replaces, while loading, and which of its layers can be
+    // copied: hash to layer index, for layers uploaded with every level of detail.
+    // Filled before the loader starts, read-only after.
+    std::shared_ptr<const GCodeModel> previous_;
+    std::unordered_map<uint64_t, int> reusable_;
 
-    // OpenGL handles: each layer gets its own VAO/VBO pair.
-    std::vector<unsigned int> layerVAOs_;
-    std::vector<unsigned int> layerVBOs_;
+    // All uploaded layers, packed into a few large buffers; one arena per level
+    // of detail, level 0 being the full toolpaths. A layer's vertices exist only
+    // there (and in level 0's compressed copy); parsed layers are packed and
+    // handed over by PumpUploads, not kept on the CPU side.
+    std::array<GCodeArena, GCodeLod::kLevels> arenas_;
+    std::vector<bool> lodReady_;
+    size_t vramBudget_ = 0;                 // bytes; 0 for no limit
+    // Start of the previous PumpUploads: pages drawn since then are in the
+    // current view and not evicted.
+    std::chrono::steady_clock::time_point lastPump_;
+    // Level each (layer, tile cell) was drawn at last, for GCodeLod::Select.
+    // Covers the cells between cellMin_ and cellMax_; indexed by layer, then row.
+    mutable std::vector<uint8_t> lodState_;
+    glm::ivec2 cellMin_{0};
+    glm::ivec2 cellMax_{-1};
 
     bool ready_{false};
 
-    // We do *not* keep one big “lineVertices_” vector anymore; it's now split per layer.
-    // Temporary storage is used only during parsing.
+    // Loading: loadLayers fills pending_ (on loader_ in progressive mode),
+    // PumpUploads drains it. Layers served from the sidecar cache point into
+    // its mapping instead of owning a vertex copy.
+    struct PendingLayer
+    {
+        size_t index = 0;
+        GCodePackedLayer packed;
+        const GCodePackedVertex *mapped = nullptr;
+        size_t mappedCount = 0;
+        GCodeEstimate estimate;
+        std::vector<uint8_t> moves;             // GCodePacking::CompressMoves; packed.moves is left empty
+        std::vector<GCodePackedLayer> lod;      // levels 1.. of detail, once built
+        bool lodOnly = false;                   // the layer itself was queued before
+        uint64_t hash = 0;                      // see GCodePacking::Hash
+        int reuse = -1;                         // layer of previous_ to copy, all levels included
+    };
+    std::string path_;
+    GCodeMachineLimits machine_;
+    // The text, kept only for GetSource(): the loader sets it once (sourceSet_)
+    // and finishLoading lets go of it. Layers are parsed from the loader's own reference.
+    std::promise<std::shared_ptr<const GCodeSource> > sourcePromise_;
+    std::shared_future<std::shared_ptr<const GCodeSource> > source_;
+    bool sourceSet_{false};
+    std::unique_ptr<GCodeCache> cache_;
+    std::thread loader_;
+    std::atomic<bool> cancel_{false};
+    std::atomic<bool> parsing_{false};
+    bool loading_{false};
+    mutable std::mutex pendingMutex_;
+    std::deque<PendingLayer> pending_;
+    bool layerTablePending_{false};         // pendingIndex_/pendingLayerZs_ not yet adopted
+    GCodeLayerIndex pendingIndex_;
+    std::vector<float> pendingLayerZs_;
+    int requestFirst_{-1};                  // guarded by pendingMutex_
+    int requestLast_{-1};
+    std::atomic<bool> requestPending_{false};
+    int requestedFirst_{-1};                // GL thread's last request
+    int requestedLast_{-1};
 };
@@ -0,0 +1,88 @@
+#include "GCodeOutput.h"
+#include "GCodeSource.h"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace
+{
+    constexpr int64_t kPowers10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+}
+
+void AppendGCodeFixed(std::string &out, int64_t units, int decimals, int keep)
+{
+    decimals = std::clamp(decimals, 0, 9);
+    if (units < 0)
+        {
+        out.push_back('-');
+        units = -units;
+        }
+    const int64_t scale = kPowers10[decimals];
+    char digits[24];
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), units / scale).ptr);
+    int64_t fraction = units % scale;
+    int length = decimals;
+    for (int i = length - 1; i >= 0; --i, fraction /= 10)
+        digits[i] = static_cast<char>('0' + fraction % 10);
+    while (length > keep && digits[length - 1] == '0')
+        --length;
+    if (length == 0)
+        return;
+    out.push_back('.');
+    out.append(digits, static_cast<size_t>(length));
+}
+
+GCodeOutputBuffer::GCodeOutputBuffer(std::ostream &out)
+    : out_(out)
+{
+    text_.reserve(kBlockBytes + 256);
+}
+
+void GCodeOutputBuffer::Flush()
+{
+    out_.write(text_.data(), static_cast<std::streamsize>(text_.size()));
+    written_ += text_.size();
+    text_.clear();
+}
+
+void RewriteGCodeFile(const std::string &inPath, const std::string &outPath,
+                      const std::function<void(const GCodeSource &source, std::ostream &out)> &write)
+{
+    std::error_code ec;
+    const bool inPlace = std::filesystem::equivalent(inPath, outPath, ec);
+    const std::string target = inPlace ? outPath + ".tmp" : outPath;
+    {
+        const GCodeSource source(inPath);
+        std::ofstream out(target, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Cannot write G-code file: " + target);
+        try
+            {
+            write(source, out);
+            }
+        catch (const std::exception &)
+            {
+            out.close();
+            std::filesystem::remove(target, ec);
+            throw;
+            }
+        out.close();
+        if (!out)
+            {
+            std::filesystem::remove(target, ec);
+            throw std::runtime_error("Failed to write G-code file: " + target);
+            }
+    }
+    if (inPlace)
+        {
+        std::filesystem::rename(target, outPath, ec);
+        if (ec)
+            {
+            std::filesystem::remove(target, ec);
+            throw std::runtime_error("Cannot replace G-code file: " + outPath);
+            }
+        }
+}
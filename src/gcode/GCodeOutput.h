@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+class GCodeSource;
+
+/// Append units / 10^decimals to `out`, exactly, with `decimals` clamped to
+/// 0..9. Trailing zeros of the fraction are dropped, but at least `keep`
+/// decimals are written; the point goes too if none are left.
+void AppendGCodeFixed(std::string &out, int64_t units, int decimals, int keep = 0);
+
+/// Output text gathered in memory and written to a stream in blocks of about
+/// kBlockBytes, so a rewriter appends to a string instead of calling the stream
+/// for every word.
+class GCodeOutputBuffer
+{
+public:
+    static constexpr size_t kBlockBytes = size_t(64) << 10;
+
+    explicit GCodeOutputBuffer(std::ostream &out);
+
+    /// The text not written yet; append to it, then call Spill.
+    std::string &Text() { return text_; }
+
+    /// Write the text if it has reached a block.
+    void Spill()
+    {
+        if (text_.size() >= kBlockBytes)
+            Flush();
+    }
+
+    void Flush();
+
+    /// Bytes handed to the stream so far.
+    size_t Written() const { return written_; }
+
+private:
+    std::ostream &out_;
+    std::string text_;
+    size_t written_ = 0;
+};
+
+/// Write `outPath` from the G-code file `inPath`, which may be compressed (see
+/// GCodeSource): `write` gets its text and a binary stream to `outPath`. If the
+/// two paths are the same file, the output goes to "<outPath>.tmp" first and
+/// replaces the input once it is complete. The partial output is removed if
+/// `write` throws or the stream fails.
+///
+/// Throws std::runtime_error if the input cannot be read or the output cannot
+/// be written or renamed, and rethrows what `write` throws.
+void RewriteGCodeFile(const std::string &inPath, const std::string &outPath,
+                      const std::function<void(const GCodeSource &source, std::ostream &out)> &write);
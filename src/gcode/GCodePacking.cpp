@@ -0,0 +1,290 @@
+#include "GCodePacking.h"
+#include "GCodeHash.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace
+{
+    constexpr float kQuantMax = 65535.0f;
+
+    uint16_t Quantize(float value, float origin, float step)
+    {
+        float q = std::round((value - origin) / step);
+        return static_cast<uint16_t>(std::clamp(q, 0.0f, kQuantMax));
+    }
+
+    // Fields of GCodePackedVertex after the position, which Compress stores
+    // only when they change.
+    constexpr size_t kSettingsOffset = offsetof(GCodePackedVertex, feature);
+    constexpr size_t kSettingsBytes = sizeof(GCodePackedVertex) - kSettingsOffset;
+    constexpr uint8_t kZChangedBit = 1 << kSettingsBytes;
+    static_assert(kSettingsBytes < 8);
+
+    // 7-bit groups, low first, the top bit set on all but the last.
+    void PutVarint(std::vector<uint8_t> &out, uint32_t value)
+    {
+        while (value >= 0x80)
+            {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+            }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    uint32_t GetVarint(const uint8_t *&in)
+    {
+        uint32_t value = 0;
+        for (int shift = 0;; shift += 7)
+            {
+            const uint8_t byte = *in++;
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+            }
+    }
+
+    // Change of a quantized coordinate, zigzag coded so small steps either way
+    // are small numbers, as a varint (at most three bytes).
+    void PutDelta(std::vector<uint8_t> &out, uint16_t value, uint16_t previous)
+    {
+        const auto delta = static_cast<int16_t>(static_cast<uint16_t>(value - previous));
+        PutVarint(out, static_cast<uint16_t>((delta * 2) ^ (delta >> 15)));
+    }
+
+    uint16_t GetDelta(const uint8_t *&in, uint16_t previous)
+    {
+        const uint32_t zigzag = GetVarint(in);
+        const auto delta = static_cast<uint16_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+        return static_cast<uint16_t>(previous + delta);
+    }
+
+    // Grid cell of a point, packed into one key that sorts row by row. Cells
+    // are clamped to the int16_t range, far beyond any bed.
+    int64_t TileKey(const glm::vec3 &p)
+    {
+        auto cell = [](float v)
+            {
+            return static_cast<int64_t>(std::clamp(std::floor(v / GCodePacking::kTileSize), -32768.0f, 32767.0f));
+            };
+        return (cell(p.y) << 32) + (cell(p.x) & 0xFFFFFFFF);
+    }
+
+    // A run, or the part of one inside a single tile: path[first..last], where
+    // path[first] is the run start or the vertex the previous piece ended on.
+    struct Piece
+    {
+        int64_t tile;
+        size_t first;
+        size_t last;
+    };
+}
+
+uint8_t GCodePacking::EncodeArea(float area)
+{
+    const float s = std::sqrt(std::clamp(area / kMaxArea, 0.0f, 1.0f));
+    return static_cast<uint8_t>(std::lround(s * 255.0f));
+}
+
+uint8_t GCodePacking::EncodeSpeed(float speed)
+{
+    const float s = std::sqrt(std::clamp(speed / kMaxSpeed, 0.0f, 1.0f));
+    return static_cast<uint8_t>(std::lround(s * 255.0f));
+}
+
+uint8_t GCodePacking::EncodeTemperature(float celsius)
+{
+    return static_cast<uint8_t>(std::lround(std::clamp(celsius / kTemperatureStep, 0.0f, 255.0f)));
+}
+
+void GCodePacking::GrowSettingsRange(const GCodePackedVertex *vertices, size_t count, glm::vec4 &mn, glm::vec4 &mx)
+{
+    for (size_t i = 0; i < count; ++i)
+        {
+        const GCodePackedVertex &v = vertices[i];
+        if (v.area == 0 || (v.feature & kRunStartBit))
+            continue;
+        const float speed = DecodeSpeed(v.speed);
+        const glm::vec4 settings(speed, DecodeArea(v.area) * speed, v.fan * (100.0f / 255.0f),
+                                 DecodeTemperature(v.temperature));
+        mn = glm::min(mn, settings);
+        mx = glm::max(mx, settings);
+        }
+}
+
+uint64_t GCodePacking::Hash(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, size_t count)
+{
+    const float frame[8] = {layer.z, layer.height, layer.origin.x, layer.origin.y, layer.origin.z,
+                            layer.step.x, layer.step.y, layer.step.z};
+    uint64_t h = GCodeHash::Bytes(frame, sizeof(frame));
+    h = GCodeHash::Combine(h, GCodeHash::Bytes(vertices, count * sizeof(GCodePackedVertex)));
+    h = GCodeHash::Combine(h, GCodeHash::Bytes(layer.runFirst.data(), layer.runFirst.size() * sizeof(int32_t)));
+    h = GCodeHash::Combine(h, GCodeHash::Bytes(layer.runCount.data(), layer.runCount.size() * sizeof(int32_t)));
+    return GCodeHash::Combine(h, GCodeHash::Bytes(layer.tiles.data(), layer.tiles.size() * sizeof(GCodePackedTile)));
+}
+
+std::vector<uint8_t> GCodePacking::Compress(const GCodePackedVertex *vertices, size_t count)
+{
+    std::vector<uint8_t> out;
+    out.reserve(count * 5);
+    GCodePackedVertex previous{};
+    for (size_t i = 0; i < count; ++i)
+        {
+        const GCodePackedVertex &v = vertices[i];
+        const auto *bytes = reinterpret_cast<const uint8_t *>(&v) + kSettingsOffset;
+        const auto *before = reinterpret_cast<const uint8_t *>(&previous) + kSettingsOffset;
+        uint8_t changed = v.z != previous.z ? kZChangedBit : 0;
+        for (size_t b = 0; b < kSettingsBytes; ++b)
+            changed |= bytes[b] != before[b] ? 1 << b : 0;
+        out.push_back(changed);
+        PutDelta(out, v.x, previous.x);
+        PutDelta(out, v.y, previous.y);
+        if (changed & kZChangedBit)
+            PutDelta(out, v.z, previous.z);
+        for (size_t b = 0; b < kSettingsBytes; ++b)
+            {
+            if (changed & (1 << b))
+                out.push_back(bytes[b]);
+            }
+        previous = v;
+        }
+    out.shrink_to_fit();
+    return out;
+}
+
+void GCodePacking::Expand(const std::vector<uint8_t> &data, size_t count, GCodePackedVertex *out)
+{
+    const uint8_t *in = data.data();
+    GCodePackedVertex previous{};
+    for (size_t i = 0; i < count; ++i)
+        {
+        GCodePackedVertex v = previous;
+        const uint8_t changed = *in++;
+        v.x = GetDelta(in, previous.x);
+        v.y = GetDelta(in, previous.y);
+        if (changed & kZChangedBit)
+            v.z = GetDelta(in, previous.z);
+        auto *bytes = reinterpret_cast<uint8_t *>(&v) + kSettingsOffset;
+        for (size_t b = 0; b < kSettingsBytes; ++b)
+            {
+            if (changed & (1 << b))
+                bytes[b] = *in++;
+            }
+        out[i] = v;
+        previous = v;
+        }
+}
+
+std::vector<uint8_t> GCodePacking::CompressMoves(const uint32_t *moves, size_t count)
+{
+    std::vector<uint8_t> out;
+    out.reserve(count + count / 8);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+        {
+        // The next move is the common step, so it is coded as 0.
+        const auto delta = static_cast<int32_t>(moves[i] - previous - 1);
+        PutVarint(out, (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+        previous = moves[i];
+        }
+    out.shrink_to_fit();
+    return out;
+}
+
+void GCodePacking::ExpandMoves(const std::vector<uint8_t> &data, size_t count, uint32_t *out)
+{
+    const uint8_t *in = data.data();
+    uint32_t previous = 0;
+    for (size_t i = 0; i < count; ++i)
+        {
+        const uint32_t zigzag = GetVarint(in);
+        previous += ((zigzag >> 1) ^ (0u - (zigzag & 1))) + 1;
+        out[i] = previous;
+        }
+}
+
+GCodePackedLayer GCodePacking::Pack(float z, float height, const std::vector<GCodePathVertex> &path)
+{
+    GCodePackedLayer layer;
+    layer.z = z;
+    layer.height = height;
+    if (path.empty())
+        return layer;
+
+    // The quantization box covers every vertex; the reported bounds only the extrusions.
+    glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+    for (size_t i = 0; i < path.size(); ++i)
+        {
+        const GCodePathVertex &v = path[i];
+        boxMin = glm::min(boxMin, v.pos);
+        boxMax = glm::max(boxMax, v.pos);
+        if (i > 0 && !v.IsRunStart() && !IsTravel(v.feature))
+            {
+            layer.boundsMin = glm::min(layer.boundsMin, glm::min(path[i - 1].pos, v.pos));
+            layer.boundsMax = glm::max(layer.boundsMax, glm::max(path[i - 1].pos, v.pos));
+            }
+        }
+    layer.origin = boxMin;
+    layer.step = glm::max(boxMax - boxMin, glm::vec3(1e-4f)) / kQuantMax;
+
+    // Segments belong to the tile of their midpoint; a run changing tiles is cut.
+    std::vector<Piece> pieces;
+    for (size_t i = 0; i < path.size(); ++i)
+        {
+        if (i == 0 || path[i].IsRunStart())
+            {
+            pieces.push_back({TileKey(path[i].pos), i, i});
+            continue;
+            }
+        const int64_t tile = TileKey((path[i - 1].pos + path[i].pos) * 0.5f);
+        Piece &piece = pieces.back();
+        if (piece.last == piece.first)
+            piece.tile = tile;
+        else if (piece.tile != tile)
+            pieces.push_back({tile, i - 1, i - 1});
+        pieces.back().last = i;
+        }
+    std::stable_sort(pieces.begin(), pieces.end(), [](const Piece &a, const Piece &b) { return a.tile < b.tile; });
+
+    layer.vertices.reserve(path.size() + pieces.size());
+    layer.runFirst.reserve(pieces.size());
+    layer.runCount.reserve(pieces.size());
+    layer.moves.reserve(path.size() + pieces.size());
+    for (size_t k = 0; k < pieces.size(); ++k)
+        {
+        const Piece &piece = pieces[k];
+        if (k == 0 || piece.tile != pieces[k - 1].tile)
+            {
+            GCodePackedTile tile;
+            tile.firstRun = static_cast<uint32_t>(k);
+            tile.cellX = static_cast<int16_t>(static_cast<int32_t>(piece.tile & 0xFFFFFFFF));
+            tile.cellY = static_cast<int16_t>(piece.tile >> 32);
+            layer.tiles.push_back(tile);
+            }
+        GCodePackedTile &tile = layer.tiles.back();
+        ++tile.runs;
+        layer.runFirst.push_back(static_cast<int32_t>(layer.vertices.size()));
+        layer.runCount.push_back(static_cast<int32_t>(piece.last - piece.first + 1));
+        for (size_t i = piece.first; i <= piece.last; ++i)
+            {
+            const GCodePathVertex &v = path[i];
+            tile.boundsMin = glm::min(tile.boundsMin, v.pos);
+            tile.boundsMax = glm::max(tile.boundsMax, v.pos);
+            GCodePackedVertex p;
+            p.x = Quantize(v.pos.x, layer.origin.x, layer.step.x);
+            p.y = Quantize(v.pos.y, layer.origin.y, layer.step.y);
+            p.z = Quantize(v.pos.z, layer.origin.z, layer.step.z);
+            const bool runStart = i == piece.first;
+            p.feature = static_cast<uint8_t>(static_cast<uint8_t>(v.feature) | (runStart ? kRunStartBit : 0));
+            p.area = runStart ? 0 : EncodeArea(v.area);
+            p.speed = EncodeSpeed(v.speed);
+            p.fan = v.fan;
+            p.temperature = EncodeTemperature(v.temperature);
+            p.tool = v.tool;
+            layer.vertices.push_back(p);
+            layer.moves.push_back(v.move);
+            }
+        }
+    GrowSettingsRange(layer.vertices.data(), layer.vertices.size(), layer.settingsMin, layer.settingsMax);
+    return layer;
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GCodeParser.h"
+
+/// GPU vertex of a toolpath run, 12 bytes.
+/// The position is quantized to 16 bits per axis inside its layer's bounding box;
+/// see GCodePackedLayer::origin/step. `feature` holds the GCodeFeature in its low
+/// bits and kRunStartBit if a run starts here, so the instanced ribbon renderer
+/// can tell segments from run breaks. `area` is the cross-section of the extrusion
+/// ending here (see GCodePacking::EncodeArea). The last four bytes are the print
+/// settings of that segment (see GCodePathVertex), which the colour modes show.
+/// Both shaders decode all of it.
+struct GCodePackedVertex
+{
+    uint16_t x, y, z;
+    uint8_t feature;
+    uint8_t area;
+    uint8_t speed;              // GCodePacking::EncodeSpeed
+    uint8_t fan;                // 0..255
+    uint8_t temperature;        // GCodePacking::EncodeTemperature
+    uint8_t tool;
+};
+static_assert(sizeof(GCodePackedVertex) == 12);
+
+/// A square cell of a layer (GCodePacking::kTileSize on a side) and the runs
+/// inside it, so the renderer can skip cells outside the view. A tile's runs
+/// and vertices are contiguous; its bounds cover every vertex, travel included.
+struct GCodePackedTile
+{
+    uint32_t firstRun = 0;              // into GCodePackedLayer::runFirst/runCount
+    uint32_t runs = 0;
+    int16_t cellX = 0;                  // grid cell: x in [cellX, cellX + 1) * kTileSize
+    int16_t cellY = 0;
+    glm::vec3 boundsMin{FLT_MAX};
+    glm::vec3 boundsMax{-FLT_MAX};
+};
+static_assert(sizeof(GCodePackedTile) == 36);
+
+/// One layer ready for upload: packed vertices drawn as GL_LINE_STRIP runs,
+/// grouped by tile.
+struct GCodePackedLayer
+{
+    float z = 0.0f;
+    float height = 0.0f;                // layer thickness, mm; with `area` it gives the bead width
+    glm::vec3 origin{0.0f};             // position of quantized (0, 0, 0)
+    glm::vec3 step{0.0f};               // mm per quantization unit, per axis
+    glm::vec3 boundsMin{FLT_MAX};       // extrusions only; travel moves can leave the print
+    glm::vec3 boundsMax{-FLT_MAX};
+    float seconds = 0.0f;               // layer time, for the colour modes; Pack leaves it to the caller
+    glm::vec4 settingsMin{FLT_MAX};     // see GCodePacking::GrowSettingsRange
+    glm::vec4 settingsMax{-FLT_MAX};
+    std::vector<GCodePackedVertex> vertices;
+    std::vector<int32_t> runFirst;      // glMultiDrawArrays arguments
+    std::vector<int32_t> runCount;
+    std::vector<GCodePackedTile> tiles;
+    std::vector<uint32_t> moves;        // per vertex: GCodePathVertex::move, for playback
+
+    bool HasExtrusions() const { return boundsMin.x <= boundsMax.x; }
+};
+
+namespace GCodePacking
+{
+    constexpr uint8_t kRunStartBit = 0x80;
+
+    /// Largest cross-section `area` can hold, mm^2; far above any 1 mm nozzle line.
+    constexpr float kMaxArea = 2.0f;
+
+    /// Cross-sections are stored as sqrt(area / kMaxArea) in 8 bits, which keeps
+    /// the relative error near 2% for typical 0.05..0.3 mm^2 lines.
+    uint8_t EncodeArea(float area);
+    inline float DecodeArea(uint8_t code)
+    {
+        const float s = code / 255.0f;
+        return s * s * kMaxArea;
+    }
+
+    /// Fastest feedrate `speed` can hold, mm/s.
+    constexpr float kMaxSpeed = 1000.0f;
+
+    /// Feedrates are stored like cross-sections, as sqrt(speed / kMaxSpeed) in
+    /// 8 bits: about 2 mm/s apart at 50 mm/s and 6 mm/s at 500.
+    uint8_t EncodeSpeed(float speed);
+    inline float DecodeSpeed(uint8_t code)
+    {
+        const float s = code / 255.0f;
+        return s * s * kMaxSpeed;
+    }
+
+    /// Nozzle temperatures are stored in steps of kTemperatureStep degrees C.
+    constexpr float kTemperatureStep = 2.0f;
+    uint8_t EncodeTemperature(float celsius);
+    inline float DecodeTemperature(uint8_t code)
+    {
+        return code * kTemperatureStep;
+    }
+
+    /// Grow `mn` and `mx` by the decoded print settings of the extrusions among
+    /// `count` packed vertices: speed (mm/s), volumetric flow (area times speed,
+    /// mm^3/s), fan (percent) and temperature (degrees C). The shaders decode
+    /// the same values for the colour modes.
+    void GrowSettingsRange(const GCodePackedVertex *vertices, size_t count, glm::vec4 &mn, glm::vec4 &mx);
+
+    /// Edge of the XY grid layers are tiled on, mm.
+    constexpr float kTileSize = 20.0f;
+
+    /// Quantize a parsed layer `height` mm thick. The position error is at most
+    /// half a step, about 2 microns on a 250 mm bed. Runs are cut where they
+    /// cross into another tile (the cut vertex is repeated to start the next
+    /// piece) and reordered tile by tile; print order holds within a tile, so
+    /// `moves` never decreases inside one.
+    GCodePackedLayer Pack(float z, float height, const std::vector<GCodePathVertex> &path);
+
+    /// Content hash of a packed layer as it is drawn: Z, thickness, quantization,
+    /// vertices (`count` of them, which may live in a mapped file), runs and
+    /// tiles. `moves` and `seconds` are left out. Layers with equal hashes
+    /// upload the same buffers, so a re-slice can keep those it did not change.
+    uint64_t Hash(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, size_t count);
+
+    /// Compact copy of `count` packed vertices for keeping in RAM while they are
+    /// not on the GPU (see GCodeArena::SetKeepCompressed). Each vertex is a byte
+    /// saying which of its last six fields changed and whether Z did, the X, Y
+    /// (and Z) deltas from the vertex before as zigzag varints, then the changed
+    /// bytes: about 5 bytes instead of 12 for a sliced print.
+    std::vector<uint8_t> Compress(const GCodePackedVertex *vertices, size_t count);
+
+    /// Inverse of Compress: write the `count` vertices of `data` to `out`.
+    void Expand(const std::vector<uint8_t> &data, size_t count, GCodePackedVertex *out);
+
+    /// Compact copy of a layer's `count` move numbers (GCodePackedLayer::moves),
+    /// for keeping in RAM until playback or picking needs them: each is its step
+    /// from the one before as a zigzag varint, about a byte instead of 4, since
+    /// most vertices end the next move or the same one.
+    std::vector<uint8_t> CompressMoves(const uint32_t *moves, size_t count);
+
+    /// Inverse of CompressMoves: write the `count` move numbers of `data` to `out`.
+    void ExpandMoves(const std::vector<uint8_t> &data, size_t count, uint32_t *out);
+
+    /// Inverse of the position quantization, for code that needs positions back.
+    inline glm::vec3 Unpack(const GCodePackedLayer &layer, const GCodePackedVertex &v)
+    {
+        return layer.origin + glm::vec3(v.x, v.y, v.z) * layer.step;
+    }
+}
@@ -1,157 +1,1544 @@
 #include "GCodeParser.h"
-#include <fstream>
-#include <regex>
-#include <sstream>
+#include "GCodeLayerIndex.h"
+#include "GCodeTokenizer.h"
+#include "GCodeVisitor.h"
+#include "GCodeSource.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
 
-void GCodeParser::Parse
-(
-    const std::string &path,
-    std::vector<std::vector<GCodeColoredVertex> > &layers,
-    std::vector<float> &layerZs
-) const
+namespace
 {
-    std::ifstream in(path);
-    if (!in.is_open())
+    struct FeatureTag
+    {
+        std::string_view type;
+        GCodeFeature feature;
+    };
+
+    // Cura's ";TYPE:" values. Longer names come first where one is a prefix of another.
+    constexpr FeatureTag kFeatureTags[] = {
+        {"WALL-OUTER", GCodeFeature::WallOuter},
+        {"WALL-INNER", GCodeFeature::WallInner},
+        {"SKIN", GCodeFeature::Skin},
+        {"FILL", GCodeFeature::Infill},
+        {"SUPPORT-INTERFACE", GCodeFeature::SupportInterface},
+        {"SUPPORT-ROOF", GCodeFeature::SupportInterface},
+        {"SUPPORT-BOTTOM", GCodeFeature::SupportInterface},
+        {"SUPPORT", GCodeFeature::Support},
+        {"SKIRT", GCodeFeature::Skirt},
+        {"PRIME-TOWER", GCodeFeature::PrimeTower},
+    };
+
+    // Returns true and sets `feature` if the comment carries a Cura ";TYPE:" tag.
+    bool FeatureForComment(std::string_view comment, GCodeFeature &feature)
+    {
+        size_t pos = GCodeTokenizer::FindNoCase(comment, "TYPE:");
+        if (pos == std::string_view::npos)
+            return false;
+        std::string_view type = comment.substr(pos + 5);
+        feature = GCodeFeature::Other;
+        for (const FeatureTag &tag: kFeatureTags)
+            {
+            if (GCodeTokenizer::FindNoCase(type, tag.type) == 0)
+                {
+                feature = tag.feature;
+                break;
+                }
+            }
+        return true;
+    }
+
+    // Filament state after a move to `e` from `before`: retracted if E went down, primed if it went up.
+    bool RetractedAfter(float e, float before, bool retracted)
+    {
+        return e < before ? true : e > before ? false : retracted;
+    }
+
+    // Append `src` to `dst`, joining a run that `src` starts at the very point where `dst` ends,
+    // exactly as a single pass over both would have. `src` counts its moves from
+    // `moveOffset` moves into the layer of `dst`.
+    void AppendPath(std::vector<GCodePathVertex> &dst, const std::vector<GCodePathVertex> &src,
+                    uint32_t moveOffset = 0)
+    {
+        auto from = src.begin();
+        if (from != src.end() && !dst.empty() && from->IsRunStart() && dst.back().pos == from->pos)
+            ++from;
+        const size_t first = dst.size();
+        dst.insert(dst.end(), from, src.end());
+        for (size_t i = first; i < dst.size(); ++i)
+            dst[i].move += moveOffset;
+    }
+
+    // Squared distance from `p` to the segment [a, b].
+    float SegmentDistance2(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+    {
+        const glm::vec3 d = b - a;
+        const float len2 = glm::dot(d, d);
+        const float t = len2 > 0.0f ? std::clamp(glm::dot(p - a, d) / len2, 0.0f, 1.0f) : 0.0f;
+        const glm::vec3 off = p - (a + t * d);
+        return glm::dot(off, off);
+    }
+
+    // Simplify the layer if a tolerance is set and count what was removed, then hand it on.
+    GCodeParser::LayerCallback SimplifyingCallback(float tolerance, const GCodeParser::LayerCallback &onLayer,
+                                                   GCodeParseStats &stats)
+    {
+        if (tolerance <= 0.0f)
+            return onLayer;
+        return [tolerance, &onLayer, &stats](float z, std::vector<GCodePathVertex> &&path, const GCodeEstimate &estimate)
+            {
+            stats.removedVertices += GCodeParser::Simplify(path, tolerance);
+            return onLayer(z, std::move(path), estimate);
+            };
+    }
+
+    // Marlin's feedrate before the first F word, mm/min.
+    constexpr float kDefaultFeedrate = 1500.0f;
+
+    // Chord tolerance for arcs when the parser does not simplify, mm.
+    constexpr float kArcTolerance = 0.005f;
+    // Arcs tighter than this are drawn as a straight move, mm; a full circle
+    // is never split into more than kMaxArcSegments chords.
+    constexpr float kMinArcRadius = 1e-4f;
+    constexpr int kMaxArcSegments = 1024;
+    constexpr double kPi = 3.14159265358979323846;
+
+    // G10 and G11 retract and prime the filament when the firmware does the
+    // retraction. RepRapFirmware's "G10 P<tool>" sets tool offsets instead.
+    bool FirmwareRetraction(GCodeAction action, const GCodeCommand &cmd, bool &retracted)
+    {
+        if ((action != GCodeAction::Retract && action != GCodeAction::Unretract) || cmd.Has(GCodeCommand::HasP))
+            return false;
+        retracted = action == GCodeAction::Retract;
+        return true;
+    }
+
+    // The E position a G92 sets, if it sets one.
+    template <typename Flavor>
+    bool SetPositionE(GCodeAction action, const GCodeCommand &cmd, float &e)
+    {
+        if (action != GCodeAction::SetPosition)
+            return false;
+        if (cmd.Has(GCodeCommand::HasE))
+            {
+            e = cmd.e;
+            return true;
+            }
+        if constexpr (Flavor::kBareSetPositionZeroes)
+            {
+            if ((cmd.words & (GCodeCommand::HasX | GCodeCommand::HasY | GCodeCommand::HasZ)) == 0)
+                {
+                e = 0.0f;
+                return true;
+                }
+            }
+        return false;
+    }
+
+    // Points along the G2/G3 arc in `cmd` from `from` to `to`, after `from`:
+    // chords that stray at most `tolerance` from the arc, rising evenly in Z
+    // for a helix, the last point being `to` itself. The centre is given by I
+    // and J or, where the flavor has it, found from the radius R as Marlin does;
+    // a negative R takes the longer way round. Returns false if the arc has no
+    // usable centre, which the caller draws as a straight move like firmware
+    // without arc support would.
+    template <typename Flavor>
+    bool ArcPoints(const GCodeCommand &cmd, bool clockwise, const glm::vec3 &from, const glm::vec3 &to,
+                   float tolerance, std::vector<glm::vec3> &points)
+    {
+        const glm::vec2 a(from), b(to);
+        glm::vec2 center;
+        if (cmd.Has(GCodeCommand::HasI) || cmd.Has(GCodeCommand::HasJ))
+            center = a + glm::vec2(cmd.Has(GCodeCommand::HasI) ? cmd.i : 0.0f,
+                                   cmd.Has(GCodeCommand::HasJ) ? cmd.j : 0.0f);
+        else if constexpr (Flavor::kArcRadius)
+            {
+            if (!cmd.Has(GCodeCommand::HasR) || cmd.r == 0.0f || a == b)
+                return false;
+            const glm::vec2 chord = b - a;
+            const float length = glm::length(chord);
+            const float offset = std::sqrt(std::max(cmd.r * cmd.r - 0.25f * length * length, 0.0f));
+            const float side = clockwise != (cmd.r < 0.0f) ? -1.0f : 1.0f;
+            center = 0.5f * (a + b) + side * offset / length * glm::vec2(-chord.y, chord.x);
+            }
+        else
+            return false;
+
+        const glm::vec2 start = a - center;
+        const glm::vec2 end = b - center;
+        const float radius = glm::length(start);
+        if (!(radius > kMinArcRadius))
+            return false;
+        double sweep = std::atan2(start.x * end.y - start.y * end.x, glm::dot(start, end));
+        if (sweep < 0.0)
+            sweep += 2.0 * kPi;
+        if (clockwise)
+            sweep -= 2.0 * kPi;
+        else if (sweep == 0.0 && a == b)
+            sweep = 2.0 * kPi;
+
+        // A chord spanning angle t strays r (1 - cos(t / 2)) from the arc.
+        const double maxAngle = tolerance < radius ? 2.0 * std::acos(1.0 - static_cast<double>(tolerance) / radius)
+                                                   : kPi;
+        const int segments = static_cast<int>(std::clamp(std::ceil(std::abs(sweep) / maxAngle), 1.0,
+                                                         static_cast<double>(kMaxArcSegments)));
+        const double angle = std::atan2(start.y, start.x);
+        points.clear();
+        for (int k = 1; k < segments; ++k)
+            {
+            const double t = static_cast<double>(k) / segments;
+            const double at = angle + sweep * t;
+            points.emplace_back(center.x + radius * static_cast<float>(std::cos(at)),
+                                center.y + radius * static_cast<float>(std::sin(at)),
+                                from.z + (to.z - from.z) * static_cast<float>(t));
+            }
+        points.push_back(to);
+        return true;
+    }
+
+    // Modal state a chunk inherits from everything before it.
+    struct ModalState
+    {
+        glm::vec3 lastPos{0.0f};
+        bool hasLastPos = false;
+        float lastExtrusion = 0.0f;
+        float currentZ = 0.0f;
+        GCodeFeature currentFeature = GCodeFeature::Other;
+        bool retracted = false;     // the last change of E was a retraction
+        bool inLayer = false;       // false until the file's first layer has started
+        GCodeModes modes;                   // G90/G91, M82/M83
+        float feedrate = kDefaultFeedrate;
+        float printAcceleration = 0.0f;     // M204 P (or S), for moves that extrude or retract
+        float travelAcceleration = 0.0f;    // M204 T (or S)
+        glm::vec3 jerk{0.0f};               // M205 X, Z, E
+        float fan = 0.0f;                   // M106 S / M107, 0..255
+        float temperature = 0.0f;           // M104 / M109 S
+        int tool = 0;                       // T<n>
+
+        // State at the start of a file printed on `machine`.
+        static ModalState Initial(const GCodeMachineLimits &machine)
+        {
+            ModalState s;
+            s.printAcceleration = s.travelAcceleration = machine.acceleration;
+            s.jerk = glm::vec3(machine.jerkXY, machine.jerkZ, machine.jerkE);
+            return s;
+        }
+
+        // Follow M204 (acceleration) and M205 (jerk); returns false for other commands.
+        bool ReadMotionSettings(GCodeAction action, const GCodeCommand &cmd)
+        {
+            if (action == GCodeAction::Acceleration)
+                {
+                if (cmd.Has(GCodeCommand::HasS))
+                    printAcceleration = travelAcceleration = cmd.s;
+                if (cmd.Has(GCodeCommand::HasP))
+                    printAcceleration = cmd.p;
+                if (cmd.Has(GCodeCommand::HasT))
+                    travelAcceleration = cmd.t;
+                }
+            else if (action == GCodeAction::Jerk)
+                {
+                if (cmd.Has(GCodeCommand::HasX))
+                    jerk.x = cmd.x;
+                if (cmd.Has(GCodeCommand::HasZ))
+                    jerk.y = cmd.z;
+                if (cmd.Has(GCodeCommand::HasE))
+                    jerk.z = cmd.e;
+                }
+            else
+                return false;
+            return true;
+        }
+
+        // Follow the part cooling fan (M106/M107), nozzle temperature (M104/M109)
+        // and tool changes; returns false for other commands. Marlin numbers the
+        // part fan P0 and Bambu firmware P1, so higher fan indices are ignored.
+        // The A1 mini's four filaments share one nozzle, so a T word on M104 or
+        // M109 does not select another temperature.
+        bool ReadPrintSettings(GCodeAction action, const GCodeCommand &cmd)
         {
-        throw std::runtime_error("Failed to open G-code file: " + path);
+            if (action == GCodeAction::Tool)
+                {
+                tool = cmd.number;
+                return true;
+                }
+            const bool partFan = !cmd.Has(GCodeCommand::HasP) || cmd.p <= 1.0f;
+            if (action == GCodeAction::Fan && partFan)
+                fan = cmd.Has(GCodeCommand::HasS) ? std::clamp(cmd.s, 0.0f, 255.0f) : 255.0f;
+            else if (action == GCodeAction::FanOff && partFan)
+                fan = 0.0f;
+            else if (action == GCodeAction::Temperature && cmd.Has(GCodeCommand::HasS))
+                temperature = cmd.s;
+            else
+                return false;
+            return true;
         }
+    };
 
-    std::string line;
-    glm::vec3 lastPos(0.0f);
-    bool hasLastPos = false;
-    float lastExtrusion = 0.0f;
-    float currentZ = 0.0f;
-    int currentLayerIndex = -1;
-    glm::vec3 modelColor(0.8f, 0.8f, 0.8f);
-    glm::vec3 infillColor(0.9f, 0.4f, 0.1f);
-    glm::vec3 supportColor(0.1f, 0.5f, 0.9f);
-    glm::vec3 currentColor = modelColor;
+    // The modes over a stretch of the buffer: those it starts with, and where
+    // they change. A line is read with the modes of the last switch before it.
+    struct ModeTrack
+    {
+        GCodeModes entry;
+        std::vector<std::pair<const char *, GCodeModes> > switches;   // switch line, modes from there on
+        bool needE = true;      // something after the stretch may read the E position it leaves
 
-    std::regex moveRegex(R"(^(?:G0|G1)\s+([^;]*))");
+        GCodeModes Exit() const { return switches.empty() ? entry : switches.back().second; }
 
-    while (std::getline(in, line))
+        template <typename Flavor>
+        bool HasAbsoluteE() const
         {
-        std::string comment;
-        size_t semiPos = line.find(';');
-        if (semiPos != std::string::npos)
+            bool absolute = !entry.RelativeE<Flavor>();
+            for (const auto &s: switches)
+                absolute = absolute || !s.second.RelativeE<Flavor>();
+            return absolute;
+        }
+    };
+
+    // Track the modes from `entry` through the switches [first, last), found at
+    // offsets from `base`.
+    template <typename Flavor>
+    ModeTrack TrackModes(const char *base, const GCodeModeSwitch *first, const GCodeModeSwitch *last,
+                         GCodeModes entry)
+    {
+        ModeTrack track;
+        track.entry = entry;
+        for (; first != last; ++first)
             {
-            comment = line.substr(semiPos + 1);
+            entry.Apply<Flavor>(first->action);
+            track.switches.emplace_back(base + first->offset, entry);
             }
+        return track;
+    }
+
+    // Where one axis is after a chunk, as a backward scan finds it: at the
+    // value of its last absolute word, or where it was before the chunk, plus
+    // the relative (G91 or M83) steps after either. The steps are added in file
+    // order, as the parser adds them, so the sum is the same to the last bit.
+    struct AxisTail
+    {
+        bool anchored = false;
+        float value = 0.0f;
+        std::vector<float> steps;   // latest first
+
+        // Note a word setting the axis to `v`, or moving it by `v` if `relative`.
+        void Read(float v, bool relative)
+        {
+            if (anchored)
+                return;
+            if (relative)
+                steps.push_back(v);
+            else
+                {
+                anchored = true;
+                value = v;
+                }
+        }
+
+        float Apply(float before) const
+        {
+            float v = anchored ? value : before;
+            for (auto it = steps.rbegin(); it != steps.rend(); ++it)
+                v += *it;
+            return v;
+        }
+    };
+
+    // The last value of each modal word inside a chunk, found by scanning it backwards.
+    struct ChunkTail
+    {
+        AxisTail x, y, z, e;        // e: E position, from moves and G92
+        bool hasFeature = false, hasMove = false;
+        GCodeFeature feature = GCodeFeature::Other;
+        // Retraction state: resolved once the last change of E is known. A
+        // relative move or G10/G11 tells at once; an absolute move only once the
+        // E before it is known too. Until then `moveE` is the latest such move,
+        // `beforeMoveE` the E before it so far, and `retractedBefore` the state
+        // before it if a line between decided that.
+        bool hasRetracted = false, retracted = false, hasMoveE = false;
+        float moveE = 0.0f;
+        AxisTail beforeMoveE;
+        bool hasRetractedBefore = false, retractedBefore = false;
+        bool hasFeedrate = false;
+        float feedrate = 0.0f;
+        // Motion settings are rare, so the main scan does not wait for them: those
+        // it passes win, the rest are looked for by a lighter scan of the lines
+        // before (see ScanTail), and what is not in the chunk carries over.
+        bool hasPrintAcceleration = false, hasTravelAcceleration = false;
+        float printAcceleration = 0.0f, travelAcceleration = 0.0f;
+        glm::bvec3 hasJerk{false};
+        glm::vec3 jerk{0.0f};
+        // Likewise for the print settings.
+        bool hasFan = false, hasTemperature = false, hasTool = false;
+        float fan = 0.0f, temperature = 0.0f;
+        int tool = 0;
+        size_t decoded = 0;         // lines decoded to find all this
+
+        // In relative E mode nothing needs the E position unless an absolute
+        // move may follow, so `needE` (ModeTrack::needE) saves scanning the
+        // whole chunk for a G92.
+        bool Complete(bool needE) const
+        {
+            return x.anchored && y.anchored && z.anchored && (e.anchored || !needE) && hasRetracted && hasFeature &&
+                   hasFeedrate;
+        }
+        bool SettingsComplete() const
+        {
+            return hasPrintAcceleration && hasTravelAcceleration && glm::all(hasJerk) && hasFan && hasTemperature &&
+                   hasTool;
+        }
+
+        // Note a line that sets E: a move, by `value` if `relative`, or a G92.
+        void ReadE(float value, bool move, bool relative)
+        {
+            e.Read(value, move && relative);
+            if (hasRetracted)
+                return;
+            if (!hasMoveE)
+                {
+                if (move && relative && value != 0.0f)
+                    {
+                    hasRetracted = true;
+                    retracted = value < 0.0f;
+                    }
+                else if (move && !relative)
+                    {
+                    hasMoveE = true;
+                    moveE = value;
+                    }
+                return;
+                }
+            if (move && relative)
+                {
+                beforeMoveE.Read(value, true);
+                if (value != 0.0f)
+                    ReadRetraction(value < 0.0f);
+                return;
+                }
+            beforeMoveE.Read(value, false);
+            const float before = beforeMoveE.Apply(0.0f);
+            if (moveE != before || hasRetractedBefore)
+                {
+                hasRetracted = true;
+                retracted = moveE != before ? moveE < before : retractedBefore;
+                }
+            else
+                {
+                // A G92 to the same value hides nothing; look further back.
+                hasMoveE = move;
+                moveE = value;
+                beforeMoveE = {};
+                }
+        }
+
+        // Note a retraction or priming that did not move E (G10, G11), or one
+        // before the latest absolute move.
+        void ReadRetraction(bool retract)
+        {
+            if (hasRetracted || hasRetractedBefore)
+                return;
+            if (hasMoveE)
+                {
+                hasRetractedBefore = true;
+                retractedBefore = retract;
+                }
+            else
+                {
+                hasRetracted = true;
+                retracted = retract;
+                }
+        }
+
+        // Note the M204 or M205 in `cmd` unless a later one was seen already.
+        void ReadMotionSettings(GCodeAction action, const GCodeCommand &cmd)
+        {
+            ModalState later;
+            if (!later.ReadMotionSettings(action, cmd))
+                return;
+            if (action == GCodeAction::Acceleration)
+                {
+                if (!hasPrintAcceleration && (cmd.Has(GCodeCommand::HasS) || cmd.Has(GCodeCommand::HasP)))
+                    {
+                    hasPrintAcceleration = true;
+                    printAcceleration = later.printAcceleration;
+                    }
+                if (!hasTravelAcceleration && (cmd.Has(GCodeCommand::HasS) || cmd.Has(GCodeCommand::HasT)))
+                    {
+                    hasTravelAcceleration = true;
+                    travelAcceleration = later.travelAcceleration;
+                    }
+                return;
+                }
+            const glm::bvec3 has(cmd.Has(GCodeCommand::HasX), cmd.Has(GCodeCommand::HasZ), cmd.Has(GCodeCommand::HasE));
+            for (int i = 0; i < 3; ++i)
+                {
+                if (has[i] && !hasJerk[i])
+                    {
+                    hasJerk[i] = true;
+                    jerk[i] = later.jerk[i];
+                    }
+                }
+        }
+
+        // Note the print setting in `cmd` unless a later one was seen already.
+        void ReadPrintSettings(GCodeAction action, const GCodeCommand &cmd)
+        {
+            ModalState later;
+            later.fan = -1.0f;
+            later.temperature = -1.0f;
+            later.tool = -1;
+            if (!later.ReadPrintSettings(action, cmd))
+                return;
+            if (!hasFan && later.fan >= 0.0f)
+                {
+                hasFan = true;
+                fan = later.fan;
+                }
+            if (!hasTemperature && later.temperature >= 0.0f)
+                {
+                hasTemperature = true;
+                temperature = later.temperature;
+                }
+            if (!hasTool && later.tool >= 0)
+                {
+                hasTool = true;
+                tool = later.tool;
+                }
+        }
+
+        // State after a chunk with this tail, given the state before it. The
+        // modes come from the chunk's ModeTrack.
+        ModalState Apply(ModalState s) const
+        {
+            s.lastPos.x = x.Apply(s.lastPos.x);
+            s.lastPos.y = y.Apply(s.lastPos.y);
+            s.lastPos.z = s.currentZ = z.Apply(s.currentZ);
+            if (hasRetracted)
+                s.retracted = retracted;
+            else if (hasMoveE)
+                {
+                const float before = beforeMoveE.Apply(s.lastExtrusion);
+                s.retracted = moveE != before ? moveE < before : hasRetractedBefore ? retractedBefore : s.retracted;
+                }
+            s.lastExtrusion = e.Apply(s.lastExtrusion);
+            if (hasFeature) s.currentFeature = feature;
+            s.hasLastPos = s.hasLastPos || hasMove;
+            if (hasFeedrate) s.feedrate = feedrate;
+            if (hasPrintAcceleration) s.printAcceleration = printAcceleration;
+            if (hasTravelAcceleration) s.travelAcceleration = travelAcceleration;
+            for (int i = 0; i < 3; ++i)
+                {
+                if (hasJerk[i])
+                    s.jerk[i] = jerk[i];
+                }
+            if (hasFan) s.fan = fan;
+            if (hasTemperature) s.temperature = temperature;
+            if (hasTool) s.tool = tool;
+            return s;
+        }
+    };
+
+    // Output of one chunk. Segments extruded before the chunk's first layer change
+    // belong to whatever layer is open at the chunk start, so they are kept apart
+    // until the chunks are stitched together in file order.
+    struct ChunkResult
+    {
+        std::vector<GCodePathVertex> carried;
+        float carriedZ = 0.0f;      // Z for a new layer if no layer is open yet
+        bool carriedHasZ = false;   // a Z word came before the chunk's first layer start
+        float carriedFirstZ = 0.0f;
+        std::vector<std::vector<GCodePathVertex> > layers;
+        std::vector<float> layerZs;
+        bool zPending = false;      // the last layer's marker has not been followed by a Z yet
+        GCodeParseStats stats;
+        // Estimates parallel to `carried` and `layers`. A layer's moves are planned
+        // once it is complete, so those of the carried and the last layer are
+        // left to whoever stitches the chunks together.
+        GCodeEstimate carriedEstimate;
+        GCodeTimeEstimator carriedMoves;
+        std::vector<GCodeEstimate> layerEstimates;
+        GCodeTimeEstimator openMoves;
+        // With ChunkOptions::deferFirstLayer, the moves of the first of several
+        // layers, which the stitch plans after any preamble before them.
+        GCodeTimeEstimator firstMoves;
+        // With ChunkOptions::keepOpen, the state to parse the text after the chunk from.
+        ModalState exit;
+    };
 
-        std::smatch m;
-        if (!std::regex_search(line, m, moveRegex))
+    // Walk lines backwards from `end` until every modal word has been seen.
+    // This is usually a few hundred lines, far cheaper than parsing the chunk.
+    // Settings such as a temperature may be set once at the top of the file, so
+    // the rest of the chunk is then searched for M and T commands. `modes` says
+    // which lines are relative.
+    template <typename Flavor>
+    ChunkTail ScanTail(const char *begin, const char *end, const ModeTrack &modes)
+    {
+        ChunkTail tail;
+        GCodeCommand cmd;
+        size_t next = modes.switches.size();    // switches before the current line
+        const char *lineEnd = end;
+        while (lineEnd > begin && !tail.Complete(modes.needE))
+            {
+            const char *lineBegin = lineEnd;
+            while (lineBegin > begin && lineBegin[-1] != '\n')
+                --lineBegin;
+            while (next > 0 && modes.switches[next - 1].first > lineBegin)
+                --next;
+            const GCodeModes &mode = next > 0 ? modes.switches[next - 1].second : modes.entry;
+            std::string_view line(lineBegin, static_cast<size_t>(lineEnd - lineBegin));
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            GCodeTokenizer::Decode(line, cmd);
+            ++tail.decoded;
+            if (!tail.hasFeature && !cmd.comment.empty())
+                tail.hasFeature = FeatureForComment(cmd.comment, tail.feature);
+            const GCodeAction action = GCodeDispatch<Flavor>::Of(cmd);
+            tail.ReadMotionSettings(action, cmd);
+            tail.ReadPrintSettings(action, cmd);
+            float e = 0.0f;
+            bool retracted = false;
+            if (action == GCodeAction::Move || action == GCodeAction::ArcClockwise ||
+                action == GCodeAction::ArcCounterClockwise)
+                {
+                tail.hasMove = true;
+                if (!tail.hasFeedrate && cmd.Has(GCodeCommand::HasF)) { tail.hasFeedrate = true; tail.feedrate = cmd.f; }
+                if (cmd.Has(GCodeCommand::HasX)) tail.x.Read(cmd.x, mode.relative);
+                if (cmd.Has(GCodeCommand::HasY)) tail.y.Read(cmd.y, mode.relative);
+                if (cmd.Has(GCodeCommand::HasZ)) tail.z.Read(cmd.z, mode.relative);
+                if (cmd.Has(GCodeCommand::HasE))
+                    tail.ReadE(cmd.e, true, mode.RelativeE<Flavor>());
+                }
+            else if (SetPositionE<Flavor>(action, cmd, e))
+                tail.ReadE(e, false, false);
+            else if (FirmwareRetraction(action, cmd, retracted))
+                tail.ReadRetraction(retracted);
+            lineEnd = lineBegin > begin ? lineBegin - 1 : begin;
+            }
+        if (!tail.SettingsComplete())
             {
-            if (!comment.empty())
+            // M and T are rare outside commands, so memchr finds the few lines
+            // that can hold one much faster than walking every line.
+            std::vector<const char *> lines;
+            for (const char letter: {'M', 'T'})
                 {
-                std::string upper = comment;
-                std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
-                auto pos = upper.find("TYPE:");
-                if (pos != std::string::npos)
+                for (const char *p = begin; p < lineEnd; ++p)
                     {
-                    std::string type = upper.substr(pos + 5);
-                    if (type.find("SUPPORT") != std::string::npos)
-                        currentColor = supportColor;
-                    else if (type.find("FILL") != std::string::npos)
-                        currentColor = infillColor;
-                    else
-                        currentColor = modelColor;
+                    p = static_cast<const char *>(std::memchr(p, letter, static_cast<size_t>(lineEnd - p)));
+                    if (!p)
+                        break;
+                    const char *lineBegin = p;
+                    while (lineBegin > begin && (lineBegin[-1] == ' ' || lineBegin[-1] == '\t'))
+                        --lineBegin;
+                    if (lineBegin == begin || lineBegin[-1] == '\n')
+                        lines.push_back(p);
                     }
                 }
-            continue;
+            std::sort(lines.begin(), lines.end(), std::greater<>());
+            for (size_t i = 0; i < lines.size() && !tail.SettingsComplete(); ++i)
+                {
+                const size_t rest = static_cast<size_t>(lineEnd - lines[i]);
+                const char *eol = static_cast<const char *>(std::memchr(lines[i], '\n', rest));
+                std::string_view line(lines[i], eol ? static_cast<size_t>(eol - lines[i]) : rest);
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+                GCodeTokenizer::Decode(line, cmd);
+                ++tail.decoded;
+                const GCodeAction action = GCodeDispatch<Flavor>::Of(cmd);
+                tail.ReadMotionSettings(action, cmd);
+                tail.ReadPrintSettings(action, cmd);
+                }
             }
+        return tail;
+    }
 
-        if (!comment.empty())
+    // Hand the layer that is currently open in `out` to `emit` and drop it from `out`.
+    bool EmitOpenLayer(ChunkResult &out, const GCodeParser::LayerCallback &emit)
+    {
+        bool keepGoing = true;
+        if (!out.layers.empty())
             {
-            std::string upper = comment;
-            std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
-            auto pos = upper.find("TYPE:");
-            if (pos != std::string::npos)
+            GCodeEstimate &estimate = out.layerEstimates.back();
+            estimate.seconds += out.openMoves.Flush(&estimate.moveTimes);
+            out.stats.estimate += estimate;
+            keepGoing = emit(out.layerZs.back(), std::move(out.layers.back()), estimate);
+            }
+        else if (!out.carried.empty())
+            {
+            out.carriedEstimate.seconds += out.carriedMoves.Flush(&out.carriedEstimate.moveTimes);
+            out.stats.estimate += out.carriedEstimate;
+            keepGoing = emit(out.carriedZ, std::move(out.carried), out.carriedEstimate);
+            }
+        out.layers.clear();
+        out.layerZs.clear();
+        out.layerEstimates.clear();
+        out.carried.clear();
+        out.carriedEstimate = {};
+        return keepGoing;
+    }
+
+    // Open a new layer at `z`. Segments from before the first layer of the file
+    // (start G-code, prime line) become the start of that layer. With
+    // `deferFirst` the first layer's moves are kept in out.firstMoves unplanned.
+    bool StartLayer
+    (
+        ChunkResult &out,
+        ModalState &state,
+        float z,
+        std::vector<GCodePathVertex> *&target,
+        const GCodeParser::LayerCallback *emit,
+        bool deferFirst
+    )
+    {
+        std::vector<GCodePathVertex> preamble;
+        GCodeEstimate preambleEstimate;
+        if (!state.inLayer)
+            {
+            preamble.swap(out.carried);
+            std::swap(preambleEstimate, out.carriedEstimate);
+            out.openMoves.Append(std::move(out.carriedMoves));
+            }
+        else if (!out.layers.empty())
+            {
+            // The open layer is complete.
+            GCodeEstimate &estimate = out.layerEstimates.back();
+            if (deferFirst && out.layers.size() == 1)
+                out.firstMoves.Append(std::move(out.openMoves));
+            else
+                estimate.seconds += out.openMoves.Flush(&estimate.moveTimes);
+            }
+        if (emit && !EmitOpenLayer(out, *emit))
+            return false;
+        state.inLayer = true;
+        out.layerZs.push_back(z);
+        out.layers.push_back(std::move(preamble));
+        out.layerEstimates.push_back(preambleEstimate);
+        target = &out.layers.back();
+        return true;
+    }
+
+    // Tell `visitor` about the print setting `action` just changed in `s`.
+    void ReportPrintSetting(IGCodeVisitor &visitor, GCodeAction action, const ModalState &s)
+    {
+        if (action == GCodeAction::Tool)
+            visitor.OnTool(s.tool);
+        else if (action == GCodeAction::Temperature)
+            visitor.OnTemperature(s.temperature);
+        else
+            visitor.OnFan(s.fan);
+    }
+
+    // Parser settings every chunk needs.
+    struct ChunkOptions
+    {
+        bool markers = false;       // layers start at ";LAYER:" markers, not at every new Z
+        float filamentArea = 0.0f;  // mm^2, turns E into extruded volume
+        float gramsPerMm = 0.0f;    // filament mass per mm of E
+        GCodeMachineLimits machine;
+        bool timed = true;          // plan moves for the print time (see GCodeTimeEstimator::SetTimed)
+        bool moveLines = false;     // fill GCodeEstimate::moveLines
+        float arcTolerance = kArcTolerance;     // chord tolerance G2/G3 arcs are drawn with, mm
+        // Leave the first layer's moves to the stitch, when a preamble from
+        // earlier chunks may have to be planned with them.
+        bool deferFirstLayer = false;
+        // More text follows the chunk: keep the open layer in `out` rather than
+        // emit it, so a later ParseChunk with the same `out` can carry on.
+        bool keepOpen = false;
+    };
+
+    // Arcs are drawn as finely as the parser simplifies: chords within the
+    // simplification tolerance look the same as the arc would after it.
+    ChunkOptions ChunkOptionsFor(bool markers, float filamentDiameter, float filamentDensity,
+                                 const GCodeMachineLimits &machine, float simplifyTolerance)
+    {
+        const float radius = 0.5f * filamentDiameter;
+        const float area = 3.14159265f * radius * radius;
+        ChunkOptions options{markers, area, area * filamentDensity * 1e-3f, machine};
+        if (simplifyTolerance > 0.0f)
+            options.arcTolerance = simplifyTolerance;
+        return options;
+    }
+
+    // Parse one chunk from `state`. Layers start at ";LAYER:" markers if
+    // `options.markers` is set and at every new Z otherwise. With `emit`, each
+    // layer is handed over as soon as the next one starts instead of being kept
+    // in `out`; returns false if `emit` asked to stop. `visitors` hear of
+    // every command, layer start, setting change and move as it is read.
+    // A layer `out` holds open from an earlier chunk is carried on.
+    template <typename Flavor>
+    bool ParseChunk
+    (
+        const char *begin,
+        const char *end,
+        ModalState state,
+        const ChunkOptions &options,
+        ChunkResult &out,
+        const GCodeParser::LayerCallback *emit = nullptr,
+        const std::vector<IGCodeVisitor *> *visitors = nullptr
+    )
+    {
+        const bool markers = options.markers;
+        out.stats.bytes += static_cast<size_t>(end - begin);
+        std::vector<GCodePathVertex> *target = &out.carried;
+        GCodeEstimate *estimate = &out.carriedEstimate;
+        GCodeTimeEstimator *moves = &out.carriedMoves;
+        if (!out.layers.empty())
+            {
+            target = &out.layers.back();
+            estimate = &out.layerEstimates.back();
+            moves = &out.openMoves;
+            }
+        out.carriedMoves.SetLimits(options.machine);
+        out.openMoves.SetLimits(options.machine);
+        out.carriedMoves.SetTimed(options.timed);
+        out.openMoves.SetTimed(options.timed);
+        // A parse without visitors pays one test per event.
+        auto notify = [&](auto &&event)
+            {
+            if (!visitors)
+                return;
+            for (IGCodeVisitor *visitor: *visitors)
+                event(*visitor);
+            };
+        size_t layersStarted = 0;
+        auto startLayer = [&](float z)
+            {
+            if (!StartLayer(out, state, z, target, emit, options.deferFirstLayer))
+                return false;
+            estimate = &out.layerEstimates.back();
+            moves = &out.openMoves;
+            notify([&](IGCodeVisitor &v) { v.OnLayer(layersStarted, out.stats.lines - 1); });
+            ++layersStarted;
+            return true;
+            };
+
+        // A move or pause the estimator queued came from the current line.
+        auto recordLine = [&](size_t movesBefore)
+            {
+            if (options.moveLines && moves->Size() > movesBefore)
+                estimate->moveLines.push_back(static_cast<uint32_t>(out.stats.lines - 1));
+            };
+
+        // One straight segment from the last position to `to`, moving
+        // `filament` mm of E of which `extruded` is pushed out of the nozzle.
+        auto moveTo = [&](const glm::vec3 &to, float filament, float extruded)
+            {
+            const uint32_t movesBefore = static_cast<uint32_t>(moves->Size());
+            const GCodeFeature feature = extruded > 0.0f ? state.currentFeature
+                                       : state.retracted ? GCodeFeature::Retract
+                                       : GCodeFeature::Travel;
+            if (state.hasLastPos)
                 {
-                std::string type = upper.substr(pos + 5);
-                if (type.find("SUPPORT") != std::string::npos)
-                    currentColor = supportColor;
-                else if (type.find("FILL") != std::string::npos)
-                    currentColor = infillColor;
-                else
-                    currentColor = modelColor;
+                const float acceleration = filament != 0.0f ? state.printAcceleration : state.travelAcceleration;
+                moves->AddMove(glm::vec4(to - state.lastPos, filament), state.feedrate * (1.0f / 60.0f),
+                               acceleration, state.jerk);
+                recordLine(movesBefore);
+                notify([&](IGCodeVisitor &v)
+                    {
+                    v.OnMove({out.stats.lines - 1, state.lastPos, to, filament, state.feedrate * (1.0f / 60.0f),
+                              feature});
+                    });
                 }
-            }
 
-        std::string tokenStr = m[1].str();
-        std::istringstream tokenStream(tokenStr);
-        std::string token;
-        float X = NAN, Y = NAN, Z = NAN, E = NAN;
-        while (tokenStream >> token)
+            if (state.hasLastPos && to != state.lastPos)
+                {
+                if (target == &out.carried && out.carried.empty())
+                    out.carriedZ = to.z;
+                GCodePathVertex v;
+                v.feature = feature;
+                v.fan = static_cast<uint8_t>(std::lround(state.fan));
+                v.tool = static_cast<uint8_t>(std::clamp(state.tool, 0, 255));
+                v.speed = state.feedrate * (1.0f / 60.0f);
+                v.temperature = state.temperature;
+                if (target->empty() || target->back().pos != state.lastPos)
+                    {
+                    v.pos = state.lastPos;
+                    v.flags = GCodePathVertex::RunStart;
+                    v.move = movesBefore;
+                    target->push_back(v);
+                    ++out.stats.vertices;
+                    }
+                // Volume over length gives the bead's cross-section.
+                v.pos = to;
+                v.flags = 0;
+                v.area = extruded * options.filamentArea / glm::length(to - state.lastPos);
+                v.move = static_cast<uint32_t>(moves->Size());
+                target->push_back(v);
+                ++out.stats.vertices;
+                }
+
+            state.lastPos = to;
+            state.hasLastPos = true;
+            };
+
+        GCodeLineScanner scanner(begin, end);
+        GCodeCommand cmd;
+        std::string_view line;
+        std::vector<glm::vec3> arc;
+        while (scanner.Next(line))
             {
-            if (token.size() < 2)
+            ++out.stats.lines;
+            if (markers && GCodeLayerIndex::IsMarker(line))
+                {
+                if (!startLayer(state.currentZ))
+                    return false;
+                out.zPending = true;
                 continue;
-            char prefix = token[0];
-            std::string numberPart = token.substr(1);
-            float value = 0.0f;
-            bool ok = false;
-            try
+                }
+            GCodeTokenizer::Decode(line, cmd);
+            ++out.stats.decoded;
+            if (cmd.letter)
+                notify([&](IGCodeVisitor &v) { v.OnCommand(cmd, out.stats.lines - 1); });
+            if (!cmd.comment.empty())
                 {
-                value = std::stof(numberPart);
-                ok = true;
+                const GCodeFeature before = state.currentFeature;
+                if (FeatureForComment(cmd.comment, state.currentFeature) && state.currentFeature != before)
+                    notify([&](IGCodeVisitor &v) { v.OnFeature(state.currentFeature); });
                 }
-            catch (const std::exception &) { ok = false; }
-            if (!ok)
+            const GCodeAction action = GCodeDispatch<Flavor>::Of(cmd);
+            if (action != GCodeAction::Move && action != GCodeAction::ArcClockwise &&
+                action != GCodeAction::ArcCounterClockwise)
+                {
+                // "G92 E0" resets the extruder position without moving filament.
+                float e = 0.0f;
+                if (SetPositionE<Flavor>(action, cmd, e))
+                    state.lastExtrusion = e;
+                else if (action == GCodeAction::Dwell)
+                    {
+                    const size_t movesBefore = moves->Size();
+                    moves->AddDwell(cmd.Has(GCodeCommand::HasS) ? cmd.s : cmd.p * 1e-3f);
+                    recordLine(movesBefore);
+                    }
+                else if (!FirmwareRetraction(action, cmd, state.retracted) && !state.modes.Apply<Flavor>(action) &&
+                         !state.ReadMotionSettings(action, cmd) && state.ReadPrintSettings(action, cmd))
+                    notify([&](IGCodeVisitor &v) { ReportPrintSetting(v, action, state); });
                 continue;
-            switch (prefix)
+                }
+            ++out.stats.moves;
+            if (cmd.Has(GCodeCommand::HasF))
+                state.feedrate = cmd.f;
+
+            const bool relative = state.modes.relative;
+            if (cmd.Has(GCodeCommand::HasZ))
                 {
-                case 'X': X = value;
-                    break;
-                case 'Y': Y = value;
-                    break;
-                case 'Z': Z = value;
-                    break;
-                case 'E': E = value;
-                    break;
-                default: break;
+                const float z = relative ? state.currentZ + cmd.z : cmd.z;
+                if (out.zPending)
+                    {
+                    out.layerZs.back() = z;
+                    out.zPending = false;
+                    }
+                else if (target == &out.carried && !out.carriedHasZ)
+                    {
+                    out.carriedHasZ = true;
+                    out.carriedFirstZ = z;
+                    }
+                if (!markers && z != state.currentZ && !startLayer(z))
+                    return false;
+                state.currentZ = z;
+                }
+
+            glm::vec3 currentPos = state.lastPos;
+            if (cmd.Has(GCodeCommand::HasX))
+                currentPos.x = relative ? state.lastPos.x + cmd.x : cmd.x;
+            if (cmd.Has(GCodeCommand::HasY))
+                currentPos.y = relative ? state.lastPos.y + cmd.y : cmd.y;
+            if (cmd.Has(GCodeCommand::HasZ))
+                currentPos.z = state.currentZ;
+
+            float filament = 0.0f;
+            if (cmd.Has(GCodeCommand::HasE))
+                {
+                const bool relativeE = state.modes.RelativeE<Flavor>();
+                filament = relativeE ? cmd.e : cmd.e - state.lastExtrusion;
+                state.retracted = RetractedAfter(filament, 0.0f, state.retracted);
+                state.lastExtrusion = relativeE ? state.lastExtrusion + cmd.e : cmd.e;
+                estimate->filament += filament;
+                estimate->grams += filament * options.gramsPerMm;
                 }
+            const float extruded = std::max(filament, 0.0f);
+
+            // An arc becomes chords that share its filament evenly.
+            if (action != GCodeAction::Move && state.hasLastPos &&
+                ArcPoints<Flavor>(cmd, action == GCodeAction::ArcClockwise, state.lastPos, currentPos,
+                                  options.arcTolerance, arc))
+                {
+                const float share = 1.0f / static_cast<float>(arc.size());
+                for (const glm::vec3 &p: arc)
+                    moveTo(p, filament * share, extruded * share);
+                }
+            else
+                moveTo(currentPos, filament, extruded);
             }
+        if (options.keepOpen)
+            {
+            out.exit = state;
+            return true;
+            }
+        return !emit || EmitOpenLayer(out, *emit);
+    }
+
+    // Split [begin, end) into at most `count` ranges that each end just after a newline.
+    std::vector<const char *> SplitAtNewlines(const char *begin, const char *end, size_t count)
+    {
+        std::vector<const char *> bounds{begin};
+        const size_t total = static_cast<size_t>(end - begin);
+        for (size_t i = 1; i < count; ++i)
+            {
+            const char *p = std::max(begin + total * i / count, bounds.back());
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (!nl)
+                break;
+            if (nl + 1 > bounds.back() && nl + 1 < end)
+                bounds.push_back(nl + 1);
+            }
+        bounds.push_back(end);
+        return bounds;
+    }
+}
+
+const char *GCodeFeatureName(GCodeFeature feature)
+{
+    switch (feature)
+        {
+        case GCodeFeature::Other: return "Other";
+        case GCodeFeature::WallOuter: return "Outer wall";
+        case GCodeFeature::WallInner: return "Inner wall";
+        case GCodeFeature::Skin: return "Skin";
+        case GCodeFeature::Infill: return "Infill";
+        case GCodeFeature::Support: return "Support";
+        case GCodeFeature::SupportInterface: return "Support interface";
+        case GCodeFeature::Skirt: return "Skirt / brim";
+        case GCodeFeature::PrimeTower: return "Prime tower";
+        case GCodeFeature::Travel: return "Travel";
+        case GCodeFeature::Retract: return "Retracted travel";
+        case GCodeFeature::Count: break;
+        }
+    return "";
+}
+
+GCodeParseStats GCodeParser::Parse
+(
+    const std::string &path,
+    std::vector<std::vector<GCodePathVertex> > &layers,
+    std::vector<float> &layerZs,
+    std::vector<GCodeEstimate> *layerEstimates
+) const
+{
+    GCodeSource file(path);
+    return ParseBuffer(file.data(), file.data() + file.size(), layers, layerZs, layerEstimates);
+}
+
+GCodeParseStats GCodeParser::ParseBuffer
+(
+    const char *begin,
+    const char *end,
+    std::vector<std::vector<GCodePathVertex> > &layers,
+    std::vector<float> &layerZs,
+    std::vector<GCodeEstimate> *layerEstimates
+) const
+{
+    return WithGCodeFlavor(flavorFor(begin, end), [&](auto flavor)
+        {
+        return parseBuffer<decltype(flavor)>(begin, end, layers, layerZs, layerEstimates);
+        });
+}
+
+template <typename Flavor>
+GCodeParseStats GCodeParser::parseBuffer
+(
+    const char *begin,
+    const char *end,
+    std::vector<std::vector<GCodePathVertex> > &layers,
+    std::vector<float> &layerZs,
+    std::vector<GCodeEstimate> *layerEstimates
+) const
+{
+    auto t0 = std::chrono::steady_clock::now();
 
-        if (!std::isnan(Z) && Z != currentZ)
+    unsigned threads = threadCount_ ? threadCount_ : std::max(1u, std::thread::hardware_concurrency());
+    size_t bySize = static_cast<size_t>(end - begin) / std::max<size_t>(1, minChunkBytes_);
+    std::vector<const char *> bounds = SplitAtNewlines(begin, end, std::clamp<size_t>(bySize, 1, threads));
+    const size_t chunkCount = bounds.size() - 1;
+
+    // 1) Each chunk's tail tells us what it leaves behind; 2) a prefix pass over
+    // the tails gives every chunk its exact starting state; 3) parse chunks in parallel.
+    std::vector<ChunkTail> tails(chunkCount);
+    std::vector<ChunkResult> results(chunkCount);
+    auto forEachChunk = [&](auto &&fn)
+        {
+        if (chunkCount == 1)
             {
-            currentZ = Z;
-            layerZs.push_back(currentZ);
-            layers.emplace_back();
-            currentLayerIndex = static_cast<int>(layers.size()) - 1;
+            fn(0);
+            return;
             }
+        std::vector<std::thread> workers;
+        workers.reserve(chunkCount);
+        for (size_t i = 0; i < chunkCount; ++i)
+            workers.emplace_back(fn, i);
+        for (auto &w: workers)
+            w.join();
+        };
 
-        glm::vec3 currentPos = lastPos;
-        if (!std::isnan(X))
-            currentPos.x = X;
-        if (!std::isnan(Y))
-            currentPos.y = Y;
-        if (!std::isnan(Z))
-            currentPos.z = Z;
+    // The tails have to know which lines are relative, so the few G90, G91, M82
+    // and M83 lines are found first and the modes followed from chunk to chunk.
+    std::vector<ModeTrack> tracks(chunkCount);
+    if (chunkCount > 1)
+        {
+        std::vector<std::vector<GCodeModeSwitch> > switches(chunkCount);
+        forEachChunk([&](size_t i) { FindGCodeModeSwitches(bounds[i], bounds[i + 1], switches[i]); });
+        for (size_t i = 0; i < chunkCount; ++i)
+            {
+            const GCodeModes modes = i > 0 ? tracks[i - 1].Exit() : GCodeModes();
+            tracks[i] = TrackModes<Flavor>(bounds[i], switches[i].data(), switches[i].data() + switches[i].size(),
+                                           modes);
+            }
+        // Only an absolute E move reads the E position a chunk leaves behind.
+        bool needE = false;
+        for (size_t i = chunkCount; i-- > 0;)
+            {
+            tracks[i].needE = needE;
+            needE = needE || tracks[i].HasAbsoluteE<Flavor>();
+            }
+        forEachChunk([&](size_t i) { tails[i] = ScanTail<Flavor>(bounds[i], bounds[i + 1], tracks[i]); });
+        }
+    std::vector<ModalState> entry(chunkCount, ModalState::Initial(machine_));
+    for (size_t i = 1; i < chunkCount; ++i)
+        {
+        entry[i] = tails[i - 1].Apply(entry[i - 1]);
+        entry[i].modes = tracks[i].entry;
+        entry[i].inLayer = true;
+        }
+    ChunkOptions options = ChunkOptionsFor(GCodeLayerIndex::FindMarker(begin, end) != end, filamentDiameter_,
+                                           filamentDensity_, machine_, simplifyTolerance_);
+    options.timed = estimateTime_;
+    ChunkOptions later = options;
+    later.deferFirstLayer = true;
+    forEachChunk([&](size_t i)
+        {
+        ParseChunk<Flavor>(bounds[i], bounds[i + 1], entry[i], i == 0 ? options : later, results[i]);
+        });
 
-        if (!std::isnan(E) && E > lastExtrusion && hasLastPos)
+    // 4) Stitch in file order. Chunks after the first cannot know whether a layer
+    // is already open, so segments they carry before any layer exists are held
+    // back and prepended to the first layer, as the single-threaded parse does.
+    // The moves of a layer cut by chunk boundaries are planned once it is whole,
+    // and those of a chunk's first layer after any preamble, in one plan.
+    GCodeParseStats stats;
+    std::vector<GCodePathVertex> preamble;
+    float preambleZ = 0.0f;
+    bool zPending = false;
+    std::vector<GCodeEstimate> estimates;
+    GCodeEstimate preambleEstimate;
+    GCodeTimeEstimator openMoves;
+    for (auto &r: results)
+        {
+        if (zPending && r.carriedHasZ)
+            {
+            layerZs.back() = r.carriedFirstZ;
+            zPending = false;
+            }
+        if (!r.carried.empty())
             {
-            if (currentLayerIndex < 0)
+            if (layers.empty())
+                {
+                if (preamble.empty())
+                    preambleZ = r.carriedZ;
+                AppendPath(preamble, r.carried, static_cast<uint32_t>(openMoves.Size()));
+                }
+            else
+                AppendPath(layers.back(), r.carried, static_cast<uint32_t>(openMoves.Size()));
+            }
+        (layers.empty() ? preambleEstimate : estimates.back()) += r.carriedEstimate;
+        openMoves.Append(std::move(r.carriedMoves));
+        for (size_t i = 0; i < r.layers.size(); ++i)
+            {
+            if (!layers.empty())
+                estimates.back().seconds += openMoves.Flush(&estimates.back().moveTimes);
+            else
+                {
+                // The preamble's moves come first in the layer; they stay queued
+                // to be planned with the layer's own.
+                if (!preamble.empty() || openMoves.Size() > 0)
+                    {
+                    AppendPath(preamble, r.layers[i], static_cast<uint32_t>(openMoves.Size()));
+                    r.layers[i] = std::move(preamble);
+                    preamble.clear();
+                    }
+                r.layerEstimates[i] += std::exchange(preambleEstimate, {});
+                }
+            if (i == 0 && r.layers.size() > 1 && &r != &results.front())
                 {
-                currentLayerIndex = 0;
-                layerZs.push_back(currentPos.z);
-                layers.emplace_back();
+                openMoves.Append(std::move(r.firstMoves));
+                r.layerEstimates[i].seconds += openMoves.Flush(&r.layerEstimates[i].moveTimes);
                 }
-            glm::vec3 lightDir = glm::normalize(glm::vec3(0.5f, 0.5f, 1.0f));
-            glm::vec3 dir = glm::normalize(currentPos - lastPos);
-            float intensity = 0.8f + 0.4f * fabs(glm::dot(dir, lightDir));
-            glm::vec3 finalColor = glm::clamp(currentColor * intensity,
-                                              glm::vec3(0.0f), glm::vec3(1.0f));
-            layers[currentLayerIndex].push_back({lastPos, finalColor});
-            layers[currentLayerIndex].push_back({currentPos, finalColor});
+            layers.push_back(std::move(r.layers[i]));
+            layerZs.push_back(r.layerZs[i]);
+            estimates.push_back(std::move(r.layerEstimates[i]));
             }
+        openMoves.Append(std::move(r.openMoves));
+        if (!r.layers.empty())
+            zPending = r.zPending;
+        stats.bytes += r.stats.bytes;
+        stats.lines += r.stats.lines;
+        stats.decoded += r.stats.decoded;
+        stats.moves += r.stats.moves;
+        stats.vertices += r.stats.vertices;
+        }
+    for (const ChunkTail &tail: tails)
+        stats.decoded += tail.decoded;
+    if (layers.empty() && !preamble.empty())
+        {
+        layers.push_back(std::move(preamble));
+        layerZs.push_back(preambleZ);
+        estimates.push_back(preambleEstimate);
+        }
+    if (!estimates.empty())
+        estimates.back().seconds += openMoves.Flush(&estimates.back().moveTimes);
+    for (const GCodeEstimate &e: estimates)
+        stats.estimate += e;
+    if (layerEstimates)
+        *layerEstimates = std::move(estimates);
+
+    // 5) Simplify whole layers, so the result does not depend on where the chunks were cut.
+    if (simplifyTolerance_ > 0.0f)
+        {
+        const size_t groups = std::min<size_t>(chunkCount, layers.size());
+        std::vector<size_t> removed(groups, 0);
+        auto simplifyGroup = [&](size_t g)
+            {
+            for (size_t i = layers.size() * g / groups; i < layers.size() * (g + 1) / groups; ++i)
+                removed[g] += Simplify(layers[i], simplifyTolerance_);
+            };
+        std::vector<std::thread> workers;
+        for (size_t g = 1; g < groups; ++g)
+            workers.emplace_back(simplifyGroup, g);
+        if (groups > 0)
+            simplifyGroup(0);
+        for (auto &w: workers)
+            w.join();
+        for (size_t r: removed)
+            stats.removedVertices += r;
+        }
+    // Chunks count the vertices they emit, which overcounts runs that stitching joined.
+    stats.vertices = 0;
+    for (const auto &layer: layers)
+        stats.vertices += layer.size();
 
-        if (!std::isnan(E))
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return stats;
+}
+
+GCodeParseStats GCodeParser::ParseBufferStreaming
+(
+    const char *begin,
+    const char *end,
+    const LayerCallback &onLayer
+) const
+{
+    return WithGCodeFlavor(flavorFor(begin, end), [&](auto flavor)
+        {
+        return parseStreaming<decltype(flavor)>(begin, end, onLayer);
+        });
+}
+
+GCodeParseStats GCodeParser::Visit
+(
+    const char *begin,
+    const char *end,
+    const std::vector<IGCodeVisitor *> &visitors
+) const
+{
+    // The toolpath is one more event: each finished layer goes to every visitor.
+    const LayerCallback onLayer = [&](float z, std::vector<GCodePathVertex> &&path, const GCodeEstimate &estimate)
+        {
+        bool keepGoing = true;
+        for (IGCodeVisitor *visitor: visitors)
+            keepGoing = visitor->OnLayerDone(z, path, estimate) && keepGoing;
+        return keepGoing;
+        };
+    return WithGCodeFlavor(flavorFor(begin, end), [&](auto flavor)
+        {
+        return parseStreaming<decltype(flavor)>(begin, end, onLayer, &visitors);
+        });
+}
+
+GCodeParseStats GCodeParser::Visit(const std::string &path, const std::vector<IGCodeVisitor *> &visitors) const
+{
+    GCodeSource file(path);
+    return Visit(file.data(), file.data() + file.size(), visitors);
+}
+
+template <typename Flavor>
+GCodeParseStats GCodeParser::parseStreaming
+(
+    const char *begin,
+    const char *end,
+    const LayerCallback &onLayer,
+    const std::vector<IGCodeVisitor *> *visitors
+) const
+{
+    auto t0 = std::chrono::steady_clock::now();
+    ChunkResult result;
+    ChunkOptions options = ChunkOptionsFor(GCodeLayerIndex::FindMarker(begin, end) != end, filamentDiameter_,
+                                           filamentDensity_, machine_, simplifyTolerance_);
+    options.timed = estimateTime_;
+    options.moveLines = recordMoveLines_;
+    GCodeParseStats simplified;
+    const LayerCallback emit = SimplifyingCallback(simplifyTolerance_, onLayer, simplified);
+    ParseChunk<Flavor>(begin, end, ModalState::Initial(machine_), options, result, &emit, visitors);
+    result.stats.removedVertices = simplified.removedVertices;
+    result.stats.vertices -= simplified.removedVertices;
+    result.stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return result.stats;
+}
+
+struct GCodeStreamingParse::State
+{
+    GCodeParser parser;
+    GCodeParser::LayerCallback onLayer;
+    GCodeParseStats simplified;
+    GCodeParser::LayerCallback emit;
+    ChunkOptions options;
+    ChunkResult result;             // the open layer and, in result.exit, the state after the text parsed
+    GCodeFlavor flavor = GCodeFlavor::Auto;
+    bool decided = false;           // options and flavor are set
+    bool stopped = false;
+    size_t searched = 0;            // bytes searched for a layer marker before deciding
+    size_t parsed = 0;              // bytes parsed
+    double seconds = 0.0;
+
+    // Set the options and flavor once [begin, end) shows a marker, or is long
+    // enough to say it has none, or is `whole`.
+    bool decide(const char *begin, const char *end, bool whole)
+    {
+        if (decided)
+            return true;
+        // The last line searched may have been incomplete; search it again.
+        const char *from = begin + searched;
+        while (from > begin && from[-1] != '\n')
+            --from;
+        const bool markers = GCodeLayerIndex::FindMarker(from, end) != end;
+        searched = static_cast<size_t>(end - begin);
+        if (!markers && !whole && searched < parser.minChunkBytes_)
+            return false;
+        options = ChunkOptionsFor(markers, parser.filamentDiameter_, parser.filamentDensity_, parser.machine_,
+                                  parser.simplifyTolerance_);
+        options.timed = parser.estimateTime_;
+        options.moveLines = parser.recordMoveLines_;
+        flavor = parser.flavorFor(begin, end);
+        decided = true;
+        return true;
+    }
+
+    // Parse from where the last call stopped to the last line end of
+    // [begin, end), or to `end` itself if it is the `last` of the text.
+    bool parse(const char *begin, const char *end, bool last)
+    {
+        if (stopped || !decide(begin, end, last))
+            return !stopped;
+        const char *from = begin + parsed;
+        const char *to = end;
+        while (!last && to > from && to[-1] != '\n')
+            --to;
+        if (to == from && !last)
+            return true;
+        auto t0 = std::chrono::steady_clock::now();
+        options.keepOpen = !last;
+        stopped = !WithGCodeFlavor(flavor, [&](auto f)
+            {
+            return ParseChunk<decltype(f)>(from, to, result.exit, options, result, &emit);
+            });
+        parsed = static_cast<size_t>(to - begin);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        return !stopped;
+    }
+};
+
+GCodeStreamingParse::GCodeStreamingParse(const GCodeParser &parser, GCodeParser::LayerCallback onLayer)
+    : state_(std::make_unique<State>())
+{
+    state_->parser = parser;
+    state_->onLayer = std::move(onLayer);
+    state_->emit = SimplifyingCallback(parser.simplifyTolerance_, state_->onLayer, state_->simplified);
+    state_->result.exit = ModalState::Initial(parser.machine_);
+}
+
+GCodeStreamingParse::~GCodeStreamingParse() = default;
+
+bool GCodeStreamingParse::Feed(const char *begin, const char *end)
+{
+    return state_->parse(begin, end, false);
+}
+
+GCodeParseStats GCodeStreamingParse::Finish(const char *begin, const char *end)
+{
+    state_->parse(begin, end, true);
+    GCodeParseStats stats = state_->result.stats;
+    stats.removedVertices = state_->simplified.removedVertices;
+    stats.vertices -= state_->simplified.removedVertices;
+    stats.seconds = state_->seconds;
+    return stats;
+}
+
+GCodeParseStats GCodeParser::ParseLayerRange
+(
+    const char *begin,
+    const char *end,
+    const GCodeLayerIndex &index,
+    size_t first,
+    size_t last,
+    const LayerCallback &onLayer
+) const
+{
+    return WithGCodeFlavor(flavorFor(begin, end), [&](auto flavor)
+        {
+        return parseLayerRange<decltype(flavor)>(begin, end, index, first, last, onLayer);
+        });
+}
+
+template <typename Flavor>
+GCodeParseStats GCodeParser::parseLayerRange
+(
+    const char *begin,
+    const char *end,
+    const GCodeLayerIndex &index,
+    size_t first,
+    size_t last,
+    const LayerCallback &onLayer
+) const
+{
+    auto t0 = std::chrono::steady_clock::now();
+    ChunkResult result;
+    auto [from, to] = index.ByteRange(first, std::min(last, index.Count() - 1));
+    to = std::min(to, static_cast<size_t>(end - begin));
+    if (from < to)
+        {
+        // The modal state at the layer start comes from a short backward scan,
+        // which reads the modes of each line from the index.
+        ModalState entry = ModalState::Initial(machine_);
+        if (from > 0)
+            {
+            const GCodeModeSwitch *switches = index.ModeSwitches().data();
+            const GCodeModeSwitch *switchesEnd = switches + index.ModeSwitches().size();
+            auto before = [](const GCodeModeSwitch &s, size_t offset) { return s.offset < offset; };
+            const GCodeModeSwitch *split = std::lower_bound(switches, switchesEnd, from, before);
+            const GCodeModeSwitch *stop = std::lower_bound(split, switchesEnd, to, before);
+            ModeTrack prefix = TrackModes<Flavor>(begin, switches, split, GCodeModes());
+            const ModeTrack range = TrackModes<Flavor>(begin, split, stop, prefix.Exit());
+            prefix.needE = range.HasAbsoluteE<Flavor>();
+            entry = ScanTail<Flavor>(begin, begin + from, prefix).Apply(entry);
+            entry.modes = prefix.Exit();
+            entry.inLayer = true;
+            }
+        GCodeParseStats simplified;
+        const LayerCallback emit = SimplifyingCallback(simplifyTolerance_, onLayer, simplified);
+        const bool markers = index.GetSource() == GCodeLayerIndex::Source::Markers;
+        ChunkOptions options = ChunkOptionsFor(markers, filamentDiameter_, filamentDensity_, machine_,
+                                               simplifyTolerance_);
+        options.timed = estimateTime_;
+        options.moveLines = recordMoveLines_;
+        ParseChunk<Flavor>(begin + from, begin + to, entry, options, result, &emit);
+        result.stats.removedVertices = simplified.removedVertices;
+        result.stats.vertices -= simplified.removedVertices;
+        }
+    result.stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return result.stats;
+}
+
+GCodeFlavor GCodeParser::flavorFor(const char *begin, const char *end) const
+{
+    return flavor_ != GCodeFlavor::Auto ? flavor_ : DetectGCodeFlavor(begin, end);
+}
+
+size_t GCodeParser::Simplify(std::vector<GCodePathVertex> &path, float tolerance)
+{
+    // Greedy pass: the last kept vertex (the tail) is replaced by the next one
+    // as long as the extrusion from the vertex before the tail to the new vertex
+    // passes within `tolerance` of the tail and of everything dropped since.
+    // The dropped list is capped so pathological runs stay linear.
+    constexpr size_t kMaxDropped = 256;
+    constexpr float kAreaTolerance = 0.05f;
+    if (tolerance <= 0.0f || path.size() < 3)
+        return 0;
+    const float tolerance2 = tolerance * tolerance;
+    std::vector<glm::vec3> dropped;
+    size_t kept = 1;
+    for (size_t i = 1; i < path.size(); ++i)
+        {
+        const GCodePathVertex v = path[i];
+        GCodePathVertex &tail = path[kept - 1];
+        if (kept >= 2 && !v.IsRunStart() && !tail.IsRunStart() && tail.feature == v.feature && tail.SameSettings(v) &&
+            std::abs(tail.area - v.area) <= kAreaTolerance * std::max(tail.area, v.area) &&
+            dropped.size() < kMaxDropped)
+            {
+            const glm::vec3 &anchor = path[kept - 2].pos;
+            bool within = SegmentDistance2(tail.pos, anchor, v.pos) <= tolerance2;
+            for (size_t k = 0; within && k < dropped.size(); ++k)
+                within = SegmentDistance2(dropped[k], anchor, v.pos) <= tolerance2;
+            if (within)
+                {
+                // The merged extrusion keeps the volume of the two it replaces.
+                const float tailLength = glm::length(tail.pos - anchor);
+                const float length = glm::length(v.pos - tail.pos);
+                dropped.push_back(tail.pos);
+                const float area = tailLength + length > 0.0f
+                                       ? (tail.area * tailLength + v.area * length) / (tailLength + length)
+                                       : v.area;
+                tail = v;
+                tail.area = area;
+                continue;
+                }
+            }
+        dropped.clear();
+        path[kept++] = v;
+        }
+    const size_t removed = path.size() - kept;
+    path.resize(kept);
+    return removed;
+}
+
+double GCodeParser::ReportedPrintTime(const char *begin, const char *end)
+{
+    // Cura writes the header before the start G-code; stop at the first command.
+    GCodeLineScanner scanner(begin, end);
+    std::string_view line;
+    while (scanner.Next(line) && (line.empty() || line[0] == ';'))
+        {
+        float seconds = 0.0f;
+        if (line.size() > 6 && line.compare(0, 6, ";TIME:") == 0 &&
+            GCodeTokenizer::ParseFloat(line.substr(6), seconds))
+            return seconds;
+        }
+    return -1.0;
+}
+
+GCodeParseStats GCodeParser::MeasureThroughput(const std::string &path, int passes) const
+{
+    GCodeSource file(path);
+    GCodeParser untimed = *this;
+    untimed.SetEstimateTime(false);
+    GCodeParseStats best;
+    double untimedBest = 0.0;
+    // Alternate the two, and which goes first, so that drifting clock speeds
+    // and a warm allocator weigh on both alike.
+    for (int i = 0; i < std::max(1, passes); ++i)
+        {
+        for (bool timed: {i % 2 == 0, i % 2 != 0})
             {
-            lastExtrusion = E;
+            std::vector<std::vector<GCodePathVertex> > layers;
+            std::vector<float> layerZs;
+            const GCodeParser &parser = timed ? *this : untimed;
+            GCodeParseStats s = parser.ParseBuffer(file.data(), file.data() + file.size(), layers, layerZs);
+            if (!timed)
+                untimedBest = i == 0 ? s.seconds : std::min(untimedBest, s.seconds);
+            else if (i == 0 || s.seconds < best.seconds)
+                best = s;
             }
-        lastPos = currentPos;
-        hasLastPos = true;
         }
+    best.untimedSeconds = untimedBest;
+    return best;
 }
@@ -1,21 +1,298 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <glm/glm.hpp>
+#include "GCodeEstimator.h"
+#include "GCodeFlavor.h"
 
-struct GCodeColoredVertex
+/// What a segment is: an extrusion of one of Cura's ";TYPE:" features, or a move
+/// without extrusion. The renderer uses it as a palette index and visibility bit.
+enum class GCodeFeature : uint8_t
 {
+    Other,              // extrusion before any ";TYPE:" tag, or of a type not listed here
+    WallOuter,          // WALL-OUTER
+    WallInner,          // WALL-INNER
+    Skin,               // SKIN
+    Infill,             // FILL
+    Support,            // SUPPORT, SUPPORT-INFILL
+    SupportInterface,   // SUPPORT-INTERFACE, SUPPORT-ROOF, SUPPORT-BOTTOM
+    Skirt,              // SKIRT (also brim and raft)
+    PrimeTower,         // PRIME-TOWER
+    Travel,             // move without extrusion
+    Retract,            // move without extrusion while the filament is retracted
+    Count
+};
+
+/// Display name of a feature, e.g. "Outer wall".
+const char *GCodeFeatureName(GCodeFeature feature);
+
+/// True for Travel and Retract, which are moves rather than extrusions.
+inline bool IsTravel(GCodeFeature feature)
+{
+    return feature == GCodeFeature::Travel || feature == GCodeFeature::Retract;
+}
+
+/// One toolpath vertex. A layer is a sequence of runs: a run begins at a vertex
+/// flagged RunStart, and every following vertex ends one segment of `feature`
+/// (an extrusion or a travel move) from the vertex before it. Consecutive
+/// segments share their endpoint. The print settings are those in force for
+/// the segment ending here; the renderer can colour by them.
+struct GCodePathVertex
+{
+    enum Flag : uint8_t
+    {
+        RunStart = 1 << 0
+    };
+
     glm::vec3 pos;
-    glm::vec3 color;
+    GCodeFeature feature = GCodeFeature::Other;
+    uint8_t flags = 0;
+    uint8_t fan = 0;            // part cooling fan, 0..255 as in M106 S
+    uint8_t tool = 0;           // active extruder, T0..T3 on the A1 mini
+    float area = 0.0f;          // cross-section of the extrusion ending here, mm^2; 0 for travel
+    uint32_t move = 0;          // moves of the layer done on reaching this point (see GCodeEstimate::moveTimes)
+    float speed = 0.0f;         // commanded feedrate, mm/s
+    float temperature = 0.0f;   // nozzle target, degrees C
+
+    bool IsRunStart() const { return (flags & RunStart) != 0; }
+    bool SameSettings(const GCodePathVertex &other) const
+    {
+        return speed == other.speed && fan == other.fan && tool == other.tool && temperature == other.temperature;
+    }
 };
 
+/// Timing and volume figures for one parse, used by the throughput mode.
+struct GCodeParseStats
+{
+    size_t bytes = 0;
+    size_t lines = 0;
+    size_t decoded = 0;         // lines the tokenizer decoded, the chunk tails' backward scans included
+    size_t moves = 0;
+    size_t vertices = 0;        // vertices kept, after simplification
+    size_t removedVertices = 0; // vertices dropped by simplification
+    double seconds = 0.0;
+    double untimedSeconds = 0.0;    // throughput mode: fastest pass without planning (SetEstimateTime(false))
+    GCodeEstimate estimate;     // print time and filament of the layers parsed
+
+    double MegabytesPerSecond() const
+    {
+        return seconds > 0.0 ? (static_cast<double>(bytes) / (1024.0 * 1024.0)) / seconds : 0.0;
+    }
+};
+
+class GCodeLayerIndex;
+class IGCodeVisitor;
+
+/// Parses G-code into per-layer toolpath runs, travel moves included.
+/// Layers start at Cura's ";LAYER:" markers, or at every new Z in files without
+/// them; see GCodeLayerIndex for the exact rule. Large buffers are split at
+/// newline boundaries and parsed on several threads; the result is identical
+/// to a single-threaded parse.
+///
+/// Commands are read as the file's firmware flavor reads them (see
+/// GCodeFlavor): relative moves and extrusion (G91, M83), G92 E resets,
+/// firmware retraction (G10/G11) and G2/G3 arcs, which become chords. The
+/// parse is compiled once per flavor, so a flavor without a command pays
+/// nothing for it. G92 on X, Y or Z is ignored.
 class GCodeParser
 {
 public:
-    void Parse
+    /// Number of worker threads; 0 selects std::thread::hardware_concurrency().
+    void SetThreadCount(unsigned threads) { threadCount_ = threads; }
+
+    /// Buffers are never split into chunks smaller than this.
+    void SetMinChunkBytes(size_t bytes) { minChunkBytes_ = bytes; }
+
+    /// Diameter of the filament E is measured in; sets the extrusion cross-sections.
+    static constexpr float kDefaultFilamentDiameter = 1.75f;
+    void SetFilamentDiameter(float mm) { filamentDiameter_ = mm; }
+    float GetFilamentDiameter() const { return filamentDiameter_; }
+
+    /// Filament density in g/cm^3, for the estimated filament mass.
+    void SetFilamentDensity(float gramsPerCm3) { filamentDensity_ = gramsPerCm3; }
+
+    /// Printer limits the print time is estimated with (see GCodeTimeEstimator).
+    /// M204 and M205 in the file override the acceleration and jerk from there on.
+    void SetMachineLimits(const GCodeMachineLimits &limits) { machine_ = limits; }
+    const GCodeMachineLimits &GetMachineLimits() const { return machine_; }
+
+    /// Plan every move for the print time, as by default. Off, moves are still
+    /// counted and filament still summed, but GCodeEstimate::seconds and every
+    /// move time stay 0; a parse for the geometry alone then skips the planner.
+    void SetEstimateTime(bool estimate) { estimateTime_ = estimate; }
+    bool GetEstimateTime() const { return estimateTime_; }
+
+    /// Merge consecutive segments of the same feature while every vertex they
+    /// drop stays within `mm` of the merged segment (the chord tolerance).
+    /// 0, the default, keeps every vertex. Arcs are split into chords within
+    /// the same tolerance, or within 5 microns when it is 0.
+    void SetSimplifyTolerance(float mm) { simplifyTolerance_ = mm; }
+    float GetSimplifyTolerance() const { return simplifyTolerance_; }
+
+    /// Firmware flavor to read buffers as. Auto, the default, detects it from
+    /// each buffer (see DetectGCodeFlavor); set it when parsing part of a file.
+    void SetFlavor(GCodeFlavor flavor) { flavor_ = flavor; }
+    GCodeFlavor GetFlavor() const { return flavor_; }
+
+    /// Fill GCodeEstimate::moveLines, which ties moves to the lines they came
+    /// from. Only single-pass parses record them (ParseBufferStreaming and
+    /// ParseLayerRange); ParseBuffer leaves them empty.
+    void SetRecordMoveLines(bool record) { recordMoveLines_ = record; }
+
+    /// The simplification step on its own: simplify one layer in place and
+    /// return the number of vertices removed. Run starts are always kept, and
+    /// extrusions only merge if their cross-sections are within 5% of each other
+    /// and their print settings (speed, fan, temperature, tool) are the same.
+    static size_t Simplify(std::vector<GCodePathVertex> &path, float tolerance);
+
+    /// Parse the file at `path` into per-layer toolpath runs, and optionally the
+    /// estimated print time and filament of each layer.
+    /// The file is memory-mapped, or decoded if it is gzipped or binary G-code
+    /// (see GCodeSource), and scanned in a single allocation-free pass.
+    GCodeParseStats Parse
     (
         const std::string &path,
-        std::vector<std::vector<GCodeColoredVertex> > &layers,
-        std::vector<float> &layerZs
+        std::vector<std::vector<GCodePathVertex> > &layers,
+        std::vector<float> &layerZs,
+        std::vector<GCodeEstimate> *layerEstimates = nullptr
+    ) const;
+
+    /// Parse an in-memory buffer; `Parse` forwards here after mapping the file.
+    GCodeParseStats ParseBuffer
+    (
+        const char *begin,
+        const char *end,
+        std::vector<std::vector<GCodePathVertex> > &layers,
+        std::vector<float> &layerZs,
+        std::vector<GCodeEstimate> *layerEstimates = nullptr
+    ) const;
+
+    /// Receives one finished layer and its estimate; return false to stop parsing.
+    using LayerCallback = std::function<bool(float z, std::vector<GCodePathVertex> &&vertices,
+                                             const GCodeEstimate &estimate)>;
+
+    /// Single-threaded parse that hands each layer to `onLayer` as soon as the next
+    /// layer starts, so a caller can display the bottom of a print while the rest
+    /// is still being read. Yields the same layers, in order, as ParseBuffer.
+    GCodeParseStats ParseBufferStreaming
+    (
+        const char *begin,
+        const char *end,
+        const LayerCallback &onLayer
+    ) const;
+
+    /// Single-threaded parse that reports everything it reads to each of
+    /// `visitors` in turn (see IGCodeVisitor): commands, layer starts, feature
+    /// and setting changes, moves and finished layers. However many analyses
+    /// run, the buffer is read and tokenized once.
+    GCodeParseStats Visit
+    (
+        const char *begin,
+        const char *end,
+        const std::vector<IGCodeVisitor *> &visitors
+    ) const;
+
+    /// Read the file at `path`, as Parse does, and visit it.
+    GCodeParseStats Visit(const std::string &path, const std::vector<IGCodeVisitor *> &visitors) const;
+
+    /// Parse only layers first..last (inclusive) of a buffer indexed by `index`,
+    /// handing them to `onLayer` in order. Yields exactly those layers of ParseBuffer,
+    /// without reading anything before them except a short backward scan.
+    GCodeParseStats ParseLayerRange
+    (
+        const char *begin,
+        const char *end,
+        const GCodeLayerIndex &index,
+        size_t first,
+        size_t last,
+        const LayerCallback &onLayer
+    ) const;
+
+    /// Print time in seconds from the ";TIME:" line Cura writes in the file header,
+    /// or a negative value if the header has none.
+    static double ReportedPrintTime(const char *begin, const char *end);
+
+    /// Throughput mode: parse `path` `passes` times and report the fastest pass.
+    /// The file stays mapped (or decoded) between passes so the figure reflects parser cost,
+    /// not disk I/O or decompression. Each pass is followed by one without time
+    /// estimation, whose fastest is reported as untimedSeconds.
+    GCodeParseStats MeasureThroughput(const std::string &path, int passes = 3) const;
+
+private:
+    GCodeFlavor flavorFor(const char *begin, const char *end) const;
+    template <typename Flavor>
+    GCodeParseStats parseBuffer
+    (
+        const char *begin,
+        const char *end,
+        std::vector<std::vector<GCodePathVertex> > &layers,
+        std::vector<float> &layerZs,
+        std::vector<GCodeEstimate> *layerEstimates
     ) const;
+    template <typename Flavor>
+    GCodeParseStats parseStreaming
+    (
+        const char *begin,
+        const char *end,
+        const LayerCallback &onLayer,
+        const std::vector<IGCodeVisitor *> *visitors = nullptr
+    ) const;
+    template <typename Flavor>
+    GCodeParseStats parseLayerRange
+    (
+        const char *begin,
+        const char *end,
+        const GCodeLayerIndex &index,
+        size_t first,
+        size_t last,
+        const LayerCallback &onLayer
+    ) const;
+
+    unsigned threadCount_ = 0;
+    size_t minChunkBytes_ = 4u << 20;
+    float simplifyTolerance_ = 0.0f;
+    bool recordMoveLines_ = false;
+    bool estimateTime_ = true;
+    float filamentDiameter_ = kDefaultFilamentDiameter;
+    float filamentDensity_ = 1.24f;     // PLA
+    GCodeMachineLimits machine_;
+    GCodeFlavor flavor_ = GCodeFlavor::Auto;
+
+    friend class GCodeStreamingParse;
+};
+
+/// ParseBufferStreaming over text that grows while it is parsed, such as a
+/// compressed file still being decoded (see GCodeSource). Each Feed passes all
+/// the text so far, which may have moved since the last; its complete lines
+/// not parsed yet are, and finished layers go to `onLayer` as they would from
+/// ParseBufferStreaming. Finish parses the rest and hands over the last layer.
+///
+/// Whether layers start at ";LAYER:" markers, and the flavor when the parser's
+/// is Auto, are told from the head of the text: its first marker, or its first
+/// minimum chunk (GCodeParser::SetMinChunkBytes) if it has none by then. A file
+/// whose flavor only shows at its end should be parsed with SetFlavor.
+class GCodeStreamingParse
+{
+public:
+    /// Parse with the settings `parser` has now.
+    GCodeStreamingParse(const GCodeParser &parser, GCodeParser::LayerCallback onLayer);
+    ~GCodeStreamingParse();
+
+    GCodeStreamingParse(const GCodeStreamingParse &) = delete;
+    GCodeStreamingParse &operator=(const GCodeStreamingParse &) = delete;
+
+    /// Parse the new complete lines of [begin, end). Returns false, and parses
+    /// nothing more, once `onLayer` has asked to stop.
+    bool Feed(const char *begin, const char *end);
+
+    /// Parse the rest of the whole text [begin, end), last line included.
+    GCodeParseStats Finish(const char *begin, const char *end);
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
 };
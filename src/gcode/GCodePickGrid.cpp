@@ -0,0 +1,168 @@
+#include "GCodePickGrid.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+    // Cells are never smaller than this, mm, nor more than kMaxCells on a side.
+    constexpr float kMinCellSize = 0.05f;
+    constexpr int kMaxCells = 4096;
+
+    // Cells per segment are a trade between memory and cells to search; long
+    // travel moves pass through many cells anyway.
+    constexpr float kSegmentsPerCell = 4.0f;
+
+    // Visit every cell the segment from `a` to `b` passes through, in cell units,
+    // walking from cell to cell along it (Amanatides and Woo). Each step crosses
+    // one cell edge, so a long travel move costs its length in cells rather
+    // than the area of its bounding box.
+    template <typename Visit>
+    void ForEachCell(const glm::vec2 &a, const glm::vec2 &b, int columns, int rows, Visit &&visit)
+    {
+        int x = std::clamp(static_cast<int>(std::floor(a.x)), 0, columns - 1);
+        int y = std::clamp(static_cast<int>(std::floor(a.y)), 0, rows - 1);
+        const int endX = std::clamp(static_cast<int>(std::floor(b.x)), 0, columns - 1);
+        const int endY = std::clamp(static_cast<int>(std::floor(b.y)), 0, rows - 1);
+        const glm::vec2 d = b - a;
+        const int stepX = endX > x ? 1 : -1;
+        const int stepY = endY > y ? 1 : -1;
+        const float deltaX = d.x != 0.0f ? 1.0f / std::abs(d.x) : FLT_MAX;
+        const float deltaY = d.y != 0.0f ? 1.0f / std::abs(d.y) : FLT_MAX;
+        float nextX = d.x != 0.0f ? (static_cast<float>(x + (stepX > 0)) - a.x) / d.x : FLT_MAX;
+        float nextY = d.y != 0.0f ? (static_cast<float>(y + (stepY > 0)) - a.y) / d.y : FLT_MAX;
+        visit(x, y);
+        // Rounding can pick the wrong edge near a corner; once one axis has
+        // arrived, only the other may step, so the walk always ends at (endX, endY).
+        while (x != endX || y != endY)
+            {
+            if (y == endY || (x != endX && nextX < nextY))
+                {
+                x += stepX;
+                nextX += deltaX;
+                }
+            else
+                {
+                y += stepY;
+                nextY += deltaY;
+                }
+            visit(x, y);
+            }
+    }
+
+    float SegmentDistance2(const glm::vec2 &p, const glm::vec2 &a, const glm::vec2 &b)
+    {
+        const glm::vec2 d = b - a;
+        const float len2 = glm::dot(d, d);
+        const float t = len2 > 0.0f ? std::clamp(glm::dot(p - a, d) / len2, 0.0f, 1.0f) : 0.0f;
+        const glm::vec2 off = p - (a + t * d);
+        return glm::dot(off, off);
+    }
+}
+
+void GCodePickGrid::Build(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, size_t count)
+{
+    origin_ = layer.origin;
+    step_ = layer.step;
+    vertices_.assign(vertices, vertices + count);
+    cellFirst_.clear();
+    cellSegments_.clear();
+    columns_ = rows_ = 0;
+
+    glm::vec2 mn(FLT_MAX), mx(-FLT_MAX);
+    size_t segments = 0;
+    for (size_t r = 0; r < layer.runFirst.size(); ++r)
+        {
+        if (layer.runCount[r] < 2)
+            continue;
+        segments += static_cast<size_t>(layer.runCount[r] - 1);
+        for (int32_t i = layer.runFirst[r]; i < layer.runFirst[r] + layer.runCount[r]; ++i)
+            {
+            const glm::vec2 p(position(static_cast<uint32_t>(i)));
+            mn = glm::min(mn, p);
+            mx = glm::max(mx, p);
+            }
+        }
+    if (segments == 0)
+        return;
+
+    const glm::vec2 extent = glm::max(mx - mn, glm::vec2(kMinCellSize));
+    const float fit = std::sqrt(extent.x * extent.y * kSegmentsPerCell / static_cast<float>(segments));
+    cellSize_ = std::max({fit, kMinCellSize, std::max(extent.x, extent.y) / static_cast<float>(kMaxCells - 1)});
+    gridMin_ = mn;
+    columns_ = static_cast<int>(extent.x / cellSize_) + 1;
+    rows_ = static_cast<int>(extent.y / cellSize_) + 1;
+
+    // Count the segments of each cell, turn the counts into offsets, then fill in.
+    auto forEachSegment = [&](auto &&fn)
+        {
+        for (size_t r = 0; r < layer.runFirst.size(); ++r)
+            {
+            for (int32_t i = layer.runFirst[r] + 1; i < layer.runFirst[r] + layer.runCount[r]; ++i)
+                {
+                const uint32_t end = static_cast<uint32_t>(i);
+                const glm::vec2 a = (glm::vec2(position(end - 1)) - gridMin_) / cellSize_;
+                const glm::vec2 b = (glm::vec2(position(end)) - gridMin_) / cellSize_;
+                ForEachCell(a, b, columns_, rows_,
+                            [&](int x, int y) { fn(static_cast<size_t>(y) * columns_ + x, end); });
+                }
+            }
+        };
+    cellFirst_.assign(static_cast<size_t>(columns_) * rows_ + 1, 0);
+    forEachSegment([&](size_t cell, uint32_t) { ++cellFirst_[cell + 1]; });
+    for (size_t c = 1; c < cellFirst_.size(); ++c)
+        cellFirst_[c] += cellFirst_[c - 1];
+    cellSegments_.resize(cellFirst_.back());
+    std::vector<uint32_t> fill(cellFirst_.begin(), cellFirst_.end() - 1);
+    forEachSegment([&](size_t cell, uint32_t end) { cellSegments_[fill[cell]++] = end; });
+}
+
+bool GCodePickGrid::Nearest(const glm::vec2 &point, float radius, const Filter &accept, Hit &out) const
+{
+    if (Empty() || !(radius >= 0.0f))
+        return false;
+    const glm::vec2 lo = glm::floor((point - radius - gridMin_) / cellSize_);
+    const glm::vec2 hi = glm::floor((point + radius - gridMin_) / cellSize_);
+    if (hi.x < 0.0f || hi.y < 0.0f || lo.x >= static_cast<float>(columns_) || lo.y >= static_cast<float>(rows_))
+        return false;
+    const int x0 = std::max(static_cast<int>(lo.x), 0);
+    const int y0 = std::max(static_cast<int>(lo.y), 0);
+    const int x1 = std::min(static_cast<int>(hi.x), columns_ - 1);
+    const int y1 = std::min(static_cast<int>(hi.y), rows_ - 1);
+
+    // A segment through several of these cells is measured once per cell; that
+    // is cheaper than remembering which ones were seen.
+    float best2 = radius * radius;
+    bool found = false;
+    for (int y = y0; y <= y1; ++y)
+        {
+        for (int x = x0; x <= x1; ++x)
+            {
+            const size_t cell = static_cast<size_t>(y) * columns_ + x;
+            for (uint32_t k = cellFirst_[cell]; k < cellFirst_[cell + 1]; ++k)
+                {
+                const uint32_t end = cellSegments_[k];
+                const float d2 = SegmentDistance2(point, glm::vec2(position(end - 1)), glm::vec2(position(end)));
+                if (d2 > best2 || (found && d2 == best2 && end <= out.vertex))
+                    continue;
+                if (accept && !accept(end, vertices_[end]))
+                    continue;
+                best2 = d2;
+                found = true;
+                out.vertex = end;
+                }
+            }
+        }
+    if (!found)
+        return false;
+    out.from = position(out.vertex - 1);
+    out.to = position(out.vertex);
+    out.distance = std::sqrt(best2);
+    return true;
+}
+
+size_t GCodePickGrid::MemoryBytes() const
+{
+    return vertices_.capacity() * sizeof(GCodePackedVertex) +
+           (cellFirst_.capacity() + cellSegments_.capacity()) * sizeof(uint32_t);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GCodePacking.h"
+
+/// Uniform XY grid over the segments of one packed layer, for finding the
+/// segment under the mouse.
+///
+/// Each cell lists the segments that pass through it, so the segments near a
+/// point are found in the few cells around it however many the layer has.
+/// Cells are sized for a few segments each. The arenas keep vertices on the
+/// GPU or compressed, so the grid holds its own copy of the layer's packed
+/// vertices: 12 bytes per vertex, plus 4 for each cell a segment passes
+/// through. GCodeModel builds grids only for the layers it picks from.
+class GCodePickGrid
+{
+public:
+    /// A segment, from the vertex before `vertex` to `vertex`.
+    struct Hit
+    {
+        uint32_t vertex = 0;        // index into the layer's packed vertices
+        glm::vec3 from{0.0f};
+        glm::vec3 to{0.0f};
+        float distance = 0.0f;      // from the query point in XY, mm
+    };
+
+    /// Decides whether the segment ending at a vertex can be picked, e.g. whether its feature is shown.
+    using Filter = std::function<bool(uint32_t vertex, const GCodePackedVertex &v)>;
+
+    /// Index the runs of `layer`, whose `count` packed vertices are `vertices`
+    /// (its own, or mapped from the cache).
+    void Build(const GCodePackedLayer &layer, const GCodePackedVertex *vertices, size_t count);
+
+    bool Empty() const { return cellSegments_.empty(); }
+
+    /// The segment nearest `point` in XY, if one passing `accept` is within
+    /// `radius` mm. Of segments equally near, the one printed later wins.
+    bool Nearest(const glm::vec2 &point, float radius, const Filter &accept, Hit &out) const;
+
+    const GCodePackedVertex &Vertex(uint32_t vertex) const { return vertices_[vertex]; }
+
+    /// Bytes of RAM the grid takes.
+    size_t MemoryBytes() const;
+
+private:
+    glm::vec3 position(uint32_t vertex) const
+    {
+        const GCodePackedVertex &v = vertices_[vertex];
+        return origin_ + glm::vec3(v.x, v.y, v.z) * step_;
+    }
+
+    glm::vec3 origin_{0.0f};                // GCodePackedLayer::origin/step
+    glm::vec3 step_{0.0f};
+    glm::vec2 gridMin_{0.0f};               // corner of cell (0, 0), mm
+    float cellSize_ = 1.0f;                 // mm
+    int columns_ = 0;
+    int rows_ = 0;
+    std::vector<GCodePackedVertex> vertices_;
+    std::vector<uint32_t> cellFirst_;       // per cell, then one past the last: into cellSegments_
+    std::vector<uint32_t> cellSegments_;    // end vertex of each segment, cell by cell
+};
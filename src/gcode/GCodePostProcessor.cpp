@@ -0,0 +1,642 @@
+#include "GCodePostProcessor.h"
+#include "GCodeOutput.h"
+#include "GCodeSource.h"
+#include "GCodeTokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    // An arc replaces at least this many moves; at most this many are held
+    // back while one is being fitted.
+    constexpr size_t kMinArcMoves = 3;
+    constexpr size_t kMaxArcMoves = 256;
+
+    // Wider arcs are all but straight, with centres far off the bed.
+    constexpr double kMaxArcRadius = 1000.0;
+
+    // Extrusion per mm may vary this much over the moves of an arc, which
+    // spreads it evenly along its length.
+    constexpr double kFlowVariance = 0.05;
+
+    constexpr int kFeedDecimals = 1;
+    constexpr double kTwoPi = 6.28318530717958647692;
+
+    int64_t Power10(int decimals)
+    {
+        int64_t p = 1;
+        for (int i = 0; i < std::clamp(decimals, 0, 9); ++i)
+            p *= 10;
+        return p;
+    }
+
+    // `value` in units of the last decimal kept.
+    int64_t Units(double value, int64_t scale)
+    {
+        return std::llround(value * static_cast<double>(scale));
+    }
+
+    void AppendWord(std::string &out, char letter, int64_t units, int decimals)
+    {
+        out.push_back(' ');
+        out.push_back(letter);
+        AppendGCodeFixed(out, units, decimals);
+    }
+
+    // True if every word after the command word starts with one of `letters`.
+    bool OnlyWords(std::string_view line, std::string_view letters)
+    {
+        line = line.substr(0, line.find(';'));
+        size_t pos = line.find_first_not_of(" \t");
+        pos = line.find_first_of(" \t", pos);
+        while ((pos = line.find_first_not_of(" \t", pos)) != std::string_view::npos)
+            {
+            if (letters.find(line[pos]) == std::string_view::npos)
+                return false;
+            pos = line.find_first_of(" \t", pos);
+            }
+        return true;
+    }
+
+    // Commands that neither move the head nor set anything this pass tracks,
+    // besides those GCodeDispatch names.
+    bool IsHarmless(const GCodeCommand &cmd)
+    {
+        if (cmd.letter == 'G')
+            return cmd.number == 17 || cmd.number == 21;
+        if (cmd.letter != 'M')
+            return false;
+        switch (cmd.number)
+            {
+            case 73: case 117: case 140: case 141: case 190: case 191: case 201: case 203:
+            case 220: case 221: case 400: case 900:
+                return true;
+            default:
+                return false;
+            }
+    }
+
+    struct Point
+    {
+        double x = 0.0;
+        double y = 0.0;
+    };
+
+    double Distance(Point a, Point b)
+    {
+        return std::hypot(b.x - a.x, b.y - a.y);
+    }
+
+    // Centre of the circle through three points; false if they are on a line.
+    bool Circumcentre(Point a, Point b, Point c, Point &centre)
+    {
+        const double bx = b.x - a.x;
+        const double by = b.y - a.y;
+        const double cx = c.x - a.x;
+        const double cy = c.y - a.y;
+        const double d = 2.0 * (bx * cy - by * cx);
+        if (std::abs(d) < 1e-9)
+            return false;
+        const double b2 = bx * bx + by * by;
+        const double c2 = cx * cx + cy * cy;
+        centre = {a.x + (cy * b2 - by * c2) / d, a.y + (bx * c2 - cx * b2) / d};
+        return true;
+    }
+
+    // A G1 held back while an arc is fitted through it.
+    struct ArcMove
+    {
+        GCodeCommand cmd;       // as read, to write it unchanged if no arc takes it
+        Point to;
+        double extruded = 0.0;  // mm of filament
+        double length = 0.0;    // mm in XY
+    };
+
+    struct Arc
+    {
+        Point centre;
+        bool clockwise = false;
+    };
+
+    // Fit an arc from `start` through the ends of moves[0, count). Every end
+    // must be within `tolerance` of the circle, every move's chord within it
+    // of the arc between its ends, and the arc must turn one way by less than
+    // a full turn and end at least `minChord` from where it starts.
+    bool FitArc(Point start, const std::vector<ArcMove> &moves, size_t count, double tolerance, double minChord,
+                Arc &arc)
+    {
+        Point centre;
+        if (!Circumcentre(start, moves[count / 2].to, moves[count - 1].to, centre))
+            return false;
+        const double radius = Distance(centre, start);
+        if (radius > kMaxArcRadius || Distance(start, moves[count - 1].to) < minChord)
+            return false;
+
+        double extruded = 0.0;
+        double length = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            {
+            extruded += moves[i].extruded;
+            length += moves[i].length;
+            }
+        const double flow = extruded / length;
+
+        double sweep = 0.0;
+        Point from = start;
+        for (size_t i = 0; i < count; ++i)
+            {
+            const ArcMove &m = moves[i];
+            if (std::abs(Distance(centre, m.to) - radius) > tolerance)
+                return false;
+            const double half = m.length * 0.5;
+            if (half >= radius || radius - std::sqrt(radius * radius - half * half) > tolerance)
+                return false;
+            if (std::abs(m.extruded / m.length - flow) > kFlowVariance * flow)
+                return false;
+            const double ax = from.x - centre.x;
+            const double ay = from.y - centre.y;
+            const double bx = m.to.x - centre.x;
+            const double by = m.to.y - centre.y;
+            const double step = std::atan2(ax * by - ay * bx, ax * bx + ay * by);
+            if (step == 0.0 || (i > 0 && (step > 0.0) != (sweep > 0.0)))
+                return false;
+            sweep += step;
+            from = m.to;
+            }
+        if (std::abs(sweep) >= kTwoPi)
+            return false;
+        arc.centre = centre;
+        arc.clockwise = sweep < 0.0;
+        return true;
+    }
+
+    // One pass over a file. The input side follows the position as the
+    // file sets it; the output side follows what has been written, which lags
+    // behind while moves are held for an arc and is rounded to the decimals kept.
+    template <typename Flavor>
+    class PostPass
+    {
+    public:
+        PostPass(const GCodePostOptions &options, std::ostream &out, GCodePostStats &stats)
+            : options_(options), stats_(stats), xyzScale_(Power10(options.xyzDecimals)),
+              eScale_(Power10(options.eDecimals)), feedScale_(Power10(kFeedDecimals)), buffer_(out)
+        {
+            pending_.reserve(kMaxArcMoves);
+        }
+
+        void Line(std::string_view line)
+        {
+            GCodeTokenizer::Decode(line, cmd_);
+            if (cmd_.letter)
+                ++stats_.commandsIn;
+            const GCodeAction action = GCodeDispatch<Flavor>::Of(cmd_);
+
+            ArcMove move;
+            if (action == GCodeAction::Move && arcCandidate(line, move))
+                {
+                addArcMove(move);
+                return;
+                }
+            flushArcs();
+
+            switch (action)
+                {
+                case GCodeAction::Move:
+                    if (modes_.relative || !OnlyWords(line, "XYZEF"))
+                        {
+                        copy(line);
+                        break;
+                        }
+                    read(cmd_);
+                    write(cmd_);
+                    break;
+                case GCodeAction::Absolute:
+                case GCodeAction::Relative:
+                case GCodeAction::AbsoluteE:
+                case GCodeAction::RelativeE:
+                    setMode(action, line);
+                    break;
+                case GCodeAction::SetPosition:
+                    setPosition(line);
+                    break;
+                case GCodeAction::Fan:
+                case GCodeAction::FanOff:
+                    setFan(action, line);
+                    break;
+                case GCodeAction::ArcClockwise:
+                case GCodeAction::ArcCounterClockwise:
+                case GCodeAction::Dwell:
+                case GCodeAction::Retract:
+                case GCodeAction::Unretract:
+                case GCodeAction::Temperature:
+                case GCodeAction::Acceleration:
+                case GCodeAction::Jerk:
+                    copy(line);
+                    break;
+                default:
+                    copy(line);
+                    if (cmd_.letter && !IsHarmless(cmd_))
+                        forget();
+                    break;
+                }
+        }
+
+        void Finish()
+        {
+            flushArcs();
+            buffer_.Flush();
+        }
+
+    private:
+        // Write `line` as it is, and follow what it does to the position.
+        void copy(std::string_view line)
+        {
+            if (cmd_.IsMove())
+                {
+                // Relative, with words this pass does not know, or an arc:
+                // what it leaves the position at is not worth working out.
+                if (cmd_.Has(GCodeCommand::HasX))
+                    knownX_ = writtenX_ = false;
+                if (cmd_.Has(GCodeCommand::HasY))
+                    knownY_ = writtenY_ = false;
+                if (cmd_.Has(GCodeCommand::HasZ))
+                    writtenZ_ = false;
+                if (cmd_.Has(GCodeCommand::HasE))
+                    {
+                    knownE_ = !modes_.RelativeE<Flavor>();
+                    e_ = cmd_.e;
+                    writtenE_ = false;
+                    }
+                if (cmd_.Has(GCodeCommand::HasF))
+                    {
+                    feed_ = Units(cmd_.f, feedScale_);
+                    writtenFeed_ = false;
+                    }
+                }
+            emit(line, cmd_.letter != 0);
+        }
+
+        // Whether `move` can extend the arc being fitted; fills it if so.
+        bool arcCandidate(std::string_view line, ArcMove &move) const
+        {
+            const GCodeCommand &c = cmd_;
+            if (options_.arcTolerance <= 0.0f || c.number != 1 || modes_.relative || !knownX_ || !knownY_ ||
+                !c.Has(GCodeCommand::HasE) || c.Has(GCodeCommand::HasZ) ||
+                !(c.Has(GCodeCommand::HasX) || c.Has(GCodeCommand::HasY)) || !c.comment.empty() ||
+                !OnlyWords(line, "XYEF"))
+                return false;
+            const bool relativeE = modes_.RelativeE<Flavor>();
+            if (!relativeE && !knownE_)
+                return false;
+            move.cmd = c;
+            move.cmd.comment = {};
+            move.to = {c.Has(GCodeCommand::HasX) ? c.x : position_.x, c.Has(GCodeCommand::HasY) ? c.y : position_.y};
+            move.extruded = relativeE ? c.e : c.e - e_;
+            move.length = Distance(position_, move.to);
+            return move.extruded > 0.0 && move.length > 1e-6;
+        }
+
+        void addArcMove(const ArcMove &move)
+        {
+            // A new feedrate can only start an arc.
+            if (move.cmd.Has(GCodeCommand::HasF) && Units(move.cmd.f, feedScale_) != feed_)
+                flushArcs();
+            if (pending_.empty())
+                start_ = position_;
+            read(move.cmd);
+            pending_.push_back(move);
+            if (pending_.size() < kMinArcMoves)
+                return;
+
+            Arc arc;
+            const double minChord = 2.0 / static_cast<double>(xyzScale_);
+            if (FitArc(start_, pending_, pending_.size(), options_.arcTolerance, minChord, arc))
+                {
+                fitted_ = pending_.size();
+                arc_ = arc;
+                if (fitted_ == kMaxArcMoves)
+                    flushArcs();
+                return;
+                }
+            if (fitted_)
+                {
+                // The move before this one ended the arc.
+                writeArc(fitted_);
+                start_ = pending_[fitted_ - 1].to;
+                pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(fitted_));
+                fitted_ = 0;
+                return;
+                }
+            // No arc starts at the first move; try from the next.
+            write(pending_.front().cmd);
+            start_ = pending_.front().to;
+            pending_.erase(pending_.begin());
+        }
+
+        void flushArcs()
+        {
+            size_t first = 0;
+            if (fitted_ >= kMinArcMoves)
+                {
+                writeArc(fitted_);
+                first = fitted_;
+                }
+            for (size_t i = first; i < pending_.size(); ++i)
+                write(pending_[i].cmd);
+            pending_.clear();
+            fitted_ = 0;
+        }
+
+        // Follow a G0/G1 in absolute positioning on the input side.
+        void read(const GCodeCommand &c)
+        {
+            if (c.Has(GCodeCommand::HasX))
+                {
+                position_.x = c.x;
+                knownX_ = true;
+                }
+            if (c.Has(GCodeCommand::HasY))
+                {
+                position_.y = c.y;
+                knownY_ = true;
+                }
+            if (c.Has(GCodeCommand::HasE) && !modes_.RelativeE<Flavor>())
+                {
+                e_ = c.e;
+                knownE_ = true;
+                }
+            if (c.Has(GCodeCommand::HasF))
+                feed_ = Units(c.f, feedScale_);
+        }
+
+        // Write a G0/G1 in absolute positioning, leaving out what it repeats.
+        void write(const GCodeCommand &c)
+        {
+            std::string &line = line_;
+            line.assign(c.number == 0 ? "G0" : "G1");
+            const size_t bare = line.size();
+            if (c.Has(GCodeCommand::HasF))
+                writeFeed(line, c.f);
+            if (c.Has(GCodeCommand::HasX))
+                writeAxis(line, 'X', c.x, writtenX_, outX_);
+            if (c.Has(GCodeCommand::HasY))
+                writeAxis(line, 'Y', c.y, writtenY_, outY_);
+            if (c.Has(GCodeCommand::HasZ))
+                writeAxis(line, 'Z', c.z, writtenZ_, outZ_);
+            if (c.Has(GCodeCommand::HasE))
+                writeE(line, c.e);
+            const bool command = line.size() > bare;
+            if (!command)
+                line.clear();
+            if (!c.comment.empty())
+                line.append(command ? " ;" : ";").append(c.comment);
+            if (command || !line.empty())
+                emit(line, command);
+        }
+
+        void writeArc(size_t count)
+        {
+            const GCodeCommand &first = pending_.front().cmd;
+            const ArcMove &last = pending_[count - 1];
+            std::string &line = line_;
+            line.assign(arc_.clockwise ? "G2" : "G3");
+            if (first.Has(GCodeCommand::HasF))
+                writeFeed(line, first.f);
+
+            // The centre is given from the start as written, rounded.
+            const double scale = static_cast<double>(xyzScale_);
+            const double startX = writtenX_ ? static_cast<double>(outX_) / scale : start_.x;
+            const double startY = writtenY_ ? static_cast<double>(outY_) / scale : start_.y;
+            outX_ = Units(last.to.x, xyzScale_);
+            outY_ = Units(last.to.y, xyzScale_);
+            writtenX_ = writtenY_ = true;
+            AppendWord(line, 'X', outX_, options_.xyzDecimals);
+            AppendWord(line, 'Y', outY_, options_.xyzDecimals);
+            AppendWord(line, 'I', Units(arc_.centre.x - startX, xyzScale_), options_.xyzDecimals);
+            AppendWord(line, 'J', Units(arc_.centre.y - startY, xyzScale_), options_.xyzDecimals);
+
+            double e = last.cmd.e;
+            if (modes_.RelativeE<Flavor>())
+                {
+                e = 0.0;
+                for (size_t i = 0; i < count; ++i)
+                    e += pending_[i].cmd.e;
+                }
+            writeE(line, e);
+            emit(line, true);
+            ++stats_.arcs;
+            stats_.movesInArcs += count;
+        }
+
+        void writeFeed(std::string &line, float f)
+        {
+            const int64_t units = Units(f, feedScale_);
+            if (options_.dropRedundant && writtenFeed_ && units == outFeed_)
+                return;
+            outFeed_ = units;
+            writtenFeed_ = true;
+            AppendWord(line, 'F', units, kFeedDecimals);
+        }
+
+        void writeAxis(std::string &line, char letter, double value, bool &written, int64_t &out)
+        {
+            const int64_t units = Units(value, xyzScale_);
+            if (options_.dropRedundant && written && units == out)
+                return;
+            out = units;
+            written = true;
+            AppendWord(line, letter, units, options_.xyzDecimals);
+        }
+
+        // Relative E carries what rounding left over to the next move, so the
+        // filament fed adds up to what the file asked for.
+        void writeE(std::string &line, double e)
+        {
+            int64_t units = 0;
+            if (modes_.RelativeE<Flavor>())
+                {
+                const double exact = e * static_cast<double>(eScale_) + eCarry_;
+                units = std::llround(exact);
+                eCarry_ = exact - static_cast<double>(units);
+                if (options_.dropRedundant && units == 0)
+                    return;
+                }
+            else
+                {
+                units = Units(e, eScale_);
+                if (options_.dropRedundant && writtenE_ && units == outE_)
+                    return;
+                outE_ = units;
+                writtenE_ = true;
+                }
+            AppendWord(line, 'E', units, options_.eDecimals);
+        }
+
+        void setMode(GCodeAction action, std::string_view line)
+        {
+            GCodeModes next = modes_;
+            next.Apply<Flavor>(action);
+            const bool positioning = action == GCodeAction::Absolute || action == GCodeAction::Relative;
+            const bool known = positioning ? knownPositioning_ && (!Flavor::kPositioningSetsE || knownEMode_)
+                                           : knownEMode_;
+            const bool same = next.relative == modes_.relative && next.relativeE == modes_.relativeE;
+            if (options_.dropRedundant && known && same)
+                return;
+            if (next.RelativeE<Flavor>() != modes_.RelativeE<Flavor>())
+                {
+                // The other mode starts from where the firmware is, not from what was written.
+                knownE_ = writtenE_ = false;
+                eCarry_ = 0.0;
+                }
+            modes_ = next;
+            knownPositioning_ = knownPositioning_ || positioning;
+            knownEMode_ = knownEMode_ || !positioning || Flavor::kPositioningSetsE;
+            emit(line, true);
+        }
+
+        void setPosition(std::string_view line)
+        {
+            emit(line, true);
+            // A bare G92 zeroes every axis on some firmware; on the others what
+            // it does is not worth relying on.
+            const bool all = cmd_.words == 0;
+            if (all && !Flavor::kBareSetPositionZeroes)
+                {
+                forget();
+                return;
+                }
+            if (all || cmd_.Has(GCodeCommand::HasX))
+                {
+                position_.x = all ? 0.0 : cmd_.x;
+                knownX_ = writtenX_ = true;
+                outX_ = Units(position_.x, xyzScale_);
+                }
+            if (all || cmd_.Has(GCodeCommand::HasY))
+                {
+                position_.y = all ? 0.0 : cmd_.y;
+                knownY_ = writtenY_ = true;
+                outY_ = Units(position_.y, xyzScale_);
+                }
+            if (all || cmd_.Has(GCodeCommand::HasZ))
+                {
+                writtenZ_ = true;
+                outZ_ = all ? 0 : Units(cmd_.z, xyzScale_);
+                }
+            if (all || cmd_.Has(GCodeCommand::HasE))
+                {
+                e_ = all ? 0.0 : cmd_.e;
+                knownE_ = writtenE_ = true;
+                outE_ = Units(e_, eScale_);
+                }
+        }
+
+        void setFan(GCodeAction action, std::string_view line)
+        {
+            // Only the part cooling fan; Bambu addresses its others with P.
+            if (cmd_.Has(GCodeCommand::HasP))
+                {
+                emit(line, true);
+                return;
+                }
+            const float speed = action == GCodeAction::FanOff ? 0.0f
+                                                              : (cmd_.Has(GCodeCommand::HasS) ? cmd_.s : 255.0f);
+            if (options_.dropRedundant && knownFan_ && speed == fan_)
+                return;
+            fan_ = speed;
+            knownFan_ = true;
+            emit(line, true);
+        }
+
+        // After homing, a macro or a tool change the firmware may be anywhere.
+        void forget()
+        {
+            knownX_ = knownY_ = knownE_ = false;
+            writtenX_ = writtenY_ = writtenZ_ = writtenE_ = writtenFeed_ = false;
+            feed_ = -1;
+        }
+
+        void emit(std::string_view line, bool command)
+        {
+            buffer_.Text().append(line).push_back('\n');
+            stats_.bytesOut += line.size() + 1;
+            if (command)
+                ++stats_.commandsOut;
+            buffer_.Spill();
+        }
+
+        const GCodePostOptions &options_;
+        GCodePostStats &stats_;
+        const int64_t xyzScale_;
+        const int64_t eScale_;
+        const int64_t feedScale_;
+        GCodeCommand cmd_;
+        std::string line_;
+        GCodeOutputBuffer buffer_;
+
+        // Input side.
+        GCodeModes modes_;
+        bool knownPositioning_ = false;     // a G90 or G91 was seen
+        bool knownEMode_ = false;           // an M82 or M83 was, or what sets E mode on this flavor
+        Point position_;
+        bool knownX_ = false;
+        bool knownY_ = false;
+        double e_ = 0.0;                    // absolute E
+        bool knownE_ = false;
+        int64_t feed_ = -1;                 // in output units, -1 if unknown
+
+        // Output side.
+        int64_t outX_ = 0, outY_ = 0, outZ_ = 0, outE_ = 0, outFeed_ = 0;
+        bool writtenX_ = false, writtenY_ = false, writtenZ_ = false, writtenE_ = false, writtenFeed_ = false;
+        double eCarry_ = 0.0;               // relative E rounding left over, in units
+        float fan_ = 0.0f;
+        bool knownFan_ = false;
+
+        // Moves held for the arc being fitted, which starts at start_. The
+        // first fitted_ of them make an arc, arc_, if fitted_ is not 0.
+        std::vector<ArcMove> pending_;
+        Point start_;
+        size_t fitted_ = 0;
+        Arc arc_;
+    };
+}
+
+GCodePostStats GCodePostProcessor::Process(const char *begin, const char *end, std::ostream &out) const
+{
+    const GCodeFlavor flavor = flavor_ == GCodeFlavor::Auto ? DetectGCodeFlavor(begin, end) : flavor_;
+    return WithGCodeFlavor(flavor, [&](auto f)
+        {
+        return process<decltype(f)>(begin, end, out);
+        });
+}
+
+template <typename Flavor>
+GCodePostStats GCodePostProcessor::process(const char *begin, const char *end, std::ostream &out) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    GCodePostStats stats;
+    stats.bytesIn = static_cast<size_t>(end - begin);
+    PostPass<Flavor> pass(options_, out, stats);
+    GCodeLineScanner scanner(begin, end);
+    std::string_view line;
+    while (scanner.Next(line))
+        pass.Line(line);
+    pass.Finish();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+GCodePostStats GCodePostProcessor::ProcessFile(const std::string &inPath, const std::string &outPath) const
+{
+    GCodePostStats stats;
+    RewriteGCodeFile(inPath, outPath, [&](const GCodeSource &source, std::ostream &out)
+        {
+        stats = Process(source.data(), source.data() + source.size(), out);
+        stats.bytesIn = source.StoredSize();
+        });
+    return stats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include "GCodeFlavor.h"
+
+/// What GCodePostProcessor does to a file.
+struct GCodePostOptions
+{
+    /// How far a fitted G2/G3 arc may stray from the moves it replaces, mm;
+    /// 0 fits no arcs.
+    float arcTolerance = 0.02f;
+
+    /// Decimals kept on X, Y, Z and arc centres (3 is 1 um, finer than the
+    /// steps of any printer we drive), and on E.
+    int xyzDecimals = 3;
+    int eDecimals = 5;
+
+    /// Drop F words that repeat the feedrate, axis words that repeat the
+    /// position, moves left without words, and G90/G91, M82/M83 and M106/M107
+    /// that set what is already set.
+    bool dropRedundant = true;
+};
+
+/// What a post-processing pass did.
+struct GCodePostStats
+{
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    size_t commandsIn = 0;      // lines with a command word
+    size_t commandsOut = 0;
+    size_t arcs = 0;            // G2/G3 written
+    size_t movesInArcs = 0;     // G1 moves they replace
+    double seconds = 0.0;
+
+    /// Share of the bytes and commands removed, 0..1.
+    double SizeReduction() const { return bytesIn ? 1.0 - static_cast<double>(bytesOut) / bytesIn : 0.0; }
+    double CommandReduction() const
+    {
+        return commandsIn ? 1.0 - static_cast<double>(commandsOut) / commandsIn : 0.0;
+    }
+};
+
+/// Streaming post-processor for sliced G-code. CuraEngine writes curves as
+/// long runs of short G1 moves, which bloat the file and can drain the
+/// printer's planner buffer faster than it is filled. This pass
+///   - replaces runs of extruding G1 moves that lie on a circle, to within
+///     the arc tolerance, by one G2 or G3 (I/J form, which every flavor reads),
+///   - drops words and commands that change nothing (GCodePostOptions::dropRedundant),
+///   - rounds coordinates to the decimals the options keep.
+///
+/// Output is written line by line; only the moves of the arc being fitted are
+/// held back (a bounded number), so memory does not grow with the file.
+/// Comments, layer markers and commands the pass does not know are copied as
+/// they are; after one of those that may move the head (a macro, homing, a
+/// tool change) it assumes nothing about the position until it is set again.
+class GCodePostProcessor
+{
+public:
+    explicit GCodePostProcessor(const GCodePostOptions &options = {}) : options_(options) {}
+
+    /// Dialect to read the input as; Auto, the default, detects it per file.
+    void SetFlavor(GCodeFlavor flavor) { flavor_ = flavor; }
+    GCodeFlavor GetFlavor() const { return flavor_; }
+
+    /// Post-process [begin, end) into `out`.
+    GCodePostStats Process(const char *begin, const char *end, std::ostream &out) const;
+
+    /// Post-process the file at `inPath` (plain, gzipped or binary G-code)
+    /// into a text file at `outPath`, which may be the same path: the output
+    /// then goes to a temporary file that replaces the input once complete.
+    /// Throws std::runtime_error if either file cannot be opened or written.
+    GCodePostStats ProcessFile(const std::string &inPath, const std::string &outPath) const;
+
+private:
+    template <typename Flavor>
+    GCodePostStats process(const char *begin, const char *end, std::ostream &out) const;
+
+    GCodePostOptions options_;
+    GCodeFlavor flavor_ = GCodeFlavor::Auto;
+};
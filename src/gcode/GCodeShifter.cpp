@@ -0,0 +1,259 @@
+#include "GCodeShifter.h"
+#include "GCodeLayerIndex.h"
+#include "GCodeOutput.h"
+#include "GCodeSource.h"
+#include "GCodeTokenizer.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+namespace
+{
+    // Shifted numbers keep their decimals, and get at least this many: Cura
+    // writes 3, and a whole number shifted by a fraction needs some.
+    constexpr int kMinDecimals = 3;
+    constexpr int kMaxDecimals = 6;
+
+    // Cura ends each layer with this comment; the end G-code follows the last one.
+    constexpr std::string_view kLayerEnd = ";TIME_ELAPSED:";
+
+    // A prime tower stands where the printer profile puts it, not with the print.
+    constexpr std::string_view kPrimeTower = "\n;TYPE:PRIME-TOWER";
+
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    // A ";===== ... begin =====" or "... finish =====" comment of the
+    // printer's extruder start and end code.
+    bool IsTemplateMark(std::string_view comment, std::string_view mark)
+    {
+        return comment.substr(0, 5) == "=====" && comment.find(mark) != std::string_view::npos;
+    }
+
+    // A decimal number as an integer count of 10^-decimals units, exactly,
+    // and the decimals it was written with.
+    struct Fixed
+    {
+        int64_t units = 0;
+        int decimals = 0;
+        int written = 0;
+    };
+
+    bool ParseFixed(std::string_view text, Fixed &value)
+    {
+        bool negative = false;
+        if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+            {
+            negative = text[0] == '-';
+            text.remove_prefix(1);
+            }
+        const size_t dot = text.find('.');
+        const std::string_view whole = text.substr(0, dot);
+        const std::string_view fraction = dot == std::string_view::npos ? std::string_view() : text.substr(dot + 1);
+        if ((whole.empty() && fraction.empty()) || fraction.size() > kMaxDecimals ||
+            !std::all_of(whole.begin(), whole.end(), [](char c) { return c >= '0' && c <= '9'; }) ||
+            !std::all_of(fraction.begin(), fraction.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            return false;
+        value.written = static_cast<int>(fraction.size());
+        value.decimals = std::max(kMinDecimals, value.written);
+        int64_t units = 0;
+        for (const char c: whole)
+            units = units * 10 + (c - '0');
+        for (int i = 0; i < value.decimals; ++i)
+            units = units * 10 + (i < static_cast<int>(fraction.size()) ? fraction[i] - '0' : 0);
+        value.units = negative ? -units : units;
+        return true;
+    }
+
+    class ShiftPass
+    {
+    public:
+        ShiftPass(const glm::dvec2 &offset, const glm::dvec2 &bedMin, const glm::dvec2 &bedMax, std::ostream &out,
+                  GCodeShiftStats &stats)
+            : offset_(offset), bedMin_(bedMin), bedMax_(bedMax), stats_(stats), buffer_(out)
+        {
+        }
+
+        /// `line` without its newline, and the newline ("\n", "\r\n" or none
+        /// at the end of the text). `shift` is false outside the layers.
+        void Line(std::string_view line, std::string_view newline, bool shift)
+        {
+            // Only whole-line comments and G commands matter; the rest is copied unread.
+            const size_t first = line.find_first_not_of(" \t");
+            const char lead = first == std::string_view::npos ? 0 : line[first];
+            int number = -1;
+            if (lead == 'G')
+                {
+                const char *p = line.data() + first + 1;
+                const char *end = line.data() + line.size();
+                auto [ptr, ec] = std::from_chars(p, end, number);
+                if (ec != std::errc() || (ptr != end && !IsSpace(*ptr) && *ptr != ';'))
+                    number = -1;
+                }
+            if (number == 90 || number == 91)
+                relative_ = number == 91;
+            if (shift && lead == ';')
+                {
+                const std::string_view comment = line.substr(first + 1);
+                if (IsTemplateMark(comment, " begin ="))
+                    inTemplate_ = true;
+                else if (IsTemplateMark(comment, " finish ="))
+                    inTemplate_ = false;
+                }
+            if (shift && !inTemplate_ && !relative_ && ((number >= 0 && number <= 3) || number == 92))
+                rewrite(line, number == 92);
+            else if (lead != ';' || !rewriteBound(line, first))
+                buffer_.Text().append(line);
+            buffer_.Text().append(newline);
+            buffer_.Spill();
+        }
+
+        void Finish()
+        {
+            buffer_.Flush();
+            stats_.bytes = buffer_.Written();
+        }
+
+    private:
+        // Copy `line` with its X and Y words shifted; words are split at
+        // spaces as GCodeTokenizer splits them. A G92 sets the position
+        // without moving there, so its values need not be on the bed.
+        void rewrite(std::string_view line, bool setPosition)
+        {
+            const size_t semi = line.find(';');
+            const std::string_view code = line.substr(0, semi);
+            size_t copied = 0;
+            bool first = true;
+            for (size_t i = 0; i < code.size();)
+                {
+                while (i < code.size() && IsSpace(code[i]))
+                    ++i;
+                const size_t wordBegin = i;
+                while (i < code.size() && !IsSpace(code[i]))
+                    ++i;
+                if (wordBegin == i)
+                    break;
+                const char axis = code[wordBegin];
+                if (first || (axis != 'X' && axis != 'Y'))
+                    {
+                    first = false;
+                    continue;
+                    }
+                // Leaving a coordinate unshifted would leave part of the print behind.
+                const std::string_view number = code.substr(wordBegin + 1, i - wordBegin - 1);
+                Fixed value;
+                if (!ParseFixed(number, value))
+                    throw std::runtime_error(std::string("Cannot move the coordinate ") + axis + std::string(number));
+                const int a = axis == 'X' ? 0 : 1;
+                const double shifted = shiftValue(value, a);
+                constexpr double kSlack = 1e-6;
+                if (!setPosition && (shifted < bedMin_[a] - kSlack || shifted > bedMax_[a] + kSlack))
+                    throw std::runtime_error(std::string("The moved print leaves the bed (") + axis + " " +
+                                             std::to_string(shifted) + ")");
+                buffer_.Text().append(line.substr(copied, wordBegin + 1 - copied));
+                appendFixed(value);
+                copied = i;
+                }
+            buffer_.Text().append(line.substr(copied));
+            if (copied > 0)
+                ++stats_.moves;
+        }
+
+        // Cura's header gives the print's extent as ";MINX:12.345" and so on
+        // for MAXX, MINY and MAXY; those move with it. False for other lines.
+        bool rewriteBound(std::string_view line, size_t first)
+        {
+            const std::string_view comment = line.substr(first + 1);
+            if (comment.size() < 5 || (comment.substr(0, 3) != "MIN" && comment.substr(0, 3) != "MAX") ||
+                (comment[3] != 'X' && comment[3] != 'Y') || comment[4] != ':')
+                return false;
+            std::string_view number = comment.substr(5);
+            const size_t trailing = number.find_last_not_of(" \t");
+            number = number.substr(0, trailing == std::string_view::npos ? 0 : trailing + 1);
+            Fixed value;
+            if (!ParseFixed(number, value))
+                return false;
+            shiftValue(value, comment[3] == 'X' ? 0 : 1);
+            const size_t at = static_cast<size_t>(number.data() - line.data());
+            buffer_.Text().append(line.substr(0, at));
+            appendFixed(value);
+            buffer_.Text().append(line.substr(at + number.size()));
+            return true;
+        }
+
+        // Add the offset along `axis` to `value`; returns the result in mm.
+        double shiftValue(Fixed &value, int axis) const
+        {
+            const double scale = std::pow(10.0, value.decimals);
+            value.units += std::llround(offset_[axis] * scale);
+            return static_cast<double>(value.units) / scale;
+        }
+
+        // With the decimals the number was written with, and more if it needs them.
+        void appendFixed(const Fixed &value)
+        {
+            AppendGCodeFixed(buffer_.Text(), value.units, value.decimals, value.written);
+        }
+
+        glm::dvec2 offset_;
+        glm::dvec2 bedMin_;
+        glm::dvec2 bedMax_;
+        GCodeShiftStats &stats_;
+        GCodeOutputBuffer buffer_;
+        bool relative_ = false;     // G91 in force
+        bool inTemplate_ = false;   // within extruder start or end code
+    };
+}
+
+GCodeShiftStats GCodeShifter::Shift(const char *begin, const char *end, std::ostream &out) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    const char *first = GCodeLayerIndex::FindMarker(begin, end);
+    const std::string_view text(begin, static_cast<size_t>(end - begin));
+    size_t last = text.rfind(kLayerEnd);
+    while (last != std::string_view::npos && last > 0 && text[last - 1] != '\n')
+        last = text.rfind(kLayerEnd, last - 1);
+    if (first == end || last == std::string_view::npos || begin + last < first)
+        throw std::runtime_error("No Cura layers to move in the G-code");
+    const char *layersEnd = begin + last;
+    // Moving the print but not its tower could put one on the other; only a
+    // fresh slice can place them both.
+    if (std::string_view(first, static_cast<size_t>(layersEnd - first)).find(kPrimeTower) != std::string_view::npos)
+        throw std::runtime_error("The print has a prime tower, which cannot move with it");
+
+    GCodeShiftStats stats;
+    ShiftPass pass(offset_, bedMin_, bedMax_, out, stats);
+    GCodeLineScanner scanner(begin, end);
+    std::string_view line;
+    const char *lineBegin = begin;
+    while (scanner.Next(line))
+        {
+        // The scanner drops the newline and a '\r' before it; both are copied as they were.
+        const char *lineEnd = scanner.Position();
+        const std::string_view newline(line.data() + line.size(),
+                                       static_cast<size_t>(lineEnd - line.data()) - line.size());
+        pass.Line(line, newline, lineBegin >= first && lineBegin < layersEnd);
+        lineBegin = lineEnd;
+        }
+    pass.Finish();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+GCodeShiftStats GCodeShifter::ShiftFile(const std::string &inPath, const std::string &outPath) const
+{
+    GCodeShiftStats stats;
+    RewriteGCodeFile(inPath, outPath, [&](const GCodeSource &source, std::ostream &out)
+        {
+        stats = Shift(source.data(), source.data() + source.size(), out);
+        });
+    return stats;
+}
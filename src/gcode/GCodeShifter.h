@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <glm/glm.hpp>
+
+/// What a shift did.
+struct GCodeShiftStats
+{
+    size_t bytes = 0;           // written
+    size_t moves = 0;           // commands whose X or Y was shifted
+    double seconds = 0.0;
+};
+
+/// Moves a sliced print across the bed by rewriting the X and Y words of its
+/// moves: what re-slicing a model that was only moved in X and Y would give,
+/// in a fraction of the time.
+///
+/// Only CuraEngine's layers move, from the first ";LAYER:" marker to the last
+/// ";TIME_ELAPSED:". The start and end G-code around them, and the printer's
+/// extruder start and end code within them (which the A1 mini profile wraps in
+/// ";===== ... begin =====" and ";===== ... finish =====" comments), prime,
+/// wipe and park at fixed places and stay where they are. Skirt, brim and
+/// support are part of the layers and move with the print. A prime tower does
+/// not: it stays where the profile puts it, so a print with one (a
+/// ";TYPE:PRIME-TOWER" section) is refused and has to be sliced again. The
+/// print's extent in Cura's header (";MINX:", ";MAXX:", ";MINY:", ";MAXY:")
+/// moves with it. Relative moves (G91) and arc centres (I, J) need no change.
+/// Everything but the rewritten numbers is copied byte for byte.
+class GCodeShifter
+{
+public:
+    /// Shift by `offset` mm; every shifted X and Y must stay within
+    /// [bedMin, bedMax].
+    GCodeShifter(const glm::dvec2 &offset, const glm::dvec2 &bedMin, const glm::dvec2 &bedMax)
+        : offset_(offset), bedMin_(bedMin), bedMax_(bedMax) {}
+
+    /// Shift [begin, end) into `out`. Throws std::runtime_error, with `out`
+    /// left incomplete, if the text has no Cura layers or has a prime tower,
+    /// an X or Y to shift is not a plain decimal of at most 6 places, or a move
+    /// would leave the bed (G92 may set a position off it).
+    GCodeShiftStats Shift(const char *begin, const char *end, std::ostream &out) const;
+
+    /// Shift the file at `inPath` into a text file at `outPath`, which may be
+    /// the same path: the output then goes to a temporary file that replaces
+    /// the input once complete. Throws std::runtime_error as Shift does, or if
+    /// either file cannot be opened or written; the input is left as it was.
+    GCodeShiftStats ShiftFile(const std::string &inPath, const std::string &outPath) const;
+
+private:
+    glm::dvec2 offset_;
+    glm::dvec2 bedMin_;
+    glm::dvec2 bedMax_;
+};
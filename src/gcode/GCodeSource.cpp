@@ -0,0 +1,260 @@
+#include "GCodeSource.h"
+#include "GCodeBinary.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <zlib.h>
+
+using GCodeBinary::Block;
+using GCodeBinary::BlockType;
+
+namespace
+{
+    // zlib counts in 32-bit units; the input is fed and the output drained in
+    // blocks no larger than these.
+    constexpr size_t kInflateInBytes = size_t(1) << 20;
+    constexpr size_t kInflateOutBytes = size_t(1) << 30;
+
+    // A decode shown piece by piece (GCodeSource::DecodeCallback) stops for the
+    // caller about this often: a few layers of a typical print.
+    constexpr size_t kPieceBytes = size_t(4) << 20;
+
+    // Binary G-code blocks are decoded on several threads once there is this
+    // much to decode per thread.
+    constexpr size_t kMinShareBytes = size_t(1) << 20;
+
+    uint32_t ReadLE(const unsigned char *p, size_t bytes)
+    {
+        uint32_t v = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            v |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return v;
+    }
+
+    // Metadata is INI text, "key=value" per line; write it as the
+    // "; key = value" comments a text export carries.
+    void AppendMetadata(const Block &b, std::string &out)
+    {
+        const std::string ini = GCodeBinary::Decompress(b);
+        std::string_view rest(ini);
+        while (!rest.empty())
+            {
+            const size_t nl = rest.find('\n');
+            std::string_view line = rest.substr(0, nl);
+            rest = nl == std::string_view::npos ? std::string_view() : rest.substr(nl + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            const size_t eq = line.find('=');
+            if (line.empty() || eq == std::string_view::npos)
+                continue;
+            out.append("; ").append(line.substr(0, eq)).append(" = ").append(line.substr(eq + 1)).push_back('\n');
+            }
+    }
+
+    // Decode the G-code blocks of a file, in parallel when there are enough of them.
+    std::vector<std::string> DecodeGCodeBlocks(const std::vector<const Block *> &blocks)
+    {
+        size_t stored = 0;
+        for (const Block *b: blocks)
+            stored += b->stored;
+        const size_t threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), blocks.size());
+        const size_t shares = std::clamp<size_t>(stored / kMinShareBytes, 1, std::max<size_t>(1, threads));
+
+        std::vector<std::string> texts(blocks.size());
+        std::vector<std::exception_ptr> errors(shares);
+        auto decode = [&](size_t share)
+            {
+            try
+                {
+                for (size_t i = blocks.size() * share / shares; i < blocks.size() * (share + 1) / shares; ++i)
+                    texts[i] = GCodeBinary::DecodeGCode(*blocks[i]);
+                }
+            catch (...)
+                {
+                errors[share] = std::current_exception();
+                }
+            };
+        if (shares == 1)
+            decode(0);
+        else
+            {
+            std::vector<std::thread> workers;
+            workers.reserve(shares);
+            for (size_t i = 0; i < shares; ++i)
+                workers.emplace_back(decode, i);
+            for (auto &w: workers)
+                w.join();
+            }
+        for (const std::exception_ptr &e: errors)
+            {
+            if (e)
+                std::rethrow_exception(e);
+            }
+        return texts;
+    }
+}
+
+GCodeSource::GCodeSource(const std::string &path)
+    : GCodeSource(path, DecodeCallback())
+{
+}
+
+GCodeSource::GCodeSource(const std::string &path, const DecodeCallback &onDecoded)
+    : file_(map(path))
+{
+    format_ = Detect(file_.data(), file_.size());
+    try
+        {
+        if (format_ == Format::Gzip)
+            inflateGzip(onDecoded);
+        else if (format_ == Format::Binary)
+            decodeBinary(onDecoded);
+        }
+    catch (const std::exception &e)
+        {
+        throw std::runtime_error("Failed to open G-code file: " + path + ": " + e.what());
+        }
+}
+
+MappedFile GCodeSource::map(const std::string &path)
+{
+    try
+        {
+        return MappedFile(path);
+        }
+    catch (const std::exception &)
+        {
+        throw std::runtime_error("Failed to open G-code file: " + path);
+        }
+}
+
+GCodeSource::Format GCodeSource::Detect(const char *data, size_t size)
+{
+    if (size >= 2 && static_cast<unsigned char>(data[0]) == 0x1F && static_cast<unsigned char>(data[1]) == 0x8B)
+        return Format::Gzip;
+    const char *magic = GCodeBinary::kMagic;
+    if (size >= sizeof(GCodeBinary::kMagic) && std::memcmp(data, magic, sizeof(GCodeBinary::kMagic)) == 0)
+        return Format::Binary;
+    return Format::Text;
+}
+
+void GCodeSource::inflateGzip(const DecodeCallback &onDecoded)
+{
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(file_.data());
+    const size_t size = file_.size();
+
+    // The trailer holds the decoded size modulo 4 GiB. That is exact for most
+    // files; a larger or multi-member one grows the buffer as it goes.
+    // Deflate cannot expand more than about 1032:1, which bounds a bogus trailer.
+    const size_t hint = size >= 18 ? std::min<size_t>(ReadLE(in + size - 4, 4), size * 1032) : 0;
+    text_.resize(std::max(hint, size * 2));
+
+    z_stream zs{};
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        throw std::runtime_error("cannot initialise zlib");
+    size_t read = 0;
+    size_t written = 0;
+    for (;;)
+        {
+        if (zs.avail_in == 0 && read < size)
+            {
+            zs.next_in = const_cast<Bytef *>(in + read);
+            zs.avail_in = static_cast<uInt>(std::min(kInflateInBytes, size - read));
+            read += zs.avail_in;
+            }
+        if (written == text_.size())
+            text_.resize(text_.size() * 2);
+        zs.next_out = reinterpret_cast<Bytef *>(text_.data() + written);
+        const size_t out = onDecoded ? kPieceBytes : kInflateOutBytes;
+        zs.avail_out = static_cast<uInt>(std::min(out, text_.size() - written));
+        const uInt room = zs.avail_out;
+        const int ret = inflate(&zs, Z_NO_FLUSH);
+        written += room - zs.avail_out;
+        if (onDecoded && room != zs.avail_out && !onDecoded(text_.data(), text_.data() + written))
+            break;
+        if (ret == Z_STREAM_END)
+            {
+            // Members written one after another ("cat a.gz b.gz") make one file.
+            if (zs.avail_in == 0 && read == size)
+                break;
+            if (zs.avail_in < 2 || zs.next_in[0] != 0x1F || zs.next_in[1] != 0x8B)
+                {
+                std::cerr << "Warning: ignoring data after the end of a gzip G-code stream" << std::endl;
+                break;
+                }
+            inflateReset(&zs);
+            }
+        else if (ret != Z_OK && !(ret == Z_BUF_ERROR && zs.avail_out == 0))
+            {
+            inflateEnd(&zs);
+            throw std::runtime_error(ret == Z_BUF_ERROR ? "truncated gzip stream"
+                                                        : std::string("corrupt gzip stream: ") +
+                                                              (zs.msg ? zs.msg : "inflate failed"));
+            }
+        }
+    inflateEnd(&zs);
+    text_.resize(written);
+}
+
+void GCodeSource::decodeBinary(const DecodeCallback &onDecoded)
+{
+    const unsigned char *begin = reinterpret_cast<const unsigned char *>(file_.data());
+    const std::vector<Block> blocks = GCodeBinary::ReadBlocks(begin, begin + file_.size());
+
+    std::string head;
+    std::string tail;
+    std::vector<const Block *> gcode;
+    for (const Block &b: blocks)
+        {
+        switch (b.type)
+            {
+            case BlockType::FileMetadata:
+            case BlockType::PrinterMetadata:
+                AppendMetadata(b, head);
+                break;
+            case BlockType::PrintMetadata:
+                AppendMetadata(b, tail);
+                break;
+            case BlockType::SlicerMetadata:
+                // GCodeBinaryWriter leaves it empty; the settings are in the G-code.
+                if (b.size == 0)
+                    break;
+                tail += "\n; prusaslicer_config = begin\n";
+                AppendMetadata(b, tail);
+                tail += "; prusaslicer_config = end\n";
+                break;
+            case BlockType::GCode:
+                gcode.push_back(&b);
+                break;
+            default:
+                break;
+            }
+        }
+
+    // MeatPacked blocks decode to a little more than their size; the buffer grows if so.
+    size_t total = head.size() + tail.size();
+    for (const Block *b: gcode)
+        total += b->size;
+    text_.reserve(total);
+    text_.insert(text_.end(), head.begin(), head.end());
+
+    // All blocks at once, or a piece's worth per thread at a time for `onDecoded`.
+    const size_t pieceBytes = std::max<size_t>(1, std::thread::hardware_concurrency()) * kPieceBytes;
+    for (size_t first = 0; first < gcode.size();)
+        {
+        size_t last = first;
+        for (size_t bytes = 0; last < gcode.size() && (!onDecoded || bytes < pieceBytes); ++last)
+            bytes += gcode[last]->size;
+        const std::vector<const Block *> piece(gcode.begin() + first, gcode.begin() + last);
+        for (const std::string &t: DecodeGCodeBlocks(piece))
+            text_.insert(text_.end(), t.begin(), t.end());
+        first = last;
+        if (onDecoded && !onDecoded(text_.data(), text_.data() + text_.size()))
+            return;
+        }
+    text_.insert(text_.end(), tail.begin(), tail.end());
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MappedFile.h"
+
+/// The text of a G-code file, as plain G-code, gzip (".gcode.gz") or Prusa
+/// binary G-code (".bgcode"). The format is told from the first bytes, not the
+/// file name.
+///
+/// Plain files stay mapped. Compressed ones are decoded block by block into
+/// memory when the source is opened, without a temporary file: the layer index,
+/// the text panel and the parallel parse all need the whole text at hand. A
+/// caller that can use the text as it comes, such as GCodeStreamingParse, is
+/// shown each decoded piece on the way.
+/// Binary files decode their G-code blocks on several threads; their metadata
+/// becomes "; key = value" comments, the printer's at the start and the
+/// slicer's at the end, where a text export has them. Thumbnails are skipped.
+///
+/// Throws std::runtime_error, "Failed to open G-code file: <path>" and the
+/// reason, if the file cannot be read or is corrupt.
+class GCodeSource
+{
+public:
+    enum class Format
+    {
+        Text,
+        Gzip,
+        Binary
+    };
+
+    /// Receives the text decoded so far, [begin, end), which may move between
+    /// calls and may end within a line; return false to stop decoding.
+    using DecodeCallback = std::function<bool(const char *begin, const char *end)>;
+
+    explicit GCodeSource(const std::string &path);
+
+    /// Open `path`, calling `onDecoded` after each piece of a compressed file is
+    /// decoded: every few megabytes of a gzip stream, every few G-code blocks of
+    /// a binary file. It is not called for a plain file. If it stops the decode,
+    /// the source holds only the text decoded by then.
+    GCodeSource(const std::string &path, const DecodeCallback &onDecoded);
+
+    GCodeSource(GCodeSource &&) noexcept = default;
+    GCodeSource &operator=(GCodeSource &&) noexcept = default;
+
+    const char *data() const { return format_ == Format::Text ? file_.data() : text_.data(); }
+    size_t size() const { return format_ == Format::Text ? file_.size() : text_.size(); }
+    std::string_view view() const { return {data(), size()}; }
+
+    Format GetFormat() const { return format_; }
+
+    /// Bytes of the file itself, compressed or not.
+    size_t StoredSize() const { return file_.size(); }
+
+    /// Format of a file starting with [data, data + size).
+    static Format Detect(const char *data, size_t size);
+
+private:
+    static MappedFile map(const std::string &path);
+    void inflateGzip(const DecodeCallback &onDecoded);
+    void decodeBinary(const DecodeCallback &onDecoded);
+
+    MappedFile file_;
+    std::vector<char> text_;    // decoded text of a compressed file
+    Format format_ = Format::Text;
+};
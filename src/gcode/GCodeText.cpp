@@ -0,0 +1,136 @@
+#include "GCodeText.h"
+#include "GCodeParser.h"
+#include "GCodeTokenizer.h"
+#include "GCodeSource.h"
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+    // How often the indexing thread checks for a closed panel while it waits for the text.
+    constexpr std::chrono::milliseconds kSourcePoll{20};
+}
+
+GCodeText::GCodeText(const std::string &path, std::shared_future<std::shared_ptr<const GCodeSource> > source)
+    : path_(path), pending_(std::move(source))
+{
+    if (!pending_.valid())
+        file_ = std::make_shared<const GCodeSource>(path);
+    builder_ = std::thread(&GCodeText::build, this);
+}
+
+GCodeText::~GCodeText()
+{
+    closing_ = true;
+    if (builder_.joinable())
+        builder_.join();
+}
+
+void GCodeText::build()
+{
+    // A model still decoding the file may be dropped before it is done; a
+    // closed panel does not wait for it.
+    while (!file_ && pending_.wait_for(kSourcePoll) != std::future_status::ready)
+        {
+        if (closing_.load())
+            return;
+        }
+    if (!file_)
+        file_ = pending_.get();
+    pending_ = {};
+    if (!file_)
+        {
+        try
+            {
+            file_ = std::make_shared<const GCodeSource>(path_);
+            }
+        catch (const std::exception &e)
+            {
+            std::cerr << "Warning: " << e.what() << std::endl;
+            return;
+            }
+        }
+    const char *begin = file_->data();
+    lines_.Build(begin, begin + file_->size());
+    layers_.Build(begin, begin + file_->size());
+    flavor_ = DetectGCodeFlavor(begin, begin + file_->size());
+    ready_.store(true, std::memory_order_release);
+}
+
+std::string_view GCodeText::Line(size_t line) const
+{
+    return IsReady() ? lines_.Line(file_->data(), line) : std::string_view();
+}
+
+size_t GCodeText::LayerFirstLine(int layer) const
+{
+    if (!IsReady() || layer < 0 || static_cast<size_t>(layer) >= layers_.Count())
+        return 0;
+    return layers_[static_cast<size_t>(layer)].line;
+}
+
+int GCodeText::LayerOfLine(size_t line) const
+{
+    return IsReady() ? layers_.LayerAtOffset(lines_.Offset(file_->data(), line)) : -1;
+}
+
+bool GCodeText::Locate(size_t line, Location &out) const
+{
+    const int layer = LayerOfLine(line);
+    if (layer < 0 || line >= lines_.Count())
+        return false;
+
+    // Parse the layer with the buffer cut after the line: the layer it yields
+    // ends with that line's move, if it has one. No simplification, so every
+    // move keeps its vertex.
+    const char *begin = file_->data();
+    const std::string_view text = lines_.Line(begin, line);
+    const char *end = text.data() + text.size();
+    GCodeParser parser;
+    parser.SetFlavor(flavor_);  // the cut buffer may have lost the settings block it is detected from
+    bool found = false;
+    parser.ParseLayerRange(begin, end, layers_, static_cast<size_t>(layer), static_cast<size_t>(layer),
+                           [&](float, std::vector<GCodePathVertex> &&path, const GCodeEstimate &estimate)
+        {
+        found = true;
+        out.layer = layer;
+        out.moves = estimate.moveTimes.empty() ? 0 : static_cast<uint32_t>(estimate.moveTimes.size() - 1);
+        GCodeCommand cmd;
+        GCodeTokenizer::Decode(text, cmd);
+        out.moved = cmd.IsMove() && !path.empty() && path.back().move == out.moves;
+        if (out.moved)
+            {
+            out.to = path.back().pos;
+            out.from = path.size() > 1 && !path.back().IsRunStart() ? path[path.size() - 2].pos : out.to;
+            }
+        return false;
+        });
+    return found;
+}
+
+bool GCodeText::LineOfMove(int layer, uint32_t move, size_t &line) const
+{
+    if (!IsReady() || layer < 0 || static_cast<size_t>(layer) >= layers_.Count() || move == 0)
+        return false;
+    if (layer != moveLinesLayer_)
+        {
+        const char *begin = file_->data();
+        GCodeParser parser;
+        parser.SetFlavor(flavor_);
+        parser.SetRecordMoveLines(true);
+        moveLines_.clear();
+        parser.ParseLayerRange(begin, begin + file_->size(), layers_, static_cast<size_t>(layer),
+                               static_cast<size_t>(layer),
+                               [&](float, std::vector<GCodePathVertex> &&, const GCodeEstimate &estimate)
+            {
+            moveLines_ = estimate.moveLines;
+            return false;
+            });
+        moveLinesLayer_ = layer;
+        }
+    if (move > moveLines_.size())
+        return false;
+    // The layer was parsed from its first line; layer 0 from the top of the file.
+    line = (layer == 0 ? 0 : layers_[static_cast<size_t>(layer)].line) + moveLines_[move - 1];
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GCodeLayerIndex.h"
+#include "GCodeLineIndex.h"
+
+class GCodeSource;
+
+/// The text of a G-code file, for a source panel next to the 3D view.
+///
+/// The file stays in memory, mapped or decoded (see GCodeSource). Its line
+/// index (GCodeLineIndex) and layer index are built on a background thread, so
+/// even a file of tens of millions of lines opens at once and can be shown as
+/// soon as IsReady(). Lines can be related to the toolpaths both ways: the
+/// first line of a layer, and where in the print a line is (Locate), found by
+/// parsing its layer up to that line.
+class GCodeText
+{
+public:
+    /// Open the file, or take `source` if it is being read already (see
+    /// GCodeModel::GetSource), and start indexing it. Without a `source`, throws
+    /// if the file cannot be opened; with one, the indexing thread waits for it,
+    /// opens the file itself if it holds none, and warns if that fails.
+    explicit GCodeText(const std::string &path,
+                       std::shared_future<std::shared_ptr<const GCodeSource> > source = {});
+    ~GCodeText();
+
+    GCodeText(const GCodeText &) = delete;
+    GCodeText &operator=(const GCodeText &) = delete;
+
+    /// True once both indexes are built; the other members need it.
+    bool IsReady() const { return ready_.load(std::memory_order_acquire); }
+
+    size_t LineCount() const { return IsReady() ? lines_.Count() : 0; }
+
+    /// Line `line` (0-based) without its line end.
+    std::string_view Line(size_t line) const;
+
+    /// First line of layer `layer`, as in GCodeLayerMark::line.
+    size_t LayerFirstLine(int layer) const;
+
+    /// Layer holding line `line`, or -1 if the file has none.
+    int LayerOfLine(size_t line) const;
+
+    /// Where the print is once line `line` is done.
+    struct Location
+    {
+        int layer = 0;
+        uint32_t moves = 0;        // moves of `layer` done, as in GCodeEstimate::moveTimes
+        bool moved = false;        // the line is a move, from `from` to `to`
+        glm::vec3 from{0.0f};
+        glm::vec3 to{0.0f};
+    };
+
+    /// Find `line` in the print. Parses its layer up to it (see
+    /// GCodeParser::ParseLayerRange), which takes a few milliseconds for a large
+    /// layer, so call it when the line of interest changes rather than per frame.
+    bool Locate(size_t line, Location &out) const;
+
+    /// The inverse: the line of move `move` of layer `layer`, counting moves
+    /// from 1 as GCodePathVertex::move does. Parses the whole layer the first
+    /// time one of its moves is asked for and keeps its table until another
+    /// layer's is needed, so hovering over one layer stays cheap.
+    bool LineOfMove(int layer, uint32_t move, size_t &line) const;
+
+private:
+    void build();
+
+    std::string path_;
+    std::shared_future<std::shared_ptr<const GCodeSource> > pending_;  // file_, once read
+    std::shared_ptr<const GCodeSource> file_;
+    GCodeLineIndex lines_;
+    GCodeLayerIndex layers_;
+    GCodeFlavor flavor_ = GCodeFlavor::Auto;
+    std::atomic<bool> ready_{false};
+    std::atomic<bool> closing_{false};          // stop waiting for pending_
+    std::thread builder_;
+    mutable int moveLinesLayer_ = -1;           // layer moveLines_ is for
+    mutable std::vector<uint32_t> moveLines_;   // GCodeEstimate::moveLines of that layer
+};
@@ -0,0 +1,151 @@
+#include "GCodeTokenizer.h"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    inline bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline char ToUpper(char c)
+    {
+        return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+    }
+}
+
+bool GCodeLineScanner::Next(std::string_view &line)
+{
+    if (cur_ >= end_)
+        return false;
+    const char *nl = static_cast<const char *>(std::memchr(cur_, '\n', static_cast<size_t>(end_ - cur_)));
+    const char *lineEnd = nl ? nl : end_;
+    const char *trimmed = lineEnd;
+    if (trimmed > cur_ && trimmed[-1] == '\r')
+        --trimmed;
+    line = std::string_view(cur_, static_cast<size_t>(trimmed - cur_));
+    cur_ = nl ? nl + 1 : end_;
+    return true;
+}
+
+namespace GCodeTokenizer
+{
+    bool ParseFloat(std::string_view text, float &value)
+    {
+        const char *first = text.data();
+        const char *last = first + text.size();
+        if (first < last && *first == '+')
+            ++first;
+        if (first >= last)
+            return false;
+        auto [ptr, ec] = std::from_chars(first, last, value);
+        return ec == std::errc() && ptr != first && !std::isnan(value);
+    }
+
+    size_t FindNoCase(std::string_view haystack, std::string_view upperNeedle)
+    {
+        if (upperNeedle.empty())
+            return 0;
+        if (haystack.size() < upperNeedle.size())
+            return std::string_view::npos;
+        const size_t last = haystack.size() - upperNeedle.size();
+        for (size_t i = 0; i <= last; ++i)
+            {
+            size_t k = 0;
+            while (k < upperNeedle.size() && ToUpper(haystack[i + k]) == upperNeedle[k])
+                ++k;
+            if (k == upperNeedle.size())
+                return i;
+            }
+        return std::string_view::npos;
+    }
+
+    void Decode(std::string_view line, GCodeCommand &cmd)
+    {
+        cmd.letter = 0;
+        cmd.number = -1;
+        cmd.words = 0;
+        cmd.comment = {};
+
+        size_t semi = line.find(';');
+        if (semi != std::string_view::npos)
+            {
+            cmd.comment = line.substr(semi + 1);
+            line = line.substr(0, semi);
+            }
+
+        const char *p = line.data();
+        const char *end = p + line.size();
+        bool first = true;
+        while (p < end)
+            {
+            while (p < end && IsSpace(*p))
+                ++p;
+            if (p >= end)
+                break;
+            const char *wordBegin = p;
+            while (p < end && !IsSpace(*p))
+                ++p;
+            std::string_view word(wordBegin, static_cast<size_t>(p - wordBegin));
+
+            if (first)
+                {
+                first = false;
+                // The command word must be a letter followed only by an integer ("G1", "M104").
+                int number = 0;
+                auto [ptr, ec] = std::from_chars(word.data() + 1, word.data() + word.size(), number);
+                if (word.size() >= 2 && ec == std::errc() && ptr == word.data() + word.size())
+                    {
+                    cmd.letter = word[0];
+                    cmd.number = number;
+                    }
+                continue;
+                }
+
+            if (word.size() < 2)
+                continue;
+            float value = 0.0f;
+            if (!ParseFloat(word.substr(1), value))
+                continue;
+            switch (word[0])
+                {
+                case 'X': cmd.x = value;
+                    cmd.words |= GCodeCommand::HasX;
+                    break;
+                case 'Y': cmd.y = value;
+                    cmd.words |= GCodeCommand::HasY;
+                    break;
+                case 'Z': cmd.z = value;
+                    cmd.words |= GCodeCommand::HasZ;
+                    break;
+                case 'E': cmd.e = value;
+                    cmd.words |= GCodeCommand::HasE;
+                    break;
+                case 'F': cmd.f = value;
+                    cmd.words |= GCodeCommand::HasF;
+                    break;
+                case 'S': cmd.s = value;
+                    cmd.words |= GCodeCommand::HasS;
+                    break;
+                case 'P': cmd.p = value;
+                    cmd.words |= GCodeCommand::HasP;
+                    break;
+                case 'T': cmd.t = value;
+                    cmd.words |= GCodeCommand::HasT;
+                    break;
+                case 'I': cmd.i = value;
+                    cmd.words |= GCodeCommand::HasI;
+                    break;
+                case 'J': cmd.j = value;
+                    cmd.words |= GCodeCommand::HasJ;
+                    break;
+                case 'R': cmd.r = value;
+                    cmd.words |= GCodeCommand::HasR;
+                    break;
+                default: break;
+                }
+            }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/// One decoded G-code line.
+/// `comment` points into the scanned buffer, so a command is only valid
+/// while that buffer is alive. Decoding never allocates.
+struct GCodeCommand
+{
+    enum Word : uint16_t
+    {
+        HasX = 1 << 0,
+        HasY = 1 << 1,
+        HasZ = 1 << 2,
+        HasE = 1 << 3,
+        HasF = 1 << 4,
+        HasS = 1 << 5,
+        HasP = 1 << 6,
+        HasT = 1 << 7,
+        HasI = 1 << 8,
+        HasJ = 1 << 9,
+        HasR = 1 << 10
+    };
+
+    char letter = 0;            // 'G', 'M', 'T', ... or 0 if the line has no command word
+    int number = -1;            // numeric part of the command word (1 for "G1")
+    uint16_t words = 0;         // bitmask of Word flags present on the line
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+    float e = 0.0f;
+    float f = 0.0f;
+    float s = 0.0f;             // parameters of M204 ("M204 S3000"), G4 ("G4 P500") and the like
+    float p = 0.0f;
+    float t = 0.0f;
+    float i = 0.0f;             // arc centre relative to the start (G2/G3 I, J), or its radius (R)
+    float j = 0.0f;
+    float r = 0.0f;
+    std::string_view comment;   // text after the first ';', without the ';'
+
+    bool Has(Word w) const { return (words & w) != 0; }
+    /// G0 to G3: straight moves and arcs.
+    bool IsMove() const { return letter == 'G' && number >= 0 && number <= 3; }
+    bool IsSetPosition() const { return letter == 'G' && number == 92; }
+};
+
+/// Splits a character range into lines without copying.
+/// Trailing '\r' is stripped so CRLF files decode like LF files.
+class GCodeLineScanner
+{
+public:
+    GCodeLineScanner(const char *begin, const char *end) : cur_(begin), end_(end) {}
+
+    bool Next(std::string_view &line);
+
+    const char *Position() const { return cur_; }
+
+private:
+    const char *cur_;
+    const char *end_;
+};
+
+namespace GCodeTokenizer
+{
+    /// Decode one line (without its newline) into `cmd`.
+    void Decode(std::string_view line, GCodeCommand &cmd);
+
+    /// std::from_chars wrapper that also accepts a leading '+'.
+    bool ParseFloat(std::string_view text, float &value);
+
+    /// Case-insensitive search; `upperNeedle` must already be upper case.
+    size_t FindNoCase(std::string_view haystack, std::string_view upperNeedle);
+}
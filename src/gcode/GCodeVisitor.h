@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "GCodeParser.h"
+#include "GCodeTokenizer.h"
+
+/// One straight move as the parser executes it. Arcs arrive as their chords.
+struct GCodeMoveEvent
+{
+    size_t line = 0;            // 0-based line of the command in the buffer
+    glm::vec3 from{0.0f};
+    glm::vec3 to{0.0f};
+    float filament = 0.0f;      // mm of E; negative for a retraction
+    float speed = 0.0f;         // commanded feedrate, mm/s
+    GCodeFeature feature = GCodeFeature::Other;    // Travel or Retract unless it extrudes
+};
+
+/// Receives what GCodeParser::Visit reads, in file order, so several analyses
+/// share one read and one tokenizer pass over a file. Every callback does
+/// nothing by default; a visitor overrides those it needs.
+///
+/// The events come from the parser's own state, so relative modes, arcs and
+/// the flavor's commands are already resolved: a statistics pass sees the
+/// same moves the toolpath is drawn from.
+class IGCodeVisitor
+{
+public:
+    virtual ~IGCodeVisitor() = default;
+
+    /// Every line with a command word, as decoded.
+    virtual void OnCommand(const GCodeCommand &, size_t /*line*/) {}
+
+    /// A layer starts at `line`, the marker or the move to its Z. Its Z is
+    /// that of OnLayerDone: a Cura layer gets its own only from the first Z
+    /// word after the marker. The moves before the first layer belong to it.
+    virtual void OnLayer(size_t /*layer*/, size_t /*line*/) {}
+
+    /// A ";TYPE:" comment changed the feature extrusions are drawn as.
+    virtual void OnFeature(GCodeFeature) {}
+
+    virtual void OnMove(const GCodeMoveEvent &) {}
+
+    /// A T<n>, M104/M109 S or M106/M107 command, with the setting in force after it.
+    virtual void OnTool(int) {}
+    virtual void OnTemperature(float /*celsius*/) {}
+    virtual void OnFan(float /*speed*/) {}     // 0..255 as in M106 S
+
+    /// The toolpath of a finished layer, as ParseBuffer returns it. Return
+    /// false to stop the parse.
+    virtual bool OnLayerDone(float /*z*/, const std::vector<GCodePathVertex> &, const GCodeEstimate &)
+    {
+        return true;
+    }
+};
+
+/// The geometry ParseBuffer returns, collected by a visitor, for parses that
+/// want the toolpath alongside other analyses.
+class GCodeLayerCollector : public IGCodeVisitor
+{
+public:
+    std::vector<std::vector<GCodePathVertex> > layers;
+    std::vector<float> layerZs;
+    std::vector<GCodeEstimate> estimates;
+
+    bool OnLayerDone(float z, const std::vector<GCodePathVertex> &path, const GCodeEstimate &estimate) override
+    {
+        layers.push_back(path);
+        layerZs.push_back(z);
+        estimates.push_back(estimate);
+        return true;
+    }
+};
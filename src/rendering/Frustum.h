@@ -0,0 +1,35 @@
+#pragma once
+#include <glm/glm.hpp>
+
+/// The six clip planes of a view frustum, for culling axis-aligned boxes.
+/// Planes are taken from a clip matrix (projection * view * model), so boxes
+/// are tested in that model's space.
+class Frustum {
+public:
+    Frustum() = default;
+    explicit Frustum(const glm::mat4 &clip) {
+        const glm::mat4 m = glm::transpose(clip);
+        planes_[0] = m[3] + m[0];   // left
+        planes_[1] = m[3] - m[0];   // right
+        planes_[2] = m[3] + m[1];   // bottom
+        planes_[3] = m[3] - m[1];   // top
+        planes_[4] = m[3] + m[2];   // near
+        planes_[5] = m[3] - m[2];   // far
+    }
+
+    /// False only if the box lies entirely outside one plane; boxes near a
+    /// frustum corner may pass, which is fine for culling.
+    bool Intersects(const glm::vec3 &mn, const glm::vec3 &mx) const {
+        for (const glm::vec4 &p : planes_) {
+            const glm::vec3 far(p.x >= 0.0f ? mx.x : mn.x,
+                                p.y >= 0.0f ? mx.y : mn.y,
+                                p.z >= 0.0f ? mx.z : mn.z);
+            if (glm::dot(glm::vec3(p), far) + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    glm::vec4 planes_[6]{};
+};
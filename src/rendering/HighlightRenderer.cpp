@@ -0,0 +1,59 @@
+#include "HighlightRenderer.h"
+#include "Shader.h"
+
+HighlightRenderer::~HighlightRenderer()
+{
+    if (vao_) glDeleteVertexArrays(1, &vao_);
+    if (vbo_) glDeleteBuffers(1, &vbo_);
+}
+
+void HighlightRenderer::Init()
+{
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &vbo_);
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, kVertices * 6 * sizeof(GLfloat), nullptr, GL_DYNAMIC_DRAW);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,6*sizeof(GLfloat),(void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,6*sizeof(GLfloat),(void*)(3*sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    shader_ = std::make_unique<Shader>("../../resources/shaders/simple_colored_line.vert",
+                                       "../../resources/shaders/simple_colored_line.frag");
+}
+
+void HighlightRenderer::Render(const glm::mat4 &view, const glm::mat4 &proj, const glm::mat4 &model,
+                               const glm::vec3 &from, const glm::vec3 &to)
+{
+    if (!shader_ || vao_ == 0) return;
+    const float cross = 1.0f;   // mm each way
+    const glm::vec3 segmentColor(1.0f, 0.2f, 0.9f);
+    const glm::vec3 crossColor(1.0f, 1.0f, 1.0f);
+    const glm::vec3 points[kVertices][2] = {
+        {from, segmentColor}, {to, segmentColor},
+        {to - glm::vec3(cross, 0.f, 0.f), crossColor}, {to + glm::vec3(cross, 0.f, 0.f), crossColor},
+        {to - glm::vec3(0.f, cross, 0.f), crossColor}, {to + glm::vec3(0.f, cross, 0.f), crossColor},
+        {to - glm::vec3(0.f, 0.f, cross), crossColor}, {to + glm::vec3(0.f, 0.f, cross), crossColor}
+    };
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(points), points);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Drawn over everything, so it shows through the layers above.
+    GLboolean depthTestEnabled;
+    GLboolean depthWriteMask;
+    glGetBooleanv(GL_DEPTH_TEST, &depthTestEnabled);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWriteMask);
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    shader_->use();
+    shader_->setMat4("model", model);
+    shader_->setMat4("view", view);
+    shader_->setMat4("projection", proj);
+    glBindVertexArray(vao_);
+    glDrawArrays(GL_LINES, 0, kVertices);
+    glBindVertexArray(0);
+    if (depthTestEnabled) glEnable(GL_DEPTH_TEST); else glDisable(GL_DEPTH_TEST);
+    glDepthMask(depthWriteMask);
+}
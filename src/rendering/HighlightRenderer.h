@@ -0,0 +1,22 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <memory>
+class Shader;
+
+// Marks one toolpath segment on top of the scene: the segment itself and a
+// small cross at its end, e.g. the move of the G-code line under the cursor.
+class HighlightRenderer {
+public:
+    HighlightRenderer() = default;
+    ~HighlightRenderer();
+
+    void Init();
+    void Render(const glm::mat4 &view, const glm::mat4 &proj, const glm::mat4 &model, const glm::vec3 &from,
+                const glm::vec3 &to);
+
+private:
+    static constexpr int kVertices = 8;     // segment, then the cross's three axes
+    GLuint vao_ = 0, vbo_ = 0;
+    std::unique_ptr<Shader> shader_;
+};
@@ -47,12 +47,16 @@ SceneRenderer::SceneRenderer(const std::string &printerDefJsonPath)
     InitializeGrid();
     InitializeVolumeBox();
     InitializeAxes();
+    highlightRenderer_.Init();
     try {
         gcodeShader_ = std::make_unique<Shader>("../../resources/shaders/gcode_shader.vert",
                                                "../../resources/shaders/gcode_shader.frag");
+        gcodeRibbonShader_ = std::make_unique<Shader>("../../resources/shaders/gcode_ribbon.vert",
+                                                     "../../resources/shaders/gcode_ribbon.frag");
     } catch (const std::exception &e) {
         std::cerr << "CRITICAL Error loading shaders in SceneRenderer: " << e.what() << std::endl;
         gcodeShader_.reset();
+        gcodeRibbonShader_.reset();
     }
     SetViewportSize(viewportWidth_, viewportHeight_);
 }
@@ -148,34 +152,77 @@ void SceneRenderer::RenderAxes()
                                    platformOffset_.y));
 }
 
+// G-code coordinates to world space: bed origin at the corner of the bed.
+glm::mat4 SceneRenderer::GCodeModelMatrix() const
+{
+    return glm::translate(glm::mat4(1.0f),
+                          glm::vec3(platformOffset_.x - volumeHalfX_,
+                                    platformOffset_.z - volumeHalfY_,
+                                    platformOffset_.y) +
+                              gcodeOffset_);
+}
+
+// Bind the shader for the model's draw style and set the per-frame uniforms.
+// Ribbons face the camera; its position in G-code space is found here once
+// rather than per segment on the GPU. `view` receives the camera in G-code
+// space, for tile culling and level of detail.
+Shader *SceneRenderer::BeginGCodeDraw(GCodeModel::View &view)
+{
+    if (!gcodeModel_) return nullptr;
+    Shader *shader = gcodeModel_->GetDrawStyle() == GCodeModel::DrawStyle::Ribbons
+                         ? gcodeRibbonShader_.get()
+                         : gcodeShader_.get();
+    if (!shader) return nullptr;
+    shader->use();
+    const glm::mat4 modelMat = GCodeModelMatrix();
+    shader->setMat4("model", modelMat);
+    shader->setMat4("view", viewMatrix_);
+    shader->setMat4("projection", projectionMatrix_);
+    view.eye = glm::vec3(glm::inverse(viewMatrix_ * modelMat)[3]);
+    view.frustum = Frustum(projectionMatrix_ * viewMatrix_ * modelMat);
+    view.pixelScale = 0.5f * static_cast<float>(viewportHeight_) * projectionMatrix_[1][1];
+    shader->setVec3("cameraPos", view.eye);
+    return shader;
+}
+
 void SceneRenderer::RenderGCodeLayer(int layerIndex)
 {
-    if (!gcodeModel_ || !gcodeShader_) return;
-    gcodeShader_->use();
-    glm::mat4 modelMat(1.0f);
-    modelMat = glm::translate(modelMat,
-                              glm::vec3(platformOffset_.x - volumeHalfX_,
-                                        platformOffset_.z - volumeHalfY_,
-                                        platformOffset_.y) +
-                                  gcodeOffset_);
-    gcodeShader_->setMat4("model", modelMat);
-    gcodeShader_->setMat4("view", viewMatrix_);
-    gcodeShader_->setMat4("projection", projectionMatrix_);
-    gcodeModel_->DrawLayer(layerIndex, *gcodeShader_);
+    GCodeModel::View view;
+    if (Shader *shader = BeginGCodeDraw(view))
+        gcodeModel_->DrawLayer(layerIndex, *shader, &view);
 }
 
 void SceneRenderer::RenderGCodeUpToLayer(int maxLayerIndex)
 {
-    if (!gcodeModel_ || !gcodeShader_) return;
-    gcodeShader_->use();
-    glm::mat4 modelMat(1.0f);
-    modelMat = glm::translate(modelMat,
-                              glm::vec3(platformOffset_.x - volumeHalfX_,
-                                        platformOffset_.z - volumeHalfY_,
-                                        platformOffset_.y) +
-                                  gcodeOffset_);
-    gcodeShader_->setMat4("model", modelMat);
-    gcodeShader_->setMat4("view", viewMatrix_);
-    gcodeShader_->setMat4("projection", projectionMatrix_);
-    gcodeModel_->DrawUpToLayer(maxLayerIndex, *gcodeShader_);
+    GCodeModel::View view;
+    if (Shader *shader = BeginGCodeDraw(view))
+        gcodeModel_->DrawUpToLayer(maxLayerIndex, *shader, &view);
+}
+
+void SceneRenderer::RenderGCodeUpToMove(const GCodeModel::PlaybackPosition &position)
+{
+    GCodeModel::View view;
+    if (Shader *shader = BeginGCodeDraw(view))
+        gcodeModel_->DrawUpToMove(position, *shader, &view);
+}
+
+// `from` and `to` are in G-code coordinates, like the toolpaths.
+void SceneRenderer::RenderGCodeHighlight(const glm::vec3 &from, const glm::vec3 &to)
+{
+    highlightRenderer_.Render(viewMatrix_, projectionMatrix_, GCodeModelMatrix(), from, to);
+}
+
+// The G-code segment under a point of the viewport given in normalized device
+// coordinates; see GCodeModel::Pick.
+bool SceneRenderer::PickGCode(const glm::vec2 &ndc, float pixels, const GCodeModel::PlaybackPosition &upTo,
+                              GCodeModel::PickResult &out) const
+{
+    if (!gcodeModel_) return false;
+    const glm::mat4 toGCode = glm::inverse(projectionMatrix_ * viewMatrix_ * GCodeModelMatrix());
+    const glm::vec4 nearPoint = toGCode * glm::vec4(ndc, -1.0f, 1.0f);
+    const glm::vec4 farPoint = toGCode * glm::vec4(ndc, 1.0f, 1.0f);
+    GCodeModel::View view;
+    view.eye = glm::vec3(nearPoint) / nearPoint.w;
+    view.pixelScale = 0.5f * static_cast<float>(viewportHeight_) * projectionMatrix_[1][1];
+    return gcodeModel_->Pick(view, glm::vec3(farPoint) / farPoint.w - view.eye, pixels, upTo, out);
 }
@@ -7,6 +7,7 @@
 #include "GridRenderer.h"
 #include "VolumeBoxRenderer.h"
 #include "AxesRenderer.h"
+#include "HighlightRenderer.h"
 #include "FrameBuffer.h"
 using json = nlohmann::json;
 
@@ -24,6 +25,10 @@ public:
     void RenderModel(const Model &model, Shader &shader, const Transform &transform);
     void RenderGCodeLayer(int layerIndex);
     void RenderGCodeUpToLayer(int maxLayerIndex);
+    void RenderGCodeUpToMove(const GCodeModel::PlaybackPosition &position);
+    void RenderGCodeHighlight(const glm::vec3 &from, const glm::vec3 &to);
+    bool PickGCode(const glm::vec2 &ndc, float pixels, const GCodeModel::PlaybackPosition &upTo,
+                   GCodeModel::PickResult &out) const;
     void SetViewportSize(int width, int height);
 
     GLuint GetSceneTexture() const { return framebuffer_.GetColorTexture(); }
@@ -47,6 +52,8 @@ private:
     void InitializeAxes();
     void RenderGridAndVolume();
     void RenderAxes();
+    Shader *BeginGCodeDraw(GCodeModel::View &view);
+    glm::mat4 GCodeModelMatrix() const;
 
     FrameBuffer framebuffer_;
     GLuint     defaultWhiteTex_ = 0;
@@ -66,10 +73,12 @@ private:
 
     std::shared_ptr<GCodeModel> gcodeModel_;
     std::unique_ptr<Shader> gcodeShader_;
+    std::unique_ptr<Shader> gcodeRibbonShader_;
 
     glm::vec3 gcodeOffset_ = glm::vec3(0.0f);
 
     GridRenderer     gridRenderer_;
     VolumeBoxRenderer volumeBoxRenderer_;
     AxesRenderer     axesRenderer_;
+    HighlightRenderer highlightRenderer_;
 };
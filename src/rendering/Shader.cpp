@@ -109,6 +109,12 @@ void Shader::setVec3(const std::string &name, const glm::vec3 &value) const
     glUniform3fv(getUniformLocation(name), 1, glm::value_ptr(value));
 }
 
+void Shader::setVec3Array(const std::string &name, const glm::vec3 *values, int count) const
+{
+    if (!ID) return;
+    glUniform3fv(getUniformLocation(name), count, glm::value_ptr(values[0]));
+}
+
 void Shader::setVec4(const std::string &n, const glm::vec4 &v) const
 {
     if (!ID) return;
@@ -29,6 +29,7 @@ public:
     void setFloat(const std::string& name, float value) const;
     void setVec2(const std::string& name, const glm::vec2& value) const;
     void setVec3(const std::string& name, const glm::vec3& value) const;
+    void setVec3Array(const std::string& name, const glm::vec3* values, int count) const;
     void setVec4(const std::string& name, const glm::vec4& value) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
 
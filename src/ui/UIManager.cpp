@@ -37,7 +37,8 @@ using json = nlohmann::json;
 UIManager::UIManager(ModelManager& mm, SceneRenderer* renderer,
                      GizmoController& gizmo, CameraController& camera,
                      GLFWwindow* window)
-    : modelManager_(mm), renderer_(renderer), gizmo_(gizmo), camera_(camera), window_(window)
+    : modelManager_(mm), renderer_(renderer), gizmo_(gizmo), camera_(camera),
+      machineLimits_(GCodeMachineLimits::FromDefinition(A1MINI_PRINTER_SETTINGS_FILE)), window_(window)
 {
     loadModelSettings();
     if (renderer_)
@@ -54,6 +55,7 @@ void UIManager::Frame() {
 
     showMenuBar();
     openRenderScene();
+    showGCodeTextPanel();
     showGenerationModal();
     showSlicingModal();
     showErrorModal(errorModalMessage_);
@@ -63,11 +65,34 @@ void UIManager::Frame() {
     ImVec2 viewportSize = ImGui::GetContentRegionAvail();
     if (viewportSize.x < 1.0f) viewportSize.x = 1.0f;
     if (viewportSize.y < 1.0f) viewportSize.y = 1.0f;
+    if (gcodeModel_ && gcodePlaying_) {
+        gcodePlaybackTime_ += ImGui::GetIO().DeltaTime * gcodePlaybackSpeed_;
+        const GCodeModel::PlaybackPosition at = gcodeModel_->LocatePrintTime(gcodePlaybackTime_);
+        currentGCodeLayer_ = at.layer;
+        currentGCodeMove_ = static_cast<int>(at.moves);
+        gcodePlaying_ = gcodePlaybackTime_ < gcodeModel_->GetPrintEstimate().seconds;
+    }
+    if (gcodeModel_ && currentGCodeLayer_ >= 0) {
+        gcodeModel_->RequestLayers(currentGCodeLayer_, currentGCodeLayer_);
+    }
+    if (gcodeModel_ && gcodeModel_->PumpUploads(kGCodeUploadBudgetMs) && centerGCode_ && renderer_) {
+        centerGCodeOnBed();
+    }
     if (renderer_) {
         renderer_->SetViewportSize(static_cast<int>(viewportSize.x), static_cast<int>(viewportSize.y));
         renderer_->BeginScene(viewMat, camWorldPos);
         renderModels(viewMat);
-        renderer_->RenderGCodeUpToLayer(currentGCodeLayer_);
+        if (currentGCodeLayer_ >= 0 && currentGCodeMove_ >= 0) {
+            renderer_->RenderGCodeUpToMove({currentGCodeLayer_, static_cast<uint32_t>(currentGCodeMove_)});
+        } else {
+            renderer_->RenderGCodeUpToLayer(currentGCodeLayer_);
+        }
+        if (gcodeTextLocationValid_ && gcodeTextLocation_.moved) {
+            renderer_->RenderGCodeHighlight(gcodeTextLocation_.from, gcodeTextLocation_.to);
+        }
+        if (gcodePickValid_) {
+            renderer_->RenderGCodeHighlight(gcodePick_.from, gcodePick_.to);
+        }
         renderer_->EndScene();
         GLuint texID = renderer_->GetSceneTexture();
         ImGui::Image(texID, viewportSize, ImVec2(0, 1), ImVec2(1, 0));
@@ -75,6 +100,8 @@ void UIManager::Frame() {
     ImVec2 actualViewportTopLeft = ImGui::GetItemRectMin();
     if (ImGui::IsWindowHovered()) {
         handleViewportInput(viewMat, actualViewportTopLeft, viewportSize);
+    } else {
+        gcodePickValid_ = false;
     }
     ImGuizmo::SetOrthographic(false);
     ImGuizmo::SetDrawlist();
@@ -104,16 +131,18 @@ void UIManager::showMenuBar() {
             if (ImGui::MenuItem("Open G-code")) {
                 openFileDialog([this](std::string& selected){
                     try {
-                        gcodeModel_ = std::make_shared<GCodeModel>(selected);
+                        gcodeModel_ = std::make_shared<GCodeModel>(selected, GCodeModel::LoadMode::Progressive,
+                                                                   machineLimits_);
+                        gcodeModel_->SetVramBudget(static_cast<size_t>(gcodeVramBudgetMB_) << 20);
+                        openGCodeText(selected, *gcodeModel_);
+                        centerGCode_ = true;
                         if (renderer_) {
-                            glm::vec3 c = gcodeModel_->GetCenter();
-                            glm::vec3 offset(renderer_->GetBedHalfWidth() + renderer_->GetPlatformOffset().x - c.x,
-                                             renderer_->GetBedHalfDepth() + renderer_->GetPlatformOffset().z - c.y,
-                                             0.f);
-                            renderer_->SetGCodeOffset(offset);
+                            centerGCodeOnBed();
                             renderer_->SetGCodeModel(gcodeModel_);
                         }
                         currentGCodeLayer_ = -1;
+                        currentGCodeMove_ = -1;
+                        gcodePlaying_ = false;
                     } catch (const std::exception& e) {
                         std::cerr << "Failed to load G-code: " << e.what() << std::endl;
                     }
@@ -1,7 +1,9 @@
 #pragma once
 #include <memory>
 #include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <filesystem>
 #include <vector>
@@ -17,6 +19,10 @@
 #include "GizmoController.h"
 #include "CameraController.h"
 #include "GCodeModel.h"
+#include "GCodeText.h"
+#include "GCodePostProcessor.h"
+#include "GCodeBinary.h"
+#include "GCodeShifter.h"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -56,6 +62,18 @@ private:
 
     void finalizeSlicing();
 
+    std::optional<glm::dvec2> slicePosition();
+
+    uint64_t sliceSignature();
+
+    void completeSlicing(bool sliced, std::string message, const std::optional<GCodeBinaryWriter> &binaryWriter);
+
+    void centerGCodeOnBed();
+
+    void openGCodeText(const std::string &path, const GCodeModel &model);
+
+    void showGCodeTextPanel();
+
     void showGenerationModal();
 
     void showSlicingModal();
@@ -73,13 +91,52 @@ private:
         const ImVec2 &viewportSize
     );
 
+    void pickGCode(const ImVec2 &viewportPos, const ImVec2 &viewportSize);
+
     ModelManager &modelManager_;
     SceneRenderer *renderer_;
     GizmoController &gizmo_;
     CameraController &camera_;
 
     std::shared_ptr<GCodeModel> gcodeModel_;
+    GCodeMachineLimits machineLimits_;      // print time estimates are for this printer
     int currentGCodeLayer_ = -1;
+    int currentGCodeMove_ = -1;             // moves of currentGCodeLayer_ shown; -1 for all
+    bool gcodePlaying_ = false;
+    double gcodePlaybackTime_ = 0.0;        // seconds into the print while playing
+    float gcodePlaybackSpeed_ = 60.0f;      // print seconds per second
+    bool centerGCode_ = false;
+    // GPU memory for G-code toolpaths; layers beyond it wait compressed in RAM
+    int gcodeVramBudgetMB_ = 1024;
+    // Arc fitting and trimming run on each sliced file before it is loaded
+    bool gcodePostProcess_ = true;
+    GCodePostOptions gcodePostOptions_;
+    // A binary copy (.bgcode) is written beside each sliced file for sending to the printer
+    bool gcodeExportBinary_ = false;
+    GCodeBinaryOptions gcodeBinaryOptions_;
+
+    // G-code text panel. It scrolls over a window of kGCodeTextWindowLines lines
+    // starting at gcodeTextBase_, as ImGui's float scrolling is not exact tens of
+    // millions of rows down.
+    static constexpr size_t kNoLine = static_cast<size_t>(-1);
+    static constexpr size_t kGCodeTextWindowLines = size_t(1) << 16;
+    std::unique_ptr<GCodeText> gcodeText_;
+    size_t gcodeTextBase_ = 0;
+    size_t gcodeTextTop_ = 0;               // first line in view
+    size_t gcodeTextScrollTo_ = kNoLine;    // bring this line to the top next frame,
+    float gcodeTextScrollRest_ = 0.0f;      // scrolled this many pixels further
+    size_t gcodeTextSelected_ = kNoLine;
+    int gcodeTextLayer_ = -1;               // layer the panel last followed
+    size_t gcodeTextLocated_ = kNoLine;     // line gcodeTextLocation_ is for; it is highlighted
+    GCodeText::Location gcodeTextLocation_;
+    bool gcodeTextLocationValid_ = false;
+    // Toolpath segment under the mouse, picked every frame it is over the viewport.
+    static constexpr float kGCodePickPixels = 6.0f;
+    GCodeModel::PickResult gcodePick_;
+    bool gcodePickValid_ = false;
+    size_t gcodePickLine_ = kNoLine;        // source line of gcodePick_, once known
+    // Per-frame time spent uploading progressively loaded G-code layers
+    static constexpr double kGCodeUploadBudgetMs = 4.0;
 
     std::atomic<bool> generating_{false};
     std::atomic<bool> generationDone_{false};
@@ -108,6 +165,18 @@ private:
     std::string pendingStlPath_;
     int slicingModelIndex_ = -1;
     std::atomic<bool> loadGcodePending_{false};
+    // What the G-code at a path was sliced from. A model sliced again with
+    // the same signature (mesh, rotation, scale, height, settings) only moved
+    // in X and Y, and gets that G-code shifted by the change in placement.
+    struct SliceRecord
+    {
+        std::string gcodePath;
+        uint64_t signature = 0;
+        glm::dvec2 placement{0.0};          // where the slice put the mesh, in bed mm
+        uintmax_t gcodeSize = 0;            // of the file as loaded, to notice it being replaced
+    };
+    std::optional<SliceRecord> lastSlice_;
+    SliceRecord pendingSlice_;
 
     json modelSettings_;
     bool modelSettingsLoaded_ = false;
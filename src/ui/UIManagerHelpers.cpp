@@ -15,10 +15,12 @@
 #include "MeshRepairer.h"
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
 #include <filesystem>
 #include <iostream>
 #include <functional>
+#include <optional>
 #include <limits>
 #include <thread>
 #include <regex>
@@ -29,6 +31,8 @@
 #include <nlohmann/json.hpp>
 
 #include "glm/gtx/intersect.hpp"
+#include "GCodeHash.h"
+#include "MappedFile.h"
 #include "Pipe.h"
 
 using json = nlohmann::json;
@@ -47,6 +51,29 @@ namespace
         return glm::intersectRaySphere(origin, glm::normalize(dir),
                                        center, radius * radius, t);
     }
+
+    // "1 h 05 min", "4 min 12 s" or "9.3 s".
+    std::string FormatDuration(double seconds)
+    {
+        char text[32];
+        const long total = std::lround(seconds);
+        if (total >= 3600)
+            std::snprintf(text, sizeof(text), "%ld h %02ld min", total / 3600, (total / 60) % 60);
+        else if (total >= 60)
+            std::snprintf(text, sizeof(text), "%ld min %02ld s", total / 60, total % 60);
+        else
+            std::snprintf(text, sizeof(text), "%.1f s", seconds);
+        return text;
+    }
+
+    // Indexed by GCodeModel::ColorMode, with the unit of the ramp's range.
+    const char *const kColorModeNames[] = {"Feature", "Speed", "Volumetric flow", "Fan", "Temperature", "Tool",
+                                           "Layer time"};
+    const char *const kColorModeUnits[] = {"", "mm/s", "mm3/s", "%", "C", "", "s"};
+    static_assert(std::size(kColorModeNames) == static_cast<size_t>(GCodeModel::ColorMode::Count));
+
+    // Indexed by GCodeBinary::Compression.
+    const char *const kCompressionNames[] = {"None", "Deflate", "Heatshrink 11", "Heatshrink 12"};
 }
 
 void UIManager::openFileDialog(const std::function<void(std::string &)> &onFileSelected)
@@ -263,6 +290,10 @@ void UIManager::sliceActiveModel()
     std::string name = base.stem().string();
     pendingResizedPath_ = (std::filesystem::path(GCODE_OUTPUT_DIR) / (name + "_resized.stl")).string();
     pendingGcodePath_ = (std::filesystem::path(GCODE_OUTPUT_DIR) / (name + ".gcode")).string();
+    // The slicer may overwrite the file the text panel has mapped.
+    gcodeText_.reset();
+    gcodeTextLocationValid_ = false;
+    gcodePickLine_ = kNoLine;
 
     slicing_.store(true);
     slicingDone_.store(false);
@@ -271,8 +302,59 @@ void UIManager::sliceActiveModel()
     // Ensure any pending changes in the UI are written to disk
     saveModelSettings();
 
-    std::thread([this]()
+    // A model that only moved in X and Y since it was last sliced gets that G-code shifted.
+    const std::optional<glm::dvec2> position = slicePosition();
+    Transform *tf = modelManager_.GetTransform(slicingModelIndex_);
+    std::optional<GCodeShifter> shifter;
+    std::optional<SliceRecord> previous = std::move(lastSlice_);
+    lastSlice_.reset();
+    pendingSlice_ = SliceRecord();
+    if (position && tf)
+        {
+        pendingSlice_.gcodePath = pendingGcodePath_;
+        pendingSlice_.signature = sliceSignature();
+        pendingSlice_.placement = *position + glm::dvec2(tf->translation.x, tf->translation.y);
+        std::error_code ec;
+        if (renderer_ && previous && pendingSlice_.signature != 0 && previous->gcodePath == pendingSlice_.gcodePath &&
+            previous->signature == pendingSlice_.signature &&
+            std::filesystem::file_size(pendingGcodePath_, ec) == previous->gcodeSize && !ec)
+            {
+            const glm::dvec2 bed(2.0 * renderer_->GetBedHalfWidth(), 2.0 * renderer_->GetBedHalfDepth());
+            shifter.emplace(pendingSlice_.placement - previous->placement, glm::dvec2(0.0), bed);
+            }
+        }
+
+    // The thread gets its own copy; the panel may change the options meanwhile.
+    std::optional<GCodePostProcessor> postProcessor;
+    if (gcodePostProcess_)
+        postProcessor.emplace(gcodePostOptions_);
+    std::optional<GCodeBinaryWriter> binaryWriter;
+    if (gcodeExportBinary_)
+        binaryWriter.emplace(gcodeBinaryOptions_);
+
+    std::thread([this, position, shifter, postProcessor, binaryWriter]()
         {
+        if (shifter)
+            {
+            {
+                std::lock_guard lk(slicingMessageMutex_);
+                slicingMessage_ = "Moving the sliced G-code...";
+            }
+            try
+                {
+                GCodeShiftStats stats = shifter->ShiftFile(pendingGcodePath_, pendingGcodePath_);
+                char summary[96];
+                std::snprintf(summary, sizeof(summary), "Moved the last slice instead of slicing (%zu moves, %.2f s)",
+                              stats.moves, stats.seconds);
+                completeSlicing(true, summary, binaryWriter);
+                return;
+                }
+            catch (const std::exception &e)
+                {
+                // The file is as it was; CuraEngine replaces it.
+                std::cerr << "Cannot move the last slice, slicing again: " << e.what() << std::endl;
+                }
+            }
         if (!std::filesystem::exists(MODEL_SETTINGS_FILE))
             {
             std::lock_guard lk(slicingMessageMutex_);
@@ -293,17 +375,10 @@ void UIManager::sliceActiveModel()
 
             if (modelSettingsLoaded_)
                 {
-                Model *mdl = modelManager_.GetModel(slicingModelIndex_);
-                Transform *tf = modelManager_.GetTransform(slicingModelIndex_);
-                if (mdl && tf)
+                if (position)
                     {
-                    glm::vec3 localCenter = mdl->center;
-                    glm::vec3 worldCenter = glm::vec3(tf->getMatrix() * glm::vec4(localCenter, 1.0f));
-                    worldCenter.x = glm::clamp(worldCenter.x, -offX, +offX);
-                    worldCenter.y = glm::clamp(worldCenter.y, -offY, +offY);
-                    std::cout << "World center: " << worldCenter.x << ", " << worldCenter.y << std::endl;
-                    double posX = offX + worldCenter.x;
-                    double posY = offY + worldCenter.y;
+                    double posX = position->x;
+                    double posY = position->y;
                     modelSettings_["overrides"]["mesh_position_x"]["value"] = posX;
                     modelSettings_["overrides"]["mesh_position_x"]["default_value"] = posX;
                     modelSettings_["overrides"]["mesh_position_y"]["value"] = posY;
@@ -360,17 +435,122 @@ void UIManager::sliceActiveModel()
                     }
                 }
             }
-        int ret = pipe.close(); {
+        int ret = pipe.close();
+        std::string message = (ret == 0) ? "Slicing complete!" : ("Slicing failed (code " + std::to_string(ret) + ")");
+        if (ret == 0 && postProcessor)
+            {
+            {
+                std::lock_guard lk(slicingMessageMutex_);
+                slicingMessage_ = "Post-processing G-code...";
+            }
+            try
+                {
+                GCodePostStats stats = postProcessor->ProcessFile(pendingGcodePath_, pendingGcodePath_);
+                char summary[160];
+                std::snprintf(summary, sizeof(summary), " %.1f -> %.1f MB (-%.0f%%), %zu -> %zu commands, %zu arcs",
+                              stats.bytesIn / 1048576.0, stats.bytesOut / 1048576.0, 100.0 * stats.SizeReduction(),
+                              stats.commandsIn, stats.commandsOut, stats.arcs);
+                message += summary;
+                }
+            catch (const std::exception &e)
+                {
+                // The slicer's own output is still there and loads as it is.
+                std::cerr << "G-code post-processing failed: " << e.what() << std::endl;
+                message += std::string(" (post-processing failed: ") + e.what() + ")";
+                }
+            }
+        completeSlicing(ret == 0, message, binaryWriter);
+        }).detach();
+}
+
+// Worker side of the end of a slice: the binary copy, the message, and the
+// file handed to finalizeSlicing on the UI thread.
+void UIManager::completeSlicing(bool sliced, std::string message, const std::optional<GCodeBinaryWriter> &binaryWriter)
+{
+    if (sliced && binaryWriter)
+        {
+        {
             std::lock_guard lk(slicingMessageMutex_);
-            slicingMessage_ = (ret == 0) ? "Slicing complete!" : ("Slicing failed (code " + std::to_string(ret) + ")");
+            slicingMessage_ = "Writing binary G-code...";
         }
-        slicingProgress_.store(1.0f);
-        slicingDone_.store(true);
-        if (ret == 0)
+        std::filesystem::path binaryPath(pendingGcodePath_);
+        binaryPath.replace_extension(".bgcode");
+        try
             {
-            loadGcodePending_.store(true);
+            GCodeBinaryStats stats = binaryWriter->WriteFile(pendingGcodePath_, binaryPath.string());
+            char summary[96];
+            std::snprintf(summary, sizeof(summary), " | binary %.1f MB (-%.0f%%)", stats.bytesOut / 1048576.0,
+                          100.0 * stats.SizeReduction());
+            message += summary;
             }
-        }).detach();
+        catch (const std::exception &e)
+            {
+            std::cerr << "Binary G-code export failed: " << e.what() << std::endl;
+            message += std::string(" (binary export failed: ") + e.what() + ")";
+            }
+        }
+    {
+        std::lock_guard lk(slicingMessageMutex_);
+        slicingMessage_ = message;
+    }
+    slicingProgress_.store(1.0f);
+    slicingDone_.store(true);
+    if (sliced)
+        {
+        loadGcodePending_.store(true);
+        }
+}
+
+// Bed position, in mm from the bed's corner, the slice puts the model's centre
+// at (mesh_position_x/y); none without a model to slice.
+std::optional<glm::dvec2> UIManager::slicePosition()
+{
+    Model *mdl = modelManager_.GetModel(slicingModelIndex_);
+    Transform *tf = modelManager_.GetTransform(slicingModelIndex_);
+    if (!mdl || !tf)
+        return std::nullopt;
+    float offX = renderer_ ? renderer_->GetBedHalfWidth() + renderer_->GetPlatformOffset().x : 0.f;
+    float offY = renderer_ ? renderer_->GetBedHalfDepth() + renderer_->GetPlatformOffset().z : 0.f;
+    glm::vec3 localCenter = mdl->center;
+    glm::vec3 worldCenter = glm::vec3(tf->getMatrix() * glm::vec4(localCenter, 1.0f));
+    worldCenter.x = glm::clamp(worldCenter.x, -offX, +offX);
+    worldCenter.y = glm::clamp(worldCenter.y, -offY, +offY);
+    return glm::dvec2(offX + worldCenter.x, offY + worldCenter.y);
+}
+
+// Everything about a slice of the active model but where it sits in X and Y;
+// 0 if the mesh file cannot be read, which matches nothing.
+uint64_t UIManager::sliceSignature()
+{
+    Transform *tf = modelManager_.GetTransform(slicingModelIndex_);
+    if (!tf)
+        return 0;
+    uint64_t h = 0;
+    try
+        {
+        const MappedFile mesh(pendingStlPath_);
+        h = GCodeHash::Bytes(mesh.data(), mesh.size());
+        }
+    catch (const std::exception &)
+        {
+        return 0;
+        }
+    // The thread sets the mesh position from the placement, and support and centring always the same way.
+    json settings = modelSettingsLoaded_ ? modelSettings_ : json();
+    if (settings.contains("overrides") && settings["overrides"].is_object())
+        for (const char *key: {"mesh_position_x", "mesh_position_y", "support_enable", "center_object"})
+            settings["overrides"].erase(key);
+    const std::string text = settings.dump();
+    h = GCodeHash::Combine(h, GCodeHash::Bytes(text.data(), text.size()));
+    const float shape[8] = {tf->rotationQuat.w, tf->rotationQuat.x, tf->rotationQuat.y, tf->rotationQuat.z,
+                            tf->scale.x, tf->scale.y, tf->scale.z, tf->translation.z};
+    h = GCodeHash::Combine(h, GCodeHash::Bytes(shape, sizeof(shape)));
+    // The file is post-processed in place; a shift keeps what that did.
+    const float post[5] = {gcodePostProcess_ ? 1.0f : 0.0f, gcodePostOptions_.arcTolerance,
+                           static_cast<float>(gcodePostOptions_.xyzDecimals),
+                           static_cast<float>(gcodePostOptions_.eDecimals),
+                           gcodePostOptions_.dropRedundant ? 1.0f : 0.0f};
+    return GCodeHash::Combine(h, GCodeHash::Bytes(post, sizeof(post))) | 1;
 }
 
 void UIManager::loadModel(std::string &modelPath)
@@ -665,6 +845,31 @@ void UIManager::openModelPropertiesDialog()
             if (msChanged)
                 saveModelSettings();
             }
+
+        ImGui::Checkbox("Post-process G-code", &gcodePostProcess_);
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Fit arcs, drop repeated words and trim coordinates after slicing");
+        if (gcodePostProcess_)
+            {
+            ImGui::SliderFloat("Arc tolerance", &gcodePostOptions_.arcTolerance, 0.0f, 0.1f,
+                               gcodePostOptions_.arcTolerance > 0.0f ? "%.3f mm" : "No arcs");
+            ImGui::SliderInt("XYZ decimals", &gcodePostOptions_.xyzDecimals, 2, 4);
+            ImGui::Checkbox("Drop redundant words", &gcodePostOptions_.dropRedundant);
+            }
+        ImGui::Checkbox("Export binary G-code", &gcodeExportBinary_);
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("Also write a .bgcode file beside the sliced G-code");
+        if (gcodeExportBinary_)
+            {
+            int compression = static_cast<int>(gcodeBinaryOptions_.compression);
+            if (ImGui::Combo("Compression", &compression, kCompressionNames,
+                             static_cast<int>(std::size(kCompressionNames))))
+                gcodeBinaryOptions_.compression = static_cast<GCodeBinary::Compression>(compression);
+            bool meatPack = gcodeBinaryOptions_.encoding != GCodeBinary::Encoding::None;
+            if (ImGui::Checkbox("MeatPack", &meatPack))
+                gcodeBinaryOptions_.encoding =
+                    meatPack ? GCodeBinary::Encoding::MeatPackComments : GCodeBinary::Encoding::None;
+            }
         }
     if (gcodeModel_)
         {
@@ -682,12 +887,98 @@ void UIManager::openModelPropertiesDialog()
             {
             ImGui::Text("Z = %.2f mm (layer %d of %d)", layerHeights[(currentGCodeLayer_ < 0 ? 0 : currentGCodeLayer_)],
                         (currentGCodeLayer_ < 0 ? 0 : currentGCodeLayer_), layerCount - 1);
-            ImGui::SliderInt("Layer", &currentGCodeLayer_, -1, layerCount - 1, currentGCodeLayer_ < 0 ? "All" : "%d");
+            if (ImGui::SliderInt("Layer", &currentGCodeLayer_, -1, layerCount - 1, currentGCodeLayer_ < 0 ? "All" : "%d"))
+                {
+                currentGCodeMove_ = -1;
+                gcodePlaying_ = false;
+                }
+            const GCodeEstimate &total = gcodeModel_->GetPrintEstimate();
+            ImGui::Text("Print time %s, filament %.2f m (%.1f g)", FormatDuration(total.seconds).c_str(),
+                        total.filament / 1000.0, total.grams);
+            if (gcodeModel_->GetReportedPrintTime() > 0.0)
+                ImGui::Text("Slicer estimate %s", FormatDuration(gcodeModel_->GetReportedPrintTime()).c_str());
+            if (currentGCodeLayer_ >= 0)
+                {
+                const GCodeEstimate &layer = gcodeModel_->GetLayerEstimates()[currentGCodeLayer_];
+                ImGui::Text("Layer time %s, filament %.0f mm", FormatDuration(layer.seconds).c_str(), layer.filament);
+                const int moveCount = static_cast<int>(gcodeModel_->GetLayerMoveCount(currentGCodeLayer_));
+                currentGCodeMove_ = std::min(currentGCodeMove_, moveCount);
+                if (ImGui::SliderInt("Move", &currentGCodeMove_, -1, moveCount, currentGCodeMove_ < 0 ? "All" : "%d"))
+                    gcodePlaying_ = false;
+                }
+
+            // Playback: show the print as it stands some time in.
+            const bool partial = currentGCodeLayer_ >= 0;
+            const GCodeModel::PlaybackPosition shown{
+                partial ? currentGCodeLayer_ : layerCount - 1,
+                partial && currentGCodeMove_ >= 0 ? static_cast<uint32_t>(currentGCodeMove_)
+                                                  : gcodeModel_->GetLayerMoveCount(partial ? currentGCodeLayer_ : layerCount - 1)};
+            float seconds = static_cast<float>(gcodePlaying_ ? gcodePlaybackTime_ : gcodeModel_->GetPrintTimeAt(shown));
+            if (ImGui::SliderFloat("Time", &seconds, 0.0f, static_cast<float>(total.seconds), FormatDuration(seconds).c_str()))
+                {
+                const GCodeModel::PlaybackPosition at = gcodeModel_->LocatePrintTime(seconds);
+                currentGCodeLayer_ = at.layer;
+                currentGCodeMove_ = static_cast<int>(at.moves);
+                gcodePlaybackTime_ = seconds;
+                }
+            if (ImGui::Button(gcodePlaying_ ? "Pause" : "Play"))
+                {
+                gcodePlaying_ = !gcodePlaying_;
+                if (gcodePlaying_)
+                    {
+                    // From the shown position, or from the start once the end is reached.
+                    gcodePlaybackTime_ = seconds < static_cast<float>(total.seconds) ? seconds : 0.0;
+                    }
+                }
+            ImGui::SameLine();
+            ImGui::SliderFloat("Speed", &gcodePlaybackSpeed_, 1.0f, 1000.0f, "%.0fx", ImGuiSliderFlags_Logarithmic);
             }
         else
             {
             ImGui::Text("No layers found in G-code");
             }
+        bool asLines = gcodeModel_->GetDrawStyle() == GCodeModel::DrawStyle::Lines;
+        if (ImGui::Checkbox("Draw as lines", &asLines))
+            gcodeModel_->SetDrawStyle(asLines ? GCodeModel::DrawStyle::Lines : GCodeModel::DrawStyle::Ribbons);
+        bool lod = gcodeModel_->IsLodEnabled();
+        if (ImGui::Checkbox("Level of detail", &lod))
+            gcodeModel_->SetLodEnabled(lod);
+        if (ImGui::SliderInt("VRAM budget", &gcodeVramBudgetMB_, 64, 8192, "%d MB", ImGuiSliderFlags_Logarithmic))
+            gcodeModel_->SetVramBudget(static_cast<size_t>(gcodeVramBudgetMB_) << 20);
+        ImGui::Text("%.0f MB on the GPU, %.0f MB compressed in RAM", gcodeModel_->GetResidentBytes() / 1048576.0,
+                    gcodeModel_->GetCompressedBytes() / 1048576.0);
+        int colorMode = static_cast<int>(gcodeModel_->GetColorMode());
+        if (ImGui::Combo("Colour by", &colorMode, kColorModeNames, static_cast<int>(std::size(kColorModeNames))))
+            gcodeModel_->SetColorMode(static_cast<GCodeModel::ColorMode>(colorMode));
+        const GCodeModel::ColorMode mode = gcodeModel_->GetColorMode();
+        if (mode != GCodeModel::ColorMode::Feature && mode != GCodeModel::ColorMode::Tool)
+            {
+            // The ramp runs blue, cyan, green, yellow, red; see gcode_shader.vert.
+            const glm::vec2 range = gcodeModel_->GetColorRange(mode);
+            ImGui::TextColored(ImVec4(0.15f, 0.25f, 0.85f, 1.0f), "%.1f %s", range.x, kColorModeUnits[colorMode]);
+            ImGui::SameLine();
+            ImGui::TextUnformatted("to");
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(0.90f, 0.20f, 0.15f, 1.0f), "%.1f %s", range.y, kColorModeUnits[colorMode]);
+            }
+        if (ImGui::TreeNode("Features"))
+            {
+            // Visibility and colour are shader uniforms, so these apply instantly.
+            for (size_t i = 0; i < static_cast<size_t>(GCodeFeature::Count); ++i)
+                {
+                const auto feature = static_cast<GCodeFeature>(i);
+                ImGui::PushID(static_cast<int>(i));
+                bool visible = gcodeModel_->IsFeatureVisible(feature);
+                if (ImGui::Checkbox("##visible", &visible))
+                    gcodeModel_->SetFeatureVisible(feature, visible);
+                ImGui::SameLine();
+                glm::vec3 color = gcodeModel_->GetFeatureColor(feature);
+                if (ImGui::ColorEdit3(GCodeFeatureName(feature), &color.x, ImGuiColorEditFlags_NoInputs))
+                    gcodeModel_->SetFeatureColor(feature, color);
+                ImGui::PopID();
+                }
+            ImGui::TreePop();
+            }
         ImGui::EndGroup();
         }
     ImGui::End();
@@ -748,36 +1039,41 @@ void UIManager::finalizeSlicing()
 {
     try
         {
-        auto gm = std::make_shared<GCodeModel>(pendingGcodePath_);
-        glm::vec3 offset(0.f);
+        // Layers the re-slice left as they were are taken over from the current toolpaths.
+        auto gm = std::make_shared<GCodeModel>(pendingGcodePath_, GCodeModel::LoadMode::Progressive, machineLimits_,
+                                               gcodeModel_);
+        gm->SetVramBudget(static_cast<size_t>(gcodeVramBudgetMB_) << 20);
+        openGCodeText(pendingGcodePath_, *gm);
+        bool center = false;
         if (modelSettingsLoaded_)
             {
             try
                 {
                 auto &ov = modelSettings_["overrides"];
-                if (ov.contains("mesh_position_x") && ov.contains("mesh_position_y"))
-                    {
-                    double posX = ov["mesh_position_x"]["value"].get<double>();
-                    double posY = ov["mesh_position_y"]["value"].get<double>();
-                    glm::vec3 c = gm->GetCenter();
-                    offset = glm::vec3(
-                        static_cast<float>(renderer_->GetBedHalfWidth() + renderer_->GetPlatformOffset().x - c.x),
-                        static_cast<float>(renderer_->GetBedHalfDepth() + renderer_->GetPlatformOffset().z - c.y),
-                        0.f);
-                    }
+                center = ov.contains("mesh_position_x") && ov.contains("mesh_position_y");
                 }
             catch (const std::exception &e)
                 {
                 std::cerr << "Offset compute failed: " << e.what() << std::endl;
                 }
             }
+        gcodeModel_ = gm;
+        centerGCode_ = center;
         if (renderer_)
             {
-            renderer_->SetGCodeOffset(offset);
+            if (centerGCode_)
+                centerGCodeOnBed();
+            else
+                renderer_->SetGCodeOffset(glm::vec3(0.f));
             renderer_->SetGCodeModel(gm);
             }
-        gcodeModel_ = gm;
         currentGCodeLayer_ = -1;
+        currentGCodeMove_ = -1;
+        gcodePlaying_ = false;
+        std::error_code ec;
+        pendingSlice_.gcodeSize = std::filesystem::file_size(pendingGcodePath_, ec);
+        if (!ec && pendingSlice_.signature != 0)
+            lastSlice_ = pendingSlice_;
         UnloadModel(slicingModelIndex_);
         std::filesystem::remove(pendingResizedPath_);
         std::filesystem::remove(pendingStlPath_);
@@ -790,6 +1086,139 @@ void UIManager::finalizeSlicing()
         }
 }
 
+void UIManager::openGCodeText(const std::string &path, const GCodeModel &model)
+{
+    gcodeTextBase_ = 0;
+    gcodeTextTop_ = 0;
+    gcodeTextScrollTo_ = kNoLine;
+    gcodeTextSelected_ = kNoLine;
+    gcodeTextLayer_ = -1;
+    gcodeTextLocated_ = kNoLine;
+    gcodeTextLocationValid_ = false;
+    gcodePickLine_ = kNoLine;
+    try
+        {
+        gcodeText_ = std::make_unique<GCodeText>(path, model.GetSource());
+        }
+    catch (const std::exception &e)
+        {
+        gcodeText_.reset();
+        std::cerr << "Failed to open G-code text: " << e.what() << std::endl;
+        }
+}
+
+// The lines of the loaded G-code. Only the rows in view are drawn, so the
+// panel costs the same for any file size. It follows the layer slider, the line
+// under the mouse (or else the selected one) is highlighted in the viewport,
+// and clicking a line shows the print up to it.
+void UIManager::showGCodeTextPanel()
+{
+    ImGui::Begin("G-code Text");
+    if (!gcodeText_ || !gcodeText_->IsReady())
+        {
+        ImGui::TextUnformatted(gcodeText_ ? "Indexing lines..." : "No G-code loaded");
+        ImGui::End();
+        return;
+        }
+    const size_t lines = gcodeText_->LineCount();
+    if (currentGCodeLayer_ >= 0 && currentGCodeLayer_ != gcodeTextLayer_)
+        {
+        gcodeTextScrollTo_ = gcodeText_->LayerFirstLine(currentGCodeLayer_);
+        gcodeTextScrollRest_ = 0.0f;
+        }
+    gcodeTextLayer_ = currentGCodeLayer_;
+
+    ImU64 goTo = gcodeTextTop_ + 1;
+    ImGui::SetNextItemWidth(ImGui::GetFontSize() * 8.0f);
+    if (ImGui::InputScalar("##line", ImGuiDataType_U64, &goTo, nullptr, nullptr, nullptr,
+                           ImGuiInputTextFlags_EnterReturnsTrue))
+        {
+        gcodeTextScrollTo_ = static_cast<size_t>(std::clamp<ImU64>(goTo, 1, std::max<ImU64>(lines, 1)) - 1);
+        gcodeTextScrollRest_ = 0.0f;
+        }
+    ImGui::SameLine();
+    ImGui::Text("of %zu lines", lines);
+
+    // Move the scroll window to the line to show, with that line in its middle.
+    const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    if (gcodeTextScrollTo_ != kNoLine)
+        {
+        gcodeTextBase_ = gcodeTextScrollTo_ > kGCodeTextWindowLines / 2 ? gcodeTextScrollTo_ - kGCodeTextWindowLines / 2
+                                                                         : 0;
+        ImGui::SetNextWindowScroll(
+            ImVec2(-1.0f, static_cast<float>(gcodeTextScrollTo_ - gcodeTextBase_) * rowHeight + gcodeTextScrollRest_));
+        gcodeTextScrollTo_ = kNoLine;
+        }
+    const size_t window = std::min(kGCodeTextWindowLines, lines - std::min(gcodeTextBase_, lines));
+    size_t hovered = kNoLine;
+    ImGui::BeginChild("##lines", ImVec2(0.0f, 0.0f), 0, ImGuiWindowFlags_HorizontalScrollbar);
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(window), rowHeight);
+    while (clipper.Step())
+        {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+            {
+            const size_t line = gcodeTextBase_ + static_cast<size_t>(row);
+            const std::string_view text = gcodeText_->Line(line);
+            ImGui::PushID(row);
+            if (ImGui::Selectable("##row", line == gcodeTextSelected_))
+                {
+                gcodeTextSelected_ = line;
+                GCodeText::Location at;
+                if (gcodeText_->Locate(line, at))
+                    {
+                    currentGCodeLayer_ = gcodeTextLayer_ = at.layer;
+                    currentGCodeMove_ = static_cast<int>(at.moves);
+                    gcodePlaying_ = false;
+                    }
+                }
+            if (ImGui::IsItemHovered())
+                hovered = line;
+            ImGui::SameLine();
+            ImGui::TextDisabled("%8zu", line + 1);
+            ImGui::SameLine();
+            ImGui::TextUnformatted(text.data(), text.data() + text.size());
+            ImGui::PopID();
+            }
+        }
+
+    // Near either end of the window, move it so the lines in view are in its
+    // middle again; the view itself stays where it is.
+    const float scroll = ImGui::GetScrollY();
+    const size_t top = gcodeTextBase_ + static_cast<size_t>(scroll / rowHeight);
+    const float margin = static_cast<float>(kGCodeTextWindowLines / 4) * rowHeight;
+    gcodeTextTop_ = top;
+    if ((scroll < margin && gcodeTextBase_ > 0) ||
+        (scroll > static_cast<float>(window) * rowHeight - margin && gcodeTextBase_ + window < lines))
+        {
+        gcodeTextScrollTo_ = top;
+        gcodeTextScrollRest_ = std::fmod(scroll, rowHeight);
+        }
+    ImGui::EndChild();
+    ImGui::End();
+
+    // Locate the line to highlight only when it changes; that parses part of a layer.
+    const size_t target = hovered != kNoLine ? hovered : gcodeTextSelected_;
+    if (target != gcodeTextLocated_)
+        {
+        gcodeTextLocated_ = target;
+        gcodeTextLocationValid_ = target != kNoLine && gcodeText_->Locate(target, gcodeTextLocation_);
+        }
+}
+
+// The bounds of a progressively loaded model grow as layers arrive, so this is
+// re-applied every time PumpUploads adds layers.
+void UIManager::centerGCodeOnBed()
+{
+    if (!renderer_ || !gcodeModel_)
+        return;
+    glm::vec3 c = gcodeModel_->GetCenter();
+    glm::vec3 offset(renderer_->GetBedHalfWidth() + renderer_->GetPlatformOffset().x - c.x,
+                     renderer_->GetBedHalfDepth() + renderer_->GetPlatformOffset().z - c.y,
+                     0.f);
+    renderer_->SetGCodeOffset(offset);
+}
+
 void UIManager::loadModelSettings()
 {
     try
@@ -852,6 +1281,46 @@ void UIManager::saveModelSettings()
         }
 }
 
+// Find the toolpath segment under the mouse, as far as it is drawn, and show
+// where it came from and how it was printed in a tooltip.
+void UIManager::pickGCode(const ImVec2 &viewportPos, const ImVec2 &viewportSize)
+{
+    gcodePickValid_ = false;
+    if (!renderer_ || !gcodeModel_ || ImGuizmo::IsOver() || ImGuizmo::IsUsing() ||
+        ImGui::IsMouseDown(ImGuiMouseButton_Right) || ImGui::IsMouseDown(ImGuiMouseButton_Middle))
+        return;
+    const ImVec2 mouse = ImGui::GetMousePos();
+    const glm::vec2 ndc((2.0f * (mouse.x - viewportPos.x)) / viewportSize.x - 1.0f,
+                        1.0f - (2.0f * (mouse.y - viewportPos.y)) / viewportSize.y);
+    const bool partial = currentGCodeLayer_ >= 0 && currentGCodeMove_ >= 0;
+    const GCodeModel::PlaybackPosition upTo{currentGCodeLayer_,
+                                            partial ? static_cast<uint32_t>(currentGCodeMove_) : UINT32_MAX};
+    GCodeModel::PickResult pick;
+    if (!renderer_->PickGCode(ndc, kGCodePickPixels, upTo, pick))
+        return;
+    // Finding the line parses the segment's layer the first time; do it only
+    // when the segment changes, or until the text is indexed.
+    if (gcodePickLine_ == kNoLine || pick.layer != gcodePick_.layer || pick.move != gcodePick_.move)
+        {
+        size_t line = kNoLine;
+        gcodePickLine_ = gcodeText_ && gcodeText_->LineOfMove(pick.layer, pick.move, line) ? line : kNoLine;
+        }
+    gcodePick_ = pick;
+    gcodePickValid_ = true;
+
+    ImGui::BeginTooltip();
+    if (gcodePickLine_ != kNoLine)
+        {
+        const std::string_view text = gcodeText_->Line(gcodePickLine_);
+        ImGui::Text("Line %zu: %.*s", gcodePickLine_ + 1, static_cast<int>(text.size()), text.data());
+        }
+    ImGui::Text("%s, layer %d", GCodeFeatureName(pick.feature), pick.layer);
+    ImGui::Text("Feedrate %.0f mm/s", pick.speed);
+    if (!IsTravel(pick.feature))
+        ImGui::Text("Extruded %.3f mm^3 (%.4f mm of filament)", pick.volume, pick.filament);
+    ImGui::EndTooltip();
+}
+
 void UIManager::handleViewportInput
 (
     glm::mat4 &viewMatrix,
@@ -859,10 +1328,18 @@ void UIManager::handleViewportInput
     const ImVec2 &viewportSize
 )
 {
+    pickGCode(viewportPos, viewportSize);
     if (ImGui::IsMouseClicked(ImGuiMouseButton_Left) &&
         !ImGuizmo::IsOver() && !ImGuizmo::IsUsing())
         {
         getActiveModel(viewMatrix, viewportPos, viewportSize);
+        // Clicking a toolpath segment shows its line in the text panel.
+        if (gcodePickValid_ && gcodePickLine_ != kNoLine)
+            {
+            gcodeTextSelected_ = gcodePickLine_;
+            gcodeTextScrollTo_ = gcodePickLine_;
+            gcodeTextScrollRest_ = 0.0f;
+            }
         }
 
     auto rotateCamera = [&](ImGuiMouseButton btn)